@@ -0,0 +1,223 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <common/ring.h>
+
+#include "compressed-image-cache.h"
+
+#define COMPRESSED_IMAGE_CACHE_HASH_SIZE 1024
+
+struct CompressedImage {
+    gint refs;
+    RingItem lru_link;
+    CompressedImage *next;
+    CompressedImageKey key;
+
+    /* descriptor.type and u of the compressed image */
+    SpiceImage dest;
+    RedCompressBuf *comp_buf;
+    uint32_t comp_buf_size;
+    gboolean is_lossy;
+};
+
+struct CompressedImageCache {
+    CompressedImage *hash_table[COMPRESSED_IMAGE_CACHE_HASH_SIZE];
+    /* most recently used first */
+    Ring lru;
+    uint64_t bytes;
+    uint64_t max_bytes;
+
+    RedsState *reds;
+    RedStatCounter hits_counter;
+    RedStatCounter misses_counter;
+    RedStatCounter evictions_counter;
+    RedStatCounter bytes_counter;
+};
+
+static uint32_t compressed_image_key_hash(const CompressedImageKey *key)
+{
+    return (key->id ^ (key->id >> 32) ^ key->compression ^ key->jpeg_quality) %
+           COMPRESSED_IMAGE_CACHE_HASH_SIZE;
+}
+
+static bool compressed_image_key_equal(const CompressedImageKey *a, const CompressedImageKey *b)
+{
+    return a->id == b->id && a->compression == b->compression &&
+           a->jpeg == b->jpeg && a->jpeg_quality == b->jpeg_quality &&
+           a->format == b->format && a->x == b->x && a->y == b->y;
+}
+
+CompressedImage *compressed_image_ref(CompressedImage *image)
+{
+    g_atomic_int_inc(&image->refs);
+    return image;
+}
+
+void compressed_image_unref(CompressedImage *image)
+{
+    RedCompressBuf *buf, *next;
+
+    if (!g_atomic_int_dec_and_test(&image->refs)) {
+        return;
+    }
+    for (buf = image->comp_buf; buf != NULL; buf = next) {
+        next = buf->send_next;
+        compress_buf_free(buf);
+    }
+    g_free(image);
+}
+
+CompressedImageCache *compressed_image_cache_new(RedsState *reds, const RedStatNode *stat,
+                                                 uint64_t max_bytes)
+{
+    CompressedImageCache *cache = g_new0(CompressedImageCache, 1);
+
+    ring_init(&cache->lru);
+    cache->max_bytes = max_bytes;
+    cache->reds = reds;
+    stat_init_counter(&cache->hits_counter, reds, stat, "shared_image_hits", TRUE);
+    stat_init_counter(&cache->misses_counter, reds, stat, "shared_image_misses", TRUE);
+    stat_init_counter(&cache->evictions_counter, reds, stat, "shared_image_evictions", TRUE);
+    stat_init_counter(&cache->bytes_counter, reds, stat, "shared_image_bytes", TRUE);
+    return cache;
+}
+
+static void compressed_image_cache_remove(CompressedImageCache *cache, CompressedImage *image)
+{
+    CompressedImage **now;
+
+    now = &cache->hash_table[compressed_image_key_hash(&image->key)];
+    for (;;) {
+        spice_assert(*now);
+        if (*now == image) {
+            *now = image->next;
+            break;
+        }
+        now = &(*now)->next;
+    }
+    ring_remove(&image->lru_link);
+    cache->bytes -= image->comp_buf_size;
+    /* the messages being sent may still use it */
+    compressed_image_unref(image);
+}
+
+void compressed_image_cache_reset(CompressedImageCache *cache)
+{
+    RingItem *item;
+
+    while ((item = ring_get_head(&cache->lru))) {
+        compressed_image_cache_remove(cache, SPICE_CONTAINEROF(item, CompressedImage, lru_link));
+    }
+    stat_set_counter(cache->bytes_counter, 0);
+}
+
+void compressed_image_cache_free(CompressedImageCache *cache)
+{
+    if (!cache) {
+        return;
+    }
+    compressed_image_cache_reset(cache);
+    stat_remove_counter(cache->reds, &cache->hits_counter);
+    stat_remove_counter(cache->reds, &cache->misses_counter);
+    stat_remove_counter(cache->reds, &cache->evictions_counter);
+    stat_remove_counter(cache->reds, &cache->bytes_counter);
+    g_free(cache);
+}
+
+bool compressed_image_cache_lookup(CompressedImageCache *cache, const CompressedImageKey *key,
+                                   SpiceImage *dest, const SpiceBitmap *src,
+                                   compress_send_data_t *o_comp_data)
+{
+    CompressedImage *image = cache->hash_table[compressed_image_key_hash(key)];
+
+    while (image && !compressed_image_key_equal(&image->key, key)) {
+        image = image->next;
+    }
+    if (!image) {
+        stat_inc_counter(cache->misses_counter, 1);
+        return FALSE;
+    }
+    stat_inc_counter(cache->hits_counter, 1);
+    ring_remove(&image->lru_link);
+    ring_add(&cache->lru, &image->lru_link);
+
+    dest->descriptor.type = image->dest.descriptor.type;
+    dest->u = image->dest.u;
+    memset(o_comp_data, 0, sizeof(*o_comp_data));
+    o_comp_data->comp_buf = image->comp_buf;
+    o_comp_data->comp_buf_size = image->comp_buf_size;
+    o_comp_data->is_lossy = image->is_lossy;
+    o_comp_data->shared_image = compressed_image_ref(image);
+    if (dest->descriptor.type == SPICE_IMAGE_TYPE_LZ_PLT) {
+        dest->u.lz_plt.palette = src->palette;
+        o_comp_data->lzplt_palette = src->palette;
+    }
+    return TRUE;
+}
+
+void compressed_image_cache_add(CompressedImageCache *cache, const CompressedImageKey *key,
+                                const SpiceImage *dest, compress_send_data_t *comp_data)
+{
+    CompressedImage *image;
+    uint32_t hash;
+
+    spice_return_if_fail(comp_data->shared_image == NULL);
+
+    /* another client may have compressed the same image meanwhile, the new
+     * entry replaces the old one so that its size is only counted once */
+    hash = compressed_image_key_hash(key);
+    for (image = cache->hash_table[hash]; image; image = image->next) {
+        if (compressed_image_key_equal(&image->key, key)) {
+            compressed_image_cache_remove(cache, image);
+            break;
+        }
+    }
+
+    image = g_new0(CompressedImage, 1);
+    /* one for the cache, one for the caller */
+    image->refs = 2;
+    image->key = *key;
+    image->dest.descriptor.type = dest->descriptor.type;
+    image->dest.u = dest->u;
+    if (dest->descriptor.type == SPICE_IMAGE_TYPE_LZ_PLT) {
+        /* the palette belongs to the drawable and the cache flags to the client */
+        image->dest.u.lz_plt.palette = NULL;
+        image->dest.u.lz_plt.flags &= SPICE_BITMAP_FLAGS_TOP_DOWN;
+    }
+    image->comp_buf = comp_data->comp_buf;
+    image->comp_buf_size = comp_data->comp_buf_size;
+    image->is_lossy = comp_data->is_lossy;
+    comp_data->shared_image = image;
+
+    image->next = cache->hash_table[hash];
+    cache->hash_table[hash] = image;
+    ring_item_init(&image->lru_link);
+    ring_add(&cache->lru, &image->lru_link);
+    cache->bytes += image->comp_buf_size;
+
+    while (cache->bytes > cache->max_bytes) {
+        CompressedImage *tail = SPICE_CONTAINEROF(ring_get_tail(&cache->lru),
+                                                  CompressedImage, lru_link);
+        compressed_image_cache_remove(cache, tail);
+        stat_inc_counter(cache->evictions_counter, 1);
+    }
+    stat_set_counter(cache->bytes_counter, cache->bytes);
+}
@@ -0,0 +1,80 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COMPRESSED_IMAGE_CACHE_H_
+#define COMPRESSED_IMAGE_CACHE_H_
+
+#include "image-encoders.h"
+#include "stat.h"
+
+/*
+ * Images compressed for a client of a display channel, kept so that the
+ * other clients asking for the same image with the same parameters send
+ * the same data rather than compressing the image again.
+ *
+ * The compressed buffers are shared: a CompressedImage is refcounted and
+ * each message carrying it holds a reference until it's sent. The least
+ * recently used images are dropped from the cache when the total size of
+ * their buffers goes over the budget.
+ *
+ * Only the images the guest asked to cache (SPICE_IMAGE_FLAGS_CACHE_ME) can
+ * be shared, as their id is the identity of their content. GLZ depends on
+ * the dictionary of each client so it's never shared.
+ */
+typedef struct CompressedImageCache CompressedImageCache;
+typedef struct CompressedImage CompressedImage;
+
+typedef struct CompressedImageKey {
+    uint64_t id;
+    SpiceImageCompression compression;
+    bool jpeg;
+    /* 0 if not jpeg */
+    int jpeg_quality;
+    uint8_t format;
+    uint32_t x;
+    uint32_t y;
+} CompressedImageKey;
+
+CompressedImageCache *compressed_image_cache_new(RedsState *reds, const RedStatNode *stat,
+                                                 uint64_t max_bytes);
+void compressed_image_cache_free(CompressedImageCache *cache);
+void compressed_image_cache_reset(CompressedImageCache *cache);
+
+/*
+ * compressed_image_cache_lookup
+ * On a hit, fills @dest and @o_comp_data as the image_encoders_compress_*()
+ * functions do, @o_comp_data->shared_image holding a reference to the
+ * buffers. The palette of LZ_PLT images is taken from @src.
+ *
+ * Returns: whether the image was found
+ */
+bool compressed_image_cache_lookup(CompressedImageCache *cache, const CompressedImageKey *key,
+                                   SpiceImage *dest, const SpiceBitmap *src,
+                                   compress_send_data_t *o_comp_data);
+/*
+ * compressed_image_cache_add
+ * Adds the result of a compression, the buffers of @comp_data are given to
+ * the cache and @comp_data->shared_image is set to a reference to them.
+ */
+void compressed_image_cache_add(CompressedImageCache *cache, const CompressedImageKey *key,
+                                const SpiceImage *dest, compress_send_data_t *comp_data);
+
+CompressedImage *compressed_image_ref(CompressedImage *image);
+void compressed_image_unref(CompressedImage *image);
+
+#endif /* COMPRESSED_IMAGE_CACHE_H_ */
@@ -48,10 +48,24 @@ struct CursorChannelClientPrivate
     uint32_t cursor_cache_items;
 };
 
+/* The cursor updates depend on each other and on the cache messages, none
+ * of them can be overtaken. They are still put in their own lane so their
+ * latency shows in the pipe statistics. */
+static RedPipeLane
+cursor_channel_client_pipe_item_lane(RedChannelClient *rcc, RedPipeItem *item)
+{
+    return item->type == RED_PIPE_ITEM_TYPE_CURSOR ?
+        RED_PIPE_LANE_INTERACTIVE : RED_PIPE_LANE_DEFAULT;
+}
+
 static void
 cursor_channel_client_class_init(CursorChannelClientClass *klass)
 {
+    RedChannelClientClass *client_class = RED_CHANNEL_CLIENT_CLASS(klass);
+
     g_type_class_add_private(klass, sizeof(CursorChannelClientPrivate));
+
+    client_class->pipe_item_lane = cursor_channel_client_pipe_item_lane;
 }
 
 static void
@@ -301,6 +301,7 @@ CursorChannel* cursor_channel_new(RedsState *server, QXLInstance *qxl,
                         "migration-flags", 0,
                         "qxl", qxl,
                         "handle-acks", TRUE,
+                        "batch-send", TRUE,
                         NULL);
 }
 
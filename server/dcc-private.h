@@ -24,6 +24,7 @@
 #include "image-encoders.h"
 #include "stream.h"
 #include "red-channel-client.h"
+#include "lossy-areas.h"
 
 typedef struct DisplayChannelClientPrivate DisplayChannelClientPrivate;
 struct DisplayChannelClientPrivate
@@ -40,6 +41,9 @@ struct DisplayChannelClientPrivate
     PixmapCache *pixmap_cache;
     uint32_t pixmap_cache_generation;
     int pending_pixmaps_sync;
+    /* shard locked with dcc_pixmap_cache_lock() and since when */
+    PixmapCacheShard *pixmap_cache_locked_shard;
+    red_time_t pixmap_cache_lock_time;
 
     RedCacheItem *palette_cache[PALETTE_CACHE_HASH_SIZE];
     Ring palette_cache_lru;
@@ -50,6 +54,8 @@ struct DisplayChannelClientPrivate
         FreeList free_list;
         uint64_t pixmap_cache_items[MAX_DRAWABLE_PIXMAP_CACHE_ITEMS];
         int num_pixmap_cache_items;
+        /* job of the item being sent, used by dcc_compress_image() */
+        ImageEncoderJob *compress_job;
     } send_data;
 
     /* Host preferred video-codec order sorted with client preferred */
@@ -58,8 +64,27 @@ struct DisplayChannelClientPrivate
      * preference order (index) as value */
     GArray *client_preferred_video_codecs;
 
+    /* when the JPEG quality was last adjusted, see dcc_update_jpeg_quality() */
+    red_time_t jpeg_quality_time;
+    /* decaying sums of the sizes of the images sent, before and after
+     * compression, see dcc_note_compression_ratio() */
+    uint64_t image_bytes;
+    uint64_t compressed_image_bytes;
+
     uint8_t surface_client_created[NUM_SURFACES];
     QRegion surface_client_lossy_region[NUM_SURFACES];
+    /* the areas to refine first, see dcc_refine_lossy() */
+    LossyAreas lossy_areas;
+    /* the bytes the refinement can still send, when it was refilled and
+     * the bytes sent to the client then */
+    int64_t lossy_refine_budget;
+    red_time_t lossy_refine_time;
+    uint64_t lossy_refine_sent_bytes;
+
+    /* set while the client is too far behind to get every drawable,
+     * surface_lagging_region holds the areas to send again as images */
+    bool lagging;
+    QRegion surface_lagging_region[NUM_SURFACES];
 
     StreamAgent stream_agents[NUM_STREAMS];
     uint32_t streams_max_latency;
@@ -55,12 +55,12 @@ static int dcc_pixmap_cache_unlocked_hit(DisplayChannelClient *dcc, uint64_t id,
     uint64_t serial;
 
     serial = red_channel_client_get_message_serial(RED_CHANNEL_CLIENT(dcc));
-    item = cache->hash_table[BITS_CACHE_HASH_KEY(id)];
+    item = pixmap_cache_get_shard(cache, id)->hash_table[BITS_CACHE_HASH_KEY(id)];
 
     while (item) {
         if (item->id == id) {
             ring_remove(&item->lru_link);
-            ring_add(&cache->lru, &item->lru_link);
+            ring_add(&pixmap_cache_get_shard(cache, id)->lru, &item->lru_link);
             spice_assert(dcc->priv->id < MAX_CACHE_CLIENTS);
             item->sync[dcc->priv->id] = serial;
             cache->sync[dcc->priv->id] = serial;
@@ -76,11 +76,10 @@ static int dcc_pixmap_cache_unlocked_hit(DisplayChannelClient *dcc, uint64_t id,
 static int dcc_pixmap_cache_hit(DisplayChannelClient *dcc, uint64_t id, int *lossy)
 {
     int hit;
-    PixmapCache *cache = dcc->priv->pixmap_cache;
 
-    pthread_mutex_lock(&cache->lock);
+    dcc_pixmap_cache_lock(dcc, id);
     hit = dcc_pixmap_cache_unlocked_hit(dcc, id, lossy);
-    pthread_mutex_unlock(&cache->lock);
+    dcc_pixmap_cache_unlock(dcc);
     return hit;
 }
 
@@ -182,7 +181,7 @@ static GList *dcc_get_tail(DisplayChannelClient *dcc)
 
 static void red_display_add_image_to_pixmap_cache(RedChannelClient *rcc,
                                                   SpiceImage *image, SpiceImage *io_image,
-                                                  int is_lossy)
+                                                  const PixmapContent *content, int is_lossy)
 {
     DisplayChannel *display_channel G_GNUC_UNUSED =
         DISPLAY_CHANNEL(red_channel_client_get_channel(rcc));
@@ -191,7 +190,7 @@ static void red_display_add_image_to_pixmap_cache(RedChannelClient *rcc,
     if ((image->descriptor.flags & SPICE_IMAGE_FLAGS_CACHE_ME)) {
         spice_assert(image->descriptor.width * image->descriptor.height > 0);
         if (!(io_image->descriptor.flags & SPICE_IMAGE_FLAGS_CACHE_REPLACE_ME)) {
-            if (dcc_pixmap_cache_unlocked_add(dcc, image->descriptor.id,
+            if (dcc_pixmap_cache_unlocked_add(dcc, image->descriptor.id, content,
                                               image->descriptor.width * image->descriptor.height,
                                               is_lossy)) {
                 io_image->descriptor.flags |= SPICE_IMAGE_FLAGS_CACHE_ME;
@@ -328,19 +327,35 @@ static void marshaller_compress_buf_free(uint8_t *data, void *opaque)
     compress_buf_free(opaque);
 }
 
-static void marshaller_add_compressed(SpiceMarshaller *m,
-                                      RedCompressBuf *comp_buf, size_t size)
+static void marshaller_unref_shared_image(uint8_t *data, void *opaque)
+{
+    compressed_image_unref(opaque);
+}
+
+static void marshaller_add_compressed(SpiceMarshaller *m, compress_send_data_t *comp_data)
 {
-    size_t max = size;
+    RedCompressBuf *comp_buf = comp_data->comp_buf;
+    CompressedImage *shared_image = comp_data->shared_image;
+    size_t max = comp_data->comp_buf_size;
     size_t now;
     do {
         spice_return_if_fail(comp_buf);
         now = MIN(sizeof(comp_buf->buf), max);
         max -= now;
-        spice_marshaller_add_by_ref_full(m, comp_buf->buf.bytes, now,
-                                         marshaller_compress_buf_free, comp_buf);
+        if (shared_image) {
+            /* the buffers may be sent to other clients too */
+            spice_marshaller_add_by_ref_full(m, comp_buf->buf.bytes, now,
+                                             marshaller_unref_shared_image,
+                                             compressed_image_ref(shared_image));
+        } else {
+            spice_marshaller_add_by_ref_full(m, comp_buf->buf.bytes, now,
+                                             marshaller_compress_buf_free, comp_buf);
+        }
         comp_buf = comp_buf->send_next;
     } while (max);
+    if (shared_image) {
+        compressed_image_unref(shared_image);
+    }
 }
 
 static void marshaller_unref_drawable(uint8_t *data, void *opaque)
@@ -349,6 +364,80 @@ static void marshaller_unref_drawable(uint8_t *data, void *opaque)
     drawable_unref(drawable);
 }
 
+/*
+ * Looks for a cached pixmap with the given content and marks it as used by
+ * the client, the shard locked by the caller first, then the shards not
+ * locked by another thread.
+ */
+static bool dcc_pixmap_cache_unlocked_hit_content(DisplayChannelClient *dcc,
+                                                  const PixmapContent *content,
+                                                  int can_lossy, uint64_t *id, int *lossy)
+{
+    PixmapCache *cache = dcc->priv->pixmap_cache;
+    PixmapCacheShard *locked_shard = dcc->priv->pixmap_cache_locked_shard;
+    NewCacheItem *item;
+    uint32_t i;
+
+    item = pixmap_cache_unlocked_find_content(locked_shard, content);
+    if (item && (!item->lossy || can_lossy)) {
+        *id = item->id;
+        return dcc_pixmap_cache_unlocked_hit(dcc, item->id, lossy);
+    }
+    for (i = 0; i < cache->n_shards; i++) {
+        PixmapCacheShard *shard = &cache->shards[i];
+        bool hit = FALSE;
+
+        if (shard == locked_shard || pthread_mutex_trylock(&shard->lock) != 0) {
+            continue;
+        }
+        item = pixmap_cache_unlocked_find_content(shard, content);
+        if (item && (!item->lossy || can_lossy)) {
+            *id = item->id;
+            hit = dcc_pixmap_cache_unlocked_hit(dcc, item->id, lossy);
+        }
+        pthread_mutex_unlock(&shard->lock);
+        if (hit) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * Sends a reference to a cached pixmap with the same content as @simage, the
+ * guest giving different ids, or none, to the same image drawn again.
+ * Must be called with the pixmap cache locked.
+ */
+static bool marshall_image_from_content_cache(DisplayChannelClient *dcc, SpiceMarshaller *m,
+                                              SpiceImage *simage, SpiceImage *image,
+                                              const PixmapContent *content, int can_lossy,
+                                              int *lossy)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    SpiceMarshaller *bitmap_palette_out, *lzplt_palette_out;
+    uint64_t id;
+
+    if (!dcc_pixmap_cache_unlocked_hit_content(dcc, content, can_lossy, &id, lossy)) {
+        return FALSE;
+    }
+    dcc->priv->send_data.pixmap_cache_items[dcc->priv->send_data.num_pixmap_cache_items++] = id;
+
+    image->descriptor.id = id;
+    if (!display->priv->enable_jpeg || *lossy) {
+        image->descriptor.type = SPICE_IMAGE_TYPE_FROM_CACHE;
+    } else {
+        image->descriptor.type = SPICE_IMAGE_TYPE_FROM_CACHE_LOSSLESS;
+    }
+    spice_marshall_Image(m, image,
+                         &bitmap_palette_out, &lzplt_palette_out);
+    spice_assert(bitmap_palette_out == NULL);
+    spice_assert(lzplt_palette_out == NULL);
+    stat_inc_counter(display->priv->pixmap_dedup_hits_counter, 1);
+    stat_inc_counter(display->priv->pixmap_dedup_bytes_saved_counter,
+                     (uint64_t)simage->u.bitmap.stride * simage->u.bitmap.y);
+    return TRUE;
+}
+
 /* if the number of times fill_bits can be called per one qxl_drawable increases -
    MAX_LZ_DRAWABLE_INSTANCES must be increased as well */
 /* NOTE: 'simage' should be owned by the drawable. The drawable will be kept
@@ -373,7 +462,7 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
     if (simage->descriptor.flags & SPICE_IMAGE_FLAGS_HIGH_BITS_SET) {
         image.descriptor.flags = SPICE_IMAGE_FLAGS_HIGH_BITS_SET;
     }
-    pthread_mutex_lock(&dcc->priv->pixmap_cache->lock);
+    dcc_pixmap_cache_lock(dcc, image.descriptor.id);
 
     if ((simage->descriptor.flags & SPICE_IMAGE_FLAGS_CACHE_ME)) {
         int lossy_cache_item;
@@ -394,7 +483,7 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
                 spice_assert(bitmap_palette_out == NULL);
                 spice_assert(lzplt_palette_out == NULL);
                 stat_inc_counter(display->priv->cache_hits_counter, 1);
-                pthread_mutex_unlock(&dcc->priv->pixmap_cache->lock);
+                dcc_pixmap_cache_unlock(dcc);
                 return FILL_BITS_TYPE_CACHE;
             } else {
                 pixmap_cache_unlocked_set_lossy(dcc->priv->pixmap_cache, simage->descriptor.id,
@@ -412,7 +501,7 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
         surface_id = simage->u.surface.surface_id;
         if (!display_channel_validate_surface(display, surface_id)) {
             spice_warning("Invalid surface in SPICE_IMAGE_TYPE_SURFACE");
-            pthread_mutex_unlock(&dcc->priv->pixmap_cache->lock);
+            dcc_pixmap_cache_unlock(dcc);
             return FILL_BITS_TYPE_SURFACE;
         }
 
@@ -427,23 +516,46 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
                              &bitmap_palette_out, &lzplt_palette_out);
         spice_assert(bitmap_palette_out == NULL);
         spice_assert(lzplt_palette_out == NULL);
-        pthread_mutex_unlock(&dcc->priv->pixmap_cache->lock);
+        dcc_pixmap_cache_unlock(dcc);
         return FILL_BITS_TYPE_SURFACE;
     }
     case SPICE_IMAGE_TYPE_BITMAP: {
         SpiceBitmap *bitmap = &image.u.bitmap;
+        PixmapContent content = { 0, };
+        int lossy_cache_item;
 #ifdef DUMP_BITMAP
         dump_bitmap(&simage->u.bitmap);
 #endif
+        if (display->priv->pixmap_dedup &&
+            !(image.descriptor.flags & SPICE_IMAGE_FLAGS_CACHE_REPLACE_ME)) {
+            red_time_t start = spice_get_monotonic_time_ns();
+
+            content.hash = bitmap_hash(&simage->u.bitmap);
+            content.width = simage->u.bitmap.x;
+            content.height = simage->u.bitmap.y;
+            content.stride = simage->u.bitmap.stride;
+            content.format = simage->u.bitmap.format;
+            content.flags = simage->u.bitmap.flags & SPICE_BITMAP_FLAGS_TOP_DOWN;
+            stat_inc_counter(display->priv->pixmap_dedup_hashed_counter, 1);
+            stat_inc_counter(display->priv->pixmap_dedup_hash_time_counter,
+                             spice_get_monotonic_time_ns() - start);
+            if (marshall_image_from_content_cache(dcc, m, simage, &image, &content,
+                                                  can_lossy, &lossy_cache_item)) {
+                dcc_pixmap_cache_unlock(dcc);
+                return (lossy_cache_item ? FILL_BITS_TYPE_COMPRESS_LOSSY :
+                                           FILL_BITS_TYPE_CACHE);
+            }
+        }
         /* Images must be added to the cache only after they are compressed
            in order to prevent starvation in the client between pixmap_cache and
            global dictionary (in cases of multiple monitors) */
         if (reds_stream_get_family(red_channel_client_get_stream(rcc)) == AF_UNIX ||
-            !dcc_compress_image(dcc, &image, &simage->u.bitmap,
-                                drawable, can_lossy, &comp_send_data)) {
+            !dcc_compress_image(dcc, &image, &simage->u.bitmap, drawable, can_lossy,
+                                simage->descriptor.flags & SPICE_IMAGE_FLAGS_CACHE_ME,
+                                &comp_send_data)) {
             SpicePalette *palette;
 
-            red_display_add_image_to_pixmap_cache(rcc, simage, &image, FALSE);
+            red_display_add_image_to_pixmap_cache(rcc, simage, &image, &content, FALSE);
 
             *bitmap = simage->u.bitmap;
             bitmap->flags = bitmap->flags & SPICE_BITMAP_FLAGS_TOP_DOWN;
@@ -466,32 +578,31 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
                                                  bitmap->data->chunk[i].len,
                                                  marshaller_unref_drawable, drawable);
             }
-            pthread_mutex_unlock(&dcc->priv->pixmap_cache->lock);
+            dcc_pixmap_cache_unlock(dcc);
             return FILL_BITS_TYPE_BITMAP;
         } else {
-            red_display_add_image_to_pixmap_cache(rcc, simage, &image,
+            red_display_add_image_to_pixmap_cache(rcc, simage, &image, &content,
                                                   comp_send_data.is_lossy);
 
             spice_marshall_Image(m, &image,
                                  &bitmap_palette_out, &lzplt_palette_out);
             spice_assert(bitmap_palette_out == NULL);
 
-            marshaller_add_compressed(m, comp_send_data.comp_buf,
-                                      comp_send_data.comp_buf_size);
+            marshaller_add_compressed(m, &comp_send_data);
 
             if (lzplt_palette_out && comp_send_data.lzplt_palette) {
                 spice_marshall_Palette(lzplt_palette_out, comp_send_data.lzplt_palette);
             }
 
             spice_assert(!comp_send_data.is_lossy || can_lossy);
-            pthread_mutex_unlock(&dcc->priv->pixmap_cache->lock);
+            dcc_pixmap_cache_unlock(dcc);
             return (comp_send_data.is_lossy ? FILL_BITS_TYPE_COMPRESS_LOSSY :
                                               FILL_BITS_TYPE_COMPRESS_LOSSLESS);
         }
         break;
     }
     case SPICE_IMAGE_TYPE_QUIC:
-        red_display_add_image_to_pixmap_cache(rcc, simage, &image, FALSE);
+        red_display_add_image_to_pixmap_cache(rcc, simage, &image, NULL, FALSE);
         image.u.quic = simage->u.quic;
         spice_marshall_Image(m, &image,
                              &bitmap_palette_out, &lzplt_palette_out);
@@ -505,12 +616,12 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
                                              image.u.quic.data->chunk[i].len,
                                              marshaller_unref_drawable, drawable);
         }
-        pthread_mutex_unlock(&dcc->priv->pixmap_cache->lock);
+        dcc_pixmap_cache_unlock(dcc);
         return FILL_BITS_TYPE_COMPRESS_LOSSLESS;
     default:
         spice_error("invalid image type %u", image.descriptor.type);
     }
-    pthread_mutex_unlock(&dcc->priv->pixmap_cache->lock);
+    dcc_pixmap_cache_unlock(dcc);
     return FILL_BITS_TYPE_INVALID;
 }
 
@@ -592,6 +703,7 @@ static void surface_lossy_region_update(DisplayChannelClient *dcc,
         region_and(&draw_region, &clip_rgn);
         if (lossy) {
             region_or(surface_lossy_region, &draw_region);
+            dcc_note_lossy_area(dcc, item->surface_id, &drawable->bbox);
         } else {
             region_exclude(surface_lossy_region, &draw_region);
         }
@@ -603,6 +715,7 @@ static void surface_lossy_region_update(DisplayChannelClient *dcc,
             region_remove(surface_lossy_region, &drawable->bbox);
         } else {
             region_add(surface_lossy_region, &drawable->bbox);
+            dcc_note_lossy_area(dcc, item->surface_id, &drawable->bbox);
         }
     }
 }
@@ -709,8 +822,11 @@ static void red_pipe_replace_rendered_drawables_with_images(DisplayChannelClient
                                                             int first_surface_id,
                                                             SpiceRect *first_area)
 {
-    int resent_surface_ids[MAX_PIPE_SIZE];
-    SpiceRect resent_areas[MAX_PIPE_SIZE]; // not pointers since drawables may be released
+    int stack_surface_ids[MAX_PIPE_SIZE];
+    SpiceRect stack_areas[MAX_PIPE_SIZE]; // not pointers since drawables may be released
+    int *resent_surface_ids = stack_surface_ids;
+    SpiceRect *resent_areas = stack_areas;
+    int max_resent = MAX_PIPE_SIZE;
     int num_resent;
     GList *l;
     GQueue *pipe;
@@ -748,6 +864,20 @@ static void red_pipe_replace_rendered_drawables_with_images(DisplayChannelClient
 
         image = dcc_add_surface_area_image(dcc, drawable->red_drawable->surface_id,
                                            &drawable->red_drawable->bbox, l, TRUE);
+        if (num_resent == max_resent) {
+            /* only the pipe of a client with a byte budget, that is when
+             * there are several clients, holds that many drawables */
+            max_resent *= 2;
+            if (resent_areas == stack_areas) {
+                resent_surface_ids = g_new(int, max_resent);
+                resent_areas = g_new(SpiceRect, max_resent);
+                memcpy(resent_surface_ids, stack_surface_ids, sizeof(stack_surface_ids));
+                memcpy(resent_areas, stack_areas, sizeof(stack_areas));
+            } else {
+                resent_surface_ids = g_renew(int, resent_surface_ids, max_resent);
+                resent_areas = g_renew(SpiceRect, resent_areas, max_resent);
+            }
+        }
         resent_surface_ids[num_resent] = drawable->red_drawable->surface_id;
         resent_areas[num_resent] = drawable->red_drawable->bbox;
         num_resent++;
@@ -756,6 +886,11 @@ static void red_pipe_replace_rendered_drawables_with_images(DisplayChannelClient
         red_channel_client_pipe_remove_and_release_pos(RED_CHANNEL_CLIENT(dcc), l);
         pipe_item = &image->base;
     }
+
+    if (resent_areas != stack_areas) {
+        g_free(resent_surface_ids);
+        g_free(resent_areas);
+    }
 }
 
 static void red_add_lossless_drawable_dependencies(RedChannelClient *rcc,
@@ -1680,6 +1815,61 @@ static void red_release_video_encoder_buffer(uint8_t *data, void *opaque)
     buffer->free(buffer);
 }
 
+static bool stream_frame_is_sized(Stream *stream, const SpiceRect *src_area,
+                                  const SpiceRect *dest)
+{
+    return (src_area->right - src_area->left != stream->width) ||
+           (src_area->bottom - src_area->top != stream->height) ||
+           !rect_is_equal(dest, &stream->dest_area);
+}
+
+/* A helper for red_marshall_stream_data() and marshall_stream_data_item() */
+static void marshall_stream_frame(RedChannelClient *rcc,
+                                  SpiceMarshaller *base_marshaller,
+                                  StreamAgent *agent, uint32_t frame_mm_time,
+                                  const SpiceRect *src_area, const SpiceRect *dest,
+                                  VideoBuffer *outbuf,
+                                  spice_marshaller_item_free_func free_data, void *opaque)
+{
+    DisplayChannelClient *dcc = DISPLAY_CHANNEL_CLIENT(rcc);
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    Stream *stream = agent->stream;
+
+    if (!stream_frame_is_sized(stream, src_area, dest)) {
+        SpiceMsgDisplayStreamData stream_data;
+
+        red_channel_client_init_send_data(rcc, SPICE_MSG_DISPLAY_STREAM_DATA);
+
+        stream_data.base.id = display_channel_get_stream_id(display, stream);
+        stream_data.base.multi_media_time = frame_mm_time;
+        stream_data.data_size = outbuf->size;
+
+        spice_marshall_msg_display_stream_data(base_marshaller, &stream_data);
+    } else {
+        SpiceMsgDisplayStreamDataSized stream_data;
+
+        red_channel_client_init_send_data(rcc, SPICE_MSG_DISPLAY_STREAM_DATA_SIZED);
+
+        stream_data.base.id = display_channel_get_stream_id(display, stream);
+        stream_data.base.multi_media_time = frame_mm_time;
+        stream_data.data_size = outbuf->size;
+        stream_data.width = src_area->right - src_area->left;
+        stream_data.height = src_area->bottom - src_area->top;
+        stream_data.dest = *dest;
+
+        spice_debug("stream %d: sized frame: dest ==> ", stream_data.base.id);
+        rect_debug(&stream_data.dest);
+        spice_marshall_msg_display_stream_data_sized(base_marshaller, &stream_data);
+    }
+    spice_marshaller_add_by_ref_full(base_marshaller, outbuf->data, outbuf->size,
+                                     free_data, opaque);
+#ifdef STREAM_STATS
+    agent->stats.num_frames_sent++;
+    agent->stats.size_sent += outbuf->size;
+    agent->stats.end = frame_mm_time;
+#endif
+}
+
 static bool red_marshall_stream_data(RedChannelClient *rcc,
                                      SpiceMarshaller *base_marshaller,
                                      Drawable *drawable)
@@ -1689,7 +1879,6 @@ static bool red_marshall_stream_data(RedChannelClient *rcc,
     Stream *stream = drawable->stream;
     SpiceCopy *copy;
     uint32_t frame_mm_time;
-    int is_sized;
     int ret;
 
     spice_assert(drawable->red_drawable->type == QXL_DRAW_COPY);
@@ -1699,11 +1888,7 @@ static bool red_marshall_stream_data(RedChannelClient *rcc,
         return FALSE;
     }
 
-    is_sized = (copy->src_area.right - copy->src_area.left != stream->width) ||
-               (copy->src_area.bottom - copy->src_area.top != stream->height) ||
-               !rect_is_equal(&drawable->red_drawable->bbox, &stream->dest_area);
-
-    if (is_sized &&
+    if (stream_frame_is_sized(stream, &copy->src_area, &drawable->red_drawable->bbox) &&
         !red_channel_client_test_remote_cap(rcc, SPICE_DISPLAY_CAP_SIZED_STREAM)) {
         return FALSE;
     }
@@ -1729,6 +1914,9 @@ static bool red_marshall_stream_data(RedChannelClient *rcc,
         return TRUE;
     case VIDEO_ENCODER_FRAME_UNSUPPORTED:
         return FALSE;
+    case VIDEO_ENCODER_FRAME_ENCODE_PENDING:
+        /* sent by marshall_stream_data_item() once compressed */
+        return TRUE;
     case VIDEO_ENCODER_FRAME_ENCODE_DONE:
         break;
     default:
@@ -1736,43 +1924,22 @@ static bool red_marshall_stream_data(RedChannelClient *rcc,
         return FALSE;
     }
 
-    if (!is_sized) {
-        SpiceMsgDisplayStreamData stream_data;
-
-        red_channel_client_init_send_data(rcc, SPICE_MSG_DISPLAY_STREAM_DATA);
-
-        stream_data.base.id = display_channel_get_stream_id(display, stream);
-        stream_data.base.multi_media_time = frame_mm_time;
-        stream_data.data_size = outbuf->size;
-
-        spice_marshall_msg_display_stream_data(base_marshaller, &stream_data);
-    } else {
-        SpiceMsgDisplayStreamDataSized stream_data;
-
-        red_channel_client_init_send_data(rcc, SPICE_MSG_DISPLAY_STREAM_DATA_SIZED);
-
-        stream_data.base.id = display_channel_get_stream_id(display, stream);
-        stream_data.base.multi_media_time = frame_mm_time;
-        stream_data.data_size = outbuf->size;
-        stream_data.width = copy->src_area.right - copy->src_area.left;
-        stream_data.height = copy->src_area.bottom - copy->src_area.top;
-        stream_data.dest = drawable->red_drawable->bbox;
-
-        spice_debug("stream %d: sized frame: dest ==> ", stream_data.base.id);
-        rect_debug(&stream_data.dest);
-        spice_marshall_msg_display_stream_data_sized(base_marshaller, &stream_data);
-    }
-    spice_marshaller_add_by_ref_full(base_marshaller, outbuf->data, outbuf->size,
-                                     &red_release_video_encoder_buffer, outbuf);
-#ifdef STREAM_STATS
-    agent->stats.num_frames_sent++;
-    agent->stats.size_sent += outbuf->size;
-    agent->stats.end = frame_mm_time;
-#endif
-
+    marshall_stream_frame(rcc, base_marshaller, agent, frame_mm_time,
+                          &copy->src_area, &drawable->red_drawable->bbox, outbuf,
+                          &red_release_video_encoder_buffer, outbuf);
     return TRUE;
 }
 
+static void marshall_stream_data_item(RedChannelClient *rcc,
+                                      SpiceMarshaller *base_marshaller,
+                                      StreamDataItem *item)
+{
+    red_pipe_item_ref(&item->base);
+    marshall_stream_frame(rcc, base_marshaller, item->agent, item->frame_mm_time,
+                          &item->src_area, &item->dest, item->buffer,
+                          marshaller_unref_pipe_item, item);
+}
+
 static inline void marshall_inval_palette(RedChannelClient *rcc,
                                           SpiceMarshaller *base_marshaller,
                                           RedCacheItem *cache_item)
@@ -1863,7 +2030,7 @@ static void display_channel_marshall_pixmap_sync(RedChannelClient *rcc,
     red_channel_client_init_send_data(rcc, SPICE_MSG_WAIT_FOR_CHANNELS);
     pixmap_cache = dcc->priv->pixmap_cache;
 
-    pthread_mutex_lock(&pixmap_cache->lock);
+    pixmap_cache_lock_all(pixmap_cache);
 
     wait.wait_count = 1;
     wait.wait_list[0].channel_type = SPICE_CHANNEL_DISPLAY;
@@ -1872,7 +2039,7 @@ static void display_channel_marshall_pixmap_sync(RedChannelClient *rcc,
     dcc->priv->pixmap_cache_generation = pixmap_cache->generation;
     dcc->priv->pending_pixmaps_sync = FALSE;
 
-    pthread_mutex_unlock(&pixmap_cache->lock);
+    pixmap_cache_unlock_all(pixmap_cache);
 
     spice_marshall_msg_wait_for_channels(base_marshaller, &wait);
 }
@@ -1885,7 +2052,7 @@ static void dcc_pixmap_cache_reset(DisplayChannelClient *dcc, SpiceMsgWaitForCha
     uint32_t i;
 
     serial = red_channel_client_get_message_serial(RED_CHANNEL_CLIENT(dcc));
-    pthread_mutex_lock(&cache->lock);
+    pixmap_cache_lock_all(cache);
     pixmap_cache_clear(cache);
 
     dcc->priv->pixmap_cache_generation = ++cache->generation;
@@ -1902,7 +2069,7 @@ static void dcc_pixmap_cache_reset(DisplayChannelClient *dcc, SpiceMsgWaitForCha
         }
     }
     sync_data->wait_count = wait_count;
-    pthread_mutex_unlock(&cache->lock);
+    pixmap_cache_unlock_all(cache);
 }
 
 static void display_channel_marshall_reset_cache(RedChannelClient *rcc,
@@ -1980,15 +2147,15 @@ static void red_marshall_image(RedChannelClient *rcc,
 
     compress_send_data_t comp_send_data = {0};
 
-    int comp_succeeded = dcc_compress_image(dcc, &red_image, &bitmap, NULL, item->can_lossy, &comp_send_data);
+    int comp_succeeded = dcc_compress_image(dcc, &red_image, &bitmap, NULL, item->can_lossy,
+                                            FALSE, &comp_send_data);
 
     surface_lossy_region = &dcc->priv->surface_client_lossy_region[item->surface_id];
     if (comp_succeeded) {
         spice_marshall_Image(src_bitmap_out, &red_image,
                              &bitmap_palette_out, &lzplt_palette_out);
 
-        marshaller_add_compressed(src_bitmap_out,
-                                  comp_send_data.comp_buf, comp_send_data.comp_buf_size);
+        marshaller_add_compressed(src_bitmap_out, &comp_send_data);
 
         if (lzplt_palette_out && comp_send_data.lzplt_palette) {
             spice_marshall_Palette(lzplt_palette_out, comp_send_data.lzplt_palette);
@@ -1996,6 +2163,7 @@ static void red_marshall_image(RedChannelClient *rcc,
 
         if (spice_image_descriptor_is_lossy(&red_image.descriptor)) {
             region_add(surface_lossy_region, &copy.base.box);
+            dcc_note_lossy_area(dcc, item->surface_id, &copy.base.box);
         } else {
             region_remove(surface_lossy_region, &copy.base.box);
         }
@@ -2173,6 +2341,8 @@ static void marshall_stream_start(RedChannelClient *rcc,
     if (stream->current) {
         RedDrawable *red_drawable = stream->current->red_drawable;
         stream_create.clip = red_drawable->clip;
+    } else if (stream->surface) {
+        stream_create.clip.type = SPICE_CLIP_TYPE_NONE;
     } else {
         stream_create.clip.type = SPICE_CLIP_TYPE_RECTS;
         clip_rects.num_rects = 0;
@@ -2384,7 +2554,9 @@ void dcc_send_item(RedChannelClient *rcc, RedPipeItem *pipe_item)
     switch (pipe_item->type) {
     case RED_PIPE_ITEM_TYPE_DRAW: {
         RedDrawablePipeItem *dpi = SPICE_CONTAINEROF(pipe_item, RedDrawablePipeItem, dpi_pipe_item);
+        dcc->priv->send_data.compress_job = dpi->compress_job;
         marshall_qxl_drawable(rcc, m, dpi);
+        dcc->priv->send_data.compress_job = NULL;
         break;
     }
     case RED_PIPE_ITEM_TYPE_INVAL_ONE:
@@ -2409,9 +2581,13 @@ void dcc_send_item(RedChannelClient *rcc, RedPipeItem *pipe_item)
     case RED_PIPE_ITEM_TYPE_MIGRATE_DATA:
         display_channel_marshall_migrate_data(rcc, m);
         break;
-    case RED_PIPE_ITEM_TYPE_IMAGE:
-        red_marshall_image(rcc, m, SPICE_UPCAST(RedImageItem, pipe_item));
+    case RED_PIPE_ITEM_TYPE_IMAGE: {
+        RedImageItem *image = SPICE_UPCAST(RedImageItem, pipe_item);
+        dcc->priv->send_data.compress_job = image->compress_job;
+        red_marshall_image(rcc, m, image);
+        dcc->priv->send_data.compress_job = NULL;
         break;
+    }
     case RED_PIPE_ITEM_TYPE_PIXMAP_SYNC:
         display_channel_marshall_pixmap_sync(rcc, m);
         break;
@@ -2441,6 +2617,9 @@ void dcc_send_item(RedChannelClient *rcc, RedPipeItem *pipe_item)
         marshall_monitors_config(rcc, m, monconf_item->monitors_config);
         break;
     }
+    case RED_PIPE_ITEM_TYPE_STREAM_DATA:
+        marshall_stream_data_item(rcc, m, SPICE_UPCAST(StreamDataItem, pipe_item));
+        break;
     case RED_PIPE_ITEM_TYPE_STREAM_ACTIVATE_REPORT: {
         RedStreamActivateReportItem *report_item = SPICE_CONTAINEROF(pipe_item,
                                                                      RedStreamActivateReportItem,
@@ -31,6 +31,9 @@ G_DEFINE_TYPE(DisplayChannelClient, display_channel_client, TYPE_COMMON_GRAPHICS
 
 #define DISPLAY_CLIENT_SHORT_TIMEOUT 15000000000ULL //nano
 #define DISPLAY_FREE_LIST_DEFAULT_SIZE 128
+/* the range of the JPEG quality, see dcc_update_jpeg_quality() */
+#define DCC_JPEG_QUALITY_MAX 86
+#define DCC_JPEG_QUALITY_MIN 20
 
 enum
 {
@@ -42,6 +45,16 @@ enum
 
 static void on_display_video_codecs_update(GObject *gobject, GParamSpec *pspec, gpointer user_data);
 static bool dcc_config_socket(RedChannelClient *rcc);
+static uint32_t dcc_pipe_item_size(RedChannelClient *rcc, RedPipeItem *item);
+static RedPipeLane dcc_pipe_item_lane(RedChannelClient *rcc, RedPipeItem *item);
+static bool dcc_pipe_item_can_overtake(RedChannelClient *rcc, RedPipeItem *item,
+                                       RedPipeItem *queued);
+static bool dcc_pipe_item_is_ready(RedChannelClient *rcc, RedPipeItem *item);
+static bool dcc_can_compress_async(DisplayChannelClient *dcc);
+static ImageEncoderJob *dcc_compress_image_async(DisplayChannelClient *dcc, SpiceBitmap *src,
+                                                 Drawable *drawable, int can_lossy,
+                                                 image_encoder_job_release_t release,
+                                                 void *opaque);
 
 static void
 display_channel_client_get_property(GObject *object,
@@ -112,8 +125,12 @@ static void
 display_channel_client_finalize(GObject *object)
 {
     DisplayChannelClient *self = DISPLAY_CHANNEL_CLIENT(object);
+    int i;
 
     g_signal_handlers_disconnect_by_func(DCC_TO_DC(self), on_display_video_codecs_update, self);
+    for (i = 0; i < NUM_SURFACES; i++) {
+        region_destroy(&self->priv->surface_lagging_region[i]);
+    }
     g_clear_pointer(&self->priv->preferred_video_codecs, g_array_unref);
     g_clear_pointer(&self->priv->client_preferred_video_codecs, g_array_unref);
     g_free(self->priv);
@@ -133,6 +150,10 @@ display_channel_client_class_init(DisplayChannelClientClass *klass)
     object_class->finalize = display_channel_client_finalize;
 
     client_class->config_socket = dcc_config_socket;
+    client_class->pipe_item_size = dcc_pipe_item_size;
+    client_class->pipe_item_lane = dcc_pipe_item_lane;
+    client_class->pipe_item_can_overtake = dcc_pipe_item_can_overtake;
+    client_class->pipe_item_is_ready = dcc_pipe_item_is_ready;
 
     g_object_class_install_property(object_class,
                                     PROP_IMAGE_COMPRESSION,
@@ -167,15 +188,19 @@ display_channel_client_class_init(DisplayChannelClientClass *klass)
 
 static void display_channel_client_init(DisplayChannelClient *self)
 {
+    int i;
+
     /* we need to allocate the private data manually here since
      * g_type_class_add_private() doesn't support private structs larger than
      * 64k */
     self->priv = g_new0(DisplayChannelClientPrivate, 1);
+    for (i = 0; i < NUM_SURFACES; i++) {
+        region_init(&self->priv->surface_lagging_region[i]);
+    }
 
     ring_init(&self->priv->palette_cache_lru);
     self->priv->palette_cache_available = CLIENT_PALETTE_CACHE_SIZE;
-    // todo: tune quality according to bandwidth
-    self->priv->encoders.jpeg_quality = 86;
+    self->priv->encoders.jpeg_quality = DCC_JPEG_QUALITY_MAX;
     self->priv->send_data.free_list.res =
         spice_malloc(sizeof(SpiceResourceList) +
                      DISPLAY_FREE_LIST_DEFAULT_SIZE * sizeof(SpiceResourceID));
@@ -313,12 +338,55 @@ void dcc_create_surface(DisplayChannelClient *dcc, int surface_id)
     red_channel_client_pipe_add(RED_CHANNEL_CLIENT(dcc), &create->pipe_item);
 }
 
-// adding the pipe item after pos. If pos == NULL, adding to head.
-RedImageItem *dcc_add_surface_area_image(DisplayChannelClient *dcc,
-                                         int surface_id,
-                                         SpiceRect *area,
-                                         GList *pipe_item_pos,
-                                         int can_lossy)
+static void red_image_item_free(RedPipeItem *base)
+{
+    RedImageItem *item = SPICE_UPCAST(RedImageItem, base);
+
+    if (item->compress_job) {
+        image_encoder_job_unref(item->compress_job);
+    }
+    free(item);
+}
+
+static void red_image_item_compress_done(void *opaque)
+{
+    RedImageItem *item = opaque;
+
+    spice_chunks_destroy(item->compress_chunks);
+    item->compress_chunks = NULL;
+    red_pipe_item_unref(&item->base);
+}
+
+static ImageEncoderJob *red_image_item_compress_async(DisplayChannelClient *dcc,
+                                                      RedImageItem *item)
+{
+    SpiceBitmap bitmap = {
+        .format = item->image_format,
+        .flags = item->top_down ? SPICE_BITMAP_FLAGS_TOP_DOWN : 0,
+        .x = item->width,
+        .y = item->height,
+        .stride = item->stride,
+    };
+    ImageEncoderJob *job;
+
+    item->compress_chunks = spice_chunks_new_linear(item->data, item->stride * item->height);
+    bitmap.data = item->compress_chunks;
+    job = dcc_compress_image_async(dcc, &bitmap, NULL, item->can_lossy,
+                                   red_image_item_compress_done, item);
+    if (!job) {
+        spice_chunks_destroy(item->compress_chunks);
+        item->compress_chunks = NULL;
+        return NULL;
+    }
+    red_pipe_item_ref(&item->base);
+    return job;
+}
+
+static RedImageItem *dcc_add_surface_area_image_item(DisplayChannelClient *dcc,
+                                                     int surface_id,
+                                                     SpiceRect *area,
+                                                     GList *pipe_item_pos,
+                                                     int can_lossy)
 {
     DisplayChannel *display = DCC_TO_DC(dcc);
     RedSurface *surface = &display->priv->surfaces[surface_id];
@@ -339,7 +407,7 @@ RedImageItem *dcc_add_surface_area_image(DisplayChannelClient *dcc,
 
     item = (RedImageItem *)spice_malloc_n_m(height, stride, sizeof(RedImageItem));
 
-    red_pipe_item_init(&item->base, RED_PIPE_ITEM_TYPE_IMAGE);
+    red_pipe_item_init_full(&item->base, RED_PIPE_ITEM_TYPE_IMAGE, red_image_item_free);
 
     item->surface_id = surface_id;
     item->image_format =
@@ -367,6 +435,8 @@ RedImageItem *dcc_add_surface_area_image(DisplayChannelClient *dcc,
         }
     }
 
+    item->compress_job = red_image_item_compress_async(dcc, item);
+
     if (pipe_item_pos) {
         red_channel_client_pipe_add_after_pos(RED_CHANNEL_CLIENT(dcc), &item->base, pipe_item_pos);
     } else {
@@ -376,6 +446,56 @@ RedImageItem *dcc_add_surface_area_image(DisplayChannelClient *dcc,
     return item;
 }
 
+/*
+ * The images of large areas are split in tiles, each compressed by a thread
+ * of the encoder pool and sent as its own draw copy. The grid is aligned on
+ * the surface rather than on the area: the edges of the tiles fall on the
+ * 8x8 blocks of JPEG, and the lossy region of the client is kept per tile.
+ */
+#define DCC_IMAGE_TILE_SIZE 512
+/* smaller areas are compressed in one piece */
+#define DCC_IMAGE_TILE_MIN_AREA (1024 * 768)
+
+// adding the pipe item after pos. If pos == NULL, adding to head.
+// Returns the first tile of the image when it's split.
+RedImageItem *dcc_add_surface_area_image(DisplayChannelClient *dcc,
+                                         int surface_id,
+                                         SpiceRect *area,
+                                         GList *pipe_item_pos,
+                                         int can_lossy)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    RedImageItem *first = NULL;
+    SpiceRect tile;
+    int n_tiles = 0;
+
+    spice_assert(area);
+
+    if (!dcc_can_compress_async(dcc) ||
+        (area->right - area->left) * (area->bottom - area->top) < DCC_IMAGE_TILE_MIN_AREA) {
+        return dcc_add_surface_area_image_item(dcc, surface_id, area, pipe_item_pos, can_lossy);
+    }
+
+    for (tile.top = area->top; tile.top < area->bottom; tile.top = tile.bottom) {
+        tile.bottom = MIN((tile.top / DCC_IMAGE_TILE_SIZE + 1) * DCC_IMAGE_TILE_SIZE,
+                          area->bottom);
+        for (tile.left = area->left; tile.left < area->right; tile.left = tile.right) {
+            RedImageItem *item;
+
+            tile.right = MIN((tile.left / DCC_IMAGE_TILE_SIZE + 1) * DCC_IMAGE_TILE_SIZE,
+                             area->right);
+            item = dcc_add_surface_area_image_item(dcc, surface_id, &tile, pipe_item_pos,
+                                                   can_lossy);
+            if (!first) {
+                first = item;
+            }
+            n_tiles++;
+        }
+    }
+    stat_inc_counter(display->priv->image_tiles_counter, n_tiles);
+    return first;
+}
+
 void dcc_push_surface_image(DisplayChannelClient *dcc, int surface_id)
 {
     DisplayChannel *display;
@@ -436,10 +556,43 @@ static void red_drawable_pipe_item_free(RedPipeItem *item)
     spice_assert(item->refcount == 0);
 
     dpi->drawable->pipes = g_list_remove(dpi->drawable->pipes, dpi);
+    if (dpi->compress_job) {
+        image_encoder_job_unref(dpi->compress_job);
+    }
     drawable_unref(dpi->drawable);
     free(dpi);
 }
 
+static void red_drawable_compress_done(void *opaque)
+{
+    drawable_unref(opaque);
+}
+
+/* only the source of the copies is compressed ahead, the other drawables
+ * rarely carry big images */
+static ImageEncoderJob *red_drawable_compress_async(DisplayChannelClient *dcc,
+                                                    Drawable *drawable)
+{
+    RedDrawable *red_drawable = drawable->red_drawable;
+    SpiceImage *image;
+    ImageEncoderJob *job;
+
+    if (red_drawable->type != QXL_DRAW_COPY || drawable->stream) {
+        return NULL;
+    }
+    image = red_drawable->u.copy.src_bitmap;
+    if (!image || image->descriptor.type != SPICE_IMAGE_TYPE_BITMAP) {
+        return NULL;
+    }
+    job = dcc_compress_image_async(dcc, &image->u.bitmap, drawable,
+                                   DCC_TO_DC(dcc)->priv->enable_jpeg,
+                                   red_drawable_compress_done, drawable);
+    if (job) {
+        drawable->refs++;
+    }
+    return job;
+}
+
 static RedDrawablePipeItem *red_drawable_pipe_item_new(DisplayChannelClient *dcc,
                                                        Drawable *drawable)
 {
@@ -452,29 +605,504 @@ static RedDrawablePipeItem *red_drawable_pipe_item_new(DisplayChannelClient *dcc
     red_pipe_item_init_full(&dpi->dpi_pipe_item, RED_PIPE_ITEM_TYPE_DRAW,
                             red_drawable_pipe_item_free);
     drawable->refs++;
+    dpi->compress_job = red_drawable_compress_async(dcc, drawable);
     return dpi;
 }
 
+/*
+ * Rough estimation of the bytes an item will take on the wire, used to
+ * account the pipe budget of the client: drawables carrying an image count
+ * for their uncompressed size, the compressed video frames for theirs, the
+ * other items are small.
+ */
+#define DCC_PIPE_ITEM_MIN_SIZE 64
+
+static uint32_t dcc_pipe_item_size(RedChannelClient *rcc, RedPipeItem *item)
+{
+    switch (item->type) {
+    case RED_PIPE_ITEM_TYPE_DRAW: {
+        RedDrawablePipeItem *dpi = SPICE_CONTAINEROF(item, RedDrawablePipeItem, dpi_pipe_item);
+        RedDrawable *red_drawable = dpi->drawable->red_drawable;
+        const SpiceRect *bbox = &red_drawable->bbox;
+
+        switch (red_drawable->type) {
+        case QXL_DRAW_COPY:
+        case QXL_DRAW_OPAQUE:
+        case QXL_DRAW_BLEND:
+        case QXL_DRAW_TRANSPARENT:
+        case QXL_DRAW_ALPHA_BLEND:
+        case QXL_DRAW_ROP3:
+        case QXL_DRAW_COMPOSITE:
+            return MAX((uint32_t)(bbox->right - bbox->left) * (bbox->bottom - bbox->top) * 4,
+                       DCC_PIPE_ITEM_MIN_SIZE);
+        default:
+            return DCC_PIPE_ITEM_MIN_SIZE;
+        }
+    }
+    case RED_PIPE_ITEM_TYPE_IMAGE: {
+        RedImageItem *image = SPICE_UPCAST(RedImageItem, item);
+
+        return MAX((uint32_t)image->height * image->stride, DCC_PIPE_ITEM_MIN_SIZE);
+    }
+    case RED_PIPE_ITEM_TYPE_STREAM_DATA:
+        return MAX(SPICE_UPCAST(StreamDataItem, item)->buffer->size, DCC_PIPE_ITEM_MIN_SIZE);
+    default:
+        return DCC_PIPE_ITEM_MIN_SIZE;
+    }
+}
+
+/*
+ * The video streams go ahead of the drawings and images queued before them,
+ * so a large image does not delay the frames, unless they cover the area of
+ * the stream (see dcc_pipe_item_can_overtake()). The stream messages are
+ * kept in the same lane so they stay ordered with the frames.
+ * The drawings reading from a surface, and everything else, keep their
+ * place in the pipe.
+ */
+static RedPipeLane dcc_pipe_item_lane(RedChannelClient *rcc, RedPipeItem *item)
+{
+    switch (item->type) {
+    case RED_PIPE_ITEM_TYPE_DRAW: {
+        RedDrawablePipeItem *dpi = SPICE_CONTAINEROF(item, RedDrawablePipeItem, dpi_pipe_item);
+        Drawable *drawable = dpi->drawable;
+
+        if (drawable->stream) {
+            return RED_PIPE_LANE_INTERACTIVE;
+        }
+        if (drawable->red_drawable->type == QXL_COPY_BITS ||
+            !is_drawable_independent_from_surfaces(drawable)) {
+            return RED_PIPE_LANE_DEFAULT;
+        }
+        return RED_PIPE_LANE_BULK;
+    }
+    case RED_PIPE_ITEM_TYPE_IMAGE:
+        return RED_PIPE_LANE_BULK;
+    case RED_PIPE_ITEM_TYPE_STREAM_CREATE:
+    case RED_PIPE_ITEM_TYPE_STREAM_CLIP:
+    case RED_PIPE_ITEM_TYPE_STREAM_DESTROY:
+    case RED_PIPE_ITEM_TYPE_STREAM_ACTIVATE_REPORT:
+    case RED_PIPE_ITEM_TYPE_STREAM_DATA:
+        return RED_PIPE_LANE_INTERACTIVE;
+    default:
+        return RED_PIPE_LANE_DEFAULT;
+    }
+}
+
+/* where a video frame is drawn, NULL if @item is not one */
+static const SpiceRect *dcc_pipe_item_frame_area(RedPipeItem *item)
+{
+    switch (item->type) {
+    case RED_PIPE_ITEM_TYPE_DRAW: {
+        Drawable *drawable = SPICE_CONTAINEROF(item, RedDrawablePipeItem, dpi_pipe_item)->drawable;
+
+        return drawable->stream ? &drawable->red_drawable->bbox : NULL;
+    }
+    case RED_PIPE_ITEM_TYPE_STREAM_DATA:
+        return &SPICE_UPCAST(StreamDataItem, item)->dest;
+    default:
+        return NULL;
+    }
+}
+
+/* a frame does not go ahead of a drawing or an image queued before it over
+ * the same area, it would be painted over by older content */
+static bool dcc_pipe_item_can_overtake(RedChannelClient *rcc, RedPipeItem *item,
+                                       RedPipeItem *queued)
+{
+    const SpiceRect *frame_area = dcc_pipe_item_frame_area(item);
+    SpiceRect area;
+
+    if (!frame_area) {
+        return TRUE;
+    }
+    switch (queued->type) {
+    case RED_PIPE_ITEM_TYPE_DRAW: {
+        Drawable *drawable = SPICE_CONTAINEROF(queued, RedDrawablePipeItem,
+                                               dpi_pipe_item)->drawable;
+
+        return !rect_intersects(frame_area, &drawable->red_drawable->bbox);
+    }
+    case RED_PIPE_ITEM_TYPE_IMAGE: {
+        RedImageItem *image = SPICE_UPCAST(RedImageItem, queued);
+
+        area.left = image->pos.x;
+        area.top = image->pos.y;
+        area.right = image->pos.x + image->width;
+        area.bottom = image->pos.y + image->height;
+        return !rect_intersects(frame_area, &area);
+    }
+    default:
+        return TRUE;
+    }
+}
+
+/* the items compressed by the encoder pool wait for their compression, the
+ * items behind them too so the order of the messages does not change */
+static bool dcc_pipe_item_is_ready(RedChannelClient *rcc, RedPipeItem *item)
+{
+    ImageEncoderJob *job;
+
+    switch (item->type) {
+    case RED_PIPE_ITEM_TYPE_DRAW:
+        job = SPICE_CONTAINEROF(item, RedDrawablePipeItem, dpi_pipe_item)->compress_job;
+        break;
+    case RED_PIPE_ITEM_TYPE_IMAGE:
+        job = SPICE_UPCAST(RedImageItem, item)->compress_job;
+        break;
+    default:
+        return TRUE;
+    }
+    return !job || image_encoder_job_is_done(job);
+}
+
+/* whether the client shares the display channel with other clients, only
+ * then its pipe has a byte budget and it can be lagging */
+static bool dcc_has_peers(DisplayChannelClient *dcc)
+{
+    return red_channel_get_n_clients(RED_CHANNEL(DCC_TO_DC(dcc))) > 1;
+}
+
+static bool dcc_pipe_is_over(DisplayChannelClient *dcc, int factor, int divisor)
+{
+    RedChannelClient *rcc = RED_CHANNEL_CLIENT(dcc);
+
+    if (red_channel_client_get_pipe_size(rcc) > MAX_PIPE_SIZE * factor / divisor) {
+        return TRUE;
+    }
+    return dcc_has_peers(dcc) &&
+           red_channel_client_get_pipe_bytes(rcc) > (uint64_t)MAX_PIPE_BYTES * factor / divisor;
+}
+
+/* whether the client has enough pending data, the commands processing
+ * waits for all the clients to be in this state */
+bool dcc_pipe_is_full(DisplayChannelClient *dcc)
+{
+    return dcc_pipe_is_over(dcc, 1, 1);
+}
+
+/*
+ * The commands are processed as long as one client can take more data, so
+ * the pipe of a slow client can grow way over its budget. Once it is
+ * PIPE_LAGGING_FACTOR times over, the client is lagging: new drawables are
+ * not queued for it anymore, only the area they change is recorded and
+ * sent as images of the final content when the pipe has drained (see
+ * dcc_resync_lagging()). A burst of drawables thus collapses into a few
+ * images for that client instead of throttling the others.
+ *
+ * Returns: #true if the drawable must not be added to the pipe
+ */
+static bool dcc_merge_lagging_drawable(DisplayChannelClient *dcc, Drawable *drawable)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+
+    if (!dcc->priv->lagging) {
+        /* a single client throttles the commands processing instead */
+        if (!dcc_has_peers(dcc) || !dcc_pipe_is_over(dcc, PIPE_LAGGING_FACTOR, 1)) {
+            return FALSE;
+        }
+        spice_debug("client %p is lagging, pipe size %u bytes %" G_GUINT64_FORMAT,
+                    dcc, red_channel_client_get_pipe_size(RED_CHANNEL_CLIENT(dcc)),
+                    red_channel_client_get_pipe_bytes(RED_CHANNEL_CLIENT(dcc)));
+        dcc->priv->lagging = TRUE;
+    }
+
+    /* the first drawable on a surface makes its whole content to be sent */
+    if (!dcc->priv->surface_client_created[drawable->surface_id]) {
+        return FALSE;
+    }
+
+    region_add(&dcc->priv->surface_lagging_region[drawable->surface_id],
+               &drawable->red_drawable->bbox);
+    stat_inc_counter(display->priv->merged_drawables_counter, 1);
+    return TRUE;
+}
+
+/* beyond that, the bounding box of the area is sent */
+#define DCC_RESYNC_MAX_RECTS 16
+
+/* Sends the areas changed while the client was lagging, once its pipe is
+ * down to half of its budget */
+void dcc_resync_lagging(DisplayChannelClient *dcc)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    uint32_t surface_id;
+
+    if (!dcc->priv->lagging || dcc_pipe_is_over(dcc, 1, 2)) {
+        return;
+    }
+
+    for (surface_id = 0; surface_id < display->priv->n_surfaces; surface_id++) {
+        QRegion *region = &dcc->priv->surface_lagging_region[surface_id];
+        SpiceRect rects[DCC_RESYNC_MAX_RECTS];
+        int n_rects, i;
+
+        if (region_is_empty(region)) {
+            continue;
+        }
+
+        if (display->priv->surfaces[surface_id].context.canvas &&
+            dcc->priv->surface_client_created[surface_id]) {
+            n_rects = pixman_region32_n_rects(region);
+            if (n_rects > DCC_RESYNC_MAX_RECTS) {
+                region_extents(region, &rects[0]);
+                n_rects = 1;
+            } else {
+                region_ret_rects(region, rects, n_rects);
+            }
+            for (i = 0; i < n_rects; i++) {
+                /* render what is still in the tree before reading the surface */
+                display_channel_draw(display, &rects[i], surface_id);
+                dcc_add_surface_area_image(dcc, surface_id, &rects[i], NULL, TRUE);
+            }
+            stat_inc_counter(display->priv->resync_images_counter, n_rects);
+        }
+
+        region_destroy(region);
+        region_init(region);
+    }
+
+    spice_debug("client %p caught up", dcc);
+    dcc->priv->lagging = FALSE;
+    red_channel_client_push(RED_CHANNEL_CLIENT(dcc));
+}
+
+/* @area of @surface_id was just sent lossy, it will be refined first */
+void dcc_note_lossy_area(DisplayChannelClient *dcc, uint32_t surface_id,
+                         const SpiceRect *area)
+{
+    lossy_areas_note(&dcc->priv->lossy_areas, surface_id, area);
+}
+
+/* whether the lossy areas of @surface_id can be refined now */
+static bool dcc_can_refine_surface(DisplayChannelClient *dcc, uint32_t surface_id)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+
+    if (!display->priv->surfaces[surface_id].context.canvas ||
+        !dcc->priv->surface_client_created[surface_id]) {
+        return FALSE;
+    }
+    /* the frames of the surface stream paint over it */
+    return !(is_primary_surface(display, surface_id) && stream_surface_video_is_active(display));
+}
+
+/* The part of @area of @surface_id still lossy on the client, as a rectangle.
+ * It is limited to the tile of the grid of dcc_add_surface_area_image()
+ * holding the top left lossy pixel, so that a refinement is never larger
+ * than a tile. */
+static bool dcc_get_lossy_area(DisplayChannelClient *dcc, uint32_t surface_id,
+                               const SpiceRect *area, SpiceRect *lossy_area)
+{
+    QRegion region;
+    bool found;
+
+    if (!dcc_can_refine_surface(dcc, surface_id)) {
+        return FALSE;
+    }
+
+    region_init(&region);
+    region_add(&region, area);
+    region_and(&region, &dcc->priv->surface_client_lossy_region[surface_id]);
+    found = !region_is_empty(&region);
+    if (found) {
+        /* the rectangles of a region are sorted from the top */
+        pixman_box32_t *box = pixman_region32_rectangles(&region, NULL);
+        QRegion tile_region;
+        SpiceRect tile;
+
+        tile.left = box->x1 - box->x1 % DCC_IMAGE_TILE_SIZE;
+        tile.top = box->y1 - box->y1 % DCC_IMAGE_TILE_SIZE;
+        tile.right = tile.left + DCC_IMAGE_TILE_SIZE;
+        tile.bottom = tile.top + DCC_IMAGE_TILE_SIZE;
+        region_init(&tile_region);
+        region_add(&tile_region, &tile);
+        region_and(&region, &tile_region);
+        region_destroy(&tile_region);
+        region_extents(&region, lossy_area);
+    }
+    region_destroy(&region);
+    return found;
+}
+
+/* The visible surface first, the most recently lossy areas first, then what
+ * remains in the lossy regions */
+static bool dcc_next_lossy_area(DisplayChannelClient *dcc, uint32_t *surface_id,
+                                SpiceRect *area)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    LossyArea lossy;
+    uint32_t id;
+
+    while (lossy_areas_take(&dcc->priv->lossy_areas, 0, &lossy)) {
+        if (dcc_get_lossy_area(dcc, lossy.surface_id, &lossy.area, area)) {
+            /* the rest of the area comes next */
+            lossy_areas_note(&dcc->priv->lossy_areas, lossy.surface_id, &lossy.area);
+            *surface_id = lossy.surface_id;
+            return TRUE;
+        }
+    }
+
+    for (id = 0; id < display->priv->n_surfaces; id++) {
+        QRegion *region = &dcc->priv->surface_client_lossy_region[id];
+        pixman_box32_t *box;
+        SpiceRect rect;
+        int n_boxes;
+
+        if (!dcc->priv->surface_client_created[id] || region_is_empty(region)) {
+            continue;
+        }
+        box = pixman_region32_rectangles(region, &n_boxes);
+        rect.left = box->x1;
+        rect.top = box->y1;
+        rect.right = box->x2;
+        rect.bottom = box->y2;
+        if (dcc_get_lossy_area(dcc, id, &rect, area)) {
+            *surface_id = id;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* whether dcc_next_lossy_area() would find an area. The noted areas are
+ * part of the lossy regions, checking the regions is enough. */
+static bool dcc_has_lossy_areas(DisplayChannelClient *dcc)
+{
+    uint32_t id;
+
+    for (id = 0; id < DCC_TO_DC(dcc)->priv->n_surfaces; id++) {
+        if (dcc_can_refine_surface(dcc, id) &&
+            !region_is_empty(&dcc->priv->surface_client_lossy_region[id])) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* the bytes per second the refinement may send: what the connection is
+ * measured to carry, up to lossy_refine_rate */
+static uint64_t dcc_get_lossy_refine_rate(DisplayChannelClient *dcc)
+{
+    uint64_t max_rate = DCC_TO_DC(dcc)->priv->lossy_refine_rate;
+    uint64_t bit_rate = red_channel_client_get_bitrate_estimate(RED_CHANNEL_CLIENT(dcc));
+
+    /* without an estimate (not TCP, nothing measured yet) only the limit applies */
+    if (bit_rate == 0) {
+        return max_rate;
+    }
+    return MAX(MIN(bit_rate / 8, max_rate), 1);
+}
+
+/* how often the worker checks again while lossy areas wait for the pipe to
+ * drain, see dcc_get_lossy_refine_timeout() */
+#define DCC_LOSSY_REFINE_POLL_MS 50
+
+/*
+ * The lossy areas are replaced by lossless images while the client has
+ * nothing else to receive. The budget grows with the bit rate measured on
+ * the connection and shrinks with everything sent to the client, so the
+ * refinement only takes what the other messages leave. One tile is sent at
+ * a time, the next one once the pipe is empty again: the surfaces are read
+ * when the client is up to date, and the areas sent are only out of the
+ * lossy region once marshalled. This lets the JPEG quality go low when the
+ * connection is busy without leaving blurry text behind.
+ */
+void dcc_refine_lossy(DisplayChannelClient *dcc)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    RedChannelClient *rcc = RED_CHANNEL_CLIENT(dcc);
+    int64_t rate;
+    red_time_t now;
+    uint64_t elapsed;
+    uint64_t sent_bytes;
+    uint32_t surface_id;
+    SpiceRect area;
+    uint64_t size;
+    int bpp;
+
+    if (!display->priv->lossy_refine_rate) {
+        return;
+    }
+
+    /* up to a second of budget, or of debt, is kept */
+    rate = dcc_get_lossy_refine_rate(dcc);
+    now = spice_get_monotonic_time_ns();
+    sent_bytes = red_channel_client_get_sent_bytes(rcc);
+    elapsed = MIN(now - dcc->priv->lossy_refine_time, NSEC_PER_SEC);
+    dcc->priv->lossy_refine_budget += (int64_t)(elapsed * rate / NSEC_PER_SEC) -
+                                      (int64_t)(sent_bytes - dcc->priv->lossy_refine_sent_bytes);
+    dcc->priv->lossy_refine_budget = CLAMP(dcc->priv->lossy_refine_budget, -rate, rate);
+    dcc->priv->lossy_refine_time = now;
+    dcc->priv->lossy_refine_sent_bytes = sent_bytes;
+
+    if (dcc->priv->lossy_refine_budget <= 0 || dcc->priv->lagging ||
+        !red_channel_client_pipe_is_empty(rcc) ||
+        !red_channel_client_no_item_being_sent(rcc) ||
+        !dcc_next_lossy_area(dcc, &surface_id, &area)) {
+        return;
+    }
+
+    display_channel_draw(display, &area, surface_id);
+    dcc_add_surface_area_image(dcc, surface_id, &area, NULL, FALSE);
+
+    bpp = SPICE_SURFACE_FMT_DEPTH(display->priv->surfaces[surface_id].context.format) / 8;
+    size = (uint64_t)(area.right - area.left) * (area.bottom - area.top) * bpp;
+    stat_inc_counter(display->priv->lossy_refine_images_counter, 1);
+    stat_inc_counter(display->priv->lossy_refine_bytes_counter, size);
+    red_channel_client_push(rcc);
+}
+
+/* Returns: the time until dcc_refine_lossy() should run again, in ms */
+int dcc_get_lossy_refine_timeout(DisplayChannelClient *dcc)
+{
+    int64_t budget = dcc->priv->lossy_refine_budget;
+
+    if (!DCC_TO_DC(dcc)->priv->lossy_refine_rate || !dcc_has_lossy_areas(dcc)) {
+        return INT_MAX;
+    }
+    if (budget > 0) {
+        /* waiting for the pipe to drain */
+        return DCC_LOSSY_REFINE_POLL_MS;
+    }
+    return MAX((-budget * MSEC_PER_SEC) / (int64_t)dcc_get_lossy_refine_rate(dcc) + 1,
+               DCC_LOSSY_REFINE_POLL_MS);
+}
+
 void dcc_prepend_drawable(DisplayChannelClient *dcc, Drawable *drawable)
 {
-    RedDrawablePipeItem *dpi = red_drawable_pipe_item_new(dcc, drawable);
+    RedDrawablePipeItem *dpi;
 
+    if (dcc_merge_lagging_drawable(dcc, drawable)) {
+        return;
+    }
+
+    dpi = red_drawable_pipe_item_new(dcc, drawable);
     add_drawable_surface_images(dcc, drawable);
     red_channel_client_pipe_add(RED_CHANNEL_CLIENT(dcc), &dpi->dpi_pipe_item);
 }
 
 void dcc_append_drawable(DisplayChannelClient *dcc, Drawable *drawable)
 {
-    RedDrawablePipeItem *dpi = red_drawable_pipe_item_new(dcc, drawable);
+    RedDrawablePipeItem *dpi;
 
+    if (dcc_merge_lagging_drawable(dcc, drawable)) {
+        return;
+    }
+
+    dpi = red_drawable_pipe_item_new(dcc, drawable);
     add_drawable_surface_images(dcc, drawable);
     red_channel_client_pipe_add_tail_and_push(RED_CHANNEL_CLIENT(dcc), &dpi->dpi_pipe_item);
 }
 
 void dcc_add_drawable_after(DisplayChannelClient *dcc, Drawable *drawable, RedPipeItem *pos)
 {
-    RedDrawablePipeItem *dpi = red_drawable_pipe_item_new(dcc, drawable);
+    RedDrawablePipeItem *dpi;
+
+    if (dcc_merge_lagging_drawable(dcc, drawable)) {
+        return;
+    }
 
+    dpi = red_drawable_pipe_item_new(dcc, drawable);
     add_drawable_surface_images(dcc, drawable);
     red_channel_client_pipe_add_after(RED_CHANNEL_CLIENT(dcc), &dpi->dpi_pipe_item, pos);
 }
@@ -751,6 +1379,8 @@ void dcc_destroy_surface(DisplayChannelClient *dcc, uint32_t surface_id)
     }
 
     dcc->priv->surface_client_created[surface_id] = FALSE;
+    region_destroy(&dcc->priv->surface_lagging_region[surface_id]);
+    region_init(&dcc->priv->surface_lagging_region[surface_id]);
     destroy = red_surface_destroy_item_new(channel, surface_id);
     red_channel_client_pipe_add(RED_CHANNEL_CLIENT(dcc), &destroy->pipe_item);
 }
@@ -839,25 +1469,226 @@ static SpiceImageCompression get_compression_for_bitmap(SpiceBitmap *bitmap,
     return SPICE_IMAGE_COMPRESSION_INVALID;
 }
 
+/*
+ * The low bandwidth flag starts with the result of the main channel
+ * network test (or the migration data) and then follows the bandwidth
+ * estimation of the connection, so that JPEG and zlib-over-glz get
+ * enabled or disabled if the client moves to another network.
+ */
+static void dcc_update_low_bandwidth(DisplayChannelClient *dcc)
+{
+    uint64_t bitrate = red_channel_client_get_bitrate_estimate(RED_CHANNEL_CLIENT(dcc));
+    int is_low_bandwidth;
+
+    if (bitrate == 0) {
+        return;
+    }
+    /* leave some margin before switching back to avoid flapping */
+    if (dcc->is_low_bandwidth) {
+        is_low_bandwidth = bitrate < NET_LOW_BANDWIDTH_BITRATE + NET_LOW_BANDWIDTH_BITRATE / 4;
+    } else {
+        is_low_bandwidth = bitrate < NET_LOW_BANDWIDTH_BITRATE;
+    }
+    if (is_low_bandwidth == dcc->is_low_bandwidth) {
+        return;
+    }
+
+    spice_debug("bitrate %.2f Mbps, switching to %s bandwidth mode",
+                bitrate / 1024.0 / 1024.0, is_low_bandwidth ? "low" : "high");
+    dcc->is_low_bandwidth = is_low_bandwidth;
+    display_channel_update_compression(DCC_TO_DC(dcc), dcc);
+}
+
+/* the quality is lowered while sending the pipe takes longer than
+ * DCC_JPEG_QUALITY_HIGH_DELAY, and raised back under DCC_JPEG_QUALITY_LOW_DELAY */
+#define DCC_JPEG_QUALITY_INTERVAL (NSEC_PER_SEC / 2)
+#define DCC_JPEG_QUALITY_HIGH_DELAY (NSEC_PER_SEC / 2)
+#define DCC_JPEG_QUALITY_LOW_DELAY (NSEC_PER_SEC / 10)
+#define DCC_JPEG_QUALITY_STEP 10
+
+/*
+ * Like the rate control of the MJPEG encoder, the quality of the images a
+ * client gets follows its connection: the time to send the pipe is estimated
+ * from its size, scaled by the compression ratio of the last images (the
+ * pipe accounts the images uncompressed, see dcc_pipe_item_size()), the bit
+ * rate and the roundtrip. The quality drops quickly
+ * when the client falls behind, so that large redraws don't stall it for
+ * seconds, and comes back slowly. Below JPEG_SUBSAMPLING_MAX_QUALITY the
+ * chroma is subsampled too (see jpeg_encode()).
+ */
+static void dcc_update_jpeg_quality(DisplayChannelClient *dcc)
+{
+    RedChannelClient *rcc = RED_CHANNEL_CLIENT(dcc);
+    red_time_t now = spice_get_monotonic_time_ns();
+    uint64_t bit_rate;
+    uint64_t pipe_bytes;
+    uint64_t delay;
+    int roundtrip;
+    int quality;
+
+    if (now - dcc->priv->jpeg_quality_time < DCC_JPEG_QUALITY_INTERVAL) {
+        return;
+    }
+    dcc->priv->jpeg_quality_time = now;
+
+    bit_rate = red_channel_client_get_bitrate_estimate(rcc);
+    if (bit_rate == 0) {
+        /* nothing measured yet */
+        return;
+    }
+    roundtrip = red_channel_client_get_rtt_estimate_ms(rcc);
+    pipe_bytes = red_channel_client_get_pipe_bytes(rcc);
+    if (dcc->priv->image_bytes) {
+        pipe_bytes = pipe_bytes * dcc->priv->compressed_image_bytes / dcc->priv->image_bytes;
+    }
+    delay = pipe_bytes * 8 * NSEC_PER_SEC / bit_rate +
+            (uint64_t)MAX(roundtrip, 0) * NSEC_PER_MILLISEC;
+
+    quality = dcc->priv->encoders.jpeg_quality;
+    if (delay > 4 * DCC_JPEG_QUALITY_HIGH_DELAY) {
+        quality -= 2 * DCC_JPEG_QUALITY_STEP;
+    } else if (delay > DCC_JPEG_QUALITY_HIGH_DELAY) {
+        quality -= DCC_JPEG_QUALITY_STEP;
+    } else if (delay < DCC_JPEG_QUALITY_LOW_DELAY) {
+        quality += DCC_JPEG_QUALITY_STEP / 2;
+    }
+    quality = CLAMP(quality, DCC_JPEG_QUALITY_MIN, DCC_JPEG_QUALITY_MAX);
+
+    if (quality != dcc->priv->encoders.jpeg_quality) {
+        spice_debug("jpeg quality %d -> %d, delay %"PRIu64" ms, bit rate %.2f Mbps",
+                    dcc->priv->encoders.jpeg_quality, quality,
+                    (uint64_t)(delay / NSEC_PER_MILLISEC),
+                    bit_rate / 1024.0 / 1024.0);
+        dcc->priv->encoders.jpeg_quality = quality;
+    }
+}
+
+/* the compression dcc_compress_image() does for @src, @jpeg tells
+ * whether JPEG replaces QUIC */
+static SpiceImageCompression dcc_get_image_compression(DisplayChannelClient *dcc,
+                                                       SpiceBitmap *src, Drawable *drawable,
+                                                       int can_lossy, bool *jpeg)
+{
+    DisplayChannel *display_channel = DCC_TO_DC(dcc);
+    SpiceImageCompression image_compression;
+
+    *jpeg = FALSE;
+    image_compression = get_compression_for_bitmap(src, dcc->priv->image_compression, drawable);
+    switch (image_compression) {
+    case SPICE_IMAGE_COMPRESSION_QUIC:
+        *jpeg = can_lossy && display_channel->priv->enable_jpeg &&
+                (src->format != SPICE_BITMAP_FMT_RGBA || !bitmap_has_extra_stride(src));
+        if (*jpeg) {
+            dcc_update_jpeg_quality(dcc);
+        }
+        break;
+#ifdef USE_LZ4
+    case SPICE_IMAGE_COMPRESSION_LZ4:
+        if (!red_channel_client_test_remote_cap(RED_CHANNEL_CLIENT(dcc),
+                                                SPICE_DISPLAY_CAP_LZ4_COMPRESSION)) {
+            image_compression = SPICE_IMAGE_COMPRESSION_LZ;
+        }
+        break;
+#endif
+    default:
+        break;
+    }
+    return image_compression;
+}
+
+/* whether the compression of @dest can be shared with the other clients,
+ * and with which key */
+static bool dcc_get_shared_image_key(DisplayChannelClient *dcc, SpiceImage *dest,
+                                     SpiceBitmap *src, SpiceImageCompression image_compression,
+                                     bool jpeg, CompressedImageKey *key)
+{
+    /* nobody to share the images with */
+    if (!DCC_TO_DC(dcc)->priv->shared_images || !dcc_has_peers(dcc)) {
+        return FALSE;
+    }
+    switch (image_compression) {
+    case SPICE_IMAGE_COMPRESSION_QUIC:
+    case SPICE_IMAGE_COMPRESSION_LZ:
+#ifdef USE_LZ4
+    case SPICE_IMAGE_COMPRESSION_LZ4:
+#endif
+        break;
+    default:
+        return FALSE;
+    }
+    key->id = dest->descriptor.id;
+    key->compression = image_compression;
+    key->jpeg = jpeg;
+    key->jpeg_quality = jpeg ? dcc->priv->encoders.jpeg_quality : 0;
+    key->format = src->format;
+    key->x = src->x;
+    key->y = src->y;
+    return TRUE;
+}
+
+/* keeps a running compression ratio of the images sent, the older images
+ * count less and less, see dcc_update_jpeg_quality() */
+static void dcc_note_compression_ratio(DisplayChannelClient *dcc, SpiceBitmap *src,
+                                       compress_send_data_t *comp_data)
+{
+    dcc->priv->image_bytes -= dcc->priv->image_bytes / 8;
+    dcc->priv->image_bytes += src->stride * (uint64_t)src->y;
+    dcc->priv->compressed_image_bytes -= dcc->priv->compressed_image_bytes / 8;
+    dcc->priv->compressed_image_bytes += comp_data->comp_buf_size;
+}
+
+/*
+ * @can_share: the image id identifies its content, so the compressed image
+ * can be kept for the other clients
+ */
 int dcc_compress_image(DisplayChannelClient *dcc,
                        SpiceImage *dest, SpiceBitmap *src, Drawable *drawable,
-                       int can_lossy,
+                       int can_lossy, int can_share,
                        compress_send_data_t* o_comp_data)
 {
     DisplayChannel *display_channel = DCC_TO_DC(dcc);
+    CompressedImageCache *shared_images = display_channel->priv->shared_images;
     SpiceImageCompression image_compression;
+    ImageEncoderJob *job = dcc->priv->send_data.compress_job;
+    CompressedImageKey shared_key;
     stat_start_time_t start_time;
     int success = FALSE;
+    bool jpeg;
+
+    dcc_update_low_bandwidth(dcc);
 
     stat_start_time_init(&start_time, &display_channel->priv->encoder_shared_data.off_stat);
 
-    image_compression = get_compression_for_bitmap(src, dcc->priv->image_compression, drawable);
+    image_compression = dcc_get_image_compression(dcc, src, drawable, can_lossy, &jpeg);
+    can_share = can_share &&
+        dcc_get_shared_image_key(dcc, dest, src, image_compression, jpeg, &shared_key);
+
+    /* already compressed for another client */
+    if (can_share &&
+        compressed_image_cache_lookup(shared_images, &shared_key, dest, src, o_comp_data)) {
+        if (dest->descriptor.type == SPICE_IMAGE_TYPE_LZ_PLT) {
+            dcc_palette_cache_palette(dcc, dest->u.lz_plt.palette, &(dest->u.lz_plt.flags));
+        }
+        dcc_note_compression_ratio(dcc, src, o_comp_data);
+        return TRUE;
+    }
+
+    /* already compressed by the encoder pool */
+    if (job && image_encoder_job_matches(job, src, image_compression, jpeg,
+                                         dcc->priv->encoders.jpeg_quality)) {
+        success = image_encoder_job_take_result(job, dest, o_comp_data);
+        if (success && dest->descriptor.type == SPICE_IMAGE_TYPE_LZ_PLT) {
+            dcc_palette_cache_palette(dcc, dest->u.lz_plt.palette, &(dest->u.lz_plt.flags));
+        }
+        stat_inc_counter(display_channel->priv->async_compress_counter, 1);
+        goto done;
+    }
+
     switch (image_compression) {
     case SPICE_IMAGE_COMPRESSION_OFF:
         break;
     case SPICE_IMAGE_COMPRESSION_QUIC:
-        if (can_lossy && display_channel->priv->enable_jpeg &&
-            (src->format != SPICE_BITMAP_FMT_RGBA || !bitmap_has_extra_stride(src))) {
+        if (jpeg) {
             success = image_encoders_compress_jpeg(&dcc->priv->encoders, dest, src, o_comp_data);
             break;
         }
@@ -874,13 +1705,9 @@ int dcc_compress_image(DisplayChannelClient *dcc,
         goto lz_compress;
 #ifdef USE_LZ4
     case SPICE_IMAGE_COMPRESSION_LZ4:
-        if (red_channel_client_test_remote_cap(RED_CHANNEL_CLIENT(dcc),
-                                               SPICE_DISPLAY_CAP_LZ4_COMPRESSION)) {
-            success = image_encoders_compress_lz4(&dcc->priv->encoders, dest, src, o_comp_data);
-            break;
-        }
+        success = image_encoders_compress_lz4(&dcc->priv->encoders, dest, src, o_comp_data);
+        break;
 #endif
-        /* fall through */
     case SPICE_IMAGE_COMPRESSION_LZ:
 lz_compress:
         success = image_encoders_compress_lz(&dcc->priv->encoders, dest, src, o_comp_data);
@@ -892,14 +1719,65 @@ lz_compress:
         spice_error("invalid image compression type %u", image_compression);
     }
 
+done:
     if (!success) {
         uint64_t image_size = src->stride * (uint64_t)src->y;
         stat_compress_add(&display_channel->priv->encoder_shared_data.off_stat, start_time, image_size, image_size);
+    } else {
+        dcc_note_compression_ratio(dcc, src, o_comp_data);
+        if (can_share) {
+            compressed_image_cache_add(shared_images, &shared_key, dest, o_comp_data);
+        }
     }
 
     return success;
 }
 
+/* images smaller than this are not worth a trip through the encoder pool */
+#define DCC_ASYNC_COMPRESS_MIN_SIZE (16 * 1024)
+
+/*
+ * Starts compressing @src in the encoder pool, with the compression
+ * dcc_compress_image() will pick when the item is sent. GLZ must follow the
+ * order of the dictionary so it stays in dcc_compress_image().
+ */
+/* the local clients get their images uncompressed */
+static bool dcc_can_compress_async(DisplayChannelClient *dcc)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    RedChannelClient *rcc = RED_CHANNEL_CLIENT(dcc);
+
+    return display->priv->encoder_pool != NULL &&
+           reds_stream_get_family(red_channel_client_get_stream(rcc)) != AF_UNIX;
+}
+
+static ImageEncoderJob *dcc_compress_image_async(DisplayChannelClient *dcc, SpiceBitmap *src,
+                                                 Drawable *drawable, int can_lossy,
+                                                 image_encoder_job_release_t release,
+                                                 void *opaque)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    SpiceImageCompression image_compression;
+    bool jpeg;
+
+    if (!dcc_can_compress_async(dcc) ||
+        src->y * src->stride < DCC_ASYNC_COMPRESS_MIN_SIZE) {
+        return NULL;
+    }
+    if (src->data->flags & SPICE_CHUNKS_FLAGS_UNSTABLE) {
+        spice_chunks_linearize(src->data);
+    }
+
+    image_compression = dcc_get_image_compression(dcc, src, drawable, can_lossy, &jpeg);
+    if (image_compression != SPICE_IMAGE_COMPRESSION_QUIC &&
+        image_compression != SPICE_IMAGE_COMPRESSION_LZ &&
+        image_compression != SPICE_IMAGE_COMPRESSION_LZ4) {
+        return NULL;
+    }
+    return image_encoder_pool_submit(display->priv->encoder_pool, src, image_compression,
+                                     jpeg, dcc->priv->encoders.jpeg_quality, release, opaque);
+}
+
 #define CLIENT_PALETTE_CACHE
 #include "cache-item.tmpl.c"
 #undef CLIENT_PALETTE_CACHE
@@ -946,10 +1824,44 @@ static void dcc_push_release(DisplayChannelClient *dcc, uint8_t type, uint64_t i
     free_list->res->resources[free_list->res->count++].id = id;
 }
 
+/* locks the shard of the pixmap cache holding @id */
+void dcc_pixmap_cache_lock(DisplayChannelClient *dcc, uint64_t id)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    PixmapCacheShard *shard = pixmap_cache_get_shard(dcc->priv->pixmap_cache, id);
+
+    spice_assert(dcc->priv->pixmap_cache_locked_shard == NULL);
+    if (pthread_mutex_trylock(&shard->lock) != 0) {
+        red_time_t start = spice_get_monotonic_time_ns();
+
+        pthread_mutex_lock(&shard->lock);
+        stat_inc_counter(display->priv->pixmap_cache_lock_contended_counter, 1);
+        stat_inc_counter(display->priv->pixmap_cache_lock_wait_counter,
+                         spice_get_monotonic_time_ns() - start);
+    }
+    stat_inc_counter(display->priv->pixmap_cache_locks_counter, 1);
+    dcc->priv->pixmap_cache_locked_shard = shard;
+    dcc->priv->pixmap_cache_lock_time = spice_get_monotonic_time_ns();
+}
+
+void dcc_pixmap_cache_unlock(DisplayChannelClient *dcc)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    PixmapCacheShard *shard = dcc->priv->pixmap_cache_locked_shard;
+
+    spice_assert(shard);
+    stat_inc_counter(display->priv->pixmap_cache_lock_hold_counter,
+                     spice_get_monotonic_time_ns() - dcc->priv->pixmap_cache_lock_time);
+    dcc->priv->pixmap_cache_locked_shard = NULL;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/* @content: the content of the image if its hash is known, NULL otherwise */
 bool dcc_pixmap_cache_unlocked_add(DisplayChannelClient *dcc, uint64_t id,
-                                   uint32_t size, int lossy)
+                                   const PixmapContent *content, uint32_t size, int lossy)
 {
     PixmapCache *cache = dcc->priv->pixmap_cache;
+    PixmapCacheShard *shard = pixmap_cache_get_shard(cache, id);
     NewCacheItem *item;
     uint64_t serial;
     int key;
@@ -969,20 +1881,20 @@ bool dcc_pixmap_cache_unlocked_add(DisplayChannelClient *dcc, uint64_t id,
         return FALSE;
     }
 
-    cache->available -= size;
-    while (cache->available < 0) {
+    shard->available -= size;
+    while (shard->available < 0) {
         NewCacheItem *tail;
         NewCacheItem **now;
 
         SPICE_VERIFY(SPICE_OFFSETOF(NewCacheItem, lru_link) == 0);
-        if (!(tail = (NewCacheItem *)ring_get_tail(&cache->lru)) ||
+        if (!(tail = (NewCacheItem *)ring_get_tail(&shard->lru)) ||
                                                    tail->sync[dcc->priv->id] == serial) {
-            cache->available += size;
+            shard->available += size;
             free(item);
             return FALSE;
         }
 
-        now = &cache->hash_table[BITS_CACHE_HASH_KEY(tail->id)];
+        now = &shard->hash_table[BITS_CACHE_HASH_KEY(tail->id)];
         for (;;) {
             spice_assert(*now);
             if (*now == tail) {
@@ -991,19 +1903,27 @@ bool dcc_pixmap_cache_unlocked_add(DisplayChannelClient *dcc, uint64_t id,
             }
             now = &(*now)->next;
         }
+        pixmap_cache_unlocked_remove_content(shard, tail);
         ring_remove(&tail->lru_link);
-        cache->items--;
-        cache->available += tail->size;
+        shard->items--;
+        shard->available += tail->size;
         cache->sync[dcc->priv->id] = serial;
         dcc_push_release(dcc, SPICE_RES_TYPE_PIXMAP, tail->id, tail->sync);
         free(tail);
     }
-    ++cache->items;
-    item->next = cache->hash_table[(key = BITS_CACHE_HASH_KEY(id))];
-    cache->hash_table[key] = item;
+    ++shard->items;
+    item->next = shard->hash_table[(key = BITS_CACHE_HASH_KEY(id))];
+    shard->hash_table[key] = item;
     ring_item_init(&item->lru_link);
-    ring_add(&cache->lru, &item->lru_link);
+    ring_add(&shard->lru, &item->lru_link);
     item->id = id;
+    if (content && content->hash) {
+        item->content = *content;
+        item->content_next = shard->content_table[BITS_CACHE_HASH_KEY(content->hash)];
+        shard->content_table[BITS_CACHE_HASH_KEY(content->hash)] = item;
+    } else {
+        memset(&item->content, 0, sizeof(item->content));
+    }
     item->size = size;
     item->lossy = lossy;
     memset(item->sync, 0, sizeof(item->sync));
@@ -1335,12 +2255,12 @@ bool dcc_handle_migrate_data(DisplayChannelClient *dcc, uint32_t size, void *mes
                                                migrate_data->pixmap_cache_id, -1);
     spice_return_val_if_fail(dcc->priv->pixmap_cache, FALSE);
 
-    pthread_mutex_lock(&dcc->priv->pixmap_cache->lock);
+    pixmap_cache_lock_all(dcc->priv->pixmap_cache);
     for (i = 0; i < MAX_CACHE_CLIENTS; i++) {
         dcc->priv->pixmap_cache->sync[i] = MAX(dcc->priv->pixmap_cache->sync[i],
                                                migrate_data->pixmap_cache_clients[i]);
     }
-    pthread_mutex_unlock(&dcc->priv->pixmap_cache->lock);
+    pixmap_cache_unlock_all(dcc->priv->pixmap_cache);
 
     if (migrate_data->pixmap_cache_freezer) {
         /* activating the cache. The cache will start to be active after
@@ -22,6 +22,8 @@
 #include <glib-object.h>
 
 #include "image-encoders.h"
+#include "image-encoder-pool.h"
+#include "compressed-image-cache.h"
 #include "image-cache.h"
 #include "pixmap-cache.h"
 #include "display-limits.h"
@@ -76,6 +78,12 @@ GType display_channel_client_get_type(void) G_GNUC_CONST;
 #define NARROW_CLIENT_ACK_WINDOW 20
 
 #define MAX_PIPE_SIZE 50
+/* budget of a client pipe when several clients share the display,
+ * see dcc_pipe_item_size() */
+#define MAX_PIPE_BYTES (32 * 1024 * 1024)
+/* a client whose pipe is that many times over budget is lagging,
+ * see dcc_prepend_drawable() */
+#define PIPE_LAGGING_FACTOR 2
 
 typedef struct DisplayChannel DisplayChannel;
 typedef struct Stream Stream;
@@ -120,6 +128,9 @@ typedef struct RedImageItem {
     int image_format;
     uint32_t image_flags;
     int can_lossy;
+    /* compression done by the encoder pool, if any */
+    ImageEncoderJob *compress_job;
+    SpiceChunks *compress_chunks;
     uint8_t data[0];
 } RedImageItem;
 
@@ -127,6 +138,8 @@ typedef struct RedDrawablePipeItem {
     RedPipeItem dpi_pipe_item; /* link for the client's pipe itself */
     Drawable *drawable;
     DisplayChannelClient *dcc;
+    /* compression of the source image done by the encoder pool, if any */
+    ImageEncoderJob *compress_job;
 } RedDrawablePipeItem;
 
 DisplayChannelClient*      dcc_new                                   (DisplayChannel *display,
@@ -164,8 +177,13 @@ void                       dcc_palette_cache_reset                   (DisplayCha
 void                       dcc_palette_cache_palette                 (DisplayChannelClient *dcc,
                                                                       SpicePalette *palette,
                                                                       uint8_t *flags);
+void                       dcc_pixmap_cache_lock                     (DisplayChannelClient *dcc,
+                                                                      uint64_t id);
+void                       dcc_pixmap_cache_unlock                   (DisplayChannelClient *dcc);
 bool                       dcc_pixmap_cache_unlocked_add             (DisplayChannelClient *dcc,
-                                                                      uint64_t id, uint32_t size, int lossy);
+                                                                      uint64_t id,
+                                                                      const PixmapContent *content,
+                                                                      uint32_t size, int lossy);
 void                       dcc_prepend_drawable                      (DisplayChannelClient *dcc,
                                                                       Drawable *drawable);
 void                       dcc_append_drawable                       (DisplayChannelClient *dcc,
@@ -180,6 +198,13 @@ bool                       dcc_clear_surface_drawables_from_pipe     (DisplayCha
                                                                       int wait_if_used);
 bool                       dcc_drawable_is_in_pipe                   (DisplayChannelClient *dcc,
                                                                       Drawable *drawable);
+bool                       dcc_pipe_is_full                          (DisplayChannelClient *dcc);
+void                       dcc_resync_lagging                        (DisplayChannelClient *dcc);
+void                       dcc_note_lossy_area                       (DisplayChannelClient *dcc,
+                                                                      uint32_t surface_id,
+                                                                      const SpiceRect *area);
+void                       dcc_refine_lossy                          (DisplayChannelClient *dcc);
+int                        dcc_get_lossy_refine_timeout              (DisplayChannelClient *dcc);
 RedPipeItem *              dcc_gl_scanout_item_new                   (RedChannelClient *rcc,
                                                                       void *data, int num);
 RedPipeItem *              dcc_gl_draw_item_new                      (RedChannelClient *rcc,
@@ -187,7 +212,7 @@ RedPipeItem *              dcc_gl_draw_item_new                      (RedChannel
 
 int                        dcc_compress_image                        (DisplayChannelClient *dcc,
                                                                       SpiceImage *dest, SpiceBitmap *src, Drawable *drawable,
-                                                                      int can_lossy,
+                                                                      int can_lossy, int can_share,
                                                                       compress_send_data_t* o_comp_data);
 
 StreamAgent *              dcc_get_stream_agent                      (DisplayChannelClient *dcc, int stream_id);
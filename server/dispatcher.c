@@ -24,7 +24,9 @@
 #include <string.h>
 #include <pthread.h>
 #include <fcntl.h>
-#include <poll.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 
 #include <common/mem.h>
 #include <common/spice_common.h>
@@ -43,15 +45,29 @@ G_DEFINE_TYPE(Dispatcher, dispatcher, G_TYPE_OBJECT)
 #define DISPATCHER_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), TYPE_DISPATCHER, DispatcherPrivate))
 
 struct DispatcherPrivate {
-    int recv_fd;
-    int send_fd;
+    /* wakes up the dispatcher thread */
+    int recv_fds[2];
+    /* signaled by the dispatcher thread once a DISPATCHER_ACK message
+     * has been handled */
+    int ack_fds[2];
     pthread_t thread_id;
     pthread_mutex_t lock;
     DispatcherMessage *messages;
-    int stage;  /* message parser stage - sender has no stages */
     guint max_message_type;
-    void *payload; /* allocated as max of message sizes */
-    size_t payload_size; /* used to track realloc calls */
+    size_t payload_size; /* max of message sizes */
+
+    /* DISPATCHER_RING_SIZE slots of slot_size bytes */
+    uint8_t *slots;
+    size_t slot_size;
+    uint32_t enqueue_pos;
+    uint32_t dequeue_pos; /* only used by the dispatcher thread */
+    /* set once recv_fds has been signaled, until the ring is drained */
+    int notify_pending;
+    /* senders waiting for a free slot */
+    int full_waiters;
+    pthread_mutex_t full_lock;
+    pthread_cond_t full_cond;
+
     void *opaque;
     dispatcher_handle_async_done handle_async_done;
     dispatcher_handle_any_message any_handler;
@@ -110,34 +126,41 @@ dispatcher_finalize(GObject *object)
 {
     Dispatcher *self = DISPATCHER(object);
     g_free(self->priv->messages);
-    close(self->priv->send_fd);
-    close(self->priv->recv_fd);
+    dispatcher_event_free(self->priv->recv_fds);
+    dispatcher_event_free(self->priv->ack_fds);
     pthread_mutex_destroy(&self->priv->lock);
-    free(self->priv->payload);
+    pthread_mutex_destroy(&self->priv->full_lock);
+    pthread_cond_destroy(&self->priv->full_cond);
+    g_free(self->priv->slots);
     G_OBJECT_CLASS(dispatcher_parent_class)->finalize(object);
 }
 
+static int dispatcher_event_new(int fds[2], int flags);
+static void dispatcher_event_free(int fds[2]);
+static void dispatcher_alloc_slots(Dispatcher *dispatcher, size_t payload_size);
+
 static void dispatcher_constructed(GObject *object)
 {
     Dispatcher *self = DISPATCHER(object);
-    int channels[2];
 
     G_OBJECT_CLASS(dispatcher_parent_class)->constructed(object);
 
 #ifdef DEBUG_DISPATCHER
     setup_dummy_signal_handler();
 #endif
-    if (socketpair(AF_LOCAL, SOCK_STREAM, 0, channels) == -1) {
-        spice_error("socketpair failed %s", strerror(errno));
+    if (dispatcher_event_new(self->priv->recv_fds, O_NONBLOCK) == -1 ||
+        dispatcher_event_new(self->priv->ack_fds, 0) == -1) {
+        spice_error("creating dispatcher events failed %s", strerror(errno));
         return;
     }
     pthread_mutex_init(&self->priv->lock, NULL);
-    self->priv->recv_fd = channels[0];
-    self->priv->send_fd = channels[1];
+    pthread_mutex_init(&self->priv->full_lock, NULL);
+    pthread_cond_init(&self->priv->full_cond, NULL);
     self->priv->thread_id = pthread_self();
 
     self->priv->messages = g_new0(DispatcherMessage,
                                   self->priv->max_message_type);
+    dispatcher_alloc_slots(self, 0);
 }
 
 static void
@@ -188,128 +211,193 @@ dispatcher_new(size_t max_message_type, void *opaque)
 }
 
 
-#define ACK 0xffffffff
-
 /*
- * read_safe
- * helper. reads until size bytes accumulated in buf, if an error other then
- * EINTR is encountered returns -1, otherwise returns 0.
- * @block if 1 the read will block (the fd is always blocking).
- *        if 0 poll first, return immediately if no bytes available, otherwise
- *         read size in blocking mode.
+ * The messages are exchanged through a bounded ring of fixed size slots in
+ * memory, any thread can queue a message without taking a lock (this is
+ * the multiple producers queue described by Dmitry Vyukov) and only the
+ * dispatcher thread reads them. Each slot has a sequence number telling
+ * whether it is free for the producer of a given position or filled for
+ * the consumer.
+ * An event file descriptor wakes the dispatcher thread, it is only
+ * signaled when the dispatcher is not already about to drain the ring so
+ * a burst of messages costs a single wakeup.
  */
-static int read_safe(int fd, uint8_t *buf, size_t size, int block)
+#define DISPATCHER_RING_SIZE 256
+#define DISPATCHER_SLOT_ALIGN 64
+
+typedef struct DispatcherSlot {
+    uint32_t sequence;
+    uint32_t type;
+    /* followed by the payload */
+} DispatcherSlot;
+
+static inline DispatcherSlot *dispatcher_get_slot(Dispatcher *dispatcher, uint32_t pos)
 {
-    int read_size = 0;
-    int ret;
-    struct pollfd pollfd = {.fd = fd, .events = POLLIN, .revents = 0};
+    return (DispatcherSlot *)(dispatcher->priv->slots +
+                              (pos % DISPATCHER_RING_SIZE) * dispatcher->priv->slot_size);
+}
 
-    if (size == 0) {
-        return 0;
+static void dispatcher_alloc_slots(Dispatcher *dispatcher, size_t payload_size)
+{
+    DispatcherPrivate *priv = dispatcher->priv;
+    uint32_t i;
+
+    /* handlers are registered before any message is sent */
+    spice_assert(priv->enqueue_pos == 0);
+
+    g_free(priv->slots);
+    priv->slot_size = SPICE_ALIGN(sizeof(DispatcherSlot) + payload_size, DISPATCHER_SLOT_ALIGN);
+    priv->slots = g_malloc0(priv->slot_size * DISPATCHER_RING_SIZE);
+    for (i = 0; i < DISPATCHER_RING_SIZE; i++) {
+        dispatcher_get_slot(dispatcher, i)->sequence = i;
     }
+}
 
-    if (!block) {
-        while ((ret = poll(&pollfd, 1, 0)) == -1) {
-            if (errno == EINTR) {
-                spice_debug("EINTR in poll");
-                continue;
+/* returns the slot for the next message, NULL if the ring is full */
+static DispatcherSlot *dispatcher_ring_reserve(Dispatcher *dispatcher, uint32_t *slot_pos)
+{
+    DispatcherPrivate *priv = dispatcher->priv;
+    uint32_t pos = __atomic_load_n(&priv->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        DispatcherSlot *slot = dispatcher_get_slot(dispatcher, pos);
+        int32_t diff = (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&priv->enqueue_pos, &pos, pos + 1, TRUE,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *slot_pos = pos;
+                return slot;
             }
-            spice_error("poll failed");
-            return -1;
-        }
-        if (!(pollfd.revents & POLLIN)) {
-            return 0;
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&priv->enqueue_pos, __ATOMIC_RELAXED);
         }
     }
-    while (read_size < size) {
-        ret = read(fd, buf + read_size, size - read_size);
-        if (ret == -1) {
-            if (errno == EINTR) {
-                spice_debug("EINTR in read");
-                continue;
-            }
-            return -1;
-        }
-        if (ret == 0) {
-            spice_error("broken pipe on read");
-            return -1;
+}
+
+static bool dispatcher_ring_is_full(Dispatcher *dispatcher)
+{
+    uint32_t pos = __atomic_load_n(&dispatcher->priv->enqueue_pos, __ATOMIC_SEQ_CST);
+    DispatcherSlot *slot = dispatcher_get_slot(dispatcher, pos);
+
+    return (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_SEQ_CST) - pos) < 0;
+}
+
+static int dispatcher_event_new(int fds[2], int flags)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    fds[0] = fds[1] = eventfd(0, EFD_CLOEXEC | (flags & O_NONBLOCK ? EFD_NONBLOCK : 0));
+    return fds[0] == -1 ? -1 : 0;
+#else
+    if (pipe(fds) == -1) {
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, flags);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+#endif
+}
+
+static void dispatcher_event_free(int fds[2])
+{
+    if (fds[1] != fds[0]) {
+        close(fds[1]);
+    }
+    close(fds[0]);
+}
+
+static void dispatcher_event_signal(int fd)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    uint64_t value = 1;
+#else
+    uint8_t value = 1;
+#endif
+
+    while (write(fd, &value, sizeof(value)) == -1) {
+        if (errno != EINTR) {
+            spice_printerr("error signaling dispatcher event: %s", strerror(errno));
+            return;
         }
-        read_size += ret;
     }
-    return read_size;
 }
 
 /*
- * write_safe
- * @return -1 for error, otherwise number of written bytes. may be zero.
+ * dispatcher_event_wait
+ * consumes the pending events, blocks until there is one if the file
+ * descriptor is blocking
  */
-static int write_safe(int fd, uint8_t *buf, size_t size)
+static void dispatcher_event_wait(int fd)
 {
-    int written_size = 0;
-    int ret;
-
-    while (written_size < size) {
-        ret = write(fd, buf + written_size, size - written_size);
-        if (ret == -1) {
-            if (errno != EINTR) {
-                return -1;
+#ifdef HAVE_SYS_EVENTFD_H
+    uint64_t value;
+#else
+    uint8_t value[64];
+#endif
+
+    while (read(fd, &value, sizeof(value)) == -1) {
+        if (errno != EINTR) {
+            if (errno != EAGAIN) {
+                spice_printerr("error reading dispatcher event: %s", strerror(errno));
             }
-            spice_debug("EINTR in write");
-            continue;
+            return;
         }
-        written_size += ret;
     }
-    return written_size;
 }
 
 static int dispatcher_handle_single_read(Dispatcher *dispatcher)
 {
-    int ret;
+    DispatcherPrivate *priv = dispatcher->priv;
+    DispatcherSlot *slot = dispatcher_get_slot(dispatcher, priv->dequeue_pos);
+    DispatcherMessage *msg;
     uint32_t type;
-    DispatcherMessage *msg = NULL;
-    uint8_t *payload = dispatcher->priv->payload;
-    uint32_t ack = ACK;
+    uint8_t *payload;
 
-    if ((ret = read_safe(dispatcher->priv->recv_fd, (uint8_t*)&type, sizeof(type), 0)) == -1) {
-        spice_printerr("error reading from dispatcher: %d", errno);
-        return 0;
-    }
-    if (ret == 0) {
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != priv->dequeue_pos + 1) {
         /* no messsage */
         return 0;
     }
-    msg = &dispatcher->priv->messages[type];
-    if (read_safe(dispatcher->priv->recv_fd, payload, msg->size, 1) == -1) {
-        spice_printerr("error reading from dispatcher: %d", errno);
-        /* TODO: close socketpair? */
-        return 0;
-    }
-    if (dispatcher->priv->any_handler) {
-        dispatcher->priv->any_handler(dispatcher->priv->opaque, type, payload);
+    type = slot->type;
+    payload = (uint8_t *)(slot + 1);
+    msg = &priv->messages[type];
+    if (priv->any_handler) {
+        priv->any_handler(priv->opaque, type, payload);
     }
     if (msg->handler) {
-        msg->handler(dispatcher->priv->opaque, payload);
+        msg->handler(priv->opaque, payload);
     } else {
         spice_printerr("error: no handler for message type %d", type);
     }
     if (msg->ack == DISPATCHER_ACK) {
-        if (write_safe(dispatcher->priv->recv_fd,
-                       (uint8_t*)&ack, sizeof(ack)) == -1) {
-            spice_printerr("error writing ack for message %d", type);
-            /* TODO: close socketpair? */
-        }
-    } else if (msg->ack == DISPATCHER_ASYNC && dispatcher->priv->handle_async_done) {
-        dispatcher->priv->handle_async_done(dispatcher->priv->opaque, type, payload);
+        dispatcher_event_signal(priv->ack_fds[1]);
+    } else if (msg->ack == DISPATCHER_ASYNC && priv->handle_async_done) {
+        priv->handle_async_done(priv->opaque, type, payload);
+    }
+
+    /* give the slot back to the producers */
+    __atomic_store_n(&slot->sequence, priv->dequeue_pos + DISPATCHER_RING_SIZE, __ATOMIC_SEQ_CST);
+    priv->dequeue_pos++;
+    if (__atomic_load_n(&priv->full_waiters, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&priv->full_lock);
+        pthread_cond_broadcast(&priv->full_cond);
+        pthread_mutex_unlock(&priv->full_lock);
     }
     return 1;
 }
 
 /*
  * dispatcher_handle_recv_read
- * doesn't handle being in the middle of a message. all reads are blocking.
+ * handles all the messages queued so far
  */
 void dispatcher_handle_recv_read(Dispatcher *dispatcher)
 {
+    dispatcher_event_wait(dispatcher->priv->recv_fds[0]);
+    /* from now on the producers signal again, a message queued while the
+     * ring is drained may cause a spurious wakeup but is never missed */
+    __atomic_store_n(&dispatcher->priv->notify_pending, 0, __ATOMIC_SEQ_CST);
     while (dispatcher_handle_single_read(dispatcher)) {
     }
 }
@@ -317,35 +405,41 @@ void dispatcher_handle_recv_read(Dispatcher *dispatcher)
 void dispatcher_send_message(Dispatcher *dispatcher, uint32_t message_type,
                              void *payload)
 {
+    DispatcherPrivate *priv = dispatcher->priv;
     DispatcherMessage *msg;
-    uint32_t ack;
-    int send_fd = dispatcher->priv->send_fd;
+    DispatcherSlot *slot;
+    uint32_t pos;
 
-    assert(dispatcher->priv->max_message_type > message_type);
-    assert(dispatcher->priv->messages[message_type].handler);
-    msg = &dispatcher->priv->messages[message_type];
-    pthread_mutex_lock(&dispatcher->priv->lock);
-    if (write_safe(send_fd, (uint8_t*)&message_type, sizeof(message_type)) == -1) {
-        spice_printerr("error: failed to send message type for message %d",
-                   message_type);
-        goto unlock;
+    assert(priv->max_message_type > message_type);
+    assert(priv->messages[message_type].handler);
+    msg = &priv->messages[message_type];
+    if (msg->ack == DISPATCHER_ACK) {
+        /* a single sender waits for an ack at a time */
+        pthread_mutex_lock(&priv->lock);
     }
-    if (write_safe(send_fd, payload, msg->size) == -1) {
-        spice_printerr("error: failed to send message body for message %d",
-                   message_type);
-        goto unlock;
+
+    while ((slot = dispatcher_ring_reserve(dispatcher, &pos)) == NULL) {
+        /* the dispatcher thread is late, wait until it frees some slots */
+        pthread_mutex_lock(&priv->full_lock);
+        __atomic_add_fetch(&priv->full_waiters, 1, __ATOMIC_SEQ_CST);
+        while (dispatcher_ring_is_full(dispatcher)) {
+            pthread_cond_wait(&priv->full_cond, &priv->full_lock);
+        }
+        __atomic_sub_fetch(&priv->full_waiters, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&priv->full_lock);
+    }
+    slot->type = message_type;
+    memcpy(slot + 1, payload, msg->size);
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&priv->notify_pending, 1, __ATOMIC_SEQ_CST) == 0) {
+        dispatcher_event_signal(priv->recv_fds[1]);
     }
+
     if (msg->ack == DISPATCHER_ACK) {
-        if (read_safe(send_fd, (uint8_t*)&ack, sizeof(ack), 1) == -1) {
-            spice_printerr("error: failed to read ack");
-        } else if (ack != ACK) {
-            spice_printerr("error: got wrong ack value in dispatcher "
-                       "for message %d\n", message_type);
-            /* TODO handling error? */
-        }
+        dispatcher_event_wait(priv->ack_fds[0]);
+        pthread_mutex_unlock(&priv->lock);
     }
-unlock:
-    pthread_mutex_unlock(&dispatcher->priv->lock);
 }
 
 void dispatcher_register_async_done_callback(
@@ -369,7 +463,7 @@ void dispatcher_register_handler(Dispatcher *dispatcher, uint32_t message_type,
     msg->size = size;
     msg->ack = ack;
     if (msg->size > dispatcher->priv->payload_size) {
-        dispatcher->priv->payload = realloc(dispatcher->priv->payload, msg->size);
+        dispatcher_alloc_slots(dispatcher, msg->size);
         dispatcher->priv->payload_size = msg->size;
     }
 }
@@ -413,7 +507,7 @@ void dispatcher_set_opaque(Dispatcher *self, void *opaque)
 
 int dispatcher_get_recv_fd(Dispatcher *dispatcher)
 {
-    return dispatcher->priv->recv_fd;
+    return dispatcher->priv->recv_fds[0];
 }
 
 pthread_t dispatcher_get_thread_id(Dispatcher *self)
@@ -97,6 +97,7 @@ enum {
  *                  DISPATCHER_ASYNC - call send an ack. This is per message type - you can't send the
  *                  same message type with and without. Register two different
  *                  messages if that is what you want.
+ * All the handlers must be registered before the first message is sent.
  */
 void dispatcher_register_handler(Dispatcher *dispatcher, uint32_t message_type,
                                  dispatcher_handle_message handler, size_t size,
@@ -122,6 +123,8 @@ void dispatcher_register_universal_handler(Dispatcher *dispatcher,
 /*
  *  dispatcher_handle_recv_read
  *  @dispatcher: Dispatcher instance
+ *  Handles all the pending messages, to be called when the receive file
+ *  descriptor is readable.
  */
 void dispatcher_handle_recv_read(Dispatcher *);
 
@@ -20,13 +20,28 @@
 
 #include "display-channel.h"
 
-#define NUM_DRAWABLES 1000
+/* The drawables are allocated by chunks when needed, up to a maximum
+ * (see spice_server_set_max_drawables()). A chunk left unused is released
+ * once the other chunks have a chunk worth of free drawables. */
+#define DRAWABLES_CHUNK_SIZE 256
+
 typedef struct _Drawable _Drawable;
+typedef struct DrawableChunk DrawableChunk;
 struct _Drawable {
     union {
         Drawable drawable;
         _Drawable *next;
     } u;
+    DrawableChunk *chunk;
+};
+
+struct DrawableChunk {
+    RingItem link;
+    /* in free_drawable_chunks while free_drawables is set */
+    RingItem free_link;
+    uint32_t n_used;
+    _Drawable *free_drawables;
+    _Drawable drawables[DRAWABLES_CHUNK_SIZE];
 };
 
 struct DisplayChannelPrivate
@@ -40,6 +55,10 @@ struct DisplayChannelPrivate
     uint32_t renderer;
     int enable_jpeg;
     int enable_zlib_glz_wrap;
+    /* look up the pixmaps in the client cache by content */
+    int pixmap_dedup;
+    /* encode the frames of a stream once for the clients alike */
+    int shared_video_encoders;
 
     /* A ring of pending drawables for this DisplayChannel, regardless of which
      * surface they're associated with. This list is mainly used to flush older
@@ -48,8 +67,14 @@ struct DisplayChannelPrivate
     Ring current_list;
 
     uint32_t drawable_count;
-    _Drawable drawables[NUM_DRAWABLES];
-    _Drawable *free_drawables;
+    uint32_t drawables_high_water;
+    uint32_t max_drawables;
+    /* all the chunks, oldest first */
+    Ring drawable_chunks;
+    uint32_t n_drawable_chunks;
+    /* the chunks with free drawables, the last one to get one first so that
+     * the allocations fill the chunks already in use */
+    Ring free_drawable_chunks;
 
     int stream_video;
     GArray *video_codecs;
@@ -80,7 +105,54 @@ struct DisplayChannelPrivate
     RedStatCounter cache_hits_counter;
     RedStatCounter add_to_cache_counter;
     RedStatCounter non_cache_counter;
+    /* drawables not sent to lagging clients */
+    RedStatCounter merged_drawables_counter;
+    /* images sent to lagging clients once they caught up */
+    RedStatCounter resync_images_counter;
+    /* images sent with the compression done by the encoder pool */
+    RedStatCounter async_compress_counter;
+    /* tiles of the large images compressed in parallel */
+    RedStatCounter image_tiles_counter;
+    RedStatCounter drawables_counter;
+    RedStatCounter drawables_high_water_counter;
+    RedStatCounter drawables_allocated_counter;
+    /* drawables rendered early because the maximum was reached */
+    RedStatCounter drawables_max_reached_counter;
+    RedStatCounter pixmap_dedup_hashed_counter;
+    /* time spent hashing the bitmaps, in ns */
+    RedStatCounter pixmap_dedup_hash_time_counter;
+    RedStatCounter pixmap_dedup_hits_counter;
+    RedStatCounter pixmap_dedup_bytes_saved_counter;
+    RedStatCounter pixmap_cache_locks_counter;
+    /* locks of a shard of the pixmap cache held by another thread */
+    RedStatCounter pixmap_cache_lock_contended_counter;
+    /* time spent waiting for and holding the shards, in ns */
+    RedStatCounter pixmap_cache_lock_wait_counter;
+    RedStatCounter pixmap_cache_lock_hold_counter;
+    SurfaceVideo surface_video;
+    /* the change rate of the primary surface during the last window, in
+     * percents of its area per second */
+    RedStatCounter surface_video_rate_counter;
+    /* the starts and stops of the whole surface video mode */
+    RedStatCounter surface_video_switches_counter;
+    /* the compressed frames of the surface stream */
+    RedStatCounter surface_video_bytes_counter;
+    /* bytes per second of lossy areas sent again losslessly to the idle
+     * clients, see dcc_refine_lossy() */
+    uint64_t lossy_refine_rate;
+    RedStatCounter lossy_refine_images_counter;
+    /* uncompressed */
+    RedStatCounter lossy_refine_bytes_counter;
     ImageEncoderSharedData encoder_shared_data;
+
+    ImageEncoderPool *encoder_pool;
+    SpiceWatch *encoder_pool_watch;
+    /* written to by the video encoders when frames they compress
+     * asynchronously are ready, the watch is NULL if they don't */
+    int video_frames_fds[2];
+    SpiceWatch *video_frames_watch;
+    /* images compressed for a client, kept for the others */
+    CompressedImageCache *shared_images;
 };
 
 #endif /* DISPLAY_CHANNEL_PRIVATE_H_ */
@@ -18,6 +18,10 @@
 #include <config.h>
 #endif
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 #include <common/sw_canvas.h>
 
 #include "display-channel-private.h"
@@ -73,13 +77,28 @@ display_channel_set_property(GObject *object,
     }
 }
 
+static void drawables_destroy(DisplayChannel *display);
+
 static void
 display_channel_finalize(GObject *object)
 {
     DisplayChannel *self = DISPLAY_CHANNEL(object);
 
+    if (self->priv->encoder_pool_watch) {
+        SpiceCoreInterfaceInternal *core = red_channel_get_core_interface(RED_CHANNEL(self));
+        core->watch_remove(core, self->priv->encoder_pool_watch);
+    }
+    image_encoder_pool_free(self->priv->encoder_pool);
+    if (self->priv->video_frames_watch) {
+        SpiceCoreInterfaceInternal *core = red_channel_get_core_interface(RED_CHANNEL(self));
+        core->watch_remove(core, self->priv->video_frames_watch);
+        close(self->priv->video_frames_fds[0]);
+        close(self->priv->video_frames_fds[1]);
+    }
+    compressed_image_cache_free(self->priv->shared_images);
     display_channel_destroy_surfaces(self);
-    image_cache_reset(&self->priv->image_cache);
+    drawables_destroy(self);
+    image_cache_destroy(&self->priv->image_cache);
     monitors_config_unref(self->priv->monitors_config);
     g_array_unref(self->priv->video_codecs);
     g_free(self->priv);
@@ -169,7 +188,7 @@ static MonitorsConfig* monitors_config_new(QXLHead *heads, ssize_t nheads, ssize
 
 int display_channel_get_streams_timeout(DisplayChannel *display)
 {
-    int timeout = INT_MAX;
+    int timeout = stream_surface_video_get_timeout(display);
     Ring *ring = &display->priv->streams;
     RingItem *item = ring;
 
@@ -277,6 +296,8 @@ void display_channel_surface_unref(DisplayChannel *display, uint32_t surface_id)
     }
 
     region_destroy(&surface->draw_dirty_region);
+    tree_index_free(surface->tree_index);
+    surface->tree_index = NULL;
     surface->context.canvas = NULL;
     FOREACH_DCC(display, iter, dcc) {
         dcc_destroy_surface(dcc, surface_id);
@@ -316,7 +337,7 @@ static void streams_update_visible_region(DisplayChannel *display, Drawable *dra
 
         item = ring_next(ring, item);
 
-        if (stream->current == drawable) {
+        if (stream->current == drawable || stream->surface) {
             continue;
         }
 
@@ -332,12 +353,23 @@ static void streams_update_visible_region(DisplayChannel *display, Drawable *dra
     }
 }
 
+/* the drawables of the primary surface are only rendered while it is encoded
+ * as a video, see stream_surface_video_timeout() */
+static bool drawable_in_surface_video(DisplayChannel *display, Drawable *drawable)
+{
+    return stream_surface_video_is_active(display) &&
+           is_primary_surface(display, drawable->surface_id);
+}
+
 static void pipes_add_drawable(DisplayChannel *display, Drawable *drawable)
 {
     DisplayChannelClient *dcc;
     GListIter iter;
 
     spice_warn_if_fail(drawable->pipes == NULL);
+    if (drawable_in_surface_video(display, drawable)) {
+        return;
+    }
     FOREACH_DCC(display, iter, dcc) {
         dcc_prepend_drawable(dcc, drawable);
     }
@@ -351,6 +383,10 @@ static void pipes_add_drawable_after(DisplayChannel *display,
     int num_other_linked = 0;
     GList *l;
 
+    if (drawable_in_surface_video(display, drawable)) {
+        return;
+    }
+
     for (l = pos_after->pipes; l != NULL; l = l->next) {
         dpi_pos_after = l->data;
 
@@ -391,6 +427,9 @@ static void current_add_drawable(DisplayChannel *display,
 
     surface = &display->priv->surfaces[surface_id];
     ring_add_after(&drawable->tree_item.base.siblings_link, pos);
+    if (pos == &surface->current) {
+        tree_index_add(surface->tree_index, &drawable->tree_item.base);
+    }
     ring_add(&display->priv->current_list, &drawable->list_link);
     ring_add(&surface->current_list, &drawable->surface_list_link);
     drawable->refs++;
@@ -403,6 +442,7 @@ static void current_remove_drawable(DisplayChannel *display, Drawable *item)
     /* todo: move all to unref? */
     stream_trace_add_drawable(display, item);
     draw_item_remove_shadow(&item->tree_item);
+    tree_index_remove(&item->tree_item.base);
     ring_remove(&item->tree_item.base.siblings_link);
     ring_remove(&item->list_link);
     ring_remove(&item->surface_list_link);
@@ -528,6 +568,7 @@ static bool current_add_equal(DisplayChannel *display, DrawItem *item, TreeItem
                         is_drawable_independent_from_surfaces(drawable);
         stream_maintenance(display, drawable, other_drawable);
         current_add_drawable(display, drawable, &other->siblings_link);
+        tree_index_move(other, &item->base);
         other_drawable->refs++;
         current_remove_drawable(display, other_drawable);
         if (add_after) {
@@ -558,7 +599,7 @@ static bool current_add_equal(DisplayChannel *display, DrawItem *item, TreeItem
             FOREACH_DCC(display, iter, dcc) {
                 if (dpi_item && dcc == ((RedDrawablePipeItem *) dpi_item->data)->dcc) {
                     dpi_item = dpi_item->next;
-                } else {
+                } else if (!drawable_in_surface_video(display, drawable)) {
                     dcc_prepend_drawable(dcc, drawable);
                 }
             }
@@ -572,6 +613,7 @@ static bool current_add_equal(DisplayChannel *display, DrawItem *item, TreeItem
     case QXL_EFFECT_OPAQUE_BRUSH:
         if (is_same_geometry(drawable, other_drawable)) {
             current_add_drawable(display, drawable, &other->siblings_link);
+            tree_index_move(other, &item->base);
             drawable_remove_from_pipes(other_drawable);
             current_remove_drawable(display, other_drawable);
             pipes_add_drawable(display, drawable);
@@ -733,6 +775,24 @@ static void __exclude_region(DisplayChannel *display, Ring *ring, TreeItem *item
     stat_add(&display->priv->__exclude_stat, start_time);
 }
 
+/* The next item of @ring after @ring_item which may intersect @rgn, the
+ * items in between are skipped using the surface index when @ring is the
+ * top level of the tree */
+static RingItem *current_next_candidate(TreeIndex *index, Ring *ring, RingItem *ring_item,
+                                        const QRegion *rgn)
+{
+    TreeItem *next;
+
+    if (!index || ring != index->ring) {
+        return ring_next(ring, ring_item);
+    }
+    next = tree_index_next(index,
+                           ring_item == ring ? NULL :
+                           SPICE_CONTAINEROF(ring_item, TreeItem, siblings_link),
+                           &rgn->extents);
+    return next ? &next->siblings_link : NULL;
+}
+
 /* This function iterates through the given @ring starting at @ring_item and
  * continuing until reaching @last. and calls __exclude_region() on each item.
  * Any items that have an empty region as a result of the __exclude_region()
@@ -740,6 +800,8 @@ static void __exclude_region(DisplayChannel *display, Ring *ring, TreeItem *item
  *
  * TODO: What is the intended use of this function?
  *
+ * @index: the index of the surface top level ring, only used when @last is
+ *      not set since items may be skipped past it
  * @ring: every time this function is called, @ring is a Surface's 'current'
  *      ring, or to the ring of children of a container within that ring.
  * @ring_item: callers usually call this argument 'exclude_base'. We will
@@ -753,8 +815,9 @@ static void __exclude_region(DisplayChannel *display, Ring *ring, TreeItem *item
  * @frame_candidate: usually callers pass NULL, sometimes it's the drawable
  *      that's being added to the 'current' ring. TODO: What is its purpose?
  */
-static void exclude_region(DisplayChannel *display, Ring *ring, RingItem *ring_item,
-                           QRegion *rgn, TreeItem **last, Drawable *frame_candidate)
+static void exclude_region(DisplayChannel *display, TreeIndex *index, Ring *ring,
+                           RingItem *ring_item, QRegion *rgn, TreeItem **last,
+                           Drawable *frame_candidate)
 {
     Ring *top_ring;
     stat_start(&display->priv->exclude_stat, start_time);
@@ -764,6 +827,9 @@ static void exclude_region(DisplayChannel *display, Ring *ring, RingItem *ring_i
     }
 
     top_ring = ring;
+    if (last) {
+        index = NULL;
+    }
 
     for (;;) {
         TreeItem *now = SPICE_CONTAINEROF(ring_item, TreeItem, siblings_link);
@@ -817,7 +883,7 @@ static void exclude_region(DisplayChannel *display, Ring *ring, RingItem *ring_i
         /* if this is the last item to check, or if the current ring is
          * completed, don't go any further */
         while ((last && *last == (TreeItem *)ring_item) ||
-               !(ring_item = ring_next(ring, ring_item))) {
+               !(ring_item = current_next_candidate(index, ring, ring_item, rgn))) {
             /* we're currently iterating the top ring, so we're done */
             if (ring == top_ring) {
                 stat_add(&display->priv->exclude_stat, start_time);
@@ -836,6 +902,7 @@ static void exclude_region(DisplayChannel *display, Ring *ring, RingItem *ring_i
  * indicates whether the new item should be added to the pipe */
 static bool current_add_with_shadow(DisplayChannel *display, Ring *ring, Drawable *item)
 {
+    RedSurface *surface = &display->priv->surfaces[item->surface_id];
     stat_start(&display->priv->add_stat, start_time);
 #ifdef RED_WORKER_STAT
     ++display->priv->add_with_shadow_count;
@@ -862,6 +929,7 @@ static bool current_add_with_shadow(DisplayChannel *display, Ring *ring, Drawabl
 
     /* Prepend the shadow to the beginning of the current ring */
     ring_add(ring, &shadow->base.siblings_link);
+    tree_index_add(surface->tree_index, &shadow->base);
     /* Prepend the draw item to the beginning of the current ring. NOTE: this
      * means that the drawable is placed *before* its associated shadow in the
      * tree. Changing this order will violate several unstated assumptions */
@@ -873,7 +941,8 @@ static bool current_add_with_shadow(DisplayChannel *display, Ring *ring, Drawabl
          * items already in the tree.  Start iterating through the tree
          * starting with the shadow item to avoid excluding the new item
          * itself */
-        exclude_region(display, ring, &shadow->base.siblings_link, &exclude_rgn, NULL, NULL);
+        exclude_region(display, surface->tree_index, ring, &shadow->base.siblings_link,
+                       &exclude_rgn, NULL, NULL);
         region_destroy(&exclude_rgn);
         streams_update_visible_region(display, item);
     } else {
@@ -889,6 +958,7 @@ static bool current_add_with_shadow(DisplayChannel *display, Ring *ring, Drawabl
  * The return value indicates whether the new item should be added to the pipe */
 static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
 {
+    TreeIndex *index = display->priv->surfaces[drawable->surface_id].tree_index;
     DrawItem *item = &drawable->tree_item;
     RingItem *now;
     QRegion exclude_rgn;
@@ -897,7 +967,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
 
     spice_assert(!region_is_empty(&item->base.rgn));
     region_init(&exclude_rgn);
-    now = ring_next(ring, ring);
+    now = current_next_candidate(index, ring, ring, &item->base.rgn);
 
     /* check whether the new drawable region intersects any of the items
      * already in the 'current' ring */
@@ -908,7 +978,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
         if (!region_bounds_intersects(&item->base.rgn, &sibling->rgn)) {
             /* the bounds of the two items are totally disjoint, so no need to
              * check further. check the next item */
-            now = ring_next(ring, now);
+            now = current_next_candidate(index, ring, now, &item->base.rgn);
             continue;
         }
         /* bounds overlap, but check whether the regions actually overlap */
@@ -916,7 +986,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
         if (!(test_res & REGION_TEST_SHARED)) {
             /* there's no overlap of the regions between these two items. Move
              * on to the next one. */
-            now = ring_next(ring, now);
+            now = current_next_candidate(index, ring, now, &item->base.rgn);
             continue;
         } else if (sibling->type != TREE_ITEM_TYPE_SHADOW) {
             /* there is an overlap between the two regions */
@@ -959,7 +1029,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
                          * item is obscured and has a shadow. -jjongsma
                          */
                         TreeItem *next = sibling;
-                        exclude_region(display, ring, exclude_base, &exclude_rgn, &next, NULL);
+                        exclude_region(display, index, ring, exclude_base, &exclude_rgn, &next, NULL);
                         if (next != sibling) {
                             /* the @next param is only changed if the given item
                              * was removed as a side-effect of calling
@@ -1006,7 +1076,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
                  * this loop may have added various Shadow::on_hold regions to
                  * it. */
                 if (exclude_base) {
-                    exclude_region(display, ring, exclude_base, &exclude_rgn, NULL, NULL);
+                    exclude_region(display, index, ring, exclude_base, &exclude_rgn, NULL, NULL);
                     region_clear(&exclude_rgn);
                     exclude_base = NULL;
                 }
@@ -1056,7 +1126,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
          * Shadows that were associated with DrawItems that were removed from
          * the tree.  Add the new item's region to that */
         region_or(&exclude_rgn, &item->base.rgn);
-        exclude_region(display, ring, exclude_base, &exclude_rgn, NULL, drawable);
+        exclude_region(display, index, ring, exclude_base, &exclude_rgn, NULL, drawable);
         stream_trace_update(display, drawable);
         streams_update_visible_region(display, drawable);
         /*
@@ -1091,7 +1161,8 @@ static bool drawable_can_stream(DisplayChannel *display, Drawable *drawable)
         return FALSE;
     }
 
-    if (!is_primary_surface(display, drawable->surface_id)) {
+    if (!is_primary_surface(display, drawable->surface_id) ||
+        stream_surface_video_is_active(display)) {
         return FALSE;
     }
 
@@ -1386,6 +1457,10 @@ static void display_channel_add_drawable(DisplayChannel *display, Drawable *draw
         return;
     }
 
+    if (is_primary_surface(display, surface_id)) {
+        stream_surface_video_add_damage(display, drawable);
+    }
+
     if (red_drawable->self_bitmap) {
         handle_self_bitmap(display, drawable);
     }
@@ -1430,6 +1505,56 @@ void display_channel_process_draw(DisplayChannel *display, RedDrawable *red_draw
     drawable_unref(drawable);
 }
 
+/* The commands are processed while at least one client can take more
+ * data; the clients which are too far behind get degraded instead of
+ * throttling everybody (see dcc_merge_lagging_drawable()) */
+bool display_channel_pipes_are_full(DisplayChannel *display)
+{
+    DisplayChannelClient *dcc;
+    GListIter iter;
+    bool has_clients = FALSE;
+
+    FOREACH_DCC(display, iter, dcc) {
+        if (!dcc_pipe_is_full(dcc)) {
+            return FALSE;
+        }
+        has_clients = TRUE;
+    }
+    return has_clients;
+}
+
+void display_channel_resync_lagging_clients(DisplayChannel *display)
+{
+    DisplayChannelClient *dcc;
+    GListIter iter;
+
+    FOREACH_DCC(display, iter, dcc) {
+        dcc_resync_lagging(dcc);
+    }
+}
+
+void display_channel_refine_lossy_clients(DisplayChannel *display)
+{
+    DisplayChannelClient *dcc;
+    GListIter iter;
+
+    FOREACH_DCC(display, iter, dcc) {
+        dcc_refine_lossy(dcc);
+    }
+}
+
+int display_channel_get_lossy_refine_timeout(DisplayChannel *display)
+{
+    DisplayChannelClient *dcc;
+    GListIter iter;
+    int timeout = INT_MAX;
+
+    FOREACH_DCC(display, iter, dcc) {
+        timeout = MIN(timeout, dcc_get_lossy_refine_timeout(dcc));
+    }
+    return timeout;
+}
+
 bool display_channel_wait_for_migrate_data(DisplayChannel *display)
 {
     uint64_t end_time = spice_get_monotonic_time_ns() + DISPLAY_CLIENT_MIGRATE_DATA_TIMEOUT;
@@ -1562,33 +1687,111 @@ void display_channel_free_some(DisplayChannel *display)
     }
 }
 
+static void drawables_update_stats(DisplayChannel *display)
+{
+    DisplayChannelPrivate *priv = display->priv;
+
+    priv->drawables_high_water = MAX(priv->drawables_high_water, priv->drawable_count);
+    stat_set_counter(priv->drawables_counter, priv->drawable_count);
+    stat_set_counter(priv->drawables_high_water_counter, priv->drawables_high_water);
+    stat_set_counter(priv->drawables_allocated_counter,
+                     priv->n_drawable_chunks * DRAWABLES_CHUNK_SIZE);
+}
+
+static DrawableChunk *drawable_chunk_new(DisplayChannel *display)
+{
+    DrawableChunk *chunk = g_new(DrawableChunk, 1);
+    int i;
+
+    chunk->n_used = 0;
+    chunk->free_drawables = NULL;
+    for (i = DRAWABLES_CHUNK_SIZE - 1; i >= 0; i--) {
+        chunk->drawables[i].chunk = chunk;
+        chunk->drawables[i].u.next = chunk->free_drawables;
+        chunk->free_drawables = &chunk->drawables[i];
+    }
+    ring_item_init(&chunk->link);
+    ring_add_before(&chunk->link, &display->priv->drawable_chunks);
+    ring_item_init(&chunk->free_link);
+    ring_add(&display->priv->free_drawable_chunks, &chunk->free_link);
+    display->priv->n_drawable_chunks++;
+    return chunk;
+}
+
+static void drawable_chunk_free(DisplayChannel *display, DrawableChunk *chunk)
+{
+    ring_remove(&chunk->link);
+    if (ring_item_is_linked(&chunk->free_link)) {
+        ring_remove(&chunk->free_link);
+    }
+    display->priv->n_drawable_chunks--;
+    g_free(chunk);
+}
+
 static Drawable* drawable_try_new(DisplayChannel *display)
 {
-    Drawable *drawable;
+    DisplayChannelPrivate *priv = display->priv;
+    DrawableChunk *chunk;
+    RingItem *link;
+    _Drawable *drawable;
 
-    if (!display->priv->free_drawables)
-        return NULL;
+    if ((link = ring_get_head(&priv->free_drawable_chunks))) {
+        chunk = SPICE_CONTAINEROF(link, DrawableChunk, free_link);
+    } else {
+        if ((priv->n_drawable_chunks + 1) * DRAWABLES_CHUNK_SIZE > priv->max_drawables) {
+            return NULL;
+        }
+        chunk = drawable_chunk_new(display);
+    }
 
-    drawable = &display->priv->free_drawables->u.drawable;
-    display->priv->free_drawables = display->priv->free_drawables->u.next;
-    display->priv->drawable_count++;
+    drawable = chunk->free_drawables;
+    chunk->free_drawables = drawable->u.next;
+    if (!chunk->free_drawables) {
+        ring_remove(&chunk->free_link);
+    }
+    chunk->n_used++;
+    priv->drawable_count++;
+    drawables_update_stats(display);
 
-    return drawable;
+    return &drawable->u.drawable;
 }
 
 static void drawable_free(DisplayChannel *display, Drawable *drawable)
 {
-    ((_Drawable *)drawable)->u.next = display->priv->free_drawables;
-    display->priv->free_drawables = (_Drawable *)drawable;
+    DisplayChannelPrivate *priv = display->priv;
+    _Drawable *_drawable = (_Drawable *)drawable;
+    DrawableChunk *chunk = _drawable->chunk;
+
+    if (!chunk->free_drawables) {
+        ring_add(&priv->free_drawable_chunks, &chunk->free_link);
+    }
+    _drawable->u.next = chunk->free_drawables;
+    chunk->free_drawables = _drawable;
+    chunk->n_used--;
+    priv->drawable_count--;
+
+    /* keep a chunk of free drawables for the next burst */
+    if (chunk->n_used == 0 &&
+        (priv->n_drawable_chunks - 1) * DRAWABLES_CHUNK_SIZE - priv->drawable_count >=
+        DRAWABLES_CHUNK_SIZE) {
+        drawable_chunk_free(display, chunk);
+    }
+    drawables_update_stats(display);
 }
 
 static void drawables_init(DisplayChannel *display)
 {
-    int i;
+    ring_init(&display->priv->drawable_chunks);
+    ring_init(&display->priv->free_drawable_chunks);
+    display->priv->n_drawable_chunks = 0;
+}
+
+static void drawables_destroy(DisplayChannel *display)
+{
+    RingItem *link;
 
-    display->priv->free_drawables = NULL;
-    for (i = 0; i < NUM_DRAWABLES; i++) {
-        drawable_free(display, &display->priv->drawables[i].u.drawable);
+    while ((link = ring_get_head(&display->priv->drawable_chunks))) {
+        drawable_chunk_free(display, SPICE_CONTAINEROF(link, DrawableChunk, link));
     }
 }
 
@@ -1605,6 +1808,7 @@ static Drawable *display_channel_drawable_try_new(DisplayChannel *display,
     while (!(drawable = drawable_try_new(display))) {
         if (!free_one_drawable(display, FALSE))
             return NULL;
+        stat_inc_counter(display->priv->drawables_max_reached_counter, 1);
     }
 
     bzero(drawable, sizeof(Drawable));
@@ -1686,7 +1890,6 @@ void drawable_unref(Drawable *drawable)
         red_drawable_unref(drawable->red_drawable);
     }
     drawable_free(display, drawable);
-    display->priv->drawable_count--;
 }
 
 static void drawable_deps_draw(DisplayChannel *display, Drawable *drawable)
@@ -2057,6 +2260,9 @@ void display_channel_destroy_surface_wait(DisplayChannel *display, uint32_t surf
     if (!display->priv->surfaces[surface_id].context.canvas)
         return;
 
+    if (is_primary_surface(display, surface_id)) {
+        stream_surface_video_reset(display);
+    }
     draw_depend_on_me(display, surface_id);
     /* note that draw_depend_on_me must be called before current_remove_all.
        otherwise "current" will hold items that other drawables may depend on, and then
@@ -2149,6 +2355,7 @@ void display_channel_create_surface(DisplayChannel *display, uint32_t surface_id
     surface->create.info = NULL;
     surface->destroy.info = NULL;
     ring_init(&surface->current);
+    surface->tree_index = tree_index_new(&surface->current, width, height);
     ring_init(&surface->current_list);
     ring_init(&surface->depend_on_me);
     region_init(&surface->draw_dirty_region);
@@ -2189,6 +2396,12 @@ static void on_disconnect(RedChannelClient *rcc)
     dcc_stop(dcc); // TODO: start/stop -> connect/disconnect?
     display_channel_compress_stats_print(display);
 
+    /* the client is already removed, release the images nobody will share */
+    if (display->priv->shared_images &&
+        red_channel_get_n_clients(RED_CHANNEL(display)) <= 1) {
+        compressed_image_cache_reset(display->priv->shared_images);
+    }
+
     // this was the last channel client
     spice_debug("#draw=%d, #glz_draw=%d",
                 display->priv->drawable_count,
@@ -2249,6 +2462,8 @@ DisplayChannel* display_channel_new(RedsState *reds,
                            "n-surfaces", n_surfaces,
                            "video-codecs", video_codecs,
                            "handle-acks", TRUE,
+                           "batch-send", TRUE,
+                           "zerocopy-send", reds_get_zerocopy(reds),
                            NULL);
     if (display) {
         display_channel_set_stream_video(display, stream_video);
@@ -2277,11 +2492,92 @@ display_channel_init(DisplayChannel *self)
     self->priv->image_surfaces.ops = &image_surfaces_ops;
 }
 
+/* some compressions are done, the items waiting for them can be sent */
+static void display_channel_encoder_pool_ready(int fd, int event, void *opaque)
+{
+    DisplayChannel *display = opaque;
+
+    if (image_encoder_pool_handle_done(display->priv->encoder_pool) > 0) {
+        red_channel_push(RED_CHANNEL(display));
+    }
+}
+
+static void display_channel_init_encoder_pool(DisplayChannel *display)
+{
+    SpiceCoreInterfaceInternal *core = red_channel_get_core_interface(RED_CHANNEL(display));
+    int n_threads = reds_get_compression_threads(red_channel_get_server(RED_CHANNEL(display)));
+
+    if (n_threads == 0) {
+        return;
+    }
+    display->priv->encoder_pool = image_encoder_pool_new(n_threads);
+    if (!display->priv->encoder_pool) {
+        return;
+    }
+    display->priv->encoder_pool_watch =
+        core->watch_add(core, image_encoder_pool_get_fd(display->priv->encoder_pool),
+                        SPICE_WATCH_EVENT_READ, display_channel_encoder_pool_ready, display);
+    if (!display->priv->encoder_pool_watch) {
+        image_encoder_pool_free(display->priv->encoder_pool);
+        display->priv->encoder_pool = NULL;
+    }
+}
+
+/* some video frames are compressed, they can be sent */
+static void display_channel_video_frames_ready(int fd, int event, void *opaque)
+{
+    DisplayChannel *display = opaque;
+    uint8_t buf[64];
+
+    /* before pulling, so that a frame compressed meanwhile wakes us again */
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+    if (stream_agents_pull_encoded_frames(display) > 0) {
+        red_channel_push(RED_CHANNEL(display));
+    }
+}
+
+void display_channel_wakeup_video_frames(DisplayChannel *display)
+{
+    static const uint8_t byte = 0;
+
+    /* a full pipe already wakes up the worker */
+    if (write(display->priv->video_frames_fds[1], &byte, 1) < 0 && errno != EAGAIN) {
+        spice_warning("failed to notify a compressed video frame: %s", strerror(errno));
+    }
+}
+
+static void display_channel_init_async_video(DisplayChannel *display)
+{
+    SpiceCoreInterfaceInternal *core = red_channel_get_core_interface(RED_CHANNEL(display));
+    int i;
+
+    if (!reds_get_async_video_encoding(red_channel_get_server(RED_CHANNEL(display)))) {
+        return;
+    }
+    if (pipe(display->priv->video_frames_fds) < 0) {
+        spice_warning("failed to create the video frames pipe: %s", strerror(errno));
+        return;
+    }
+    for (i = 0; i < 2; i++) {
+        int fd = display->priv->video_frames_fds[i];
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    display->priv->video_frames_watch =
+        core->watch_add(core, display->priv->video_frames_fds[0], SPICE_WATCH_EVENT_READ,
+                        display_channel_video_frames_ready, display);
+    if (!display->priv->video_frames_watch) {
+        close(display->priv->video_frames_fds[0]);
+        close(display->priv->video_frames_fds[1]);
+    }
+}
+
 static void
 display_channel_constructed(GObject *object)
 {
     DisplayChannel *self = DISPLAY_CHANNEL(object);
     RedChannel *channel = RED_CHANNEL(self);
+    uint64_t shared_images_size;
 
     G_OBJECT_CLASS(display_channel_parent_class)->constructed(object);
 
@@ -2300,9 +2596,63 @@ display_channel_constructed(GObject *object)
                       "add_to_cache", TRUE);
     stat_init_counter(&self->priv->non_cache_counter, reds, stat,
                       "non_cache", TRUE);
-    image_cache_init(&self->priv->image_cache);
+    stat_init_counter(&self->priv->merged_drawables_counter, reds, stat,
+                      "merged_drawables", TRUE);
+    stat_init_counter(&self->priv->resync_images_counter, reds, stat,
+                      "resync_images", TRUE);
+    stat_init_counter(&self->priv->async_compress_counter, reds, stat,
+                      "async_compress", TRUE);
+    stat_init_counter(&self->priv->image_tiles_counter, reds, stat,
+                      "image_tiles", TRUE);
+    stat_init_counter(&self->priv->drawables_counter, reds, stat,
+                      "drawables", TRUE);
+    stat_init_counter(&self->priv->drawables_high_water_counter, reds, stat,
+                      "drawables_high_water", TRUE);
+    stat_init_counter(&self->priv->drawables_allocated_counter, reds, stat,
+                      "drawables_allocated", TRUE);
+    stat_init_counter(&self->priv->drawables_max_reached_counter, reds, stat,
+                      "drawables_max_reached", TRUE);
+    stat_init_counter(&self->priv->pixmap_dedup_hashed_counter, reds, stat,
+                      "pixmap_dedup_hashed", TRUE);
+    stat_init_counter(&self->priv->pixmap_dedup_hash_time_counter, reds, stat,
+                      "pixmap_dedup_hash_time", TRUE);
+    stat_init_counter(&self->priv->pixmap_dedup_hits_counter, reds, stat,
+                      "pixmap_dedup_hits", TRUE);
+    stat_init_counter(&self->priv->pixmap_dedup_bytes_saved_counter, reds, stat,
+                      "pixmap_dedup_bytes_saved", TRUE);
+    stat_init_counter(&self->priv->pixmap_cache_locks_counter, reds, stat,
+                      "pixmap_cache_locks", TRUE);
+    stat_init_counter(&self->priv->pixmap_cache_lock_contended_counter, reds, stat,
+                      "pixmap_cache_lock_contended", TRUE);
+    stat_init_counter(&self->priv->pixmap_cache_lock_wait_counter, reds, stat,
+                      "pixmap_cache_lock_wait", TRUE);
+    stat_init_counter(&self->priv->pixmap_cache_lock_hold_counter, reds, stat,
+                      "pixmap_cache_lock_hold", TRUE);
+    stat_init_counter(&self->priv->surface_video_rate_counter, reds, stat,
+                      "surface_video_rate", TRUE);
+    stat_init_counter(&self->priv->surface_video_switches_counter, reds, stat,
+                      "surface_video_switches", TRUE);
+    stat_init_counter(&self->priv->surface_video_bytes_counter, reds, stat,
+                      "surface_video_bytes", TRUE);
+    stat_init_counter(&self->priv->lossy_refine_images_counter, reds, stat,
+                      "lossy_refine_images", TRUE);
+    stat_init_counter(&self->priv->lossy_refine_bytes_counter, reds, stat,
+                      "lossy_refine_bytes", TRUE);
+    self->priv->pixmap_dedup = reds_get_pixmap_dedup(reds);
+    self->priv->shared_video_encoders = reds_get_shared_video_encoders(reds);
+    self->priv->surface_video.enabled = reds_get_surface_video(reds);
+    self->priv->lossy_refine_rate = reds_get_lossy_refine_rate(reds);
+    self->priv->max_drawables = reds_get_max_drawables(reds);
+    shared_images_size = reds_get_shared_images_size(reds);
+    if (shared_images_size) {
+        self->priv->shared_images = compressed_image_cache_new(reds, stat, shared_images_size);
+    }
+    image_cache_init(&self->priv->image_cache, reds_get_image_cache_size(reds),
+                     reds, stat);
     self->priv->stream_video = SPICE_STREAM_VIDEO_OFF;
     display_channel_init_streams(self);
+    display_channel_init_encoder_pool(self);
+    display_channel_init_async_video(self);
 
     red_channel_set_cap(channel, SPICE_DISPLAY_CAP_MONITORS_CONFIG);
     red_channel_set_cap(channel, SPICE_DISPLAY_CAP_PREF_COMPRESSION);
@@ -2469,6 +2819,10 @@ void display_channel_set_monitors_config_to_primary(DisplayChannel *display)
 void display_channel_reset_image_cache(DisplayChannel *self)
 {
     image_cache_reset(&self->priv->image_cache);
+    /* the guest can reuse the image ids */
+    if (self->priv->shared_images) {
+        compressed_image_cache_reset(self->priv->shared_images);
+    }
 }
 
 static void
@@ -2516,9 +2870,10 @@ void display_channel_debug_oom(DisplayChannel *display, const char *msg)
 {
     RedChannel *channel = RED_CHANNEL(display);
 
-    spice_debug("%s #draw=%u, #glz_draw=%u current %u pipes %u",
+    spice_debug("%s #draw=%u/%u, #glz_draw=%u current %u pipes %u",
                 msg,
                 display->priv->drawable_count,
+                display->priv->n_drawable_chunks * DRAWABLES_CHUNK_SIZE,
                 display->priv->encoder_shared_data.glz_drawable_count,
                 ring_get_length(&display->priv->current_list),
                 red_channel_sum_pipes_size(channel));
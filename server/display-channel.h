@@ -127,6 +127,7 @@ enum {
     RED_PIPE_ITEM_TYPE_STREAM_ACTIVATE_REPORT,
     RED_PIPE_ITEM_TYPE_GL_SCANOUT,
     RED_PIPE_ITEM_TYPE_GL_DRAW,
+    RED_PIPE_ITEM_TYPE_STREAM_DATA,
 };
 
 typedef struct MonitorsConfig {
@@ -166,6 +167,8 @@ typedef struct RedSurface {
      * which drawables overlap, and to exclude regions of drawables that are
      * obscured by other drawables */
     Ring current;
+    /* spatial index of the top level of 'current' */
+    TreeIndex *tree_index;
     /* A ring of pending Drawables associated with this surface. This ring is
      * actually used for drawing. The ring is maintained in order of age, the
      * tail being the oldest drawable. */
@@ -230,6 +233,7 @@ void                       display_channel_set_video_codecs          (DisplayCha
 GArray*                    display_channel_get_video_codecs          (DisplayChannel *display);
 int                        display_channel_get_stream_video          (DisplayChannel *display);
 int                        display_channel_get_streams_timeout       (DisplayChannel *display);
+void                       display_channel_wakeup_video_frames       (DisplayChannel *display);
 void                       display_channel_compress_stats_print      (DisplayChannel *display);
 void                       display_channel_compress_stats_reset      (DisplayChannel *display);
 void                       display_channel_surface_unref             (DisplayChannel *display,
@@ -237,6 +241,10 @@ void                       display_channel_surface_unref             (DisplayCha
 void                       display_channel_current_flush             (DisplayChannel *display,
                                                                       int surface_id);
 bool                       display_channel_wait_for_migrate_data     (DisplayChannel *display);
+bool                       display_channel_pipes_are_full            (DisplayChannel *display);
+void                       display_channel_resync_lagging_clients    (DisplayChannel *display);
+void                       display_channel_refine_lossy_clients      (DisplayChannel *display);
+int                        display_channel_get_lossy_refine_timeout  (DisplayChannel *display);
 void                       display_channel_flush_all_surfaces        (DisplayChannel *display);
 void                       display_channel_free_glz_drawables_to_free(DisplayChannel *display);
 void                       display_channel_free_glz_drawables        (DisplayChannel *display);
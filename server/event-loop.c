@@ -99,8 +99,11 @@ static GIOCondition spice_event_to_giocondition(int event_mask)
 {
     GIOCondition condition = 0;
 
+    /* G_IO_ERR is reported for pending socket errors and MSG_ZEROCOPY
+     * completions; poll() returns it even if not requested, so it must be
+     * dispatched or the loop would spin */
     if (event_mask & SPICE_WATCH_EVENT_READ)
-        condition |= G_IO_IN;
+        condition |= G_IO_IN | G_IO_ERR;
     if (event_mask & SPICE_WATCH_EVENT_WRITE)
         condition |= G_IO_OUT;
 
@@ -111,7 +114,7 @@ static int giocondition_to_spice_event(GIOCondition condition)
 {
     int event = 0;
 
-    if (condition & G_IO_IN)
+    if (condition & (G_IO_IN | G_IO_ERR))
         event |= SPICE_WATCH_EVENT_READ;
     if (condition & G_IO_OUT)
         event |= SPICE_WATCH_EVENT_WRITE;
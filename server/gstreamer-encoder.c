@@ -79,6 +79,13 @@ typedef struct {
     uint64_t duration;
 } SpiceGstFrameInformation;
 
+/* A frame pushed to the pipeline in asynchronous mode */
+typedef struct {
+    uint32_t mm_time;
+    uint64_t start;
+    gpointer bitmap_opaque;
+} SpiceGstPendingFrame;
+
 typedef enum SpiceGstBitRateStatus {
     SPICE_GST_BITRATE_DECREASING,
     SPICE_GST_BITRATE_INCREASING,
@@ -138,6 +145,17 @@ typedef struct SpiceGstEncoder {
     pthread_cond_t outbuf_cond;
     VideoBuffer *outbuf;
 
+    /* In asynchronous mode, see cbs.frame_encoded, the frames pushed to the
+     * pipeline and not handed over yet, oldest first. There is one
+     * SpiceGstVideoBuffer in encoded_frames for each frame the pipeline is
+     * done with.
+     */
+    GQueue pending_frames;
+    GAsyncQueue *encoded_frames;
+
+    /* Past this, the frames are dropped as if the pipe was congested. */
+#   define SPICE_GST_MAX_PENDING_FRAMES 3
+
     /* The video bit rate. */
     uint64_t video_bit_rate;
 
@@ -352,6 +370,24 @@ static void set_pipeline_changes(SpiceGstEncoder *encoder, uint32_t flags)
     encoder->set_pipeline |= flags;
 }
 
+/* The frames still in the pipeline are lost when it is stopped */
+static void drop_pending_frames(SpiceGstEncoder *encoder)
+{
+    SpiceGstPendingFrame *frame;
+    VideoBuffer *outbuf;
+
+    if (!encoder->encoded_frames) {
+        return;
+    }
+    while ((outbuf = g_async_queue_try_pop(encoder->encoded_frames))) {
+        outbuf->free(outbuf);
+    }
+    while ((frame = g_queue_pop_head(&encoder->pending_frames))) {
+        encoder->bitmap_unref(frame->bitmap_opaque);
+        free(frame);
+    }
+}
+
 static void free_pipeline(SpiceGstEncoder *encoder)
 {
     if (encoder->src_caps) {
@@ -360,6 +396,7 @@ static void free_pipeline(SpiceGstEncoder *encoder)
     }
     if (encoder->pipeline) {
         gst_element_set_state(encoder->pipeline, GST_STATE_NULL);
+        drop_pending_frames(encoder);
         gst_object_unref(encoder->appsrc);
         gst_object_unref(encoder->gstenc);
         gst_object_unref(encoder->appsink);
@@ -818,6 +855,20 @@ static void set_appsrc_caps(SpiceGstEncoder *encoder)
     gst_app_src_set_caps(encoder->appsrc, encoder->src_caps);
 }
 
+/* Gives an output buffer to the main thread, an empty one on errors */
+static void push_output_buffer(SpiceGstEncoder *encoder, VideoBuffer *outbuf)
+{
+    if (encoder->encoded_frames) {
+        g_async_queue_push(encoder->encoded_frames, outbuf);
+        encoder->cbs.wakeup(encoder->cbs.opaque);
+        return;
+    }
+    pthread_mutex_lock(&encoder->outbuf_mutex);
+    encoder->outbuf = outbuf;
+    pthread_cond_signal(&encoder->outbuf_cond);
+    pthread_mutex_unlock(&encoder->outbuf_mutex);
+}
+
 static GstBusSyncReply handle_pipeline_message(GstBus *bus, GstMessage *msg, gpointer video_encoder)
 {
     SpiceGstEncoder *encoder = video_encoder;
@@ -835,10 +886,7 @@ static GstBusSyncReply handle_pipeline_message(GstBus *bus, GstMessage *msg, gpo
         g_clear_error(&err);
 
         /* Unblock the main thread */
-        pthread_mutex_lock(&encoder->outbuf_mutex);
-        encoder->outbuf = (VideoBuffer*)create_gst_video_buffer();
-        pthread_cond_signal(&encoder->outbuf_cond);
-        pthread_mutex_unlock(&encoder->outbuf_mutex);
+        push_output_buffer(encoder, (VideoBuffer*)create_gst_video_buffer());
     }
     return GST_BUS_PASS;
 }
@@ -868,10 +916,7 @@ static GstFlowReturn new_sample(GstAppSink *gstappsink, gpointer video_encoder)
 #endif
 
     /* Notify the main thread that the output buffer is ready */
-    pthread_mutex_lock(&encoder->outbuf_mutex);
-    encoder->outbuf = (VideoBuffer*)outbuf;
-    pthread_cond_signal(&encoder->outbuf_cond);
-    pthread_mutex_unlock(&encoder->outbuf_mutex);
+    push_output_buffer(encoder, (VideoBuffer*)outbuf);
 
     return GST_FLOW_OK;
 }
@@ -1105,6 +1150,7 @@ static gboolean configure_pipeline(SpiceGstEncoder *encoder)
         free_pipeline(encoder);
         return FALSE;
     }
+    drop_pending_frames(encoder);
 
     /* Configure the encoder bitrate */
     if (encoder->set_pipeline & SPICE_GST_VIDEO_PIPELINE_BITRATE) {
@@ -1445,6 +1491,34 @@ static int pull_compressed_buffer(SpiceGstEncoder *encoder,
     return VIDEO_ENCODER_FRAME_UNSUPPORTED;
 }
 
+/* A helper for spice_gst_encoder_encode_frame() in asynchronous mode */
+static void add_pending_frame(SpiceGstEncoder *encoder, uint32_t frame_mm_time,
+                              uint64_t start, gpointer bitmap_opaque)
+{
+    SpiceGstPendingFrame *frame = spice_new(SpiceGstPendingFrame, 1);
+
+    frame->mm_time = frame_mm_time;
+    frame->start = start;
+    frame->bitmap_opaque = bitmap_opaque;
+    encoder->bitmap_ref(bitmap_opaque);
+    g_queue_push_tail(&encoder->pending_frames, frame);
+}
+
+/* Accounts for a compressed frame in the statistics and the rate control */
+static void add_encoded_frame(SpiceGstEncoder *encoder, uint32_t frame_mm_time,
+                              uint64_t duration, uint32_t size)
+{
+    uint32_t last_mm_time = get_last_frame_mm_time(encoder);
+    add_frame(encoder, frame_mm_time, duration, size);
+
+    int32_t refill = encoder->bit_rate * (frame_mm_time - last_mm_time) / MSEC_PER_SEC / 8;
+    encoder->vbuffer_free = MIN(encoder->vbuffer_free + refill,
+                                encoder->vbuffer_size) - size;
+
+    server_increase_bit_rate(encoder, frame_mm_time);
+    update_next_frame_mm_time(encoder);
+}
+
 
 /* ---------- VideoEncoder's public API ---------- */
 
@@ -1455,6 +1529,9 @@ static void spice_gst_encoder_destroy(VideoEncoder *video_encoder)
     free_pipeline(encoder);
     pthread_mutex_destroy(&encoder->outbuf_mutex);
     pthread_cond_destroy(&encoder->outbuf_cond);
+    if (encoder->encoded_frames) {
+        g_async_queue_unref(encoder->encoded_frames);
+    }
 
     /* Unref any lingering bitmap opaque structures from past frames */
     clear_zero_copy_queue(encoder, TRUE);
@@ -1462,6 +1539,8 @@ static void spice_gst_encoder_destroy(VideoEncoder *video_encoder)
     free(encoder);
 }
 
+static void spice_gst_encoder_notify_server_frame_drop(VideoEncoder *video_encoder);
+
 static int spice_gst_encoder_encode_frame(VideoEncoder *video_encoder,
                                           uint32_t frame_mm_time,
                                           const SpiceBitmap *bitmap,
@@ -1523,6 +1602,14 @@ static int spice_gst_encoder_encode_frame(VideoEncoder *video_encoder,
         return VIDEO_ENCODER_FRAME_DROP;
     }
 
+    if (g_queue_get_length(&encoder->pending_frames) >= SPICE_GST_MAX_PENDING_FRAMES) {
+        /* The pipeline does not keep up, so lower the bit rate as when the
+         * network does not.
+         */
+        spice_gst_encoder_notify_server_frame_drop(video_encoder);
+        return VIDEO_ENCODER_FRAME_DROP;
+    }
+
     if (!configure_pipeline(encoder)) {
         encoder->errors++;
         return VIDEO_ENCODER_FRAME_UNSUPPORTED;
@@ -1530,7 +1617,11 @@ static int spice_gst_encoder_encode_frame(VideoEncoder *video_encoder,
 
     uint64_t start = spice_get_monotonic_time_ns();
     int rc = push_raw_frame(encoder, bitmap, src, top_down, bitmap_opaque);
-    if (rc == VIDEO_ENCODER_FRAME_ENCODE_DONE) {
+    if (rc == VIDEO_ENCODER_FRAME_ENCODE_DONE && encoder->encoded_frames) {
+        /* spice_gst_encoder_pull_encoded_frames() will hand it over */
+        add_pending_frame(encoder, frame_mm_time, start, bitmap_opaque);
+        rc = VIDEO_ENCODER_FRAME_ENCODE_PENDING;
+    } else if (rc == VIDEO_ENCODER_FRAME_ENCODE_DONE) {
         rc = pull_compressed_buffer(encoder, outbuf);
         if (rc != VIDEO_ENCODER_FRAME_ENCODE_DONE) {
             /* The input buffer will be stuck in the pipeline, preventing
@@ -1549,18 +1640,49 @@ static int spice_gst_encoder_encode_frame(VideoEncoder *video_encoder,
     if (rc != VIDEO_ENCODER_FRAME_ENCODE_DONE) {
         return rc;
     }
-    uint32_t last_mm_time = get_last_frame_mm_time(encoder);
-    add_frame(encoder, frame_mm_time, spice_get_monotonic_time_ns() - start,
-              (*outbuf)->size);
+    add_encoded_frame(encoder, frame_mm_time, spice_get_monotonic_time_ns() - start,
+                      (*outbuf)->size);
 
-    int32_t refill = encoder->bit_rate * (frame_mm_time - last_mm_time) / MSEC_PER_SEC / 8;
-    encoder->vbuffer_free = MIN(encoder->vbuffer_free + refill,
-                                encoder->vbuffer_size) - (*outbuf)->size;
+    return rc;
+}
 
-    server_increase_bit_rate(encoder, frame_mm_time);
-    update_next_frame_mm_time(encoder);
+static int spice_gst_encoder_pull_encoded_frames(VideoEncoder *video_encoder)
+{
+    SpiceGstEncoder *encoder = (SpiceGstEncoder*)video_encoder;
+    VideoBuffer *outbuf;
+    int count = 0;
 
-    return rc;
+    while ((outbuf = g_async_queue_try_pop(encoder->encoded_frames))) {
+        SpiceGstPendingFrame *frame = g_queue_pop_head(&encoder->pending_frames);
+
+        if (!frame || !outbuf->data) {
+            spice_debug("failed to pull the compressed buffer");
+            outbuf->free(outbuf);
+            if (frame) {
+                encoder->bitmap_unref(frame->bitmap_opaque);
+                free(frame);
+            }
+            /* Same as in spice_gst_encoder_encode_frame(), this also drops
+             * the other pending frames.
+             */
+            free_pipeline(encoder);
+            encoder->errors++;
+            continue;
+        }
+
+        add_encoded_frame(encoder, frame->mm_time,
+                          spice_get_monotonic_time_ns() - frame->start, outbuf->size);
+        encoder->cbs.frame_encoded(encoder->cbs.opaque, frame->mm_time,
+                                   frame->bitmap_opaque, outbuf);
+        encoder->bitmap_unref(frame->bitmap_opaque);
+        free(frame);
+        count++;
+    }
+
+    /* Unref the bitmap_opaque structures of the compressed frames */
+    clear_zero_copy_queue(encoder, FALSE);
+
+    return count;
 }
 
 static void spice_gst_encoder_client_stream_report(VideoEncoder *video_encoder,
@@ -1740,6 +1862,13 @@ VideoEncoder *gstreamer_encoder_new(SpiceVideoCodecType codec_type,
     encoder->format = GSTREAMER_FORMAT_INVALID;
     pthread_mutex_init(&encoder->outbuf_mutex, NULL);
     pthread_cond_init(&encoder->outbuf_cond, NULL);
+    if (cbs->frame_encoded && cbs->wakeup) {
+        /* Don't wait for the compressed frames, so the caller can go on
+         * and several frames can be in the pipeline.
+         */
+        encoder->encoded_frames = g_async_queue_new();
+        encoder->base.pull_encoded_frames = spice_gst_encoder_pull_encoded_frames;
+    }
 
     /* All the other fields are initialized to zero by spice_new0(). */
 
@@ -1747,6 +1876,9 @@ VideoEncoder *gstreamer_encoder_new(SpiceVideoCodecType codec_type,
         /* Some GStreamer dependency is probably missing */
         pthread_cond_destroy(&encoder->outbuf_cond);
         pthread_mutex_destroy(&encoder->outbuf_mutex);
+        if (encoder->encoded_frames) {
+            g_async_queue_unref(encoder->encoded_frames);
+        }
         free(encoder);
         encoder = NULL;
     }
@@ -18,13 +18,20 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#include <stdlib.h>
+
 #include "image-cache.h"
 #include "red-parse-qxl.h"
 #include "display-channel.h"
 
+static inline uint32_t image_cache_bucket(ImageCache *cache, uint64_t id)
+{
+    return (id ^ (id >> 32)) & (cache->hash_size - 1);
+}
+
 static ImageCacheItem *image_cache_find(ImageCache *cache, uint64_t id)
 {
-    ImageCacheItem *item = cache->hash_table[id % IMAGE_CACHE_HASH_SIZE];
+    ImageCacheItem *item = cache->hash_table[image_cache_bucket(cache, id)];
 
     while (item) {
         if (item->id == id) {
@@ -41,9 +48,7 @@ static bool image_cache_hit(ImageCache *cache, uint64_t id)
     if (!(item = image_cache_find(cache, id))) {
         return FALSE;
     }
-#ifdef IMAGE_CACHE_AGE
     item->age = cache->age;
-#endif
     ring_remove(&item->lru_link);
     ring_add(&cache->lru, &item->lru_link);
     return TRUE;
@@ -53,7 +58,7 @@ static void image_cache_remove(ImageCache *cache, ImageCacheItem *item)
 {
     ImageCacheItem **now;
 
-    now = &cache->hash_table[item->id % IMAGE_CACHE_HASH_SIZE];
+    now = &cache->hash_table[image_cache_bucket(cache, item->id)];
     for (;;) {
         spice_assert(*now);
         if (*now == item) {
@@ -64,42 +69,71 @@ static void image_cache_remove(ImageCache *cache, ImageCacheItem *item)
     }
     ring_remove(&item->lru_link);
     pixman_image_unref(item->image);
-    free(item);
-#ifndef IMAGE_CACHE_AGE
+    cache->bytes -= item->size;
     cache->num_items--;
-#endif
+    free(item);
 }
 
-#define IMAGE_CACHE_MAX_ITEMS 2
+static void image_cache_resize(ImageCache *cache, uint32_t hash_size)
+{
+    ImageCacheItem **old_table = cache->hash_table;
+    uint32_t old_size = cache->hash_size;
+    uint32_t i;
+
+    cache->hash_table = g_new0(ImageCacheItem *, hash_size);
+    cache->hash_size = hash_size;
+    for (i = 0; i < old_size; i++) {
+        ImageCacheItem *item, *next;
+
+        for (item = old_table[i]; item; item = next) {
+            uint32_t bucket = image_cache_bucket(cache, item->id);
+
+            next = item->next;
+            item->next = cache->hash_table[bucket];
+            cache->hash_table[bucket] = item;
+        }
+    }
+    g_free(old_table);
+}
 
 static void image_cache_put(SpiceImageCache *spice_cache, uint64_t id, pixman_image_t *image)
 {
     ImageCache *cache = SPICE_UPCAST(ImageCache, spice_cache);
     ImageCacheItem *item;
+    uint32_t bucket;
+    size_t size;
 
-#ifndef IMAGE_CACHE_AGE
-    if (cache->num_items == IMAGE_CACHE_MAX_ITEMS) {
-        SPICE_VERIFY(SPICE_OFFSETOF(ImageCacheItem, lru_link) == 0);
+    size = (size_t)abs(pixman_image_get_stride(image)) * pixman_image_get_height(image);
+
+    SPICE_VERIFY(SPICE_OFFSETOF(ImageCacheItem, lru_link) == 0);
+    while (cache->bytes + size > cache->max_bytes) {
         ImageCacheItem *tail = (ImageCacheItem *)ring_get_tail(&cache->lru);
-        spice_assert(tail);
+
+        /* the items used by the current drawable must stay */
+        if (!tail || tail->age == cache->age) {
+            break;
+        }
         image_cache_remove(cache, tail);
+        stat_inc_counter(cache->evictions_counter, 1);
     }
-#endif
 
     item = spice_new(ImageCacheItem, 1);
     item->id = id;
-#ifdef IMAGE_CACHE_AGE
     item->age = cache->age;
-#else
-    cache->num_items++;
-#endif
     item->image = pixman_image_ref(image);
+    item->size = size;
     ring_item_init(&item->lru_link);
 
-    item->next = cache->hash_table[item->id % IMAGE_CACHE_HASH_SIZE];
-    cache->hash_table[item->id % IMAGE_CACHE_HASH_SIZE] = item;
+    if (++cache->num_items > cache->hash_size) {
+        image_cache_resize(cache, cache->hash_size * 2);
+    }
+    bucket = image_cache_bucket(cache, item->id);
+    item->next = cache->hash_table[bucket];
+    cache->hash_table[bucket] = item;
 
     ring_add(&cache->lru, &item->lru_link);
+    cache->bytes += size;
+    stat_set_counter(cache->bytes_counter, cache->bytes);
 }
 
 static pixman_image_t *image_cache_get(SpiceImageCache *spice_cache, uint64_t id)
@@ -113,7 +147,8 @@ static pixman_image_t *image_cache_get(SpiceImageCache *spice_cache, uint64_t id
     return pixman_image_ref(item->image);
 }
 
-void image_cache_init(ImageCache *cache)
+void image_cache_init(ImageCache *cache, uint64_t max_bytes,
+                      RedsState *reds, const RedStatNode *stat)
 {
     static SpiceImageCacheOps image_cache_ops = {
         image_cache_put,
@@ -121,13 +156,29 @@ void image_cache_init(ImageCache *cache)
     };
 
     cache->base.ops = &image_cache_ops;
-    memset(cache->hash_table, 0, sizeof(cache->hash_table));
+    cache->hash_size = IMAGE_CACHE_HASH_SIZE_MIN;
+    cache->hash_table = g_new0(ImageCacheItem *, cache->hash_size);
+    cache->num_items = 0;
     ring_init(&cache->lru);
-#ifdef IMAGE_CACHE_AGE
     cache->age = 0;
-#else
-    cache->num_items = 0;
-#endif
+    cache->bytes = 0;
+    cache->max_bytes = max_bytes;
+    cache->reds = reds;
+    stat_init_counter(&cache->hits_counter, reds, stat, "image_cache_hits", TRUE);
+    stat_init_counter(&cache->misses_counter, reds, stat, "image_cache_misses", TRUE);
+    stat_init_counter(&cache->evictions_counter, reds, stat, "image_cache_evictions", TRUE);
+    stat_init_counter(&cache->bytes_counter, reds, stat, "image_cache_bytes", TRUE);
+}
+
+void image_cache_destroy(ImageCache *cache)
+{
+    image_cache_reset(cache);
+    g_free(cache->hash_table);
+    cache->hash_table = NULL;
+    stat_remove_counter(cache->reds, &cache->hits_counter);
+    stat_remove_counter(cache->reds, &cache->misses_counter);
+    stat_remove_counter(cache->reds, &cache->evictions_counter);
+    stat_remove_counter(cache->reds, &cache->bytes_counter);
 }
 
 void image_cache_reset(ImageCache *cache)
@@ -138,25 +189,17 @@ void image_cache_reset(ImageCache *cache)
     while ((item = (ImageCacheItem *)ring_get_head(&cache->lru))) {
         image_cache_remove(cache, item);
     }
-#ifdef IMAGE_CACHE_AGE
+    if (cache->hash_size > IMAGE_CACHE_HASH_SIZE_MIN) {
+        image_cache_resize(cache, IMAGE_CACHE_HASH_SIZE_MIN);
+    }
     cache->age = 0;
-#endif
+    stat_set_counter(cache->bytes_counter, 0);
 }
 
-#define IMAGE_CACHE_DEPTH 4
-
+/* called before rendering each drawable */
 void image_cache_aging(ImageCache *cache)
 {
-    SPICE_VERIFY(SPICE_OFFSETOF(ImageCacheItem, lru_link) == 0);
-#ifdef IMAGE_CACHE_AGE
-    ImageCacheItem *item;
-
     cache->age++;
-    while ((item = (ImageCacheItem *)ring_get_tail(&cache->lru)) &&
-           cache->age - item->age > IMAGE_CACHE_DEPTH) {
-        image_cache_remove(cache, item);
-    }
-#endif
 }
 
 void image_cache_localize(ImageCache *cache, SpiceImage **image_ptr,
@@ -172,6 +215,7 @@ void image_cache_localize(ImageCache *cache, SpiceImage **image_ptr,
     }
 
     if (image_cache_hit(cache, image->descriptor.id)) {
+        stat_inc_counter(cache->hits_counter, 1);
         image_store->descriptor = image->descriptor;
         image_store->descriptor.type = SPICE_IMAGE_TYPE_FROM_CACHE;
         image_store->descriptor.flags = 0;
@@ -184,13 +228,11 @@ void image_cache_localize(ImageCache *cache, SpiceImage **image_ptr,
         image_store->descriptor = image->descriptor;
         image_store->u.quic = image->u.quic;
         *image_ptr = image_store;
-#ifdef IMAGE_CACHE_AGE
-        image_store->descriptor.flags |= SPICE_IMAGE_FLAGS_CACHE_ME;
-#else
-        if (image_store->descriptor.width * image->descriptor.height >= 640 * 480) {
+        stat_inc_counter(cache->misses_counter, 1);
+        /* the decoded image has 4 bytes per pixel at most */
+        if ((uint64_t)image->descriptor.width * image->descriptor.height * 4 <= cache->max_bytes) {
             image_store->descriptor.flags |= SPICE_IMAGE_FLAGS_CACHE_ME;
         }
-#endif
         break;
     }
     case SPICE_IMAGE_TYPE_BITMAP:
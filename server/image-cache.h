@@ -24,33 +24,53 @@
 #include <common/canvas_base.h>
 #include <common/ring.h>
 
+#include "red-common.h"
+#include "stat.h"
+
 /* FIXME: move back to display-channel.h (once structs are private) */
 typedef struct Drawable Drawable;
 
 typedef struct ImageCacheItem {
     RingItem lru_link;
     uint64_t id;
-#ifdef IMAGE_CACHE_AGE
+    /* age of the cache when the item was last used */
     uint32_t age;
-#endif
     struct ImageCacheItem *next;
     pixman_image_t *image;
+    size_t size;
 } ImageCacheItem;
 
-#define IMAGE_CACHE_HASH_SIZE 1024
+#define IMAGE_CACHE_HASH_SIZE_MIN 256
 
+/*
+ * The images decoded by the canvas while rendering, kept while the total
+ * size of their pixels is within the budget, the least recently used ones
+ * being dropped first. The items used by the drawable being rendered, since
+ * the last image_cache_aging(), are never dropped as the canvas will ask for
+ * them, so the budget can be exceeded until the next drawable.
+ */
 typedef struct ImageCache {
     SpiceImageCache base;
-    ImageCacheItem *hash_table[IMAGE_CACHE_HASH_SIZE];
+    ImageCacheItem **hash_table;
+    /* power of 2, grows with the number of items */
+    uint32_t hash_size;
+    uint32_t num_items;
     Ring lru;
-#ifdef IMAGE_CACHE_AGE
     uint32_t age;
-#else
-    uint32_t num_items;
-#endif
+    uint64_t bytes;
+    uint64_t max_bytes;
+
+    RedsState *reds;
+    RedStatCounter hits_counter;
+    RedStatCounter misses_counter;
+    RedStatCounter evictions_counter;
+    RedStatCounter bytes_counter;
 } ImageCache;
 
-void         image_cache_init              (ImageCache *cache);
+/* @max_bytes: budget of the cache, 0 to not cache the images */
+void         image_cache_init              (ImageCache *cache, uint64_t max_bytes,
+                                            RedsState *reds, const RedStatNode *stat);
+void         image_cache_destroy           (ImageCache *cache);
 void         image_cache_reset             (ImageCache *cache);
 void         image_cache_aging             (ImageCache *cache);
 void         image_cache_localize          (ImageCache *cache, SpiceImage **image_ptr,
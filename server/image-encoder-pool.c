@@ -0,0 +1,292 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <glib.h>
+
+#include <common/log.h>
+
+#include "image-encoder-pool.h"
+
+struct ImageEncoderJob {
+    /* only changed by the thread owning the pool */
+    int refs;
+    bool taken;
+    image_encoder_job_release_t release;
+    void *opaque;
+
+    SpiceBitmap src;
+    SpiceImageCompression compression;
+    bool jpeg;
+    int jpeg_quality;
+
+    /* written by the pool thread before done is set */
+    bool success;
+    SpiceImage dest;
+    compress_send_data_t comp_data;
+    int done;
+};
+
+typedef struct ImageEncoderThread {
+    ImageEncoderPool *pool;
+    pthread_t thread;
+    ImageEncoderSharedData shared_data;
+    ImageEncoders encoders;
+} ImageEncoderThread;
+
+struct ImageEncoderPool {
+    int n_threads;
+    ImageEncoderThread *threads;
+    GAsyncQueue *jobs;
+    GAsyncQueue *done_jobs;
+    /* a byte is written to done_fds[1] for each finished job */
+    int done_fds[2];
+};
+
+/* pushed once per thread to stop it */
+static ImageEncoderJob quit_job;
+
+static void image_encoder_job_free_result(ImageEncoderJob *job)
+{
+    RedCompressBuf *buf = job->comp_data.comp_buf;
+
+    while (buf) {
+        RedCompressBuf *next = buf->send_next;
+        compress_buf_free(buf);
+        buf = next;
+    }
+    job->comp_data.comp_buf = NULL;
+}
+
+static void image_encoder_job_run(ImageEncoderJob *job, ImageEncoders *enc)
+{
+    switch (job->compression) {
+    case SPICE_IMAGE_COMPRESSION_QUIC:
+        if (job->jpeg) {
+            enc->jpeg_quality = job->jpeg_quality;
+            job->success = image_encoders_compress_jpeg(enc, &job->dest, &job->src,
+                                                        &job->comp_data);
+        } else {
+            job->success = image_encoders_compress_quic(enc, &job->dest, &job->src,
+                                                        &job->comp_data);
+        }
+        break;
+#ifdef USE_LZ4
+    case SPICE_IMAGE_COMPRESSION_LZ4:
+        job->success = image_encoders_compress_lz4(enc, &job->dest, &job->src,
+                                                   &job->comp_data);
+        break;
+#endif
+    case SPICE_IMAGE_COMPRESSION_LZ:
+        job->success = image_encoders_compress_lz(enc, &job->dest, &job->src,
+                                                  &job->comp_data);
+        break;
+    default:
+        job->success = FALSE;
+        break;
+    }
+}
+
+static void *image_encoder_thread_main(void *data)
+{
+    ImageEncoderThread *thread = data;
+    ImageEncoderPool *pool = thread->pool;
+    ImageEncoderJob *job;
+
+    while ((job = g_async_queue_pop(pool->jobs)) != &quit_job) {
+        static const uint8_t byte = 0;
+
+        image_encoder_job_run(job, &thread->encoders);
+        g_atomic_int_set(&job->done, TRUE);
+        g_async_queue_push(pool->done_jobs, job);
+        /* a full pipe already wakes up the owner */
+        if (write(pool->done_fds[1], &byte, 1) < 0 && errno != EAGAIN) {
+            spice_warning("failed to notify a finished job: %s", strerror(errno));
+        }
+    }
+    return NULL;
+}
+
+ImageEncoderPool *image_encoder_pool_new(int n_threads)
+{
+    ImageEncoderPool *pool;
+    int i;
+
+    spice_return_val_if_fail(n_threads > 0, NULL);
+
+    pool = g_new0(ImageEncoderPool, 1);
+    if (pipe(pool->done_fds) < 0) {
+        spice_warning("failed to create the image encoder pool pipe: %s", strerror(errno));
+        g_free(pool);
+        return NULL;
+    }
+    for (i = 0; i < 2; i++) {
+        fcntl(pool->done_fds[i], F_SETFL, fcntl(pool->done_fds[i], F_GETFL) | O_NONBLOCK);
+    }
+    pool->jobs = g_async_queue_new();
+    pool->done_jobs = g_async_queue_new();
+    pool->threads = g_new0(ImageEncoderThread, n_threads);
+
+    for (i = 0; i < n_threads; i++) {
+        ImageEncoderThread *thread = &pool->threads[i];
+
+        thread->pool = pool;
+        image_encoder_shared_init(&thread->shared_data);
+        image_encoders_init(&thread->encoders, &thread->shared_data);
+        if (pthread_create(&thread->thread, NULL, image_encoder_thread_main, thread) != 0) {
+            spice_warning("failed to create an image encoder thread");
+            image_encoders_free(&thread->encoders);
+            break;
+        }
+    }
+    pool->n_threads = i;
+    if (pool->n_threads == 0) {
+        image_encoder_pool_free(pool);
+        return NULL;
+    }
+    spice_debug("image encoder pool with %d threads", pool->n_threads);
+    return pool;
+}
+
+void image_encoder_pool_free(ImageEncoderPool *pool)
+{
+    int i;
+
+    if (!pool) {
+        return;
+    }
+    /* the queue is ordered so the pending jobs are finished first */
+    for (i = 0; i < pool->n_threads; i++) {
+        g_async_queue_push(pool->jobs, &quit_job);
+    }
+    for (i = 0; i < pool->n_threads; i++) {
+        pthread_join(pool->threads[i].thread, NULL);
+        image_encoders_free(&pool->threads[i].encoders);
+    }
+    image_encoder_pool_handle_done(pool);
+
+    g_async_queue_unref(pool->jobs);
+    g_async_queue_unref(pool->done_jobs);
+    close(pool->done_fds[0]);
+    close(pool->done_fds[1]);
+    g_free(pool->threads);
+    g_free(pool);
+}
+
+int image_encoder_pool_get_fd(ImageEncoderPool *pool)
+{
+    return pool->done_fds[0];
+}
+
+int image_encoder_pool_handle_done(ImageEncoderPool *pool)
+{
+    ImageEncoderJob *job;
+    uint8_t buf[64];
+    int n = 0;
+
+    while (read(pool->done_fds[0], buf, sizeof(buf)) > 0) {
+    }
+    while ((job = g_async_queue_try_pop(pool->done_jobs)) != NULL) {
+        if (job->release) {
+            job->release(job->opaque);
+            job->release = NULL;
+        }
+        image_encoder_job_unref(job);
+        n++;
+    }
+    return n;
+}
+
+ImageEncoderJob *image_encoder_pool_submit(ImageEncoderPool *pool, const SpiceBitmap *src,
+                                           SpiceImageCompression compression, bool jpeg,
+                                           int jpeg_quality,
+                                           image_encoder_job_release_t release,
+                                           void *opaque)
+{
+    ImageEncoderJob *job;
+
+    spice_return_val_if_fail(!(src->data->flags & SPICE_CHUNKS_FLAGS_UNSTABLE), NULL);
+
+    job = g_new0(ImageEncoderJob, 1);
+    /* one reference for the caller, one for the pool */
+    job->refs = 2;
+    job->release = release;
+    job->opaque = opaque;
+    job->src = *src;
+    job->compression = compression;
+    job->jpeg = jpeg;
+    job->jpeg_quality = jpeg_quality;
+
+    g_async_queue_push(pool->jobs, job);
+    return job;
+}
+
+bool image_encoder_job_is_done(ImageEncoderJob *job)
+{
+    return g_atomic_int_get(&job->done);
+}
+
+bool image_encoder_job_matches(ImageEncoderJob *job, const SpiceBitmap *src,
+                               SpiceImageCompression compression, bool jpeg,
+                               int jpeg_quality)
+{
+    if (job->taken || job->compression != compression || job->jpeg != jpeg) {
+        return FALSE;
+    }
+    if (jpeg && job->jpeg_quality != jpeg_quality) {
+        return FALSE;
+    }
+    return job->src.format == src->format &&
+           job->src.x == src->x && job->src.y == src->y &&
+           job->src.stride == src->stride &&
+           job->src.data->num_chunks > 0 && src->data->num_chunks > 0 &&
+           job->src.data->chunk[0].data == src->data->chunk[0].data;
+}
+
+bool image_encoder_job_take_result(ImageEncoderJob *job, SpiceImage *dest,
+                                   compress_send_data_t *o_comp_data)
+{
+    spice_return_val_if_fail(image_encoder_job_is_done(job), FALSE);
+    spice_return_val_if_fail(!job->taken, FALSE);
+
+    job->taken = TRUE;
+    if (!job->success) {
+        return FALSE;
+    }
+    dest->descriptor.type = job->dest.descriptor.type;
+    dest->u = job->dest.u;
+    *o_comp_data = job->comp_data;
+    job->comp_data.comp_buf = NULL;
+    return TRUE;
+}
+
+void image_encoder_job_unref(ImageEncoderJob *job)
+{
+    if (--job->refs > 0) {
+        return;
+    }
+    image_encoder_job_free_result(job);
+    g_free(job);
+}
@@ -0,0 +1,81 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGE_ENCODER_POOL_H_
+#define IMAGE_ENCODER_POOL_H_
+
+#include "image-encoders.h"
+
+/*
+ * Threads compressing images ahead of their sending. Each thread has its
+ * own encoders, so only the encodings without state shared between images
+ * (QUIC, JPEG, LZ and LZ4) can be done by the pool, GLZ is always done by
+ * the sender.
+ *
+ * The pool and the jobs are used from a single thread, the one which
+ * created the pool. The compression is done in the pool threads, then the
+ * job is marked as done and image_encoder_pool_get_fd() becomes readable;
+ * image_encoder_pool_handle_done() must then be called to release the
+ * finished jobs.
+ */
+typedef struct ImageEncoderPool ImageEncoderPool;
+typedef struct ImageEncoderJob ImageEncoderJob;
+
+/* releases what keeps the source bitmap alive */
+typedef void (*image_encoder_job_release_t)(void *opaque);
+
+ImageEncoderPool *image_encoder_pool_new(int n_threads);
+void image_encoder_pool_free(ImageEncoderPool *pool);
+int image_encoder_pool_get_fd(ImageEncoderPool *pool);
+/* returns the number of jobs released */
+int image_encoder_pool_handle_done(ImageEncoderPool *pool);
+
+/*
+ * image_encoder_pool_submit
+ * @src: the bitmap to compress, must stay valid and unchanged until
+ *       @release is called, the bitmap structure itself is copied
+ * @compression: one of QUIC, LZ or LZ4
+ * @jpeg: use JPEG instead of QUIC
+ *
+ * Returns: a new job, to be released with image_encoder_job_unref()
+ */
+ImageEncoderJob *image_encoder_pool_submit(ImageEncoderPool *pool, const SpiceBitmap *src,
+                                           SpiceImageCompression compression, bool jpeg,
+                                           int jpeg_quality,
+                                           image_encoder_job_release_t release,
+                                           void *opaque);
+
+bool image_encoder_job_is_done(ImageEncoderJob *job);
+/* whether the job compresses @src the requested way, with @jpeg_quality
+ * if @jpeg is set */
+bool image_encoder_job_matches(ImageEncoderJob *job, const SpiceBitmap *src,
+                               SpiceImageCompression compression, bool jpeg,
+                               int jpeg_quality);
+/*
+ * image_encoder_job_take_result
+ * Fills @dest and @o_comp_data as the image_encoders_compress_*() functions
+ * do, the ownership of the compressed buffers is given to the caller. The
+ * job must be done, and the result can be taken only once.
+ *
+ * Returns: whether the compression succeeded
+ */
+bool image_encoder_job_take_result(ImageEncoderJob *job, SpiceImage *dest,
+                                   compress_send_data_t *o_comp_data);
+void image_encoder_job_unref(ImageEncoderJob *job);
+
+#endif /* IMAGE_ENCODER_POOL_H_ */
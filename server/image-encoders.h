@@ -195,6 +195,10 @@ typedef struct compress_send_data_t {
     uint32_t comp_buf_size;
     SpicePalette *lzplt_palette;
     gboolean is_lossy;
+    /* if set, comp_buf belongs to this shared image rather than to the
+     * receiver, which holds a reference to it instead,
+     * see compressed-image-cache.h */
+    struct CompressedImage *shared_image;
 } compress_send_data_t;
 
 bool image_encoders_compress_quic(ImageEncoders *enc, SpiceImage *dest,
@@ -23,6 +23,7 @@
 
 #include "red-common.h"
 #include "jpeg-encoder.h"
+#include "pixel-convert.h"
 
 typedef struct JpegEncoder {
     JpegEncoderUsrContext *usr;
@@ -37,7 +38,8 @@ typedef struct JpegEncoder {
         int height;
         int stride;
         unsigned int out_size;
-        void (*convert_line_to_RGB24) (void *line, int width, uint8_t **out_line);
+        /* NULL if libjpeg takes the lines as they are */
+        pixel_convert_line_t convert_line;
     } cur_image;
 } JpegEncoder;
 
@@ -106,65 +108,6 @@ void jpeg_encoder_destroy(JpegEncoderContext* encoder)
     free(encoder);
 }
 
-static void convert_RGB16_to_RGB24(void *line, int width, uint8_t **out_line)
-{
-    uint16_t *src_line = line;
-    uint8_t *out_pix;
-    int x;
-
-    spice_assert(out_line && *out_line);
-
-    out_pix = *out_line;
-
-    for (x = 0; x < width; x++) {
-       uint16_t pixel = *src_line++;
-       *out_pix++ = ((pixel >> 7) & 0xf8) | ((pixel >> 12) & 0x7);
-       *out_pix++ = ((pixel >> 2) & 0xf8) | ((pixel >> 7) & 0x7);
-       *out_pix++ = ((pixel << 3) & 0xf8) | ((pixel >> 2) & 0x7);
-   }
-}
-
-static void convert_BGR24_to_RGB24(void *in_line, int width, uint8_t **out_line)
-{
-    int x;
-    uint8_t *out_pix;
-    uint8_t *line = in_line;
-    spice_assert(out_line && *out_line);
-
-    out_pix = *out_line;
-
-    for (x = 0; x < width; x++) {
-        *out_pix++ = line[2];
-        *out_pix++ = line[1];
-        *out_pix++ = line[0];
-        line += 3;
-    }
-}
-
-static void convert_BGRX32_to_RGB24(void *line, int width, uint8_t **out_line)
-{
-    uint32_t *src_line = line;
-    uint8_t *out_pix;
-    int x;
-
-    spice_assert(out_line && *out_line);
-
-    out_pix = *out_line;
-
-    for (x = 0; x < width; x++) {
-        uint32_t pixel = *src_line++;
-        *out_pix++ = (pixel >> 16) & 0xff;
-        *out_pix++ = (pixel >> 8) & 0xff;
-        *out_pix++ = pixel & 0xff;
-    }
-}
-
-static void convert_RGB24_to_RGB24(void *line, int width, uint8_t **out_line)
-{
-    *out_line = line;
-}
-
-
 #define FILL_LINES() {                                                  \
     if (lines == lines_end) {                                           \
         int n = jpeg->usr->more_lines(jpeg->usr, &lines);               \
@@ -178,13 +121,13 @@ static void convert_RGB24_to_RGB24(void *line, int width, uint8_t **out_line)
 static void do_jpeg_encode(JpegEncoder *jpeg, uint8_t *lines, unsigned int num_lines)
 {
     uint8_t *lines_end;
-    uint8_t *RGB24_line;
+    uint8_t *RGB24_line = NULL;
     int stride, width;
     JSAMPROW row_pointer[1];
     width = jpeg->cur_image.width;
     stride = jpeg->cur_image.stride;
 
-    if (jpeg->cur_image.type != JPEG_IMAGE_TYPE_RGB24) {
+    if (jpeg->cur_image.convert_line) {
         RGB24_line = (uint8_t *)spice_malloc(width*3);
     }
 
@@ -192,14 +135,16 @@ static void do_jpeg_encode(JpegEncoder *jpeg, uint8_t *lines, unsigned int num_l
 
     for (;jpeg->cinfo.next_scanline < jpeg->cinfo.image_height; lines += stride) {
         FILL_LINES();
-        jpeg->cur_image.convert_line_to_RGB24(lines, width, &RGB24_line);
-        row_pointer[0] = RGB24_line;
+        if (jpeg->cur_image.convert_line) {
+            jpeg->cur_image.convert_line(lines, RGB24_line, width);
+            row_pointer[0] = RGB24_line;
+        } else {
+            row_pointer[0] = lines;
+        }
         jpeg_write_scanlines(&jpeg->cinfo, row_pointer, 1);
     }
 
-    if (jpeg->cur_image.type != JPEG_IMAGE_TYPE_RGB24) {
-        free(RGB24_line);
-    }
+    free(RGB24_line);
 }
 
 int jpeg_encode(JpegEncoderContext *jpeg, int quality, JpegEncoderImageType type,
@@ -214,32 +159,50 @@ int jpeg_encode(JpegEncoderContext *jpeg, int quality, JpegEncoderImageType type
     enc->cur_image.stride = stride;
     enc->cur_image.out_size = 0;
 
+    enc->cinfo.image_width = width;
+    enc->cinfo.image_height = height;
+    enc->cinfo.input_components = 3;
+    enc->cinfo.in_color_space = JCS_RGB;
+    enc->cur_image.convert_line = NULL;
+
+    /* libjpeg-turbo reads the 24 and 32 bits pixels as they are, saving a
+     * copy of each line */
     switch (type) {
     case JPEG_IMAGE_TYPE_RGB16:
-        enc->cur_image.convert_line_to_RGB24 = convert_RGB16_to_RGB24;
+        enc->cur_image.convert_line = pixel_convert_get_line_to_rgb24(PIXEL_CONVERT_RGB16);
         break;
     case JPEG_IMAGE_TYPE_RGB24:
-        enc->cur_image.convert_line_to_RGB24 = convert_RGB24_to_RGB24;
         break;
     case JPEG_IMAGE_TYPE_BGR24:
-        enc->cur_image.convert_line_to_RGB24 = convert_BGR24_to_RGB24;
+#ifdef JCS_EXTENSIONS
+        enc->cinfo.in_color_space = JCS_EXT_BGR;
+#else
+        enc->cur_image.convert_line = pixel_convert_get_line_to_rgb24(PIXEL_CONVERT_BGR24);
+#endif
         break;
     case JPEG_IMAGE_TYPE_BGRX32:
-        enc->cur_image.convert_line_to_RGB24 = convert_BGRX32_to_RGB24;
+#ifdef JCS_EXTENSIONS
+        enc->cinfo.in_color_space = JCS_EXT_BGRX;
+        enc->cinfo.input_components = 4;
+#else
+        enc->cur_image.convert_line = pixel_convert_get_line_to_rgb24(PIXEL_CONVERT_BGRX32);
+#endif
         break;
     default:
         spice_error("bad image type");
     }
 
-    enc->cinfo.image_width = width;
-    enc->cinfo.image_height = height;
-    enc->cinfo.input_components = 3;
-    enc->cinfo.in_color_space = JCS_RGB;
     jpeg_set_defaults(&enc->cinfo);
 
     jpeg_set_quality(&enc->cinfo, quality, TRUE);
-    enc->cinfo.comp_info[0].h_samp_factor = 1;
-    enc->cinfo.comp_info[0].v_samp_factor = 1;
+    /* at low qualities the details of the colors are lost anyway */
+    if (quality < JPEG_SUBSAMPLING_MAX_QUALITY) {
+        enc->cinfo.comp_info[0].h_samp_factor = 2;
+        enc->cinfo.comp_info[0].v_samp_factor = 2;
+    } else {
+        enc->cinfo.comp_info[0].h_samp_factor = 1;
+        enc->cinfo.comp_info[0].v_samp_factor = 1;
+    }
     enc->cinfo.comp_info[1].h_samp_factor = 1;
     enc->cinfo.comp_info[1].v_samp_factor = 1;
     enc->cinfo.comp_info[2].h_samp_factor = 1;
@@ -54,6 +54,9 @@ struct JpegEncoderUsrContext {
 JpegEncoderContext* jpeg_encoder_create(JpegEncoderUsrContext *usr);
 void jpeg_encoder_destroy(JpegEncoderContext *encoder);
 
+/* the chroma is subsampled by 2 both ways below that quality */
+#define JPEG_SUBSAMPLING_MAX_QUALITY 50
+
 /* returns the total size of the encoded data. Images must be supplied from the
    top line to the bottom */
 int jpeg_encode(JpegEncoderContext *jpeg, int quality, JpegEncoderImageType type,
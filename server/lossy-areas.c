@@ -0,0 +1,74 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <common/rect.h>
+
+#include "lossy-areas.h"
+
+static void lossy_areas_remove(LossyAreas *areas, int i)
+{
+    memmove(&areas->areas[i], &areas->areas[i + 1],
+            (areas->n_areas - i - 1) * sizeof(LossyArea));
+    areas->n_areas--;
+}
+
+void lossy_areas_note(LossyAreas *areas, uint32_t surface_id, const SpiceRect *area)
+{
+    int i;
+
+    for (i = 0; i < areas->n_areas; i++) {
+        if (areas->areas[i].surface_id == surface_id &&
+            rect_is_equal(&areas->areas[i].area, area)) {
+            break;
+        }
+    }
+    if (i == LOSSY_AREAS_MAX) {
+        /* forgetting the oldest */
+        i = 0;
+    }
+    if (i < areas->n_areas) {
+        lossy_areas_remove(areas, i);
+    }
+    areas->areas[areas->n_areas].surface_id = surface_id;
+    areas->areas[areas->n_areas].area = *area;
+    areas->n_areas++;
+}
+
+bool lossy_areas_take(LossyAreas *areas, uint32_t first_surface_id, LossyArea *lossy)
+{
+    int i;
+
+    if (areas->n_areas == 0) {
+        return false;
+    }
+    for (i = areas->n_areas - 1; i > 0; i--) {
+        if (areas->areas[i].surface_id == first_surface_id) {
+            break;
+        }
+    }
+    if (areas->areas[i].surface_id != first_surface_id) {
+        i = areas->n_areas - 1;
+    }
+    *lossy = areas->areas[i];
+    lossy_areas_remove(areas, i);
+    return true;
+}
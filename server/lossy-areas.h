@@ -0,0 +1,56 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOSSY_AREAS_H_
+#define LOSSY_AREAS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <spice/enums.h>
+#include <common/draw.h>
+
+/*
+ * The areas recently sent lossy to a client, in the order they are to be
+ * refined, see dcc_refine_lossy(). Beyond LOSSY_AREAS_MAX the oldest are
+ * forgotten, they are only found in the lossy region of the client.
+ */
+#define LOSSY_AREAS_MAX 32
+
+typedef struct LossyArea {
+    uint32_t surface_id;
+    SpiceRect area;
+} LossyArea;
+
+typedef struct LossyAreas {
+    /* the most recent last */
+    LossyArea areas[LOSSY_AREAS_MAX];
+    int n_areas;
+} LossyAreas;
+
+/* @area of @surface_id was just sent lossy, it becomes the most recent */
+void lossy_areas_note(LossyAreas *areas, uint32_t surface_id, const SpiceRect *area);
+/* removes the most recent area of @first_surface_id, or the most recent
+ * one if there is none, into @lossy */
+bool lossy_areas_take(LossyAreas *areas, uint32_t first_surface_id, LossyArea *lossy);
+
+static inline bool lossy_areas_is_empty(const LossyAreas *areas)
+{
+    return areas->n_areas == 0;
+}
+
+#endif /* LOSSY_AREAS_H_ */
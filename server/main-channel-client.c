@@ -633,12 +633,16 @@ int main_channel_client_is_network_info_initialized(MainChannelClient *mcc)
 int main_channel_client_is_low_bandwidth(MainChannelClient *mcc)
 {
     // TODO: configurable?
-    return mcc->priv->bitrate_per_sec < 10 * 1024 * 1024;
+    return main_channel_client_get_bitrate_per_sec(mcc) < NET_LOW_BANDWIDTH_BITRATE;
 }
 
+/* the network test only gives the bandwidth at connection time,
+ * prefer the current estimation once there is one */
 uint64_t main_channel_client_get_bitrate_per_sec(MainChannelClient *mcc)
 {
-    return mcc->priv->bitrate_per_sec;
+    uint64_t bitrate = red_channel_client_get_bitrate_estimate(RED_CHANNEL_CLIENT(mcc));
+
+    return bitrate ? bitrate : mcc->priv->bitrate_per_sec;
 }
 
 uint64_t main_channel_client_get_roundtrip_ms(MainChannelClient *mcc)
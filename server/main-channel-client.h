@@ -90,9 +90,13 @@ gboolean main_channel_client_migrate_src_complete(MainChannelClient *mcc,
 
 void main_channel_client_handle_pong(MainChannelClient *mcc, SpiceMsgPing *ping, uint32_t size);
 
+/* connections slower than this (bits per second) are low bandwidth */
+#define NET_LOW_BANDWIDTH_BITRATE (10 * 1024 * 1024)
+
 /*
  * return TRUE if network test had been completed successfully.
  * If FALSE, bitrate_per_sec is set to MAX_UINT64 and the roundtrip is set to 0
+ * unless the connection bandwidth could be estimated since then
  */
 int main_channel_client_is_network_info_initialized(MainChannelClient *mcc);
 int main_channel_client_is_low_bandwidth(MainChannelClient *mcc);
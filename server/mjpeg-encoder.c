@@ -26,6 +26,7 @@
 
 #include "red-common.h"
 #include "video-encoder.h"
+#include "pixel-convert.h"
 #include "utils.h"
 
 #define MJPEG_MAX_FPS 25
@@ -172,7 +173,7 @@ typedef struct MJpegEncoder {
     struct jpeg_error_mgr jerr;
 
     unsigned int bytes_per_pixel; /* bytes per pixel of the input buffer */
-    void (*pixel_converter)(void *src, uint8_t *dest);
+    pixel_convert_line_t line_converter;
 
     MJpegEncoderRateControl rate_control;
     VideoEncoderRateControlCbs cbs;
@@ -222,35 +223,6 @@ static uint8_t mjpeg_encoder_get_bytes_per_pixel(MJpegEncoder *encoder)
     return encoder->bytes_per_pixel;
 }
 
-#ifndef JCS_EXTENSIONS
-/* Pixel conversion routines */
-static void pixel_rgb24bpp_to_24(void *src_ptr, uint8_t *dest)
-{
-    uint8_t *src = src_ptr;
-    /* libjpegs stores rgb, spice/win32 stores bgr */
-    *dest++ = src[2]; /* red */
-    *dest++ = src[1]; /* green */
-    *dest++ = src[0]; /* blue */
-}
-
-static void pixel_rgb32bpp_to_24(void *src, uint8_t *dest)
-{
-    uint32_t pixel = *(uint32_t *)src;
-    *dest++ = (pixel >> 16) & 0xff;
-    *dest++ = (pixel >>  8) & 0xff;
-    *dest++ = (pixel >>  0) & 0xff;
-}
-#endif
-
-static void pixel_rgb16bpp_to_24(void *src, uint8_t *dest)
-{
-    uint16_t pixel = *(uint16_t *)src;
-    *dest++ = ((pixel >> 7) & 0xf8) | ((pixel >> 12) & 0x7);
-    *dest++ = ((pixel >> 2) & 0xf8) | ((pixel >> 7) & 0x7);
-    *dest++ = ((pixel << 3) & 0xf8) | ((pixel >> 2) & 0x7);
-}
-
-
 /* code from libjpeg 8 to handle compression to a memory buffer
  *
  * Copyright (C) 1994-1996, Thomas G. Lane.
@@ -755,7 +727,7 @@ static int mjpeg_encoder_start_frame(MJpegEncoder *encoder,
 
     encoder->cinfo.in_color_space   = JCS_RGB;
     encoder->cinfo.input_components = 3;
-    encoder->pixel_converter = NULL;
+    encoder->line_converter = NULL;
 
     switch (format) {
     case SPICE_BITMAP_FMT_32BIT:
@@ -765,19 +737,19 @@ static int mjpeg_encoder_start_frame(MJpegEncoder *encoder,
         encoder->cinfo.in_color_space   = JCS_EXT_BGRX;
         encoder->cinfo.input_components = 4;
 #else
-        encoder->pixel_converter = pixel_rgb32bpp_to_24;
+        encoder->line_converter = pixel_convert_get_line_to_rgb24(PIXEL_CONVERT_BGRX32);
 #endif
         break;
     case SPICE_BITMAP_FMT_16BIT:
         encoder->bytes_per_pixel = 2;
-        encoder->pixel_converter = pixel_rgb16bpp_to_24;
+        encoder->line_converter = pixel_convert_get_line_to_rgb24(PIXEL_CONVERT_RGB16);
         break;
     case SPICE_BITMAP_FMT_24BIT:
         encoder->bytes_per_pixel = 3;
 #ifdef JCS_EXTENSIONS
         encoder->cinfo.in_color_space = JCS_EXT_BGR;
 #else
-        encoder->pixel_converter = pixel_rgb24bpp_to_24;
+        encoder->line_converter = pixel_convert_get_line_to_rgb24(PIXEL_CONVERT_BGR24);
 #endif
         break;
     default:
@@ -787,7 +759,7 @@ static int mjpeg_encoder_start_frame(MJpegEncoder *encoder,
 
     encoder->cinfo.image_width = src->right - src->left;
     encoder->cinfo.image_height = src->bottom - src->top;
-    if (encoder->pixel_converter != NULL) {
+    if (encoder->line_converter != NULL) {
         JDIMENSION stride = encoder->cinfo.image_width * 3;
         /* check for integer overflow */
         if (stride < encoder->cinfo.image_width) {
@@ -817,17 +789,9 @@ static int mjpeg_encoder_encode_scanline(MJpegEncoder *encoder,
                                          size_t image_width)
 {
     unsigned int scanlines_written;
-    uint8_t *row;
 
-    row = encoder->row;
-    if (encoder->pixel_converter) {
-        unsigned int x;
-        for (x = 0; x < image_width; x++) {
-            /* src_pixels is expected to be 4 bytes aligned */
-            encoder->pixel_converter(src_pixels, row);
-            row += 3;
-            src_pixels += encoder->bytes_per_pixel;
-        }
+    if (encoder->line_converter) {
+        encoder->line_converter(src_pixels, encoder->row, image_width);
         scanlines_written = jpeg_write_scanlines(&encoder->cinfo, &encoder->row, 1);
     } else {
         scanlines_written = jpeg_write_scanlines(&encoder->cinfo, &src_pixels, 1);
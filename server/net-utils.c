@@ -136,3 +136,40 @@ int red_socket_get_no_delay(int fd)
 
     return delay_val;
 }
+
+/**
+ * red_socket_get_tcp_info:
+ * @fd: a TCP socket file descriptor
+ * @info: filled with the kernel view of the connection (TCP_INFO)
+ *
+ * Returns: #true if the operation succeeded, #false otherwise.
+ */
+bool red_socket_get_tcp_info(int fd, RedSocketTcpInfo *info)
+{
+#ifdef TCP_INFO
+    struct tcp_info tcp_info;
+    socklen_t opt_size = sizeof(tcp_info);
+
+    memset(&tcp_info, 0, sizeof(tcp_info));
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &tcp_info, &opt_size) == -1) {
+        return false;
+    }
+
+    info->rtt_us = tcp_info.tcpi_rtt;
+    info->rtt_var_us = tcp_info.tcpi_rttvar;
+    info->unacked = tcp_info.tcpi_unacked;
+    info->snd_cwnd = tcp_info.tcpi_snd_cwnd;
+    info->snd_mss = tcp_info.tcpi_snd_mss;
+#ifdef HAVE_STRUCT_TCP_INFO_TCPI_DELIVERY_RATE
+    info->delivery_rate = tcp_info.tcpi_delivery_rate;
+    info->app_limited = tcp_info.tcpi_delivery_rate_app_limited;
+#else
+    info->delivery_rate = 0;
+    info->app_limited = false;
+#endif
+
+    return true;
+#else
+    return false;
+#endif
+}
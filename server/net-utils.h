@@ -19,10 +19,24 @@
 #define RED_NET_UTILS_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+
+typedef struct RedSocketTcpInfo {
+    uint32_t rtt_us;
+    uint32_t rtt_var_us;
+    uint32_t unacked;
+    uint32_t snd_cwnd;
+    uint32_t snd_mss;
+    /* bytes per second, 0 if not reported by the kernel */
+    uint64_t delivery_rate;
+    /* the last delivery rate sample was limited by the sender */
+    bool app_limited;
+} RedSocketTcpInfo;
 
 bool red_socket_set_keepalive(int fd, bool enable, int timeout);
 bool red_socket_set_no_delay(int fd, bool no_delay);
 int red_socket_get_no_delay(int fd);
 bool red_socket_set_non_blocking(int fd, bool non_blocking);
+bool red_socket_get_tcp_info(int fd, RedSocketTcpInfo *info);
 
 #endif /* RED_NET_UTILS_H_ */
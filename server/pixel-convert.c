@@ -0,0 +1,259 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <common/log.h>
+
+#include "pixel-convert.h"
+#include "utils.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+static inline void rgb16_to_rgb24(uint16_t pixel, uint8_t *dest)
+{
+    dest[0] = ((pixel >> 7) & 0xf8) | ((pixel >> 12) & 0x7);
+    dest[1] = ((pixel >> 2) & 0xf8) | ((pixel >> 7) & 0x7);
+    dest[2] = ((pixel << 3) & 0xf8) | ((pixel >> 2) & 0x7);
+}
+
+static void convert_rgb16_scalar(const uint8_t *src, uint8_t *dest, int width)
+{
+    const uint16_t *src_line = (const uint16_t *)src;
+    int x;
+
+    for (x = 0; x < width; x++) {
+        rgb16_to_rgb24(src_line[x], dest + x * 3);
+    }
+}
+
+static void convert_bgr24_scalar(const uint8_t *src, uint8_t *dest, int width)
+{
+    int x;
+
+    for (x = 0; x < width; x++) {
+        dest[0] = src[2];
+        dest[1] = src[1];
+        dest[2] = src[0];
+        src += 3;
+        dest += 3;
+    }
+}
+
+static void convert_bgrx32_scalar(const uint8_t *src, uint8_t *dest, int width)
+{
+    const uint32_t *src_line = (const uint32_t *)src;
+    int x;
+
+    for (x = 0; x < width; x++) {
+        uint32_t pixel = src_line[x];
+        *dest++ = (pixel >> 16) & 0xff;
+        *dest++ = (pixel >> 8) & 0xff;
+        *dest++ = pixel & 0xff;
+    }
+}
+
+#ifdef SIMD_X86
+/*
+ * The vector versions convert the pixels in groups, the last pixels of the
+ * line are converted by the scalar version. They never read or write past
+ * the line.
+ */
+
+/* R, G, B of each 32 bits lane in the 12 low bytes, as libjpeg wants them */
+#define SHUFFLE_BGRX_TO_RGB                                             \
+    _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+/* the same from bytes R, G, B, 0 */
+#define SHUFFLE_RGBX_TO_RGB                                             \
+    _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1)
+
+/* writes the 12 low bytes of @a then of @b */
+__attribute__((target("ssse3")))
+static inline void store_24_bytes(uint8_t *dest, __m128i a, __m128i b)
+{
+    _mm_storeu_si128((__m128i *)dest, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+    _mm_storel_epi64((__m128i *)(dest + 16), _mm_srli_si128(b, 4));
+}
+
+__attribute__((target("ssse3")))
+static void convert_bgrx32_ssse3(const uint8_t *src, uint8_t *dest, int width)
+{
+    const __m128i shuffle = SHUFFLE_BGRX_TO_RGB;
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        const __m128i *in = (const __m128i *)(src + x * 4);
+        __m128i *out = (__m128i *)(dest + x * 3);
+        __m128i p0 = _mm_shuffle_epi8(_mm_loadu_si128(in), shuffle);
+        __m128i p1 = _mm_shuffle_epi8(_mm_loadu_si128(in + 1), shuffle);
+        __m128i p2 = _mm_shuffle_epi8(_mm_loadu_si128(in + 2), shuffle);
+        __m128i p3 = _mm_shuffle_epi8(_mm_loadu_si128(in + 3), shuffle);
+
+        _mm_storeu_si128(out, _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+    }
+    convert_bgrx32_scalar(src + x * 4, dest + x * 3, width - x);
+}
+
+__attribute__((target("avx2")))
+static void convert_bgrx32_avx2(const uint8_t *src, uint8_t *dest, int width)
+{
+    const __m256i shuffle = _mm256_broadcastsi128_si256(SHUFFLE_BGRX_TO_RGB);
+    /* the 24 bytes of the 2 lanes next to each other */
+    const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i *)(src + x * 4));
+
+        p = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(p, shuffle), pack);
+        _mm_storeu_si128((__m128i *)(dest + x * 3), _mm256_castsi256_si128(p));
+        _mm_storel_epi64((__m128i *)(dest + x * 3 + 16), _mm256_extracti128_si256(p, 1));
+    }
+    convert_bgrx32_scalar(src + x * 4, dest + x * 3, width - x);
+}
+
+/* 5 pixels per 16 bytes, the last byte is written again by the next group */
+__attribute__((target("ssse3")))
+static void convert_bgr24_ssse3(const uint8_t *src, uint8_t *dest, int width)
+{
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6,
+                                          11, 10, 9, 14, 13, 12, 15);
+    int x;
+
+    for (x = 0; x + 6 <= width; x += 5) {
+        __m128i p = _mm_loadu_si128((const __m128i *)(src + x * 3));
+
+        _mm_storeu_si128((__m128i *)(dest + x * 3), _mm_shuffle_epi8(p, shuffle));
+    }
+    convert_bgr24_scalar(src + x * 3, dest + x * 3, width - x);
+}
+
+/* expands the 5 bits colors of 16 bits lanes like rgb16_to_rgb24() does,
+ * returns R | G << 8 in @rg and B in @b */
+__attribute__((target("ssse3")))
+static inline void expand_rgb16_sse(__m128i p, __m128i *rg, __m128i *b)
+{
+    const __m128i mask_high = _mm_set1_epi16(0xf8);
+    const __m128i mask_low = _mm_set1_epi16(0x7);
+    __m128i r, g;
+
+    r = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(p, 7), mask_high),
+                     _mm_and_si128(_mm_srli_epi16(p, 12), mask_low));
+    g = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(p, 2), mask_high),
+                     _mm_and_si128(_mm_srli_epi16(p, 7), mask_low));
+    *b = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(p, 3), mask_high),
+                      _mm_and_si128(_mm_srli_epi16(p, 2), mask_low));
+    *rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+}
+
+__attribute__((target("ssse3")))
+static void convert_rgb16_ssse3(const uint8_t *src, uint8_t *dest, int width)
+{
+    const __m128i shuffle = SHUFFLE_RGBX_TO_RGB;
+    int x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        __m128i rg, b;
+
+        expand_rgb16_sse(_mm_loadu_si128((const __m128i *)(src + x * 2)), &rg, &b);
+        store_24_bytes(dest + x * 3,
+                       _mm_shuffle_epi8(_mm_unpacklo_epi16(rg, b), shuffle),
+                       _mm_shuffle_epi8(_mm_unpackhi_epi16(rg, b), shuffle));
+    }
+    convert_rgb16_scalar(src + x * 2, dest + x * 3, width - x);
+}
+
+__attribute__((target("avx2")))
+static void convert_rgb16_avx2(const uint8_t *src, uint8_t *dest, int width)
+{
+    const __m256i shuffle = _mm256_broadcastsi128_si256(SHUFFLE_RGBX_TO_RGB);
+    const __m256i mask_high = _mm256_set1_epi16(0xf8);
+    const __m256i mask_low = _mm256_set1_epi16(0x7);
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m256i p = _mm256_loadu_si256((const __m256i *)(src + x * 2));
+        __m256i r, g, b, rg, lo, hi;
+
+        r = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(p, 7), mask_high),
+                            _mm256_and_si256(_mm256_srli_epi16(p, 12), mask_low));
+        g = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(p, 2), mask_high),
+                            _mm256_and_si256(_mm256_srli_epi16(p, 7), mask_low));
+        b = _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi16(p, 3), mask_high),
+                            _mm256_and_si256(_mm256_srli_epi16(p, 2), mask_low));
+        rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+        /* pixels 0-3 and 8-11, 4-7 and 12-15 */
+        lo = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(rg, b), shuffle);
+        hi = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(rg, b), shuffle);
+        store_24_bytes(dest + x * 3, _mm256_castsi256_si128(lo), _mm256_castsi256_si128(hi));
+        store_24_bytes(dest + x * 3 + 24, _mm256_extracti128_si256(lo, 1),
+                       _mm256_extracti128_si256(hi, 1));
+    }
+    /* gcc doesn't clear the upper halves before the tail call, the SSE
+     * instructions would be much slower until the next AVX function returns */
+    _mm256_zeroupper();
+    convert_rgb16_ssse3(src + x * 2, dest + x * 3, width - x);
+}
+#endif
+
+pixel_convert_line_t pixel_convert_get_line_to_rgb24(PixelConvertFormat format)
+{
+#ifdef SIMD_X86
+    SimdLevel level = simd_get_level();
+#endif
+
+    switch (format) {
+    case PIXEL_CONVERT_RGB16:
+#ifdef SIMD_X86
+        if (level >= SIMD_LEVEL_AVX2) {
+            return convert_rgb16_avx2;
+        }
+        if (level >= SIMD_LEVEL_SSSE3) {
+            return convert_rgb16_ssse3;
+        }
+#endif
+        return convert_rgb16_scalar;
+    case PIXEL_CONVERT_BGR24:
+#ifdef SIMD_X86
+        /* the 256 bits shuffles stay in their lanes, which doesn't suit
+         * 3 bytes pixels */
+        if (level >= SIMD_LEVEL_SSSE3) {
+            return convert_bgr24_ssse3;
+        }
+#endif
+        return convert_bgr24_scalar;
+    case PIXEL_CONVERT_BGRX32:
+#ifdef SIMD_X86
+        if (level >= SIMD_LEVEL_AVX2) {
+            return convert_bgrx32_avx2;
+        }
+        if (level >= SIMD_LEVEL_SSSE3) {
+            return convert_bgrx32_ssse3;
+        }
+#endif
+        return convert_bgrx32_scalar;
+    default:
+        spice_error("bad pixel format %d", format);
+        return NULL;
+    }
+}
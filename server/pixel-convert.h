@@ -0,0 +1,46 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PIXEL_CONVERT_H_
+#define PIXEL_CONVERT_H_
+
+#include <stdint.h>
+
+/*
+ * Conversion of lines of pixels to the 8 bits R, G, B bytes libjpeg takes
+ * as JCS_RGB input, for the JPEG and MJPEG encoders.
+ *
+ * The version using the best vector instructions supported by the CPU is
+ * picked when the converter is asked for (see simd_get_level()), all the
+ * versions give exactly the same bytes.
+ */
+typedef enum {
+    /* 16 bits words with 5 bits per color, red in the upper bits */
+    PIXEL_CONVERT_RGB16,
+    /* in byte per color formats, the notation is according to the order of
+       the colors in the memory */
+    PIXEL_CONVERT_BGR24,
+    PIXEL_CONVERT_BGRX32,
+} PixelConvertFormat;
+
+/* converts the @width pixels of @src to @width * 3 bytes in @dest */
+typedef void (*pixel_convert_line_t)(const uint8_t *src, uint8_t *dest, int width);
+
+pixel_convert_line_t pixel_convert_get_line_to_rgb24(PixelConvertFormat format);
+
+#endif /* PIXEL_CONVERT_H_ */
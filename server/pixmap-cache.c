@@ -19,12 +19,14 @@
 #endif
 
 #include "pixmap-cache.h"
+#include "red-client.h"
+#include "reds.h"
 
 int pixmap_cache_unlocked_set_lossy(PixmapCache *cache, uint64_t id, int lossy)
 {
     NewCacheItem *item;
 
-    item = cache->hash_table[BITS_CACHE_HASH_KEY(id)];
+    item = pixmap_cache_get_shard(cache, id)->hash_table[BITS_CACHE_HASH_KEY(id)];
 
     while (item) {
         if (item->id == id) {
@@ -36,54 +38,135 @@ int pixmap_cache_unlocked_set_lossy(PixmapCache *cache, uint64_t id, int lossy)
     return !!item;
 }
 
-void pixmap_cache_clear(PixmapCache *cache)
+static bool pixmap_content_equal(const PixmapContent *a, const PixmapContent *b)
+{
+    return a->hash == b->hash && a->width == b->width && a->height == b->height &&
+           a->stride == b->stride && a->format == b->format && a->flags == b->flags;
+}
+
+NewCacheItem *pixmap_cache_unlocked_find_content(PixmapCacheShard *shard,
+                                                 const PixmapContent *content)
+{
+    NewCacheItem *item;
+
+    item = shard->content_table[BITS_CACHE_HASH_KEY(content->hash)];
+    while (item) {
+        if (pixmap_content_equal(&item->content, content)) {
+            break;
+        }
+        item = item->content_next;
+    }
+    return item;
+}
+
+void pixmap_cache_unlocked_remove_content(PixmapCacheShard *shard, NewCacheItem *item)
+{
+    NewCacheItem **now;
+
+    if (!item->content.hash) {
+        return;
+    }
+    now = &shard->content_table[BITS_CACHE_HASH_KEY(item->content.hash)];
+    for (;;) {
+        spice_assert(*now);
+        if (*now == item) {
+            *now = item->content_next;
+            break;
+        }
+        now = &(*now)->content_next;
+    }
+}
+
+void pixmap_cache_lock_all(PixmapCache *cache)
+{
+    uint32_t i;
+
+    for (i = 0; i < cache->n_shards; i++) {
+        pthread_mutex_lock(&cache->shards[i].lock);
+    }
+}
+
+void pixmap_cache_unlock_all(PixmapCache *cache)
+{
+    uint32_t i;
+
+    for (i = cache->n_shards; i > 0; i--) {
+        pthread_mutex_unlock(&cache->shards[i - 1].lock);
+    }
+}
+
+static void pixmap_cache_shard_clear(PixmapCache *cache, PixmapCacheShard *shard)
 {
     NewCacheItem *item;
 
     if (cache->frozen) {
-        cache->lru.next = cache->frozen_head;
-        cache->lru.prev = cache->frozen_tail;
-        cache->frozen = FALSE;
+        shard->lru.next = shard->frozen_head;
+        shard->lru.prev = shard->frozen_tail;
     }
 
     SPICE_VERIFY(SPICE_OFFSETOF(NewCacheItem, lru_link) == 0);
-    while ((item = (NewCacheItem *)ring_get_head(&cache->lru))) {
+    while ((item = (NewCacheItem *)ring_get_head(&shard->lru))) {
         ring_remove(&item->lru_link);
         free(item);
     }
-    memset(cache->hash_table, 0, sizeof(*cache->hash_table) * BITS_CACHE_HASH_SIZE);
+    memset(shard->hash_table, 0, sizeof(shard->hash_table));
+    memset(shard->content_table, 0, sizeof(shard->content_table));
+
+    /* a negative size keeps the cache frozen */
+    shard->available = cache->size < 0 ? cache->size : cache->size / cache->n_shards;
+    shard->items = 0;
+}
 
-    cache->available = cache->size;
-    cache->items = 0;
+void pixmap_cache_clear(PixmapCache *cache)
+{
+    uint32_t i;
+
+    for (i = 0; i < cache->n_shards; i++) {
+        pixmap_cache_shard_clear(cache, &cache->shards[i]);
+    }
+    cache->frozen = FALSE;
 }
 
 bool pixmap_cache_freeze(PixmapCache *cache)
 {
-    pthread_mutex_lock(&cache->lock);
+    uint32_t i;
+
+    pixmap_cache_lock_all(cache);
 
     if (cache->frozen) {
-        pthread_mutex_unlock(&cache->lock);
+        pixmap_cache_unlock_all(cache);
         return FALSE;
     }
 
-    cache->frozen_head = cache->lru.next;
-    cache->frozen_tail = cache->lru.prev;
-    ring_init(&cache->lru);
-    memset(cache->hash_table, 0, sizeof(*cache->hash_table) * BITS_CACHE_HASH_SIZE);
-    cache->available = -1;
+    for (i = 0; i < cache->n_shards; i++) {
+        PixmapCacheShard *shard = &cache->shards[i];
+
+        shard->frozen_head = shard->lru.next;
+        shard->frozen_tail = shard->lru.prev;
+        ring_init(&shard->lru);
+        memset(shard->hash_table, 0, sizeof(shard->hash_table));
+        memset(shard->content_table, 0, sizeof(shard->content_table));
+        shard->available = -1;
+    }
     cache->frozen = TRUE;
 
-    pthread_mutex_unlock(&cache->lock);
+    pixmap_cache_unlock_all(cache);
     return TRUE;
 }
 
 static void pixmap_cache_destroy(PixmapCache *cache)
 {
+    uint32_t i;
+
     spice_assert(cache);
 
-    pthread_mutex_lock(&cache->lock);
+    pixmap_cache_lock_all(cache);
     pixmap_cache_clear(cache);
-    pthread_mutex_unlock(&cache->lock);
+    pixmap_cache_unlock_all(cache);
+    for (i = 0; i < cache->n_shards; i++) {
+        pthread_mutex_destroy(&cache->shards[i].lock);
+    }
+    free(cache->shards);
 }
 
 
@@ -93,15 +176,22 @@ static Ring pixmap_cache_list = {&pixmap_cache_list, &pixmap_cache_list};
 static PixmapCache *pixmap_cache_new(RedClient *client, uint8_t id, int64_t size)
 {
     PixmapCache *cache = spice_new0(PixmapCache, 1);
+    uint32_t i;
 
     ring_item_init(&cache->base);
-    pthread_mutex_init(&cache->lock, NULL);
     cache->id = id;
     cache->refs = 1;
-    ring_init(&cache->lru);
-    cache->available = size;
+    cache->n_shards = reds_get_pixmap_cache_shards(red_client_get_server(client));
+    cache->shards = spice_new0(PixmapCacheShard, cache->n_shards);
     cache->size = size;
     cache->client = client;
+    for (i = 0; i < cache->n_shards; i++) {
+        PixmapCacheShard *shard = &cache->shards[i];
+
+        pthread_mutex_init(&shard->lock, NULL);
+        ring_init(&shard->lru);
+        shard->available = size < 0 ? size : size / cache->n_shards;
+    }
 
     return cache;
 }
@@ -28,32 +28,76 @@
 #define BITS_CACHE_HASH_MASK (BITS_CACHE_HASH_SIZE - 1)
 #define BITS_CACHE_HASH_KEY(id) ((id) & BITS_CACHE_HASH_MASK)
 
+#define PIXMAP_CACHE_MAX_SHARDS 16
+
 typedef struct PixmapCache PixmapCache;
+typedef struct PixmapCacheShard PixmapCacheShard;
 typedef struct NewCacheItem NewCacheItem;
 
+/*
+ * What identifies the content of a bitmap. Two bitmaps are taken as the
+ * same image when all of it matches, the pixels only being compared through
+ * their 64 bit hash: the client would show the wrong image if two bitmaps of
+ * the same geometry collide, which is about 2^-64 for a given pair and stays
+ * negligible for the few thousands of images in a cache.
+ */
+typedef struct PixmapContent {
+    /* bitmap_hash() of the image, 0 if not known */
+    uint64_t hash;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint8_t format;
+    /* SPICE_BITMAP_FLAGS_TOP_DOWN or 0 */
+    uint8_t flags;
+} PixmapContent;
+
 struct NewCacheItem {
     RingItem lru_link;
     NewCacheItem *next;
+    /* next item in content_table, if content.hash is set */
+    NewCacheItem *content_next;
     uint64_t id;
+    PixmapContent content;
     uint64_t sync[MAX_CACHE_CLIENTS];
     size_t size;
     int lossy;
 };
 
-struct PixmapCache {
-    RingItem base;
+/*
+ * The items are spread by id between the shards, each one having its own
+ * lock, LRU and share of the size of the client cache, so that the worker
+ * threads of the display channels of a client don't wait for each other to
+ * look up different images.
+ */
+struct PixmapCacheShard {
     pthread_mutex_t lock;
-    uint8_t id;
-    uint32_t refs;
     NewCacheItem *hash_table[BITS_CACHE_HASH_SIZE];
+    /* the items by content.hash, to send the images the client already has
+     * under another id as references to the cached one */
+    NewCacheItem *content_table[BITS_CACHE_HASH_SIZE];
     Ring lru;
     int64_t available;
-    int64_t size;
     int32_t items;
 
-    int frozen;
     RingItem *frozen_head;
     RingItem *frozen_tail;
+};
+
+/*
+ * The fields of the PixmapCache itself are changed with all the shards
+ * locked, and can be read with any of them locked.
+ */
+struct PixmapCache {
+    RingItem base;
+    uint8_t id;
+    uint32_t refs;
+    uint32_t n_shards;
+    /* n_shards of them, each one holds two hash tables */
+    PixmapCacheShard *shards;
+    int64_t size;
+
+    int frozen;
 
     uint32_t generation;
     struct {
@@ -65,10 +109,22 @@ struct PixmapCache {
     RedClient *client;
 };
 
+static inline PixmapCacheShard *pixmap_cache_get_shard(PixmapCache *cache, uint64_t id)
+{
+    /* the low bits of the id select the bucket in the shard */
+    return &cache->shards[((id * 0x9e3779b97f4a7c15ULL) >> 32) % cache->n_shards];
+}
+
 PixmapCache *pixmap_cache_get(RedClient *client, uint8_t id, int64_t size);
 void         pixmap_cache_unref(PixmapCache *cache);
+/* the caller must hold all the locks */
 void         pixmap_cache_clear(PixmapCache *cache);
+void         pixmap_cache_lock_all(PixmapCache *cache);
+void         pixmap_cache_unlock_all(PixmapCache *cache);
 int          pixmap_cache_unlocked_set_lossy(PixmapCache *cache, uint64_t id, int lossy);
+NewCacheItem *pixmap_cache_unlocked_find_content(PixmapCacheShard *shard,
+                                                 const PixmapContent *content);
+void         pixmap_cache_unlocked_remove_content(PixmapCacheShard *shard, NewCacheItem *item);
 bool         pixmap_cache_freeze(PixmapCache *cache);
 
 #endif /* PIXMAP_CACHE_H_ */
@@ -39,8 +39,23 @@
 
 #define CLIENT_ACK_WINDOW 20
 
+/* Budget of a single batched write, see OutgoingMessageBatch */
+#define SEND_BATCH_MAX_BYTES (64 * 1024)
+#define SEND_BATCH_MAX_MESSAGES 64
+
+/* Writes smaller than this are copied by the kernel, see ZeroCopySend */
+#define ZEROCOPY_MIN_SIZE (32 * 1024)
+
 #define MAX_HEADER_SIZE sizeof(SpiceDataHeader)
 
+/* Minimal time between two TCP_INFO samples, see RedChannelClientNetEstimate */
+#define NET_ESTIMATE_INTERVAL_NS (250 * NSEC_PER_MILLISEC)
+/* a new sample accounts for 1/8 of the estimate, like the TCP srtt */
+#define NET_ESTIMATE_SHIFT 3
+
+/* Size of the read-ahead buffer, see IncomingMessageBuffer */
+#define RECEIVE_BUF_SIZE 4096
+
 #ifndef IOV_MAX
 #define IOV_MAX 1024
 #endif
@@ -100,19 +115,95 @@ typedef struct RedChannelClientConnectivityMonitor {
     SpiceTimer *timer;
 } RedChannelClientConnectivityMonitor;
 
+/*
+ * Smoothed bandwidth and roundtrip of the connection, kept up to date for
+ * the whole session: TCP_INFO is sampled while sending, at most every
+ * NET_ESTIMATE_INTERVAL_NS. The bitrate is the kernel delivery rate, or
+ * cwnd * mss / rtt if the kernel does not report it; samples taken while
+ * we were not sending enough to fill the pipe can only raise it.
+ * Without TCP_INFO (unix sockets) only the roundtrip of the latency
+ * monitor pings is used.
+ */
+typedef struct RedChannelClientNetEstimate {
+    bool tcp_info;
+    uint64_t last_sample_time;
+    /* bits per second, 0 if unknown */
+    uint64_t bitrate;
+    /* nanoseconds, -1 if unknown */
+    int64_t rtt;
+} RedChannelClientNetEstimate;
+
 typedef struct OutgoingMessageBuffer {
     struct iovec vec[IOV_MAX];
     int vec_size;
     int pos;
     int size;
+    /* the message is written with MSG_ZEROCOPY */
+    gboolean zerocopy;
+    /* stream zero-copy id of the first write of the message */
+    uint64_t zerocopy_id;
 } OutgoingMessageBuffer;
 
+/*
+ * When batching is enabled, red_channel_client_push() marshalls several
+ * pipe items back to back, each in its own marshaller, and flushes all of
+ * them with a single writev() once the pipe is drained or the byte/message
+ * budget is exceeded. Urgent messages are never batched; they are written
+ * right after the pending batch so the wire order is preserved.
+ * Batching is disabled on plain unix sockets as a message carrying a file
+ * descriptor must be followed immediately by the descriptor on the wire.
+ */
+typedef struct OutgoingMessageBatch {
+    gboolean enabled;
+    /* set while red_channel_client_push() is draining the pipe */
+    gboolean active;
+    /* marshallers of finished messages not yet written, oldest first */
+    GQueue marshallers;
+    /* empty marshallers kept for reuse */
+    GQueue free_marshallers;
+    uint32_t size;
+} OutgoingMessageBatch;
+
+/*
+ * With MSG_ZEROCOPY the kernel reads the data from the marshaller buffers
+ * (compressed images, video frames...) after sendmsg() returned. Resetting
+ * a marshaller releases these buffers, so the marshallers of such messages
+ * are kept aside until the kernel has reported all the writes in
+ * [first_id, last_id] as complete.
+ */
+typedef struct ZeroCopySend {
+    SpiceMarshaller *marshaller;
+    uint64_t first_id;
+    uint64_t last_id;
+    uint64_t completed;
+} ZeroCopySend;
+
+/* completion of sends whose message is still being written, applied to
+ * the ZeroCopySend once the message is held */
+typedef struct ZeroCopyRange {
+    uint64_t first_id;
+    uint64_t last_id;
+} ZeroCopyRange;
+
+/*
+ * Small client messages (mouse motion, pongs, agent tokens...) are read
+ * through read_buf: a single read() takes whatever is available and the
+ * headers and bodies are then copied from it, so a burst of messages costs
+ * one syscall instead of two per message. Message bodies larger than
+ * read_buf are still read directly into the buffer given by
+ * alloc_recv_buf().
+ */
 typedef struct IncomingMessageBuffer {
     uint8_t header_buf[MAX_HEADER_SIZE];
     SpiceDataHeaderOpaque header;
     uint32_t header_pos;
     uint8_t *msg; // data of the msg following the header. allocated by alloc_msg_buf.
     uint32_t msg_pos;
+
+    uint8_t read_buf[RECEIVE_BUF_SIZE];
+    /* data read but not consumed yet is in [read_pos, read_end) */
+    uint32_t read_pos;
+    uint32_t read_end;
 } IncomingMessageBuffer;
 
 struct RedChannelClientPrivate
@@ -149,6 +240,12 @@ struct RedChannelClientPrivate
 
     int during_send;
     GQueue pipe;
+    /* sum of the pipe_item_size() of the items in the pipe */
+    uint64_t pipe_bytes;
+    /* bytes written to the stream so far */
+    uint64_t sent_bytes;
+    /* number of items of each RedPipeLane in the pipe */
+    uint32_t pipe_lane_size[RED_PIPE_LANE_COUNT];
 
     RedChannelCapabilities remote_caps;
     int is_mini_header;
@@ -159,17 +256,40 @@ struct RedChannelClientPrivate
 
     RedChannelClientLatencyMonitor latency_monitor;
     RedChannelClientConnectivityMonitor connectivity_monitor;
+    RedChannelClientNetEstimate net_estimate;
 
     IncomingMessageBuffer incoming;
     OutgoingMessageBuffer outgoing;
+    OutgoingMessageBatch send_batch;
+    /* ZeroCopySend, waiting for the kernel completion */
+    GQueue zerocopy_sends;
+    /* ZeroCopyRange completed at or after zerocopy_held_id, the first id
+     * not covered by zerocopy_sends */
+    GArray *zerocopy_early;
+    uint64_t zerocopy_held_id;
 
     RedStatCounter out_messages;
     RedStatCounter out_bytes;
+    /* write syscalls issued, out_syscalls / out_messages gives the
+     * number of syscalls per message */
+    RedStatCounter out_syscalls;
+    RedStatCounter out_zerocopy_bytes;
+    RedStatCounter in_messages;
+    /* read syscalls issued, compare with in_messages */
+    RedStatCounter in_syscalls;
+    /* per RedPipeLane, items sent and the total time they spent in the
+     * pipe, in microseconds */
+    RedStatCounter lane_items[RED_PIPE_LANE_COUNT];
+    RedStatCounter lane_wait_us[RED_PIPE_LANE_COUNT];
+    /* items overtaken by an item of an higher lane */
+    RedStatCounter preempted_items;
 };
 
 static const SpiceDataHeaderOpaque full_header_wrapper;
 static const SpiceDataHeaderOpaque mini_header_wrapper;
 static void red_channel_client_clear_sent_item(RedChannelClient *rcc);
+static void red_channel_client_batch_clear(RedChannelClient *rcc);
+static void red_channel_client_zerocopy_clear(RedChannelClient *rcc);
 static void red_channel_client_initable_interface_init(GInitableIface *iface);
 static void red_channel_client_set_message_serial(RedChannelClient *channel, uint64_t);
 static bool red_channel_client_config_socket(RedChannelClient *rcc);
@@ -338,6 +458,7 @@ static void
 red_channel_client_finalize(GObject *object)
 {
     RedChannelClient *self = RED_CHANNEL_CLIENT(object);
+    SpiceMarshaller *m;
 
     reds_stream_free(self->priv->stream);
     self->priv->stream = NULL;
@@ -350,6 +471,13 @@ red_channel_client_finalize(GObject *object)
         spice_marshaller_destroy(self->priv->send_data.urgent.marshaller);
     }
 
+    red_channel_client_batch_clear(self);
+    red_channel_client_zerocopy_clear(self);
+    g_array_free(self->priv->zerocopy_early, TRUE);
+    while ((m = g_queue_pop_head(&self->priv->send_batch.free_marshallers)) != NULL) {
+        spice_marshaller_destroy(m);
+    }
+
     red_channel_capabilities_reset(&self->priv->remote_caps);
     if (self->priv->channel) {
         g_object_unref(self->priv->channel);
@@ -365,7 +493,12 @@ static void red_channel_client_initable_interface_init(GInitableIface *iface)
 
 static void red_channel_client_constructed(GObject *object)
 {
+    static const char *const lane_names[RED_PIPE_LANE_COUNT] = {
+        "control", "interactive", "default", "bulk"
+    };
     RedChannelClient *self =  RED_CHANNEL_CLIENT(object);
+    gboolean zerocopy;
+    int i;
 
     RedChannelClientClass *klass = RED_CHANNEL_CLIENT_GET_CLASS(self);
     spice_assert(klass->alloc_recv_buf && klass->release_recv_buf);
@@ -384,11 +517,40 @@ static void red_channel_client_constructed(GObject *object)
     }
     self->priv->incoming.header.data = self->priv->incoming.header_buf;
 
+    g_object_get(self->priv->channel, "batch-send", &self->priv->send_batch.enabled, NULL);
+    if (self->priv->stream == NULL || reds_stream_is_plain_unix(self->priv->stream)) {
+        self->priv->send_batch.enabled = FALSE;
+    }
+
+    self->priv->net_estimate.rtt = -1;
+    if (self->priv->stream != NULL) {
+        int family = reds_stream_get_family(self->priv->stream);
+        self->priv->net_estimate.tcp_info = (family == AF_INET || family == AF_INET6);
+    }
+
+    g_object_get(self->priv->channel, "zerocopy-send", &zerocopy, NULL);
+    if (zerocopy && self->priv->stream != NULL) {
+        reds_stream_enable_zerocopy(self->priv->stream);
+    }
+
     RedChannel *channel = self->priv->channel;
     RedsState* reds = red_channel_get_server(channel);
     const RedStatNode *node = red_channel_get_stat_node(channel);
     stat_init_counter(&self->priv->out_messages, reds, node, "out_messages", TRUE);
     stat_init_counter(&self->priv->out_bytes, reds, node, "out_bytes", TRUE);
+    stat_init_counter(&self->priv->out_syscalls, reds, node, "out_syscalls", TRUE);
+    stat_init_counter(&self->priv->out_zerocopy_bytes, reds, node, "out_zerocopy_bytes", TRUE);
+    stat_init_counter(&self->priv->in_messages, reds, node, "in_messages", TRUE);
+    stat_init_counter(&self->priv->in_syscalls, reds, node, "in_syscalls", TRUE);
+    for (i = 0; i < RED_PIPE_LANE_COUNT; i++) {
+        char name[32];
+
+        snprintf(name, sizeof(name), "%s_items", lane_names[i]);
+        stat_init_counter(&self->priv->lane_items[i], reds, node, name, TRUE);
+        snprintf(name, sizeof(name), "%s_wait_us", lane_names[i]);
+        stat_init_counter(&self->priv->lane_wait_us[i], reds, node, name, TRUE);
+    }
+    stat_init_counter(&self->priv->preempted_items, reds, node, "preempted_items", TRUE);
 }
 
 static void red_channel_client_class_init(RedChannelClientClass *klass)
@@ -458,6 +620,10 @@ red_channel_client_init(RedChannelClient *self)
     self->priv->send_data.marshaller = self->priv->send_data.main.marshaller;
 
     g_queue_init(&self->priv->pipe);
+    g_queue_init(&self->priv->send_batch.marshallers);
+    g_queue_init(&self->priv->send_batch.free_marshallers);
+    g_queue_init(&self->priv->zerocopy_sends);
+    self->priv->zerocopy_early = g_array_new(FALSE, FALSE, sizeof(ZeroCopyRange));
 }
 
 RedChannel* red_channel_client_get_channel(RedChannelClient *rcc)
@@ -470,9 +636,61 @@ static void red_channel_client_data_sent(RedChannelClient *rcc, int n)
     if (rcc->priv->connectivity_monitor.timer) {
         rcc->priv->connectivity_monitor.sent_bytes = true;
     }
+    rcc->priv->sent_bytes += n;
     stat_inc_counter(rcc->priv->out_bytes, n);
 }
 
+static uint64_t net_estimate_smooth(int64_t estimate, uint64_t sample)
+{
+    if (estimate <= 0) {
+        return sample;
+    }
+    return estimate - (estimate >> NET_ESTIMATE_SHIFT) + (sample >> NET_ESTIMATE_SHIFT);
+}
+
+static void red_channel_client_sample_net_estimate(RedChannelClient *rcc)
+{
+    RedChannelClientNetEstimate *estimate = &rcc->priv->net_estimate;
+    RedSocketTcpInfo info;
+    uint64_t now, bitrate;
+    bool app_limited;
+
+    if (!estimate->tcp_info) {
+        return;
+    }
+    now = spice_get_monotonic_time_ns();
+    if (now - estimate->last_sample_time < NET_ESTIMATE_INTERVAL_NS) {
+        return;
+    }
+    estimate->last_sample_time = now;
+
+    if (!reds_stream_get_tcp_info(rcc->priv->stream, &info)) {
+        estimate->tcp_info = false;
+        return;
+    }
+    if (info.rtt_us == 0) {
+        return;
+    }
+
+    estimate->rtt = net_estimate_smooth(estimate->rtt, (uint64_t)info.rtt_us * NSEC_PER_MICROSEC);
+
+    if (info.delivery_rate) {
+        bitrate = info.delivery_rate * 8;
+        app_limited = info.app_limited;
+    } else {
+        bitrate = (uint64_t)info.snd_cwnd * info.snd_mss * 8 * 1000000 / info.rtt_us;
+        /* the congestion window does not grow if it is not used */
+        app_limited = info.unacked < info.snd_cwnd / 2;
+    }
+    /* an app-limited sample only shows what the application sent, it can
+     * raise an estimate but not start one: an idle session would get a
+     * tiny estimate preferred over the network test */
+    if (app_limited && (estimate->bitrate == 0 || bitrate <= estimate->bitrate)) {
+        return;
+    }
+    estimate->bitrate = net_estimate_smooth(estimate->bitrate, bitrate);
+}
+
 static void red_channel_client_data_read(RedChannelClient *rcc, int n)
 {
     if (rcc->priv->connectivity_monitor.timer) {
@@ -480,8 +698,12 @@ static void red_channel_client_data_read(RedChannelClient *rcc, int n)
     }
 }
 
+/* a pending batch is always written before the current message */
 static int red_channel_client_get_out_msg_size(RedChannelClient *rcc)
 {
+    if (rcc->priv->send_batch.size) {
+        return rcc->priv->send_batch.size;
+    }
     return rcc->priv->send_data.size;
 }
 
@@ -489,8 +711,28 @@ static int red_channel_client_prepare_out_msg(RedChannelClient *rcc,
                                               struct iovec *vec, int vec_size,
                                               int pos)
 {
-    return spice_marshaller_fill_iovec(rcc->priv->send_data.marshaller,
-                                       vec, vec_size, pos);
+    OutgoingMessageBatch *batch = &rcc->priv->send_batch;
+    size_t skip = pos;
+    GList *l;
+    int n = 0;
+
+    if (!batch->size) {
+        return spice_marshaller_fill_iovec(rcc->priv->send_data.marshaller,
+                                           vec, vec_size, pos);
+    }
+
+    for (l = batch->marshallers.head; l != NULL && n < vec_size; l = l->next) {
+        SpiceMarshaller *m = l->data;
+        size_t msg_size = spice_marshaller_get_total_size(m);
+
+        if (skip >= msg_size) {
+            skip -= msg_size;
+            continue;
+        }
+        n += spice_marshaller_fill_iovec(m, vec + n, vec_size - n, skip);
+        skip = 0;
+    }
+    return n;
 }
 
 static void red_channel_client_set_blocked(RedChannelClient *rcc)
@@ -648,9 +890,264 @@ static void red_channel_client_msg_sent(RedChannelClient *rcc)
 
 }
 
+static void red_channel_client_batch_clear(RedChannelClient *rcc)
+{
+    OutgoingMessageBatch *batch = &rcc->priv->send_batch;
+    SpiceMarshaller *m;
+
+    while ((m = g_queue_pop_head(&batch->marshallers)) != NULL) {
+        spice_marshaller_reset(m);
+        g_queue_push_tail(&batch->free_marshallers, m);
+    }
+    batch->size = 0;
+}
+
+static void red_channel_client_batch_sent(RedChannelClient *rcc)
+{
+    red_channel_client_batch_clear(rcc);
+    rcc->priv->send_data.blocked = FALSE;
+
+    if (!red_channel_client_no_item_being_sent(rcc)) {
+        /* a message (usually urgent data) was queued behind the batch */
+        red_channel_client_send(rcc);
+    } else if (g_queue_is_empty(&rcc->priv->pipe)) {
+        /* It is possible that the socket will become idle, so we may be able to test latency */
+        red_channel_client_restart_ping_timer(rcc);
+    }
+}
+
+static SpiceMarshaller *red_channel_client_get_free_marshaller(RedChannelClient *rcc)
+{
+    SpiceMarshaller *m = g_queue_pop_head(&rcc->priv->send_batch.free_marshallers);
+
+    if (m == NULL) {
+        m = spice_marshaller_new();
+    }
+    return m;
+}
+
+static void zerocopy_send_add_completion(ZeroCopySend *send, uint64_t first, uint64_t last)
+{
+    uint64_t start = MAX(first, send->first_id);
+    uint64_t end = MIN(last, send->last_id);
+
+    if (start <= end) {
+        send->completed += end - start + 1;
+    }
+}
+
+static void red_channel_client_zerocopy_add(RedChannelClient *rcc, SpiceMarshaller *m,
+                                            uint64_t first_id, uint64_t last_id)
+{
+    ZeroCopySend *send = spice_new0(ZeroCopySend, 1);
+    GArray *early = rcc->priv->zerocopy_early;
+    guint i;
+
+    send->marshaller = m;
+    send->first_id = first_id;
+    send->last_id = last_id;
+    for (i = 0; i < early->len; i++) {
+        ZeroCopyRange *range = &g_array_index(early, ZeroCopyRange, i);
+
+        zerocopy_send_add_completion(send, range->first_id, range->last_id);
+    }
+    g_queue_push_tail(&rcc->priv->zerocopy_sends, send);
+}
+
+/* the ids before zerocopy_held_id are now all covered by zerocopy_sends */
+static void red_channel_client_zerocopy_prune_early(RedChannelClient *rcc)
+{
+    GArray *early = rcc->priv->zerocopy_early;
+    guint i = 0;
+
+    while (i < early->len) {
+        ZeroCopyRange *range = &g_array_index(early, ZeroCopyRange, i);
+
+        if (range->last_id < rcc->priv->zerocopy_held_id) {
+            g_array_remove_index_fast(early, i);
+        } else {
+            range->first_id = MAX(range->first_id, rcc->priv->zerocopy_held_id);
+            i++;
+        }
+    }
+}
+
+/* Called once the message(s) described by the outgoing buffer are written:
+ * takes their marshallers away so they are not reset until the kernel
+ * is done with the data, see ZeroCopySend */
+static void red_channel_client_zerocopy_hold(RedChannelClient *rcc, uint64_t first_id)
+{
+    OutgoingMessageBatch *batch = &rcc->priv->send_batch;
+    uint64_t next_id = reds_stream_get_zerocopy_id(rcc->priv->stream);
+    SpiceMarshaller *m;
+
+    if (next_id == first_id) {
+        /* zero-copy got disabled on the stream, the data was copied */
+        return;
+    }
+
+    rcc->priv->zerocopy_held_id = next_id;
+    if (batch->size) {
+        while ((m = g_queue_pop_head(&batch->marshallers)) != NULL) {
+            red_channel_client_zerocopy_add(rcc, m, first_id, next_id - 1);
+        }
+        red_channel_client_zerocopy_prune_early(rcc);
+        return;
+    }
+
+    red_channel_client_zerocopy_add(rcc, rcc->priv->send_data.marshaller, first_id, next_id - 1);
+    red_channel_client_zerocopy_prune_early(rcc);
+    m = red_channel_client_get_free_marshaller(rcc);
+    if (red_channel_client_urgent_marshaller_is_active(rcc)) {
+        rcc->priv->send_data.urgent.marshaller = m;
+    } else {
+        rcc->priv->send_data.main.marshaller = m;
+    }
+    rcc->priv->send_data.marshaller = m;
+}
+
+static void red_channel_client_zerocopy_release(RedChannelClient *rcc, ZeroCopySend *send)
+{
+    spice_marshaller_reset(send->marshaller);
+    g_queue_push_tail(&rcc->priv->send_batch.free_marshallers, send->marshaller);
+    free(send);
+}
+
+/* Reads the completions reported by the kernel and releases the data
+ * of the messages fully sent. The error queue is drained even when no
+ * message is held yet: the completions of a message still being written
+ * would otherwise keep the socket readable. */
+static void red_channel_client_zerocopy_complete(RedChannelClient *rcc)
+{
+    GQueue *sends = &rcc->priv->zerocopy_sends;
+    uint64_t first, last;
+    GList *l, *next;
+
+    /* no zero-copy send was ever done on the stream */
+    if (!rcc->priv->stream || reds_stream_get_zerocopy_id(rcc->priv->stream) == 0) {
+        return;
+    }
+
+    while (reds_stream_get_zerocopy_completion(rcc->priv->stream, &first, &last)) {
+        for (l = sends->head; l != NULL; l = l->next) {
+            zerocopy_send_add_completion(l->data, first, last);
+        }
+        if (last >= rcc->priv->zerocopy_held_id) {
+            ZeroCopyRange range = {
+                .first_id = MAX(first, rcc->priv->zerocopy_held_id),
+                .last_id = last,
+            };
+            g_array_append_val(rcc->priv->zerocopy_early, range);
+        }
+    }
+
+    for (l = sends->head; l != NULL; l = next) {
+        ZeroCopySend *send = l->data;
+
+        next = l->next;
+        if (send->completed == send->last_id - send->first_id + 1) {
+            red_channel_client_zerocopy_release(rcc, send);
+            g_queue_delete_link(sends, l);
+        }
+    }
+}
+
+/* the socket is going away, the kernel does not send the data anymore */
+static void red_channel_client_zerocopy_clear(RedChannelClient *rcc)
+{
+    ZeroCopySend *send;
+
+    while ((send = g_queue_pop_head(&rcc->priv->zerocopy_sends)) != NULL) {
+        red_channel_client_zerocopy_release(rcc, send);
+    }
+    g_array_set_size(rcc->priv->zerocopy_early, 0);
+}
+
+/* Moves the message just marshalled to the pending batch and gives the
+ * channel a fresh main marshaller.
+ * Returns FALSE if the message must be sent right away. */
+static gboolean red_channel_client_batch_message(RedChannelClient *rcc)
+{
+    OutgoingMessageBatch *batch = &rcc->priv->send_batch;
+    SpiceMarshaller *m;
+
+    if (!batch->active || red_channel_client_urgent_marshaller_is_active(rcc)) {
+        return FALSE;
+    }
+
+    g_queue_push_tail(&batch->marshallers, rcc->priv->send_data.marshaller);
+    batch->size += rcc->priv->send_data.size;
+    rcc->priv->send_data.size = 0;
+
+    m = red_channel_client_get_free_marshaller(rcc);
+    rcc->priv->send_data.main.marshaller = m;
+    rcc->priv->send_data.marshaller = m;
+
+    if (batch->size >= SEND_BATCH_MAX_BYTES ||
+        g_queue_get_length(&batch->marshallers) >= SEND_BATCH_MAX_MESSAGES) {
+        red_channel_client_send(rcc);
+    }
+    return TRUE;
+}
+
+static inline uint32_t red_channel_client_pipe_item_size(RedChannelClient *rcc,
+                                                         RedPipeItem *item)
+{
+    RedChannelClientClass *klass = RED_CHANNEL_CLIENT_GET_CLASS(rcc);
+
+    return klass->pipe_item_size ? klass->pipe_item_size(rcc, item) : 0;
+}
+
+static RedPipeLane red_channel_client_pipe_item_lane(RedChannelClient *rcc,
+                                                     RedPipeItem *item)
+{
+    RedChannelClientClass *klass;
+
+    /* the latency monitor measures the network, not the pipe */
+    if (item->type == RED_PIPE_ITEM_TYPE_PING) {
+        return RED_PIPE_LANE_CONTROL;
+    }
+    klass = RED_CHANNEL_CLIENT_GET_CLASS(rcc);
+    return klass->pipe_item_lane ? klass->pipe_item_lane(rcc, item) : RED_PIPE_LANE_DEFAULT;
+}
+
+static inline bool red_channel_client_pipe_item_is_ready(RedChannelClient *rcc,
+                                                        RedPipeItem *item)
+{
+    RedChannelClientClass *klass = RED_CHANNEL_CLIENT_GET_CLASS(rcc);
+
+    return !klass->pipe_item_is_ready || klass->pipe_item_is_ready(rcc, item);
+}
+
+static bool red_channel_client_pipe_item_can_overtake(RedChannelClient *rcc,
+                                                      RedPipeItem *item, RedPipeLane lane,
+                                                      RedPipeItem *queued)
+{
+    RedChannelClientClass *klass = RED_CHANNEL_CLIENT_GET_CLASS(rcc);
+
+    if (queued->lane <= lane || queued->lane == RED_PIPE_LANE_DEFAULT) {
+        return FALSE;
+    }
+    return !klass->pipe_item_can_overtake || klass->pipe_item_can_overtake(rcc, item, queued);
+}
+
+static void red_channel_client_pipe_item_removed(RedChannelClient *rcc, RedPipeItem *item)
+{
+    uint32_t size = red_channel_client_pipe_item_size(rcc, item);
+
+    spice_warn_if_fail(rcc->priv->pipe_bytes >= size);
+    rcc->priv->pipe_bytes -= MIN(size, rcc->priv->pipe_bytes);
+    spice_warn_if_fail(rcc->priv->pipe_lane_size[item->lane] > 0);
+    rcc->priv->pipe_lane_size[item->lane]--;
+}
+
 static gboolean red_channel_client_pipe_remove(RedChannelClient *rcc, RedPipeItem *item)
 {
-    return g_queue_remove(&rcc->priv->pipe, item);
+    if (!g_queue_remove(&rcc->priv->pipe, item)) {
+        return FALSE;
+    }
+    red_channel_client_pipe_item_removed(rcc, item);
+    return TRUE;
 }
 
 bool red_channel_client_test_remote_common_cap(RedChannelClient *rcc, uint32_t cap)
@@ -820,6 +1317,7 @@ static void red_channel_client_event(int fd, int event, void *data)
 
     g_object_ref(rcc);
     if (event & SPICE_WATCH_EVENT_READ) {
+        red_channel_client_zerocopy_complete(rcc);
         red_channel_client_receive(rcc);
     }
     if (event & SPICE_WATCH_EVENT_WRITE) {
@@ -1049,18 +1547,31 @@ static void red_channel_client_handle_outgoing(RedChannelClient *rcc)
         return;
     }
 
+    red_channel_client_zerocopy_complete(rcc);
+
     if (buffer->size == 0) {
         buffer->size = red_channel_client_get_out_msg_size(rcc);
         if (!buffer->size) {  // nothing to be sent
             return;
         }
+        buffer->zerocopy = buffer->size >= ZEROCOPY_MIN_SIZE &&
+                           reds_stream_is_zerocopy(stream);
+        buffer->zerocopy_id = reds_stream_get_zerocopy_id(stream);
     }
 
     for (;;) {
         buffer->vec_size =
             red_channel_client_prepare_out_msg(rcc, buffer->vec, G_N_ELEMENTS(buffer->vec),
                                                buffer->pos);
-        n = reds_stream_writev(stream, buffer->vec, buffer->vec_size);
+        if (buffer->zerocopy) {
+            n = reds_stream_writev_zerocopy(stream, buffer->vec, buffer->vec_size);
+            if (n > 0) {
+                stat_inc_counter(rcc->priv->out_zerocopy_bytes, n);
+            }
+        } else {
+            n = reds_stream_writev(stream, buffer->vec, buffer->vec_size);
+        }
+        stat_inc_counter(rcc->priv->out_syscalls, 1);
         if (n == -1) {
             switch (errno) {
             case EAGAIN:
@@ -1079,48 +1590,103 @@ static void red_channel_client_handle_outgoing(RedChannelClient *rcc)
         } else {
             buffer->pos += n;
             red_channel_client_data_sent(rcc, n);
+            red_channel_client_sample_net_estimate(rcc);
             if (buffer->pos == buffer->size) { // finished writing data
                 /* reset buffer before calling on_msg_done, since it
                  * can trigger another call to red_channel_client_handle_outgoing (when
                  * switching from the urgent marshaller to the main one */
                 buffer->pos = 0;
                 buffer->size = 0;
-                red_channel_client_msg_sent(rcc);
+                if (buffer->zerocopy) {
+                    buffer->zerocopy = FALSE;
+                    red_channel_client_zerocopy_hold(rcc, buffer->zerocopy_id);
+                }
+                if (rcc->priv->send_batch.size) {
+                    red_channel_client_batch_sent(rcc);
+                } else {
+                    red_channel_client_msg_sent(rcc);
+                }
                 return;
             }
         }
     }
 }
 
-/* return the number of bytes read. -1 in case of error */
-static int red_peer_receive(RedsStream *stream, uint8_t *buf, uint32_t size)
+/* Does a single read of at most size bytes.
+ * return the number of bytes read, 0 if no data is available, -1 in case of error */
+static int red_channel_client_read(RedChannelClient *rcc, uint8_t *buf, uint32_t size)
 {
-    uint8_t *pos = buf;
-    while (size) {
+    RedsStream *stream = rcc->priv->stream;
+
+    for (;;) {
         int now;
         if (stream->shutdown) {
             return -1;
         }
-        now = reds_stream_read(stream, pos, size);
-        if (now <= 0) {
-            if (now == 0) {
-                return -1;
-            }
-            spice_assert(now == -1);
-            if (errno == EAGAIN) {
-                break;
-            } else if (errno == EINTR) {
-                continue;
-            } else if (errno == EPIPE) {
-                return -1;
-            } else {
-                spice_printerr("%s", strerror(errno));
-                return -1;
-            }
+        now = reds_stream_read(stream, buf, size);
+        stat_inc_counter(rcc->priv->in_syscalls, 1);
+        if (now > 0) {
+            return now;
+        }
+        if (now == 0) {
+            return -1;
+        }
+        spice_assert(now == -1);
+        if (errno == EAGAIN) {
+            return 0;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EPIPE) {
+            return -1;
         } else {
+            spice_printerr("%s", strerror(errno));
+            return -1;
+        }
+    }
+}
+
+/* return the number of bytes read. -1 in case of error */
+static int red_channel_client_receive_data(RedChannelClient *rcc, uint8_t *buf, uint32_t size)
+{
+    IncomingMessageBuffer *buffer = &rcc->priv->incoming;
+    uint8_t *pos = buf;
+
+    if (rcc->priv->stream->shutdown) {
+        return -1;
+    }
+
+    while (size) {
+        uint32_t now;
+        int n;
+
+        if (buffer->read_pos < buffer->read_end) {
+            now = MIN(size, buffer->read_end - buffer->read_pos);
+            memcpy(pos, buffer->read_buf + buffer->read_pos, now);
+            buffer->read_pos += now;
             size -= now;
             pos += now;
+            continue;
+        }
+
+        if (size >= sizeof(buffer->read_buf)) {
+            /* large message, no point in going through read_buf */
+            n = red_channel_client_read(rcc, pos, size);
+        } else {
+            n = red_channel_client_read(rcc, buffer->read_buf, sizeof(buffer->read_buf));
+            if (n > 0) {
+                buffer->read_pos = 0;
+                buffer->read_end = n;
+                continue;
+            }
+        }
+        if (n == -1) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
         }
+        size -= n;
+        pos += n;
     }
     return pos - buf;
 }
@@ -1145,10 +1711,6 @@ static uint8_t *red_channel_client_parse(RedChannelClient *rcc, uint8_t *message
     return parsed_message;
 }
 
-// TODO: this implementation, as opposed to the old implementation in red_worker,
-// does many calls to red_peer_receive and through it cb_read, and thus avoids pointer
-// arithmetic for the case where a single cb_read could return multiple messages. But
-// this is suboptimal potentially. Profile and consider fixing.
 static void red_channel_client_handle_incoming(RedChannelClient *rcc)
 {
     RedsStream *stream = rcc->priv->stream;
@@ -1172,9 +1734,9 @@ static void red_channel_client_handle_incoming(RedChannelClient *rcc)
         RedChannelClass *klass = RED_CHANNEL_GET_CLASS(channel);
 
         if (buffer->header_pos < buffer->header.header_size) {
-            bytes_read = red_peer_receive(stream,
-                                          buffer->header.data + buffer->header_pos,
-                                          buffer->header.header_size - buffer->header_pos);
+            bytes_read = red_channel_client_receive_data(rcc,
+                                                         buffer->header.data + buffer->header_pos,
+                                                         buffer->header.header_size - buffer->header_pos);
             if (bytes_read == -1) {
                 red_channel_client_disconnect(rcc);
                 return;
@@ -1199,9 +1761,9 @@ static void red_channel_client_handle_incoming(RedChannelClient *rcc)
                 }
             }
 
-            bytes_read = red_peer_receive(stream,
-                                          buffer->msg + buffer->msg_pos,
-                                          msg_size - buffer->msg_pos);
+            bytes_read = red_channel_client_receive_data(rcc,
+                                                         buffer->msg + buffer->msg_pos,
+                                                         msg_size - buffer->msg_pos);
             if (bytes_read == -1) {
                 red_channel_client_release_msg_buf(rcc, msg_type, msg_size,
                                                    buffer->msg);
@@ -1229,6 +1791,7 @@ static void red_channel_client_handle_incoming(RedChannelClient *rcc)
             red_channel_client_disconnect(rcc);
             return;
         }
+        stat_inc_counter(rcc->priv->in_messages, 1);
         ret_handle = klass->handle_message(rcc, msg_type,
                                            parsed_size, parsed);
         if (parsed_free != NULL) {
@@ -1245,6 +1808,11 @@ static void red_channel_client_handle_incoming(RedChannelClient *rcc)
             red_channel_client_disconnect(rcc);
             return;
         }
+        /* the handler may have disconnected us, don't dispatch what is
+         * left in the read-ahead buffer */
+        if (buffer->read_pos < buffer->read_end && !red_channel_client_is_connected(rcc)) {
+            return;
+        }
     }
 }
 
@@ -1264,11 +1832,25 @@ void red_channel_client_send(RedChannelClient *rcc)
 
 static inline RedPipeItem *red_channel_client_pipe_item_get(RedChannelClient *rcc)
 {
+    RedPipeItem *item;
+
     if (!rcc || red_channel_client_is_blocked(rcc)
              || red_channel_client_waiting_for_ack(rcc)) {
         return NULL;
     }
-    return g_queue_pop_tail(&rcc->priv->pipe);
+    item = g_queue_peek_tail(&rcc->priv->pipe);
+    if (item && !red_channel_client_pipe_item_is_ready(rcc, item)) {
+        return NULL;
+    }
+    item = g_queue_pop_tail(&rcc->priv->pipe);
+    if (item) {
+        stat_inc_counter(rcc->priv->lane_items[item->lane], 1);
+        stat_inc_counter(rcc->priv->lane_wait_us[item->lane],
+                         (spice_get_monotonic_time_ns() - item->queue_time) /
+                         NSEC_PER_MICROSEC);
+        red_channel_client_pipe_item_removed(rcc, item);
+    }
+    return item;
 }
 
 void red_channel_client_push(RedChannelClient *rcc)
@@ -1290,10 +1872,18 @@ void red_channel_client_push(RedChannelClient *rcc)
         spice_printerr("ERROR: an item waiting to be sent and not blocked");
     }
 
+    rcc->priv->send_batch.active = rcc->priv->send_batch.enabled;
     while ((pipe_item = red_channel_client_pipe_item_get(rcc))) {
         red_channel_client_send_item(rcc, pipe_item);
     }
-    if (red_channel_client_no_item_being_sent(rcc) && g_queue_is_empty(&rcc->priv->pipe)
+    rcc->priv->send_batch.active = FALSE;
+    if (rcc->priv->send_batch.size && !red_channel_client_is_blocked(rcc)) {
+        red_channel_client_send(rcc);
+    }
+    /* an item which is not ready is pushed again once it is */
+    if (red_channel_client_no_item_being_sent(rcc) && !rcc->priv->send_batch.size
+        && (g_queue_is_empty(&rcc->priv->pipe) ||
+            !red_channel_client_pipe_item_is_ready(rcc, g_queue_peek_tail(&rcc->priv->pipe)))
         && rcc->priv->stream->watch) {
         SpiceCoreInterfaceInternal *core;
         core = red_channel_get_core_interface(rcc->priv->channel);
@@ -1312,6 +1902,19 @@ int red_channel_client_get_roundtrip_ms(RedChannelClient *rcc)
     return rcc->priv->latency_monitor.roundtrip / NSEC_PER_MILLISEC;
 }
 
+uint64_t red_channel_client_get_bitrate_estimate(RedChannelClient *rcc)
+{
+    return rcc->priv->net_estimate.bitrate;
+}
+
+int red_channel_client_get_rtt_estimate_ms(RedChannelClient *rcc)
+{
+    if (rcc->priv->net_estimate.rtt < 0) {
+        return -1;
+    }
+    return rcc->priv->net_estimate.rtt / NSEC_PER_MILLISEC;
+}
+
 void red_channel_client_init_outgoing_messages_window(RedChannelClient *rcc)
 {
     rcc->priv->ack_data.messages_window = 0;
@@ -1357,6 +1960,11 @@ static void red_channel_client_handle_pong(RedChannelClient *rcc, SpiceMsgPing *
         spice_debug("update roundtrip %.2f(ms)", ((double)rcc->priv->latency_monitor.roundtrip)/NSEC_PER_MILLISEC);
     }
 
+    if (!rcc->priv->net_estimate.tcp_info) {
+        rcc->priv->net_estimate.rtt = net_estimate_smooth(rcc->priv->net_estimate.rtt,
+                                                          now - ping->timestamp);
+    }
+
     rcc->priv->latency_monitor.last_pong_time = now;
     rcc->priv->latency_monitor.state = PING_STATE_NONE;
     red_channel_client_start_ping_timer(rcc, PING_TEST_TIMEOUT_MS);
@@ -1479,6 +2087,9 @@ void red_channel_client_begin_send_message(RedChannelClient *rcc)
                                                ++rcc->priv->send_data.last_sent_serial);
     rcc->priv->ack_data.messages_window++;
     rcc->priv->send_data.header.data = NULL; /* avoid writing to this until we have a new message */
+    if (red_channel_client_batch_message(rcc)) {
+        return;
+    }
     red_channel_client_send(rcc);
 }
 
@@ -1517,16 +2128,44 @@ static inline gboolean prepare_pipe_add(RedChannelClient *rcc, RedPipeItem *item
         core->watch_update_mask(core, rcc->priv->stream->watch,
                                 SPICE_WATCH_EVENT_READ | SPICE_WATCH_EVENT_WRITE);
     }
+    rcc->priv->pipe_bytes += red_channel_client_pipe_item_size(rcc, item);
+    item->lane = red_channel_client_pipe_item_lane(rcc, item);
+    item->queue_time = spice_get_monotonic_time_ns();
+    rcc->priv->pipe_lane_size[item->lane]++;
     return TRUE;
 }
 
 void red_channel_client_pipe_add(RedChannelClient *rcc, RedPipeItem *item)
 {
+    RedPipeLane lane;
+    GList *l;
 
     if (!prepare_pipe_add(rcc, item)) {
         return;
     }
-    g_queue_push_head(&rcc->priv->pipe, item);
+    lane = item->lane;
+    if (lane >= RED_PIPE_LANE_DEFAULT ||
+        rcc->priv->pipe_lane_size[RED_PIPE_LANE_BULK] +
+        rcc->priv->pipe_lane_size[RED_PIPE_LANE_INTERACTIVE] == 0) {
+        g_queue_push_head(&rcc->priv->pipe, item);
+        return;
+    }
+
+    /* the head is the newest item, go back to the oldest one the new
+     * item can overtake */
+    for (l = rcc->priv->pipe.head; l != NULL; l = l->next) {
+        RedPipeItem *queued = l->data;
+
+        if (!red_channel_client_pipe_item_can_overtake(rcc, item, lane, queued)) {
+            break;
+        }
+        stat_inc_counter(rcc->priv->preempted_items, 1);
+    }
+    if (l != NULL) {
+        g_queue_insert_before(&rcc->priv->pipe, l, item);
+    } else {
+        g_queue_push_tail(&rcc->priv->pipe, item);
+    }
 }
 
 void red_channel_client_pipe_add_push(RedChannelClient *rcc, RedPipeItem *item)
@@ -1614,6 +2253,23 @@ uint32_t red_channel_client_get_pipe_size(RedChannelClient *rcc)
     return g_queue_get_length(&rcc->priv->pipe);
 }
 
+uint64_t red_channel_client_get_pipe_bytes(RedChannelClient *rcc)
+{
+    return rcc->priv->pipe_bytes;
+}
+
+uint64_t red_channel_client_get_sent_bytes(RedChannelClient *rcc)
+{
+    return rcc->priv->sent_bytes;
+}
+
+uint32_t red_channel_client_get_pipe_lane_size(RedChannelClient *rcc, RedPipeLane lane)
+{
+    g_return_val_if_fail(lane < RED_PIPE_LANE_COUNT, 0);
+
+    return rcc->priv->pipe_lane_size[lane];
+}
+
 GQueue* red_channel_client_get_pipe(RedChannelClient *rcc)
 {
     return &rcc->priv->pipe;
@@ -1645,9 +2301,16 @@ static void red_channel_client_pipe_clear(RedChannelClient *rcc)
     RedPipeItem *item;
 
     red_channel_client_clear_sent_item(rcc);
+    red_channel_client_batch_clear(rcc);
+    red_channel_client_zerocopy_clear(rcc);
+    rcc->priv->outgoing.pos = 0;
+    rcc->priv->outgoing.size = 0;
+    rcc->priv->outgoing.zerocopy = FALSE;
     while ((item = g_queue_pop_head(&rcc->priv->pipe)) != NULL) {
         red_pipe_item_unref(item);
     }
+    rcc->priv->pipe_bytes = 0;
+    memset(rcc->priv->pipe_lane_size, 0, sizeof(rcc->priv->pipe_lane_size));
 }
 
 void red_channel_client_ack_zero_messages_window(RedChannelClient *rcc)
@@ -1817,7 +2480,8 @@ bool red_channel_client_wait_outgoing_item(RedChannelClient *rcc,
 
 void red_channel_client_disconnect_if_pending_send(RedChannelClient *rcc)
 {
-    if (red_channel_client_is_blocked(rcc) || !g_queue_is_empty(&rcc->priv->pipe)) {
+    if (red_channel_client_is_blocked(rcc) || rcc->priv->send_batch.size ||
+        !g_queue_is_empty(&rcc->priv->pipe)) {
         red_channel_client_disconnect(rcc);
     } else {
         spice_assert(red_channel_client_no_item_being_sent(rcc));
@@ -1843,6 +2507,7 @@ void red_channel_client_pipe_remove_and_release_pos(RedChannelClient *rcc,
     RedPipeItem *item = item_pos->data;
 
     g_queue_delete_link(&rcc->priv->pipe, item_pos);
+    red_channel_client_pipe_item_removed(rcc, item);
     red_pipe_item_unref(item);
 }
 
@@ -84,6 +84,11 @@ SpiceMarshaller *red_channel_client_switch_to_urgent_sender(RedChannelClient *rc
 
 /* returns -1 if we don't have an estimation */
 int red_channel_client_get_roundtrip_ms(RedChannelClient *rcc);
+/* continuously updated estimations of the connection speed:
+ * the bitrate in bits per second (0 if unknown) and the smoothed
+ * roundtrip (-1 if unknown) */
+uint64_t red_channel_client_get_bitrate_estimate(RedChannelClient *rcc);
+int red_channel_client_get_rtt_estimate_ms(RedChannelClient *rcc);
 
 /* Checks periodically if the connection is still alive */
 void red_channel_client_start_connectivity_monitoring(RedChannelClient *rcc, uint32_t timeout_ms);
@@ -102,6 +107,10 @@ void red_channel_client_pipe_add_type(RedChannelClient *rcc, int pipe_item_type)
 void red_channel_client_pipe_add_empty_msg(RedChannelClient *rcc, int msg_type);
 gboolean red_channel_client_pipe_is_empty(RedChannelClient *rcc);
 uint32_t red_channel_client_get_pipe_size(RedChannelClient *rcc);
+uint64_t red_channel_client_get_pipe_bytes(RedChannelClient *rcc);
+/* the bytes written to the connection since it was established */
+uint64_t red_channel_client_get_sent_bytes(RedChannelClient *rcc);
+uint32_t red_channel_client_get_pipe_lane_size(RedChannelClient *rcc, RedPipeLane lane);
 GQueue* red_channel_client_get_pipe(RedChannelClient *rcc);
 gboolean red_channel_client_is_mini_header(RedChannelClient *rcc);
 
@@ -153,6 +162,27 @@ gboolean red_channel_client_set_migration_seamless(RedChannelClient *rcc);
 void red_channel_client_set_destroying(RedChannelClient *rcc);
 gboolean red_channel_client_is_destroying(RedChannelClient *rcc);
 
+/*
+ * Scheduling class of a pipe item. An item queued with
+ * red_channel_client_pipe_add() is moved ahead of the older items of a
+ * lower class it can overtake, so it is sent before them:
+ * - CONTROL items overtake the INTERACTIVE and BULK items
+ * - INTERACTIVE items overtake the BULK items
+ * - DEFAULT items are never overtaken and never overtake anything
+ * Items of the same class are always sent in order. An item must be
+ * classified CONTROL or INTERACTIVE only if it does not depend on the BULK
+ * items queued before it, and BULK only if nothing queued after it depends
+ * on it being sent first.
+ */
+typedef enum {
+    RED_PIPE_LANE_CONTROL,
+    RED_PIPE_LANE_INTERACTIVE,
+    RED_PIPE_LANE_DEFAULT,
+    RED_PIPE_LANE_BULK,
+
+    RED_PIPE_LANE_COUNT
+} RedPipeLane;
+
 struct RedChannelClient
 {
     GObject parent;
@@ -168,6 +198,19 @@ struct RedChannelClientClass
     bool (*config_socket)(RedChannelClient *rcc);
     uint8_t *(*alloc_recv_buf)(RedChannelClient *channel, uint16_t type, uint32_t size);
     void (*release_recv_buf)(RedChannelClient *channel, uint16_t type, uint32_t size, uint8_t *msg);
+    /* optional, rough estimation of the bytes an item will take once sent,
+     * must not change while the item is in the pipe */
+    uint32_t (*pipe_item_size)(RedChannelClient *rcc, RedPipeItem *item);
+    /* optional, scheduling class of the channel items, RED_PIPE_LANE_DEFAULT
+     * if not set */
+    RedPipeLane (*pipe_item_lane)(RedChannelClient *rcc, RedPipeItem *item);
+    /* optional, whether @item may be sent before @queued, queued in a
+     * lower priority lane, see RedPipeLane */
+    bool (*pipe_item_can_overtake)(RedChannelClient *rcc, RedPipeItem *item,
+                                   RedPipeItem *queued);
+    /* optional, whether the next item to send can be sent now, the items
+     * after it wait until it is */
+    bool (*pipe_item_is_ready)(RedChannelClient *rcc, RedPipeItem *item);
 };
 
 #define SPICE_SERVER_ERROR spice_server_error_quark()
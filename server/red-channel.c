@@ -77,6 +77,8 @@ struct RedChannelPrivate
 
     SpiceCoreInterfaceInternal *core;
     gboolean handle_acks;
+    gboolean batch_send;
+    gboolean zerocopy_send;
 
     // RedChannel will hold only connected channel clients
     // (logic - when pushing pipe item to all channel clients, there
@@ -108,7 +110,9 @@ enum {
     PROP_TYPE,
     PROP_ID,
     PROP_HANDLE_ACKS,
-    PROP_MIGRATION_FLAGS
+    PROP_MIGRATION_FLAGS,
+    PROP_BATCH_SEND,
+    PROP_ZEROCOPY_SEND
 };
 
 static void
@@ -139,6 +143,12 @@ red_channel_get_property(GObject *object,
         case PROP_MIGRATION_FLAGS:
             g_value_set_uint(value, self->priv->migration_flags);
             break;
+        case PROP_BATCH_SEND:
+            g_value_set_boolean(value, self->priv->batch_send);
+            break;
+        case PROP_ZEROCOPY_SEND:
+            g_value_set_boolean(value, self->priv->zerocopy_send);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
     }
@@ -172,6 +182,12 @@ red_channel_set_property(GObject *object,
         case PROP_MIGRATION_FLAGS:
             self->priv->migration_flags = g_value_get_uint(value);
             break;
+        case PROP_BATCH_SEND:
+            self->priv->batch_send = g_value_get_boolean(value);
+            break;
+        case PROP_ZEROCOPY_SEND:
+            self->priv->zerocopy_send = g_value_get_boolean(value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
     }
@@ -287,6 +303,24 @@ red_channel_class_init(RedChannelClass *klass)
                              G_PARAM_CONSTRUCT_ONLY |
                              G_PARAM_STATIC_STRINGS);
     g_object_class_install_property(object_class, PROP_MIGRATION_FLAGS, spec);
+
+    spec = g_param_spec_boolean("batch-send",
+                                "Batch send",
+                                "Whether several pipe items can be flushed with a single write",
+                                FALSE,
+                                G_PARAM_READWRITE |
+                                G_PARAM_CONSTRUCT_ONLY |
+                                G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_BATCH_SEND, spec);
+
+    spec = g_param_spec_boolean("zerocopy-send",
+                                "Zero-copy send",
+                                "Whether large messages can be sent with MSG_ZEROCOPY",
+                                FALSE,
+                                G_PARAM_READWRITE |
+                                G_PARAM_CONSTRUCT_ONLY |
+                                G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_ZEROCOPY_SEND, spec);
 }
 
 static void
@@ -54,6 +54,115 @@ struct RedDataChunk {
     uint8_t *data;
 };
 
+#define RED_ARENA_BLOCK_SIZE 4096
+/* Bigger allocations, like the chunk array of a bitmap split in many
+ * chunks, get a block of their own rather than wasting the end of the
+ * current one. */
+#define RED_ARENA_MAX_SMALL_ALLOC (RED_ARENA_BLOCK_SIZE / 4)
+
+/* the header keeps the allocations aligned as malloc() would */
+union RedArenaBlock {
+    RedArenaBlock *next;
+    uint8_t align[RED_ARENA_ALIGN];
+};
+
+void red_arena_init(RedArena *arena, void *buf, size_t size)
+{
+    spice_assert(((uintptr_t)buf & (RED_ARENA_ALIGN - 1)) == 0);
+    arena->pos = buf;
+    arena->end = buf ? arena->pos + size : NULL;
+    arena->blocks = NULL;
+}
+
+static void *red_arena_new_block(RedArena *arena, size_t size)
+{
+    RedArenaBlock *block = spice_malloc(sizeof(*block) + size);
+
+    block->next = arena->blocks;
+    arena->blocks = block;
+    return block + 1;
+}
+
+void *red_arena_alloc(RedArena *arena, size_t size)
+{
+    uint8_t *ptr;
+
+    spice_assert(size <= SIZE_MAX / 2);
+    size = SPICE_ALIGN(size, sizeof(RedArenaBlock));
+    if (size > (size_t)(arena->end - arena->pos)) {
+        if (size > RED_ARENA_MAX_SMALL_ALLOC) {
+            return red_arena_new_block(arena, size);
+        }
+        arena->pos = red_arena_new_block(arena, RED_ARENA_BLOCK_SIZE);
+        arena->end = arena->pos + RED_ARENA_BLOCK_SIZE;
+    }
+    ptr = arena->pos;
+    arena->pos += size;
+    return ptr;
+}
+
+void red_arena_destroy(RedArena *arena)
+{
+    RedArenaBlock *block;
+
+    while ((block = arena->blocks) != NULL) {
+        arena->blocks = block->next;
+        free(block);
+    }
+    arena->pos = arena->end = NULL;
+}
+
+static void *red_arena_alloc0(RedArena *arena, size_t size)
+{
+    return memset(red_arena_alloc(arena, size), 0, size);
+}
+
+static void *red_arena_alloc_n_m(RedArena *arena, size_t n_blocks, size_t n_block_bytes,
+                                 size_t extra_size)
+{
+    if (n_block_bytes && n_blocks > (MAX_DATA_CHUNK - extra_size) / n_block_bytes) {
+        spice_error("allocation of %zu blocks of %zu bytes is too big",
+                    n_blocks, n_block_bytes);
+    }
+    return red_arena_alloc(arena, n_blocks * n_block_bytes + extra_size);
+}
+
+/* images can also be created outside of the parsing, see
+ * display-channel.c:drawable_handle_self_bitmap(), they are released
+ * with a NULL arena */
+static void red_free(RedArena *arena, void *ptr)
+{
+    if (!arena) {
+        free(ptr);
+    }
+}
+
+static SpiceChunks *red_chunks_new(RedArena *arena, uint32_t num_chunks)
+{
+    SpiceChunks *chunks;
+
+    chunks = red_arena_alloc_n_m(arena, num_chunks, sizeof(SpiceChunk), sizeof(SpiceChunks));
+    chunks->flags = 0;
+    chunks->num_chunks = num_chunks;
+    return chunks;
+}
+
+static void red_chunks_destroy(RedArena *arena, SpiceChunks *chunks)
+{
+    uint32_t i;
+
+    if (!arena) {
+        spice_chunks_destroy(chunks);
+        return;
+    }
+    /* spice_chunks_linearize() can replace the chunks with a malloc()ed copy */
+    if (chunks->flags & SPICE_CHUNKS_FLAGS_FREE) {
+        for (i = 0; i < chunks->num_chunks; i++) {
+            free(chunks->chunk[i].data);
+        }
+    }
+}
+
 #if 0
 static void hexdump_qxl(RedMemSlotInfo *slots, int group_id,
                         QXLPHYSICAL addr, uint8_t bytes)
@@ -235,7 +344,7 @@ void red_get_rect_ptr(SpiceRect *red, const QXLRect *qxl)
     red->right  = qxl->right;
 }
 
-static SpicePath *red_get_path(RedMemSlotInfo *slots, int group_id,
+static SpicePath *red_get_path(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                QXLPHYSICAL addr)
 {
     RedDataChunk chunks;
@@ -281,7 +390,7 @@ static SpicePath *red_get_path(RedMemSlotInfo *slots, int group_id,
         start = (QXLPathSeg*)(&start->points[count]);
     }
 
-    red = spice_malloc(mem_size);
+    red = red_arena_alloc(arena, mem_size);
     red->num_segments = n_segments;
 
     start = (QXLPathSeg*)data;
@@ -317,7 +426,7 @@ static SpicePath *red_get_path(RedMemSlotInfo *slots, int group_id,
     return red;
 }
 
-static SpiceClipRects *red_get_clip_rects(RedMemSlotInfo *slots, int group_id,
+static SpiceClipRects *red_get_clip_rects(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                           QXLPHYSICAL addr)
 {
     RedDataChunk chunks;
@@ -351,7 +460,7 @@ static SpiceClipRects *red_get_clip_rects(RedMemSlotInfo *slots, int group_id,
      */
     spice_assert((uint64_t) num_rects * sizeof(QXLRect) == size);
     G_STATIC_ASSERT(sizeof(SpiceRect) == sizeof(QXLRect));
-    red = spice_malloc(sizeof(*red) + num_rects * sizeof(SpiceRect));
+    red = red_arena_alloc(arena, sizeof(*red) + num_rects * sizeof(SpiceRect));
     red->num_rects = num_rects;
 
     start = (QXLRect*)data;
@@ -365,7 +474,7 @@ static SpiceClipRects *red_get_clip_rects(RedMemSlotInfo *slots, int group_id,
     return red;
 }
 
-static SpiceChunks *red_get_image_data_flat(RedMemSlotInfo *slots, int group_id,
+static SpiceChunks *red_get_image_data_flat(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                             QXLPHYSICAL addr, size_t size)
 {
     SpiceChunks *data;
@@ -377,14 +486,14 @@ static SpiceChunks *red_get_image_data_flat(RedMemSlotInfo *slots, int group_id,
         return 0;
     }
 
-    data = spice_chunks_new(1);
+    data = red_chunks_new(arena, 1);
     data->data_size      = size;
     data->chunk[0].data  = (void*)bitmap_virt;
     data->chunk[0].len   = size;
     return data;
 }
 
-static SpiceChunks *red_get_image_data_chunked(RedMemSlotInfo *slots, int group_id,
+static SpiceChunks *red_get_image_data_chunked(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                                RedDataChunk *head)
 {
     SpiceChunks *data;
@@ -395,7 +504,7 @@ static SpiceChunks *red_get_image_data_chunked(RedMemSlotInfo *slots, int group_
         i++;
     }
 
-    data = spice_chunks_new(i);
+    data = red_chunks_new(arena, i);
     data->data_size = 0;
     for (i = 0, chunk = head;
          chunk != NULL && i < data->num_chunks;
@@ -450,7 +559,7 @@ static bool bitmap_consistent(SpiceBitmap *bitmap)
     return true;
 }
 
-static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id,
+static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                  QXLPHYSICAL addr, uint32_t flags, bool is_mask)
 {
     RedDataChunk chunks;
@@ -470,7 +579,7 @@ static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id,
     if (error) {
         return NULL;
     }
-    red = spice_new0(SpiceImage, 1);
+    red = red_arena_alloc0(arena, sizeof(*red));
     red->descriptor.id     = qxl->descriptor.id;
     red->descriptor.type   = qxl->descriptor.type;
     red->descriptor.flags = 0;
@@ -520,7 +629,7 @@ static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id,
                                        num_ents * sizeof(qp->ents[0]), group_id)) {
                 goto error;
             }
-            rp = spice_malloc_n_m(num_ents, sizeof(rp->ents[0]), sizeof(*rp));
+            rp = red_arena_alloc_n_m(arena, num_ents, sizeof(rp->ents[0]), sizeof(*rp));
             rp->unique   = qp->unique;
             rp->num_ents = num_ents;
             if (flags & QXL_COMMAND_FLAG_COMPAT_16BPP) {
@@ -540,7 +649,7 @@ static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id,
             goto error;
         }
         if (qxl_flags & QXL_BITMAP_DIRECT) {
-            red->u.bitmap.data = red_get_image_data_flat(slots, group_id,
+            red->u.bitmap.data = red_get_image_data_flat(slots, group_id, arena,
                                                          qxl->bitmap.data,
                                                          bitmap_size);
         } else {
@@ -550,7 +659,7 @@ static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id,
                 red_put_data_chunks(&chunks);
                 goto error;
             }
-            red->u.bitmap.data = red_get_image_data_chunked(slots, group_id,
+            red->u.bitmap.data = red_get_image_data_chunked(slots, group_id, arena,
                                                             &chunks);
             red_put_data_chunks(&chunks);
         }
@@ -570,7 +679,7 @@ static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id,
             red_put_data_chunks(&chunks);
             goto error;
         }
-        red->u.quic.data = red_get_image_data_chunked(slots, group_id,
+        red->u.quic.data = red_get_image_data_chunked(slots, group_id, arena,
                                                       &chunks);
         red_put_data_chunks(&chunks);
         break;
@@ -580,29 +689,28 @@ static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id,
     }
     return red;
 error:
-    free(red);
-    free(rp);
+    /* the memory is released with the arena */
     return NULL;
 }
 
-static void red_put_image(SpiceImage *red)
+static void red_put_image(RedArena *arena, SpiceImage *red)
 {
     if (red == NULL)
         return;
 
     switch (red->descriptor.type) {
     case SPICE_IMAGE_TYPE_BITMAP:
-        free(red->u.bitmap.palette);
-        spice_chunks_destroy(red->u.bitmap.data);
+        red_free(arena, red->u.bitmap.palette);
+        red_chunks_destroy(arena, red->u.bitmap.data);
         break;
     case SPICE_IMAGE_TYPE_QUIC:
-        spice_chunks_destroy(red->u.quic.data);
+        red_chunks_destroy(arena, red->u.quic.data);
         break;
     }
-    free(red);
+    red_free(arena, red);
 }
 
-static void red_get_brush_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_brush_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                               SpiceBrush *red, QXLBrush *qxl, uint32_t flags)
 {
     red->type = qxl->type;
@@ -615,69 +723,69 @@ static void red_get_brush_ptr(RedMemSlotInfo *slots, int group_id,
         }
         break;
     case SPICE_BRUSH_TYPE_PATTERN:
-        red->u.pattern.pat = red_get_image(slots, group_id, qxl->u.pattern.pat, flags, false);
+        red->u.pattern.pat = red_get_image(slots, group_id, arena, qxl->u.pattern.pat, flags, false);
         break;
     }
 }
 
-static void red_put_brush(SpiceBrush *red)
+static void red_put_brush(RedArena *arena, SpiceBrush *red)
 {
     switch (red->type) {
     case SPICE_BRUSH_TYPE_PATTERN:
-        red_put_image(red->u.pattern.pat);
+        red_put_image(arena, red->u.pattern.pat);
         break;
     }
 }
 
-static void red_get_qmask_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_qmask_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                               SpiceQMask *red, QXLQMask *qxl, uint32_t flags)
 {
     red->flags  = qxl->flags;
     red_get_point_ptr(&red->pos, &qxl->pos);
-    red->bitmap = red_get_image(slots, group_id, qxl->bitmap, flags, true);
+    red->bitmap = red_get_image(slots, group_id, arena, qxl->bitmap, flags, true);
 }
 
-static void red_put_qmask(SpiceQMask *red)
+static void red_put_qmask(RedArena *arena, SpiceQMask *red)
 {
-    red_put_image(red->bitmap);
+    red_put_image(arena, red->bitmap);
 }
 
-static void red_get_fill_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_fill_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                              SpiceFill *red, QXLFill *qxl, uint32_t flags)
 {
-    red_get_brush_ptr(slots, group_id, &red->brush, &qxl->brush, flags);
+    red_get_brush_ptr(slots, group_id, arena, &red->brush, &qxl->brush, flags);
     red->rop_descriptor = qxl->rop_descriptor;
-    red_get_qmask_ptr(slots, group_id, &red->mask, &qxl->mask, flags);
+    red_get_qmask_ptr(slots, group_id, arena, &red->mask, &qxl->mask, flags);
 }
 
-static void red_put_fill(SpiceFill *red)
+static void red_put_fill(RedArena *arena, SpiceFill *red)
 {
-    red_put_brush(&red->brush);
-    red_put_qmask(&red->mask);
+    red_put_brush(arena, &red->brush);
+    red_put_qmask(arena, &red->mask);
 }
 
-static void red_get_opaque_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_opaque_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                SpiceOpaque *red, QXLOpaque *qxl, uint32_t flags)
 {
-   red->src_bitmap     = red_get_image(slots, group_id, qxl->src_bitmap, flags, false);
+   red->src_bitmap     = red_get_image(slots, group_id, arena, qxl->src_bitmap, flags, false);
    red_get_rect_ptr(&red->src_area, &qxl->src_area);
-   red_get_brush_ptr(slots, group_id, &red->brush, &qxl->brush, flags);
+   red_get_brush_ptr(slots, group_id, arena, &red->brush, &qxl->brush, flags);
    red->rop_descriptor = qxl->rop_descriptor;
    red->scale_mode     = qxl->scale_mode;
-   red_get_qmask_ptr(slots, group_id, &red->mask, &qxl->mask, flags);
+   red_get_qmask_ptr(slots, group_id, arena, &red->mask, &qxl->mask, flags);
 }
 
-static void red_put_opaque(SpiceOpaque *red)
+static void red_put_opaque(RedArena *arena, SpiceOpaque *red)
 {
-    red_put_image(red->src_bitmap);
-    red_put_brush(&red->brush);
-    red_put_qmask(&red->mask);
+    red_put_image(arena, red->src_bitmap);
+    red_put_brush(arena, &red->brush);
+    red_put_qmask(arena, &red->mask);
 }
 
-static bool red_get_copy_ptr(RedMemSlotInfo *slots, int group_id,
+static bool red_get_copy_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                              SpiceCopy *red, QXLCopy *qxl, uint32_t flags)
 {
-    red->src_bitmap      = red_get_image(slots, group_id, qxl->src_bitmap, flags, false);
+    red->src_bitmap      = red_get_image(slots, group_id, arena, qxl->src_bitmap, flags, false);
     if (!red->src_bitmap) {
         return false;
     }
@@ -698,62 +806,62 @@ static bool red_get_copy_ptr(RedMemSlotInfo *slots, int group_id,
     }
     red->rop_descriptor  = qxl->rop_descriptor;
     red->scale_mode      = qxl->scale_mode;
-    red_get_qmask_ptr(slots, group_id, &red->mask, &qxl->mask, flags);
+    red_get_qmask_ptr(slots, group_id, arena, &red->mask, &qxl->mask, flags);
     return true;
 }
 
-static void red_put_copy(SpiceCopy *red)
+static void red_put_copy(RedArena *arena, SpiceCopy *red)
 {
-    red_put_image(red->src_bitmap);
-    red_put_qmask(&red->mask);
+    red_put_image(arena, red->src_bitmap);
+    red_put_qmask(arena, &red->mask);
 }
 
 // these types are really the same thing
 #define red_get_blend_ptr red_get_copy_ptr
 
-static void red_put_blend(SpiceBlend *red)
+static void red_put_blend(RedArena *arena, SpiceBlend *red)
 {
-    red_put_image(red->src_bitmap);
-    red_put_qmask(&red->mask);
+    red_put_image(arena, red->src_bitmap);
+    red_put_qmask(arena, &red->mask);
 }
 
-static void red_get_transparent_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_transparent_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                     SpiceTransparent *red, QXLTransparent *qxl,
                                     uint32_t flags)
 {
-    red->src_bitmap      = red_get_image(slots, group_id, qxl->src_bitmap, flags, false);
+    red->src_bitmap      = red_get_image(slots, group_id, arena, qxl->src_bitmap, flags, false);
    red_get_rect_ptr(&red->src_area, &qxl->src_area);
    red->src_color       = qxl->src_color;
    red->true_color      = qxl->true_color;
 }
 
-static void red_put_transparent(SpiceTransparent *red)
+static void red_put_transparent(RedArena *arena, SpiceTransparent *red)
 {
-    red_put_image(red->src_bitmap);
+    red_put_image(arena, red->src_bitmap);
 }
 
-static void red_get_alpha_blend_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_alpha_blend_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                     SpiceAlphaBlend *red, QXLAlphaBlend *qxl,
                                     uint32_t flags)
 {
     red->alpha_flags = qxl->alpha_flags;
     red->alpha       = qxl->alpha;
-    red->src_bitmap  = red_get_image(slots, group_id, qxl->src_bitmap, flags, false);
+    red->src_bitmap  = red_get_image(slots, group_id, arena, qxl->src_bitmap, flags, false);
     red_get_rect_ptr(&red->src_area, &qxl->src_area);
 }
 
-static void red_get_alpha_blend_ptr_compat(RedMemSlotInfo *slots, int group_id,
+static void red_get_alpha_blend_ptr_compat(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                            SpiceAlphaBlend *red, QXLCompatAlphaBlend *qxl,
                                            uint32_t flags)
 {
     red->alpha       = qxl->alpha;
-    red->src_bitmap  = red_get_image(slots, group_id, qxl->src_bitmap, flags, false);
+    red->src_bitmap  = red_get_image(slots, group_id, arena, qxl->src_bitmap, flags, false);
     red_get_rect_ptr(&red->src_area, &qxl->src_area);
 }
 
-static void red_put_alpha_blend(SpiceAlphaBlend *red)
+static void red_put_alpha_blend(RedArena *arena, SpiceAlphaBlend *red)
 {
-    red_put_image(red->src_bitmap);
+    red_put_image(arena, red->src_bitmap);
 }
 
 static bool get_transform(RedMemSlotInfo *slots,
@@ -776,17 +884,17 @@ static bool get_transform(RedMemSlotInfo *slots,
     return true;
 }
 
-static void red_get_composite_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_composite_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                   SpiceComposite *red, QXLComposite *qxl, uint32_t flags)
 {
     red->flags = qxl->flags;
 
-    red->src_bitmap = red_get_image(slots, group_id, qxl->src, flags, false);
+    red->src_bitmap = red_get_image(slots, group_id, arena, qxl->src, flags, false);
     if (get_transform(slots, group_id, qxl->src_transform, &red->src_transform))
         red->flags |= SPICE_COMPOSITE_HAS_SRC_TRANSFORM;
 
     if (qxl->mask) {
-        red->mask_bitmap = red_get_image(slots, group_id, qxl->mask, flags, false);
+        red->mask_bitmap = red_get_image(slots, group_id, arena, qxl->mask, flags, false);
         red->flags |= SPICE_COMPOSITE_HAS_MASK;
         if (get_transform(slots, group_id, qxl->mask_transform, &red->mask_transform))
             red->flags |= SPICE_COMPOSITE_HAS_MASK_TRANSFORM;
@@ -799,37 +907,37 @@ static void red_get_composite_ptr(RedMemSlotInfo *slots, int group_id,
     red->mask_origin.y = qxl->mask_origin.y;
 }
 
-static void red_put_composite(SpiceComposite *red)
+static void red_put_composite(RedArena *arena, SpiceComposite *red)
 {
-    red_put_image(red->src_bitmap);
+    red_put_image(arena, red->src_bitmap);
     if (red->mask_bitmap)
-        red_put_image(red->mask_bitmap);
+        red_put_image(arena, red->mask_bitmap);
 }
 
-static void red_get_rop3_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_rop3_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                              SpiceRop3 *red, QXLRop3 *qxl, uint32_t flags)
 {
-   red->src_bitmap = red_get_image(slots, group_id, qxl->src_bitmap, flags, false);
+   red->src_bitmap = red_get_image(slots, group_id, arena, qxl->src_bitmap, flags, false);
    red_get_rect_ptr(&red->src_area, &qxl->src_area);
-   red_get_brush_ptr(slots, group_id, &red->brush, &qxl->brush, flags);
+   red_get_brush_ptr(slots, group_id, arena, &red->brush, &qxl->brush, flags);
    red->rop3       = qxl->rop3;
    red->scale_mode = qxl->scale_mode;
-   red_get_qmask_ptr(slots, group_id, &red->mask, &qxl->mask, flags);
+   red_get_qmask_ptr(slots, group_id, arena, &red->mask, &qxl->mask, flags);
 }
 
-static void red_put_rop3(SpiceRop3 *red)
+static void red_put_rop3(RedArena *arena, SpiceRop3 *red)
 {
-    red_put_image(red->src_bitmap);
-    red_put_brush(&red->brush);
-    red_put_qmask(&red->mask);
+    red_put_image(arena, red->src_bitmap);
+    red_put_brush(arena, &red->brush);
+    red_put_qmask(arena, &red->mask);
 }
 
-static bool red_get_stroke_ptr(RedMemSlotInfo *slots, int group_id,
+static bool red_get_stroke_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                SpiceStroke *red, QXLStroke *qxl, uint32_t flags)
 {
     int error;
 
-    red->path = red_get_path(slots, group_id, qxl->path);
+    red->path = red_get_path(slots, group_id, arena, qxl->path);
     if (!red->path) {
         return false;
     }
@@ -839,7 +947,7 @@ static bool red_get_stroke_ptr(RedMemSlotInfo *slots, int group_id,
         uint8_t *buf;
 
         style_nseg = qxl->attr.style_nseg;
-        red->attr.style = spice_malloc_n(style_nseg, sizeof(SPICE_FIXED28_4));
+        red->attr.style = red_arena_alloc_n_m(arena, style_nseg, sizeof(SPICE_FIXED28_4), 0);
         red->attr.style_nseg  = style_nseg;
         spice_assert(qxl->attr.style);
         buf = (uint8_t *)memslot_get_virt(slots, qxl->attr.style,
@@ -852,22 +960,22 @@ static bool red_get_stroke_ptr(RedMemSlotInfo *slots, int group_id,
         red->attr.style_nseg  = 0;
         red->attr.style       = NULL;
     }
-    red_get_brush_ptr(slots, group_id, &red->brush, &qxl->brush, flags);
+    red_get_brush_ptr(slots, group_id, arena, &red->brush, &qxl->brush, flags);
     red->fore_mode        = qxl->fore_mode;
     red->back_mode        = qxl->back_mode;
     return true;
 }
 
-static void red_put_stroke(SpiceStroke *red)
+static void red_put_stroke(RedArena *arena, SpiceStroke *red)
 {
-    red_put_brush(&red->brush);
-    free(red->path);
+    red_put_brush(arena, &red->brush);
+    red_free(arena, red->path);
     if (red->attr.flags & SPICE_LINE_FLAGS_STYLED) {
-        free(red->attr.style);
+        red_free(arena, red->attr.style);
     }
 }
 
-static SpiceString *red_get_string(RedMemSlotInfo *slots, int group_id,
+static SpiceString *red_get_string(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                    QXLPHYSICAL addr)
 {
     RedDataChunk chunks;
@@ -930,7 +1038,7 @@ static SpiceString *red_get_string(RedMemSlotInfo *slots, int group_id,
     spice_assert(start <= end);
     spice_assert(glyphs == qxl_length);
 
-    red = spice_malloc(red_size);
+    red = red_arena_alloc(arena, red_size);
     red->length = qxl_length;
     red->flags = qxl_flags;
 
@@ -960,73 +1068,73 @@ static SpiceString *red_get_string(RedMemSlotInfo *slots, int group_id,
     return red;
 }
 
-static void red_get_text_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_text_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                              SpiceText *red, QXLText *qxl, uint32_t flags)
 {
-   red->str = red_get_string(slots, group_id, qxl->str);
+   red->str = red_get_string(slots, group_id, arena, qxl->str);
    red_get_rect_ptr(&red->back_area, &qxl->back_area);
-   red_get_brush_ptr(slots, group_id, &red->fore_brush, &qxl->fore_brush, flags);
-   red_get_brush_ptr(slots, group_id, &red->back_brush, &qxl->back_brush, flags);
+   red_get_brush_ptr(slots, group_id, arena, &red->fore_brush, &qxl->fore_brush, flags);
+   red_get_brush_ptr(slots, group_id, arena, &red->back_brush, &qxl->back_brush, flags);
    red->fore_mode  = qxl->fore_mode;
    red->back_mode  = qxl->back_mode;
 }
 
-static void red_put_text_ptr(SpiceText *red)
+static void red_put_text_ptr(RedArena *arena, SpiceText *red)
 {
-    free(red->str);
-    red_put_brush(&red->fore_brush);
-    red_put_brush(&red->back_brush);
+    red_free(arena, red->str);
+    red_put_brush(arena, &red->fore_brush);
+    red_put_brush(arena, &red->back_brush);
 }
 
-static void red_get_whiteness_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_whiteness_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                   SpiceWhiteness *red, QXLWhiteness *qxl, uint32_t flags)
 {
-    red_get_qmask_ptr(slots, group_id, &red->mask, &qxl->mask, flags);
+    red_get_qmask_ptr(slots, group_id, arena, &red->mask, &qxl->mask, flags);
 }
 
-static void red_put_whiteness(SpiceWhiteness *red)
+static void red_put_whiteness(RedArena *arena, SpiceWhiteness *red)
 {
-    red_put_qmask(&red->mask);
+    red_put_qmask(arena, &red->mask);
 }
 
-static void red_get_blackness_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_blackness_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                   SpiceBlackness *red, QXLBlackness *qxl, uint32_t flags)
 {
-    red_get_qmask_ptr(slots, group_id, &red->mask, &qxl->mask, flags);
+    red_get_qmask_ptr(slots, group_id, arena, &red->mask, &qxl->mask, flags);
 }
 
-static void red_put_blackness(SpiceWhiteness *red)
+static void red_put_blackness(RedArena *arena, SpiceWhiteness *red)
 {
-    red_put_qmask(&red->mask);
+    red_put_qmask(arena, &red->mask);
 }
 
-static void red_get_invers_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_invers_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                                SpiceInvers *red, QXLInvers *qxl, uint32_t flags)
 {
-    red_get_qmask_ptr(slots, group_id, &red->mask, &qxl->mask, flags);
+    red_get_qmask_ptr(slots, group_id, arena, &red->mask, &qxl->mask, flags);
 }
 
-static void red_put_invers(SpiceWhiteness *red)
+static void red_put_invers(RedArena *arena, SpiceWhiteness *red)
 {
-    red_put_qmask(&red->mask);
+    red_put_qmask(arena, &red->mask);
 }
 
-static void red_get_clip_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_clip_ptr(RedMemSlotInfo *slots, int group_id, RedArena *arena,
                              SpiceClip *red, QXLClip *qxl)
 {
     red->type = qxl->type;
     switch (red->type) {
     case SPICE_CLIP_TYPE_RECTS:
-        red->rects = red_get_clip_rects(slots, group_id, qxl->data);
+        red->rects = red_get_clip_rects(slots, group_id, arena, qxl->data);
         break;
     }
 }
 
-static void red_put_clip(SpiceClip *red)
+static void red_put_clip(RedArena *arena, SpiceClip *red)
 {
     switch (red->type) {
     case SPICE_CLIP_TYPE_RECTS:
-        free(red->rects);
+        red_free(arena, red->rects);
         break;
     }
 }
@@ -1034,6 +1142,7 @@ static void red_put_clip(SpiceClip *red)
 static bool red_get_native_drawable(RedMemSlotInfo *slots, int group_id,
                                     RedDrawable *red, QXLPHYSICAL addr, uint32_t flags)
 {
+    RedArena *arena = &red->arena;
     QXLDrawable *qxl;
     int i;
     int error = 0;
@@ -1046,7 +1155,7 @@ static bool red_get_native_drawable(RedMemSlotInfo *slots, int group_id,
     red->release_info_ext.group_id = group_id;
 
     red_get_rect_ptr(&red->bbox, &qxl->bbox);
-    red_get_clip_ptr(slots, group_id, &red->clip, &qxl->clip);
+    red_get_clip_ptr(slots, group_id, arena, &red->clip, &qxl->clip);
     red->effect           = qxl->effect;
     red->mm_time          = qxl->mm_time;
     red->self_bitmap      = qxl->self_bitmap;
@@ -1061,48 +1170,48 @@ static bool red_get_native_drawable(RedMemSlotInfo *slots, int group_id,
     red->type = qxl->type;
     switch (red->type) {
     case QXL_DRAW_ALPHA_BLEND:
-        red_get_alpha_blend_ptr(slots, group_id,
+        red_get_alpha_blend_ptr(slots, group_id, arena,
                                 &red->u.alpha_blend, &qxl->u.alpha_blend, flags);
         break;
     case QXL_DRAW_BLACKNESS:
-        red_get_blackness_ptr(slots, group_id,
+        red_get_blackness_ptr(slots, group_id, arena,
                               &red->u.blackness, &qxl->u.blackness, flags);
         break;
     case QXL_DRAW_BLEND:
-        return red_get_blend_ptr(slots, group_id, &red->u.blend, &qxl->u.blend, flags);
+        return red_get_blend_ptr(slots, group_id, arena, &red->u.blend, &qxl->u.blend, flags);
     case QXL_DRAW_COPY:
-        return red_get_copy_ptr(slots, group_id, &red->u.copy, &qxl->u.copy, flags);
+        return red_get_copy_ptr(slots, group_id, arena, &red->u.copy, &qxl->u.copy, flags);
     case QXL_COPY_BITS:
         red_get_point_ptr(&red->u.copy_bits.src_pos, &qxl->u.copy_bits.src_pos);
         break;
     case QXL_DRAW_FILL:
-        red_get_fill_ptr(slots, group_id, &red->u.fill, &qxl->u.fill, flags);
+        red_get_fill_ptr(slots, group_id, arena, &red->u.fill, &qxl->u.fill, flags);
         break;
     case QXL_DRAW_OPAQUE:
-        red_get_opaque_ptr(slots, group_id, &red->u.opaque, &qxl->u.opaque, flags);
+        red_get_opaque_ptr(slots, group_id, arena, &red->u.opaque, &qxl->u.opaque, flags);
         break;
     case QXL_DRAW_INVERS:
-        red_get_invers_ptr(slots, group_id, &red->u.invers, &qxl->u.invers, flags);
+        red_get_invers_ptr(slots, group_id, arena, &red->u.invers, &qxl->u.invers, flags);
         break;
     case QXL_DRAW_NOP:
         break;
     case QXL_DRAW_ROP3:
-        red_get_rop3_ptr(slots, group_id, &red->u.rop3, &qxl->u.rop3, flags);
+        red_get_rop3_ptr(slots, group_id, arena, &red->u.rop3, &qxl->u.rop3, flags);
         break;
     case QXL_DRAW_COMPOSITE:
-        red_get_composite_ptr(slots, group_id, &red->u.composite, &qxl->u.composite, flags);
+        red_get_composite_ptr(slots, group_id, arena, &red->u.composite, &qxl->u.composite, flags);
         break;
     case QXL_DRAW_STROKE:
-        return red_get_stroke_ptr(slots, group_id, &red->u.stroke, &qxl->u.stroke, flags);
+        return red_get_stroke_ptr(slots, group_id, arena, &red->u.stroke, &qxl->u.stroke, flags);
     case QXL_DRAW_TEXT:
-        red_get_text_ptr(slots, group_id, &red->u.text, &qxl->u.text, flags);
+        red_get_text_ptr(slots, group_id, arena, &red->u.text, &qxl->u.text, flags);
         break;
     case QXL_DRAW_TRANSPARENT:
-        red_get_transparent_ptr(slots, group_id,
+        red_get_transparent_ptr(slots, group_id, arena,
                                 &red->u.transparent, &qxl->u.transparent, flags);
         break;
     case QXL_DRAW_WHITENESS:
-        red_get_whiteness_ptr(slots, group_id,
+        red_get_whiteness_ptr(slots, group_id, arena,
                               &red->u.whiteness, &qxl->u.whiteness, flags);
         break;
     default:
@@ -1115,6 +1224,7 @@ static bool red_get_native_drawable(RedMemSlotInfo *slots, int group_id,
 static bool red_get_compat_drawable(RedMemSlotInfo *slots, int group_id,
                                     RedDrawable *red, QXLPHYSICAL addr, uint32_t flags)
 {
+    RedArena *arena = &red->arena;
     QXLCompatDrawable *qxl;
     int error;
 
@@ -1126,7 +1236,7 @@ static bool red_get_compat_drawable(RedMemSlotInfo *slots, int group_id,
     red->release_info_ext.group_id = group_id;
 
     red_get_rect_ptr(&red->bbox, &qxl->bbox);
-    red_get_clip_ptr(slots, group_id, &red->clip, &qxl->clip);
+    red_get_clip_ptr(slots, group_id, arena, &red->clip, &qxl->clip);
     red->effect           = qxl->effect;
     red->mm_time          = qxl->mm_time;
 
@@ -1140,17 +1250,17 @@ static bool red_get_compat_drawable(RedMemSlotInfo *slots, int group_id,
     red->type = qxl->type;
     switch (red->type) {
     case QXL_DRAW_ALPHA_BLEND:
-        red_get_alpha_blend_ptr_compat(slots, group_id,
+        red_get_alpha_blend_ptr_compat(slots, group_id, arena,
                                        &red->u.alpha_blend, &qxl->u.alpha_blend, flags);
         break;
     case QXL_DRAW_BLACKNESS:
-        red_get_blackness_ptr(slots, group_id,
+        red_get_blackness_ptr(slots, group_id, arena,
                               &red->u.blackness, &qxl->u.blackness, flags);
         break;
     case QXL_DRAW_BLEND:
-        return red_get_blend_ptr(slots, group_id, &red->u.blend, &qxl->u.blend, flags);
+        return red_get_blend_ptr(slots, group_id, arena, &red->u.blend, &qxl->u.blend, flags);
     case QXL_DRAW_COPY:
-        return red_get_copy_ptr(slots, group_id, &red->u.copy, &qxl->u.copy, flags);
+        return red_get_copy_ptr(slots, group_id, arena, &red->u.copy, &qxl->u.copy, flags);
     case QXL_COPY_BITS:
         red_get_point_ptr(&red->u.copy_bits.src_pos, &qxl->u.copy_bits.src_pos);
         red->surface_deps[0] = 0;
@@ -1162,30 +1272,30 @@ static bool red_get_compat_drawable(RedMemSlotInfo *slots, int group_id,
             (red->bbox.bottom - red->bbox.top);
         break;
     case QXL_DRAW_FILL:
-        red_get_fill_ptr(slots, group_id, &red->u.fill, &qxl->u.fill, flags);
+        red_get_fill_ptr(slots, group_id, arena, &red->u.fill, &qxl->u.fill, flags);
         break;
     case QXL_DRAW_OPAQUE:
-        red_get_opaque_ptr(slots, group_id, &red->u.opaque, &qxl->u.opaque, flags);
+        red_get_opaque_ptr(slots, group_id, arena, &red->u.opaque, &qxl->u.opaque, flags);
         break;
     case QXL_DRAW_INVERS:
-        red_get_invers_ptr(slots, group_id, &red->u.invers, &qxl->u.invers, flags);
+        red_get_invers_ptr(slots, group_id, arena, &red->u.invers, &qxl->u.invers, flags);
         break;
     case QXL_DRAW_NOP:
         break;
     case QXL_DRAW_ROP3:
-        red_get_rop3_ptr(slots, group_id, &red->u.rop3, &qxl->u.rop3, flags);
+        red_get_rop3_ptr(slots, group_id, arena, &red->u.rop3, &qxl->u.rop3, flags);
         break;
     case QXL_DRAW_STROKE:
-        return red_get_stroke_ptr(slots, group_id, &red->u.stroke, &qxl->u.stroke, flags);
+        return red_get_stroke_ptr(slots, group_id, arena, &red->u.stroke, &qxl->u.stroke, flags);
     case QXL_DRAW_TEXT:
-        red_get_text_ptr(slots, group_id, &red->u.text, &qxl->u.text, flags);
+        red_get_text_ptr(slots, group_id, arena, &red->u.text, &qxl->u.text, flags);
         break;
     case QXL_DRAW_TRANSPARENT:
-        red_get_transparent_ptr(slots, group_id,
+        red_get_transparent_ptr(slots, group_id, arena,
                                 &red->u.transparent, &qxl->u.transparent, flags);
         break;
     case QXL_DRAW_WHITENESS:
-        red_get_whiteness_ptr(slots, group_id,
+        red_get_whiteness_ptr(slots, group_id, arena,
                               &red->u.whiteness, &qxl->u.whiteness, flags);
         break;
     default:
@@ -1210,51 +1320,54 @@ bool red_get_drawable(RedMemSlotInfo *slots, int group_id,
 
 void red_put_drawable(RedDrawable *red)
 {
-    red_put_clip(&red->clip);
+    RedArena *arena = &red->arena;
+
+    red_put_clip(arena, &red->clip);
     if (red->self_bitmap_image) {
-        red_put_image(red->self_bitmap_image);
+        red_put_image(NULL, red->self_bitmap_image);
     }
     switch (red->type) {
     case QXL_DRAW_ALPHA_BLEND:
-        red_put_alpha_blend(&red->u.alpha_blend);
+        red_put_alpha_blend(arena, &red->u.alpha_blend);
         break;
     case QXL_DRAW_BLACKNESS:
-        red_put_blackness(&red->u.blackness);
+        red_put_blackness(arena, &red->u.blackness);
         break;
     case QXL_DRAW_BLEND:
-        red_put_blend(&red->u.blend);
+        red_put_blend(arena, &red->u.blend);
         break;
     case QXL_DRAW_COPY:
-        red_put_copy(&red->u.copy);
+        red_put_copy(arena, &red->u.copy);
         break;
     case QXL_DRAW_FILL:
-        red_put_fill(&red->u.fill);
+        red_put_fill(arena, &red->u.fill);
         break;
     case QXL_DRAW_OPAQUE:
-        red_put_opaque(&red->u.opaque);
+        red_put_opaque(arena, &red->u.opaque);
         break;
     case QXL_DRAW_INVERS:
-        red_put_invers(&red->u.invers);
+        red_put_invers(arena, &red->u.invers);
         break;
     case QXL_DRAW_ROP3:
-        red_put_rop3(&red->u.rop3);
+        red_put_rop3(arena, &red->u.rop3);
         break;
     case QXL_DRAW_COMPOSITE:
-        red_put_composite(&red->u.composite);
+        red_put_composite(arena, &red->u.composite);
         break;
     case QXL_DRAW_STROKE:
-        red_put_stroke(&red->u.stroke);
+        red_put_stroke(arena, &red->u.stroke);
         break;
     case QXL_DRAW_TEXT:
-        red_put_text_ptr(&red->u.text);
+        red_put_text_ptr(arena, &red->u.text);
         break;
     case QXL_DRAW_TRANSPARENT:
-        red_put_transparent(&red->u.transparent);
+        red_put_transparent(arena, &red->u.transparent);
         break;
     case QXL_DRAW_WHITENESS:
-        red_put_whiteness(&red->u.whiteness);
+        red_put_whiteness(arena, &red->u.whiteness);
         break;
     }
+    red_arena_destroy(arena);
 }
 
 bool red_get_update_cmd(RedMemSlotInfo *slots, int group_id,
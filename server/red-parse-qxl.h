@@ -24,8 +24,35 @@
 #include "red-common.h"
 #include "memslot.h"
 
+/*
+ * Memory backing the parse tree of a command: the allocations are carved
+ * out of blocks which are all freed at once by red_arena_destroy(). A zeroed
+ * RedArena is valid and allocates its first block on demand.
+ */
+typedef union RedArenaBlock RedArenaBlock;
+typedef struct RedArena {
+    uint8_t *pos;
+    uint8_t *end;
+    RedArenaBlock *blocks;
+} RedArena;
+
+/* the alignment of the allocations, as malloc() would */
+#define RED_ARENA_ALIGN (2 * sizeof(void *))
+
+/* @buf, if not NULL, is used before allocating any block, it's not freed,
+ * it must be aligned on RED_ARENA_ALIGN */
+void red_arena_init(RedArena *arena, void *buf, size_t size);
+void *red_arena_alloc(RedArena *arena, size_t size);
+void red_arena_destroy(RedArena *arena);
+
+/* size of the buffer allocated along with a RedDrawable for its arena,
+ * enough for the parse tree of most commands */
+#define RED_DRAWABLE_ARENA_SIZE 1024
+
 typedef struct RedDrawable {
     int refs;
+    /* everything parsed by red_get_drawable() but self_bitmap_image */
+    RedArena arena;
     QXLInstance *qxl;
     QXLReleaseInfoExt release_info_ext;
     uint32_t surface_id;
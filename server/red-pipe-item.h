@@ -19,6 +19,7 @@
 #ifndef RED_PIPE_ITEM_H_
 #define RED_PIPE_ITEM_H_
 
+#include <stdint.h>
 #include <glib.h>
 #include <common/ring.h>
 
@@ -33,6 +34,12 @@ typedef struct RedPipeItem {
     int refcount;
 
     red_pipe_item_free_t *free_func;
+
+    /* set when the item is queued to a RedChannelClient: its RedPipeLane,
+     * the same for all the clients it is queued to, and the time of the
+     * last queueing */
+    uint8_t lane;
+    uint64_t queue_time;
 } RedPipeItem;
 
 void red_pipe_item_init_full(RedPipeItem *item, int type, red_pipe_item_free_t free_func);
@@ -157,10 +157,15 @@ static int red_process_cursor(RedWorker *worker, int *ring_is_empty)
 
 static RedDrawable *red_drawable_new(QXLInstance *qxl)
 {
-    RedDrawable * red = spice_new0(RedDrawable, 1);
+    /* the first block of the arena comes with the drawable, so most
+     * commands are parsed with a single allocation */
+    size_t arena_offset = SPICE_ALIGN(sizeof(RedDrawable), RED_ARENA_ALIGN);
+    RedDrawable *red = spice_malloc(arena_offset + RED_DRAWABLE_ARENA_SIZE);
 
+    memset(red, 0, sizeof(*red));
     red->refs = 1;
     red->qxl = qxl;
+    red_arena_init(&red->arena, (uint8_t *)red + arena_offset, RED_DRAWABLE_ARENA_SIZE);
 
     return red;
 }
@@ -192,7 +197,7 @@ static int red_process_display(RedWorker *worker, int *ring_is_empty)
 
     worker->process_display_generation++;
     *ring_is_empty = FALSE;
-    while (red_channel_max_pipe_size(RED_CHANNEL(worker->display_channel)) <= MAX_PIPE_SIZE) {
+    while (!display_channel_pipes_are_full(worker->display_channel)) {
         if (!red_qxl_get_command(worker->qxl, &ext_cmd)) {
             *ring_is_empty = TRUE;
             if (worker->display_poll_tries < CMD_RING_POLL_RETRIES) {
@@ -276,7 +281,7 @@ static int red_process_display(RedWorker *worker, int *ring_is_empty)
 static bool red_process_is_blocked(RedWorker *worker)
 {
     return red_channel_max_pipe_size(RED_CHANNEL(worker->cursor_channel)) > MAX_PIPE_SIZE ||
-           red_channel_max_pipe_size(RED_CHANNEL(worker->display_channel)) > MAX_PIPE_SIZE;
+           display_channel_pipes_are_full(worker->display_channel);
 }
 
 static void red_disconnect_display(RedWorker *worker)
@@ -1247,6 +1252,7 @@ static gboolean worker_source_prepare(GSource *source, gint *p_timeout)
 
     timeout = MIN(worker->event_timeout,
                   display_channel_get_streams_timeout(worker->display_channel));
+    timeout = MIN(timeout, display_channel_get_lossy_refine_timeout(worker->display_channel));
 
     *p_timeout = (timeout == INF_EVENT_WAIT) ? -1 : timeout;
     if (*p_timeout == 0)
@@ -1287,7 +1293,10 @@ static gboolean worker_source_dispatch(GSource *source, GSourceFunc callback,
     worker->event_timeout = INF_EVENT_WAIT;
     worker->was_blocked = FALSE;
     red_process_cursor(worker, &ring_is_empty);
+    display_channel_resync_lagging_clients(display);
     red_process_display(worker, &ring_is_empty);
+    stream_surface_video_timeout(display);
+    display_channel_refine_lossy_clients(display);
 
     return TRUE;
 }
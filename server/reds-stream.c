@@ -23,7 +23,11 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 #include <fcntl.h>
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
 
 #include <glib.h>
 
@@ -78,8 +82,24 @@ typedef struct RedsSASL {
 } RedsSASL;
 #endif
 
+/* Largest plaintext payload carried by a single TLS record */
+#define SSL_RECORD_MAX_SIZE SSL3_RT_MAX_PLAIN_LENGTH
+
 struct RedsStreamPrivate {
     SSL *ssl;
+    /* scratch buffer used by stream_ssl_writev_cb() to gather small
+     * iovecs into a single TLS record, allocated on first use */
+    uint8_t *ssl_record;
+    /* size of the record SSL_write() asked us to retry, 0 if none */
+    size_t ssl_record_pending;
+    /* the kernel encrypts what is written to the socket (kTLS) */
+    bool ktls_send;
+    /* SO_ZEROCOPY is set and MSG_ZEROCOPY sends are allowed */
+    bool zerocopy;
+    /* id the kernel will give to the next successful MSG_ZEROCOPY send */
+    uint64_t zerocopy_next_id;
+    /* MSG_ZEROCOPY sends failed with ENOBUFS in a row */
+    unsigned int zerocopy_nobufs;
 
 #if HAVE_SASL
     RedsSASL sasl;
@@ -153,6 +173,87 @@ static ssize_t stream_ssl_write_cb(RedsStream *s, const void *buf, size_t size)
     return return_code;
 }
 
+/*
+ * Coalesces the iovecs into records of up to SSL_RECORD_MAX_SIZE bytes so
+ * that every small header or sub-message does not end up in its own TLS
+ * record with its own MAC and syscall.
+ *
+ * When SSL_write() cannot complete, it must be retried with the same length;
+ * the caller is expected to call again with the same data at the same
+ * position (like for any other partial write), so only the size of the
+ * pending record has to be remembered. SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+ * is set on the connection as the data may be gathered again at another
+ * address.
+ */
+static ssize_t stream_ssl_writev_cb(RedsStream *s, const struct iovec *iov, int iovcnt)
+{
+    RedsStreamPrivate *priv = s->priv;
+    ssize_t ret = 0;
+    size_t iov_pos = 0;
+    int i = 0;
+
+    for (;;) {
+        const uint8_t *record;
+        size_t record_size = priv->ssl_record_pending;
+        size_t len = 0;
+        int n;
+
+        if (record_size == 0) {
+            int j;
+            size_t left = 0;
+
+            for (j = i; j < iovcnt && left < SSL_RECORD_MAX_SIZE + iov_pos; j++) {
+                left += iov[j].iov_len;
+            }
+            left -= MIN(left, iov_pos);
+            record_size = MIN(left, SSL_RECORD_MAX_SIZE);
+            if (record_size == 0) {
+                break;
+            }
+        }
+
+        while (i < iovcnt && iov[i].iov_len == iov_pos) {
+            i++;
+            iov_pos = 0;
+        }
+        spice_return_val_if_fail(i < iovcnt, -1);
+
+        if (iov[i].iov_len - iov_pos >= record_size) {
+            /* contiguous, no need to copy */
+            record = (uint8_t *)iov[i].iov_base + iov_pos;
+            iov_pos += record_size;
+        } else {
+            if (priv->ssl_record == NULL) {
+                priv->ssl_record = spice_malloc(SSL_RECORD_MAX_SIZE);
+            }
+            while (len < record_size) {
+                size_t now;
+
+                spice_return_val_if_fail(i < iovcnt, -1);
+                now = MIN(iov[i].iov_len - iov_pos, record_size - len);
+                memcpy(priv->ssl_record + len, (uint8_t *)iov[i].iov_base + iov_pos, now);
+                len += now;
+                iov_pos += now;
+                if (iov_pos == iov[i].iov_len) {
+                    i++;
+                    iov_pos = 0;
+                }
+            }
+            record = priv->ssl_record;
+        }
+
+        n = stream_ssl_write_cb(s, record, record_size);
+        if (n <= 0) {
+            priv->ssl_record_pending = record_size;
+            return ret == 0 ? n : ret;
+        }
+        priv->ssl_record_pending = 0;
+        ret += n;
+    }
+
+    return ret;
+}
+
 static ssize_t stream_ssl_read_cb(RedsStream *s, void *buf, size_t size)
 {
     int return_code;
@@ -277,6 +378,16 @@ int reds_stream_get_no_delay(RedsStream *stream)
     return red_socket_get_no_delay(stream->socket);
 }
 
+bool reds_stream_get_tcp_info(RedsStream *stream, RedSocketTcpInfo *info)
+{
+    int family = reds_stream_get_family(stream);
+
+    if (family != AF_INET && family != AF_INET6) {
+        return false;
+    }
+    return red_socket_get_tcp_info(stream->socket, info);
+}
+
 int reds_stream_send_msgfd(RedsStream *stream, int fd)
 {
     struct msghdr msgh = { 0, };
@@ -365,6 +476,7 @@ void reds_stream_free(RedsStream *s)
     if (s->priv->ssl) {
         SSL_free(s->priv->ssl);
     }
+    free(s->priv->ssl_record);
 
     reds_stream_remove_watch(s);
     spice_debug("close socket fd %d", s->socket);
@@ -437,6 +549,180 @@ void reds_stream_disable_writev(RedsStream *stream)
     stream->priv->writev = NULL;
 }
 
+bool reds_stream_is_ktls(RedsStream *stream)
+{
+    return stream->priv->ktls_send;
+}
+
+/*
+ * MSG_ZEROCOPY lets the kernel send directly from our pages instead of
+ * copying them into socket buffers. The pages must then stay untouched
+ * until the kernel reports the send as completed on the socket error queue
+ * (see reds_stream_get_zerocopy_completion()), so this is only worth it for
+ * large payloads. Only plain TCP streams are supported: the data has to be
+ * sent unmodified.
+ */
+bool reds_stream_enable_zerocopy(RedsStream *stream)
+{
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    int one = 1;
+    int family = reds_stream_get_family(stream);
+
+    if (family != AF_INET && family != AF_INET6) {
+        return false;
+    }
+    if (stream->priv->ssl) {
+        return false;
+    }
+#if HAVE_SASL
+    if (stream->priv->sasl.conn) {
+        return false;
+    }
+#endif
+    if (setsockopt(stream->socket, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0) {
+        spice_debug("SO_ZEROCOPY not available on socket fd %d: %s",
+                    stream->socket, strerror(errno));
+        return false;
+    }
+    stream->priv->zerocopy = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool reds_stream_is_zerocopy(RedsStream *stream)
+{
+    return stream->priv->zerocopy;
+}
+
+/* id that will be given to the next successful zero-copy send, the ids
+ * of the sends done since then are in [id, reds_stream_get_zerocopy_id()) */
+uint64_t reds_stream_get_zerocopy_id(RedsStream *stream)
+{
+    return stream->priv->zerocopy_next_id;
+}
+
+/* after this many ENOBUFS in a row zero-copy is disabled on the stream */
+#define ZEROCOPY_MAX_NOBUFS 8
+
+/*
+ * Same as reds_stream_writev() but asks the kernel not to copy the data.
+ * Every call which sends some data uses one completion id.
+ * Falls back to reds_stream_writev() if zero-copy is not enabled, or if
+ * the kernel refuses the zero-copy send with ENOBUFS (the socket option
+ * memory used to track the pending sends is exhausted).
+ */
+ssize_t reds_stream_writev_zerocopy(RedsStream *s, const struct iovec *iov, int iovcnt)
+{
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(MSG_ZEROCOPY)
+    struct msghdr msgh = { 0, };
+    ssize_t n;
+
+    if (!s->priv->zerocopy) {
+        return reds_stream_writev(s, iov, iovcnt);
+    }
+
+    msgh.msg_iov = (struct iovec *)iov;
+#ifdef IOV_MAX
+    msgh.msg_iovlen = MIN(iovcnt, IOV_MAX);
+#else
+    msgh.msg_iovlen = iovcnt;
+#endif
+    n = sendmsg(s->socket, &msgh, MSG_ZEROCOPY | MSG_NOSIGNAL);
+    if (n > 0) {
+        s->priv->zerocopy_next_id++;
+        s->priv->zerocopy_nobufs = 0;
+    } else if (n == -1 && errno == ENOBUFS) {
+        if (++s->priv->zerocopy_nobufs >= ZEROCOPY_MAX_NOBUFS) {
+            spice_debug("zero-copy sends keep failing on socket fd %d, disabling",
+                        s->socket);
+            s->priv->zerocopy = false;
+        }
+        return reds_stream_writev(s, iov, iovcnt);
+    }
+    return n;
+#else
+    return reds_stream_writev(s, iov, iovcnt);
+#endif
+}
+
+/*
+ * Reads one completion notification from the socket error queue.
+ * On success the sends with ids in [*first, *last] are complete and their
+ * data can be released.
+ *
+ * Returns: #true if a notification was read, #false if there is none
+ */
+bool reds_stream_get_zerocopy_completion(RedsStream *s, uint64_t *first, uint64_t *last)
+{
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(MSG_ZEROCOPY)
+    union {
+        struct cmsghdr hdr;
+        char data[CMSG_SPACE(sizeof(struct sock_extended_err))];
+    } control;
+    struct msghdr msgh = { 0, };
+    struct cmsghdr *cmsg;
+    struct sock_extended_err *serr;
+    uint64_t next_id = s->priv->zerocopy_next_id;
+
+    for (;;) {
+        msgh.msg_control = control.data;
+        msgh.msg_controllen = sizeof(control.data);
+        if (recvmsg(s->socket, &msgh, MSG_ERRQUEUE) < 0) {
+            return false;
+        }
+
+        cmsg = CMSG_FIRSTHDR(&msgh);
+        if (cmsg == NULL ||
+            !((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+              (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+            continue;
+        }
+        serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+        if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            continue;
+        }
+
+        /* the kernel uses 32 bit ids, they are always close to next_id */
+        *first = next_id - (uint32_t)((uint32_t)next_id - serr->ee_info);
+        *last = next_id - (uint32_t)((uint32_t)next_id - serr->ee_data);
+        if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+            /* the kernel had to copy the data anyway (e.g. loopback or a
+             * device without scatter-gather), don't pay for the
+             * notifications */
+            spice_debug("zero-copy send fell back to copy on socket fd %d, disabling",
+                        s->socket);
+            s->priv->zerocopy = false;
+        }
+        return true;
+    }
+#else
+    return false;
+#endif
+}
+
+/*
+ * If kernel TLS was requested on the SSL context (SSL_OP_ENABLE_KTLS) and
+ * OpenSSL managed to hand the negotiated keys to the kernel, the socket
+ * does the encryption and record framing itself, so plain write()/writev()
+ * can be used instead of SSL_write(). Reads still go through SSL_read() as
+ * it is able to deal with non application data records.
+ */
+static void reds_stream_ssl_setup_ktls(RedsStream *stream)
+{
+#ifdef BIO_get_ktls_send
+    if (!BIO_get_ktls_send(SSL_get_wbio(stream->priv->ssl))) {
+        return;
+    }
+
+    spice_debug("kernel TLS enabled on socket fd %d", stream->socket);
+    stream->priv->ktls_send = true;
+    stream->priv->write = stream_write_cb;
+    stream->priv->writev = stream_writev_cb;
+#endif
+}
+
 RedsStreamSslStatus reds_stream_ssl_accept(RedsStream *stream)
 {
     int ssl_error;
@@ -444,6 +730,7 @@ RedsStreamSslStatus reds_stream_ssl_accept(RedsStream *stream)
 
     return_code = SSL_accept(stream->priv->ssl);
     if (return_code == 1) {
+        reds_stream_ssl_setup_ktls(stream);
         return REDS_STREAM_SSL_STATUS_OK;
     }
 
@@ -483,10 +770,11 @@ int reds_stream_enable_ssl(RedsStream *stream, SSL_CTX *ctx)
     }
 
     SSL_set_bio(stream->priv->ssl, sbio, sbio);
+    SSL_set_mode(stream->priv->ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
     stream->priv->write = stream_ssl_write_cb;
     stream->priv->read = stream_ssl_read_cb;
-    stream->priv->writev = NULL;
+    stream->priv->writev = stream_ssl_writev_cb;
 
     return reds_stream_ssl_accept(stream);
 }
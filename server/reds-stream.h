@@ -23,6 +23,7 @@
 
 #include "spice.h"
 #include "red-common.h"
+#include "net-utils.h"
 
 typedef void (*AsyncReadDone)(void *opaque);
 typedef void (*AsyncReadError)(void *opaque, int err);
@@ -68,12 +69,19 @@ void reds_stream_set_channel(RedsStream *stream, int connection_id,
                              int channel_type, int channel_id);
 RedsStream *reds_stream_new(RedsState *reds, int socket);
 bool reds_stream_is_ssl(RedsStream *stream);
+bool reds_stream_is_ktls(RedsStream *stream);
+bool reds_stream_enable_zerocopy(RedsStream *stream);
+bool reds_stream_is_zerocopy(RedsStream *stream);
+uint64_t reds_stream_get_zerocopy_id(RedsStream *stream);
+ssize_t reds_stream_writev_zerocopy(RedsStream *s, const struct iovec *iov, int iovcnt);
+bool reds_stream_get_zerocopy_completion(RedsStream *s, uint64_t *first, uint64_t *last);
 RedsStreamSslStatus reds_stream_ssl_accept(RedsStream *stream);
 int reds_stream_enable_ssl(RedsStream *stream, SSL_CTX *ctx);
 int reds_stream_get_family(const RedsStream *stream);
 bool reds_stream_is_plain_unix(const RedsStream *stream);
 bool reds_stream_set_no_delay(RedsStream *stream, bool no_delay);
 int reds_stream_get_no_delay(RedsStream *stream);
+bool reds_stream_get_tcp_info(RedsStream *stream, RedSocketTcpInfo *info);
 int reds_stream_send_msgfd(RedsStream *stream, int fd);
 
 typedef enum {
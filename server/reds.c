@@ -74,6 +74,7 @@
 #include "red-client.h"
 #include "glib-compat.h"
 #include "net-utils.h"
+#include "pixmap-cache.h"
 
 #define REDS_MAX_STAT_NODES 100
 
@@ -147,6 +148,22 @@ static const SpiceCoreInterfaceInternal core_interface_adapter = {
 
 #define REDS_TOKENS_TO_SEND 5
 #define REDS_VDI_PORT_NUM_RECEIVE_BUFFS 5
+/* per display channel, see spice_server_set_compression_threads() */
+#define REDS_MAX_COMPRESSION_THREADS 16
+/* in MiB, see spice_server_set_shared_images_size() */
+#define REDS_DEFAULT_SHARED_IMAGES_SIZE 32
+#define REDS_MAX_SHARED_IMAGES_SIZE 4096
+/* see spice_server_set_max_drawables(), the minimum is a chunk of
+ * drawables of the display channel */
+#define REDS_DEFAULT_MAX_DRAWABLES 4096
+#define REDS_MAX_DRAWABLES_MIN 256
+#define REDS_MAX_DRAWABLES_LIMIT (1024 * 1024)
+/* in MiB, see spice_server_set_image_cache_size() */
+#define REDS_DEFAULT_IMAGE_CACHE_SIZE 16
+#define REDS_MAX_IMAGE_CACHE_SIZE 4096
+/* in KiB per second, see spice_server_set_lossy_refine_rate() */
+#define REDS_DEFAULT_LOSSY_REFINE_RATE 4096
+#define REDS_MAX_LOSSY_REFINE_RATE (1024 * 1024)
 
 /* TODO while we can technically create more than one server in a process,
  * the intended use is to support a single server per process */
@@ -185,6 +202,18 @@ struct RedServerConfig {
     bool playback_compression;
     spice_wan_compression_t jpeg_state;
     spice_wan_compression_t zlib_glz_state;
+    int compression_threads;
+    int shared_images_size;
+    int max_drawables;
+    bool pixmap_dedup;
+    int pixmap_cache_shards;
+    int image_cache_size;
+    bool shared_video_encoders;
+    bool async_video_encoding;
+    bool surface_video;
+    int lossy_refine_rate;
+    bool zerocopy;
+    bool ktls;
 
     gboolean agent_mouse;
     gboolean agent_copypaste;
@@ -2830,6 +2859,13 @@ static int reds_init_ssl(RedsState *reds)
     /* Limit connection to TLSv1 only */
 #ifdef SSL_OP_NO_COMPRESSION
     ssl_options |= SSL_OP_NO_COMPRESSION;
+#endif
+    /* Opt-in kernel TLS offload, streams fall back to SSL_write() if the
+     * kernel or the negotiated cipher does not support it */
+#ifdef SSL_OP_ENABLE_KTLS
+    if (reds->config->ktls) {
+        ssl_options |= SSL_OP_ENABLE_KTLS;
+    }
 #endif
     SSL_CTX_set_options(reds->ctx, ssl_options);
 
@@ -3505,6 +3541,11 @@ SPICE_GNUC_VISIBLE SpiceServer *spice_server_new(void)
     reds->config->playback_compression = TRUE;
     reds->config->jpeg_state = SPICE_WAN_COMPRESSION_AUTO;
     reds->config->zlib_glz_state = SPICE_WAN_COMPRESSION_AUTO;
+    reds->config->shared_images_size = REDS_DEFAULT_SHARED_IMAGES_SIZE;
+    reds->config->max_drawables = REDS_DEFAULT_MAX_DRAWABLES;
+    reds->config->pixmap_cache_shards = 1;
+    reds->config->image_cache_size = REDS_DEFAULT_IMAGE_CACHE_SIZE;
+    reds->config->lossy_refine_rate = REDS_DEFAULT_LOSSY_REFINE_RATE;
     reds->config->agent_mouse = TRUE;
     reds->config->agent_copypaste = TRUE;
     reds->config->agent_file_xfer = TRUE;
@@ -3913,6 +3954,18 @@ SPICE_GNUC_VISIBLE int spice_server_set_tls(SpiceServer *s, int port,
     return 0;
 }
 
+SPICE_GNUC_VISIBLE int spice_server_set_ktls(SpiceServer *s, int enable)
+{
+#ifndef SSL_OP_ENABLE_KTLS
+    if (enable) {
+        spice_warning("kernel TLS is not supported by this OpenSSL version");
+        return -1;
+    }
+#endif
+    s->config->ktls = !!enable;
+    return 0;
+}
+
 SPICE_GNUC_VISIBLE int spice_server_set_image_compression(SpiceServer *s,
                                                           SpiceImageCompression comp)
 {
@@ -3955,6 +4008,165 @@ SPICE_GNUC_VISIBLE int spice_server_set_zlib_glz_compression(SpiceServer *s, spi
     return 0;
 }
 
+SPICE_GNUC_VISIBLE int spice_server_set_compression_threads(SpiceServer *s, int n_threads)
+{
+    if (n_threads < 0 || n_threads > REDS_MAX_COMPRESSION_THREADS) {
+        spice_warning("invalid number of compression threads %d", n_threads);
+        return -1;
+    }
+    /* used by the display channels created afterwards */
+    s->config->compression_threads = n_threads;
+    return 0;
+}
+
+int reds_get_compression_threads(const RedsState *reds)
+{
+    return reds->config->compression_threads;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_shared_images_size(SpiceServer *s, int size_mb)
+{
+    if (size_mb < 0 || size_mb > REDS_MAX_SHARED_IMAGES_SIZE) {
+        spice_warning("invalid shared images size %d MiB", size_mb);
+        return -1;
+    }
+    /* used by the display channels created afterwards */
+    s->config->shared_images_size = size_mb;
+    return 0;
+}
+
+/* in bytes */
+uint64_t reds_get_shared_images_size(const RedsState *reds)
+{
+    return reds->config->shared_images_size * 1024ULL * 1024ULL;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_max_drawables(SpiceServer *s, int max_drawables)
+{
+    if (max_drawables < REDS_MAX_DRAWABLES_MIN || max_drawables > REDS_MAX_DRAWABLES_LIMIT) {
+        spice_warning("invalid maximum number of drawables %d", max_drawables);
+        return -1;
+    }
+    /* used by the display channels created afterwards */
+    s->config->max_drawables = max_drawables;
+    return 0;
+}
+
+uint32_t reds_get_max_drawables(const RedsState *reds)
+{
+    return reds->config->max_drawables;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_pixmap_dedup(SpiceServer *s, int enable)
+{
+    /* used by the display channels created afterwards */
+    s->config->pixmap_dedup = !!enable;
+    return 0;
+}
+
+bool reds_get_pixmap_dedup(const RedsState *reds)
+{
+    return reds->config->pixmap_dedup;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_pixmap_cache_shards(SpiceServer *s, int n_shards)
+{
+    if (n_shards < 1 || n_shards > PIXMAP_CACHE_MAX_SHARDS) {
+        spice_warning("invalid number of pixmap cache shards %d", n_shards);
+        return -1;
+    }
+    /* used by the pixmap caches created afterwards */
+    s->config->pixmap_cache_shards = n_shards;
+    return 0;
+}
+
+uint32_t reds_get_pixmap_cache_shards(const RedsState *reds)
+{
+    return reds->config->pixmap_cache_shards;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_image_cache_size(SpiceServer *s, int size_mb)
+{
+    if (size_mb < 0 || size_mb > REDS_MAX_IMAGE_CACHE_SIZE) {
+        spice_warning("invalid image cache size %d MiB", size_mb);
+        return -1;
+    }
+    /* used by the display channels created afterwards */
+    s->config->image_cache_size = size_mb;
+    return 0;
+}
+
+/* in bytes */
+uint64_t reds_get_image_cache_size(const RedsState *reds)
+{
+    return reds->config->image_cache_size * 1024ULL * 1024ULL;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_shared_video_encoders(SpiceServer *s, int enable)
+{
+    /* used by the display channels created afterwards */
+    s->config->shared_video_encoders = !!enable;
+    return 0;
+}
+
+bool reds_get_shared_video_encoders(const RedsState *reds)
+{
+    return reds->config->shared_video_encoders;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_async_video_encoding(SpiceServer *s, int enable)
+{
+    /* used by the display channels created afterwards */
+    s->config->async_video_encoding = !!enable;
+    return 0;
+}
+
+bool reds_get_async_video_encoding(const RedsState *reds)
+{
+    return reds->config->async_video_encoding;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_surface_video(SpiceServer *s, int enable)
+{
+    /* used by the display channels created afterwards */
+    s->config->surface_video = !!enable;
+    return 0;
+}
+
+bool reds_get_surface_video(const RedsState *reds)
+{
+    return reds->config->surface_video;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_lossy_refine_rate(SpiceServer *s, int kib_per_sec)
+{
+    if (kib_per_sec < 0 || kib_per_sec > REDS_MAX_LOSSY_REFINE_RATE) {
+        spice_warning("invalid lossy refine rate %d KiB/s", kib_per_sec);
+        return -1;
+    }
+    /* used by the display channels created afterwards */
+    s->config->lossy_refine_rate = kib_per_sec;
+    return 0;
+}
+
+/* in bytes per second */
+uint64_t reds_get_lossy_refine_rate(const RedsState *reds)
+{
+    return reds->config->lossy_refine_rate * 1024ULL;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_zerocopy(SpiceServer *s, int enable)
+{
+    /* used by the display channels created afterwards */
+    s->config->zerocopy = !!enable;
+    return 0;
+}
+
+bool reds_get_zerocopy(const RedsState *reds)
+{
+    return reds->config->zerocopy;
+}
+
 SPICE_GNUC_VISIBLE int spice_server_set_channel_security(SpiceServer *s, const char *channel, int security)
 {
     static const char *const names[] = {
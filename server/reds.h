@@ -96,6 +96,17 @@ void reds_on_main_channel_migrate(RedsState *reds, MainChannelClient *mcc);
 void reds_set_client_mm_time_latency(RedsState *reds, RedClient *client, uint32_t latency);
 uint32_t reds_get_streaming_video(const RedsState *reds);
 GArray* reds_get_video_codecs(const RedsState *reds);
+int reds_get_compression_threads(const RedsState *reds);
+uint64_t reds_get_shared_images_size(const RedsState *reds);
+uint32_t reds_get_max_drawables(const RedsState *reds);
+bool reds_get_pixmap_dedup(const RedsState *reds);
+uint32_t reds_get_pixmap_cache_shards(const RedsState *reds);
+uint64_t reds_get_image_cache_size(const RedsState *reds);
+bool reds_get_shared_video_encoders(const RedsState *reds);
+bool reds_get_async_video_encoding(const RedsState *reds);
+bool reds_get_surface_video(const RedsState *reds);
+uint64_t reds_get_lossy_refine_rate(const RedsState *reds);
+bool reds_get_zerocopy(const RedsState *reds);
 spice_wan_compression_t reds_get_jpeg_state(const RedsState *reds);
 spice_wan_compression_t reds_get_zlib_glz_state(const RedsState *reds);
 SpiceCoreInterfaceInternal* reds_get_core_interface(RedsState *reds);
@@ -0,0 +1,487 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "red-common.h"
+#include "shared-video-encoder.h"
+
+typedef struct SharedVideoEncoderClient SharedVideoEncoderClient;
+
+/* a compressed frame and the clients' buffers pointing to it */
+typedef struct SharedVideoFrame {
+    int refs;
+    VideoBuffer *buffer;
+} SharedVideoFrame;
+
+/* the frames encoded last, so that the clients lagging a few frames behind
+ * the first one still get them from the group */
+#define SHARED_VIDEO_RECENT_FRAMES 4
+
+/* a frame given to the group encoder, holding a reference to its bitmap */
+typedef struct SharedVideoRecentFrame {
+    gpointer bitmap_opaque;
+    uint32_t mm_time;
+    uint32_t serial;
+    int ret;
+    SharedVideoFrame *frame;
+} SharedVideoRecentFrame;
+
+typedef struct SharedVideoBuffer {
+    VideoBuffer base;
+    SharedVideoFrame *frame;
+} SharedVideoBuffer;
+
+struct SharedVideoEncoder {
+    /* NULL once the groups are closed */
+    SharedVideoEncoder **groups;
+    SharedVideoEncoder *next;
+
+    RedVideoCodec video_codec;
+    int tier;
+    VideoEncoder *encoder;
+    VideoEncoderRateControlCbs cbs;
+    bitmap_ref_t bitmap_ref;
+    bitmap_unref_t bitmap_unref;
+    GList *clients;
+
+    /* the number of frames given to the encoder */
+    uint32_t serial;
+    /* the last ones, indexed by serial % SHARED_VIDEO_RECENT_FRAMES */
+    SharedVideoRecentFrame recent[SHARED_VIDEO_RECENT_FRAMES];
+};
+
+struct SharedVideoEncoderClient {
+    VideoEncoder base;
+    SharedVideoEncoder *group;
+    /* the serial of the last frame of the group this client got */
+    uint32_t serial;
+
+    /* once out of its group */
+    VideoEncoder *encoder;
+    VideoEncoderRateControlCbs cbs;
+    bitmap_ref_t bitmap_ref;
+    bitmap_unref_t bitmap_unref;
+};
+
+/* 0 without rate control, then n for the bit rates in [2^(n-1), 2^n) */
+static int bit_rate_tier(uint64_t bit_rate)
+{
+    int tier = 0;
+
+    while (bit_rate) {
+        bit_rate >>= 1;
+        tier++;
+    }
+    return tier;
+}
+
+/* the inter-frame codecs need all the frames since the last key frame */
+static bool codec_needs_all_frames(SpiceVideoCodecType codec_type)
+{
+    return codec_type != SPICE_VIDEO_CODEC_TYPE_MJPEG;
+}
+
+static void shared_video_frame_unref(SharedVideoFrame *frame)
+{
+    if (--frame->refs != 0) {
+        return;
+    }
+    frame->buffer->free(frame->buffer);
+    free(frame);
+}
+
+static void shared_video_buffer_free(VideoBuffer *video_buffer)
+{
+    SharedVideoBuffer *buffer = SPICE_CONTAINEROF(video_buffer, SharedVideoBuffer, base);
+
+    shared_video_frame_unref(buffer->frame);
+    free(buffer);
+}
+
+static VideoBuffer *shared_video_buffer_new(SharedVideoFrame *frame)
+{
+    SharedVideoBuffer *buffer = spice_new0(SharedVideoBuffer, 1);
+
+    buffer->base.data = frame->buffer->data;
+    buffer->base.size = frame->buffer->size;
+    buffer->base.free = shared_video_buffer_free;
+    buffer->frame = frame;
+    frame->refs++;
+    return &buffer->base;
+}
+
+/* the rate control callbacks of the group encoder, covering all the clients */
+
+static uint32_t shared_video_encoder_get_roundtrip_ms(void *opaque)
+{
+    SharedVideoEncoder *group = opaque;
+    uint32_t roundtrip = 0;
+    GList *l;
+
+    for (l = group->clients; l != NULL; l = l->next) {
+        SharedVideoEncoderClient *client = l->data;
+
+        roundtrip = MAX(roundtrip, client->cbs.get_roundtrip_ms(client->cbs.opaque));
+    }
+    return roundtrip;
+}
+
+static uint32_t shared_video_encoder_get_source_fps(void *opaque)
+{
+    SharedVideoEncoder *group = opaque;
+    SharedVideoEncoderClient *client = group->clients->data;
+
+    return client->cbs.get_source_fps(client->cbs.opaque);
+}
+
+static void shared_video_encoder_update_client_playback_delay(void *opaque, uint32_t delay_ms)
+{
+    SharedVideoEncoder *group = opaque;
+    GList *l;
+
+    for (l = group->clients; l != NULL; l = l->next) {
+        SharedVideoEncoderClient *client = l->data;
+
+        client->cbs.update_client_playback_delay(client->cbs.opaque, delay_ms);
+    }
+}
+
+static void shared_video_encoder_drop_recent_frame(SharedVideoEncoder *group,
+                                                   SharedVideoRecentFrame *recent)
+{
+    if (recent->bitmap_opaque) {
+        group->bitmap_unref(recent->bitmap_opaque);
+        recent->bitmap_opaque = NULL;
+    }
+    if (recent->frame) {
+        shared_video_frame_unref(recent->frame);
+        recent->frame = NULL;
+    }
+}
+
+static SharedVideoRecentFrame *shared_video_encoder_find_recent_frame(SharedVideoEncoder *group,
+                                                                      gpointer bitmap_opaque,
+                                                                      uint32_t mm_time)
+{
+    int i;
+
+    for (i = 0; i < SHARED_VIDEO_RECENT_FRAMES; i++) {
+        SharedVideoRecentFrame *recent = &group->recent[i];
+
+        if (recent->bitmap_opaque && recent->bitmap_opaque == bitmap_opaque &&
+            recent->mm_time == mm_time) {
+            return recent;
+        }
+    }
+    return NULL;
+}
+
+static void shared_video_encoder_unlink(SharedVideoEncoder *group)
+{
+    SharedVideoEncoder **now;
+
+    if (!group->groups) {
+        return;
+    }
+    for (now = group->groups; *now != group; now = &(*now)->next) {
+        spice_assert(*now);
+    }
+    *now = group->next;
+    group->groups = NULL;
+}
+
+static void shared_video_encoder_remove_client(SharedVideoEncoderClient *client)
+{
+    SharedVideoEncoder *group = client->group;
+    int i;
+
+    group->clients = g_list_remove(group->clients, client);
+    client->group = NULL;
+    if (group->clients) {
+        return;
+    }
+    shared_video_encoder_unlink(group);
+    for (i = 0; i < SHARED_VIDEO_RECENT_FRAMES; i++) {
+        shared_video_encoder_drop_recent_frame(group, &group->recent[i]);
+    }
+    group->encoder->destroy(group->encoder);
+    free(group);
+}
+
+/* the client falls behind the others, it gets an encoder of its own */
+static void shared_video_encoder_client_leave_group(SharedVideoEncoderClient *client)
+{
+    SharedVideoEncoder *group = client->group;
+    uint64_t bit_rate = 0;
+
+    /* the clients without rate control stay without it */
+    if (group->tier != 0) {
+        bit_rate = group->encoder->get_bit_rate(group->encoder) / 2;
+    }
+
+    spice_debug("client %p leaving the shared encoder of %u clients, bit rate %.2f Mbps",
+                client, g_list_length(group->clients), bit_rate / 1024.0 / 1024.0);
+    client->encoder = group->video_codec.create(group->video_codec.type, bit_rate,
+                                                &client->cbs, client->bitmap_ref,
+                                                client->bitmap_unref);
+    shared_video_encoder_remove_client(client);
+}
+
+static VideoEncoder *shared_video_encoder_client_get_encoder(SharedVideoEncoderClient *client)
+{
+    return client->group ? client->group->encoder : client->encoder;
+}
+
+static void shared_video_encoder_client_destroy(VideoEncoder *video_encoder)
+{
+    SharedVideoEncoderClient *client = (SharedVideoEncoderClient *)video_encoder;
+
+    if (client->group) {
+        shared_video_encoder_remove_client(client);
+    }
+    if (client->encoder) {
+        client->encoder->destroy(client->encoder);
+    }
+    free(client);
+}
+
+static int shared_video_encoder_client_encode_frame(VideoEncoder *video_encoder,
+                                                    uint32_t frame_mm_time,
+                                                    const SpiceBitmap *bitmap,
+                                                    const SpiceRect *src, int top_down,
+                                                    gpointer bitmap_opaque,
+                                                    VideoBuffer **outbuf)
+{
+    SharedVideoEncoderClient *client = (SharedVideoEncoderClient *)video_encoder;
+    SharedVideoEncoder *group = client->group;
+
+    if (group) {
+        SharedVideoRecentFrame *recent =
+            shared_video_encoder_find_recent_frame(group, bitmap_opaque, frame_mm_time);
+        uint32_t serial = recent ? recent->serial : group->serial + 1;
+
+        if (codec_needs_all_frames(group->video_codec.type) && client->serial != serial - 1) {
+            /* a frame was dropped from the pipe of this client, or it fell
+             * too far behind the others */
+            shared_video_encoder_client_leave_group(client);
+        } else if (recent) {
+            client->serial = serial;
+            if (recent->ret == VIDEO_ENCODER_FRAME_ENCODE_DONE) {
+                *outbuf = shared_video_buffer_new(recent->frame);
+            }
+            return recent->ret;
+        } else {
+            VideoBuffer *buffer = NULL;
+            int ret;
+
+            ret = group->encoder->encode_frame(group->encoder, frame_mm_time, bitmap, src,
+                                               top_down, bitmap_opaque, &buffer);
+            recent = &group->recent[serial % SHARED_VIDEO_RECENT_FRAMES];
+            shared_video_encoder_drop_recent_frame(group, recent);
+            group->bitmap_ref(bitmap_opaque);
+            recent->bitmap_opaque = bitmap_opaque;
+            recent->mm_time = frame_mm_time;
+            recent->serial = serial;
+            recent->ret = ret;
+            if (ret == VIDEO_ENCODER_FRAME_ENCODE_DONE) {
+                recent->frame = spice_new0(SharedVideoFrame, 1);
+                recent->frame->refs = 1;
+                recent->frame->buffer = buffer;
+                *outbuf = shared_video_buffer_new(recent->frame);
+            }
+            client->serial = group->serial = serial;
+            return ret;
+        }
+    }
+
+    if (!client->encoder) {
+        return VIDEO_ENCODER_FRAME_UNSUPPORTED;
+    }
+    return client->encoder->encode_frame(client->encoder, frame_mm_time, bitmap, src,
+                                         top_down, bitmap_opaque, outbuf);
+}
+
+static void shared_video_encoder_client_stream_report(VideoEncoder *video_encoder,
+                                                      uint32_t num_frames, uint32_t num_drops,
+                                                      uint32_t start_frame_mm_time,
+                                                      uint32_t end_frame_mm_time,
+                                                      int32_t end_frame_delay,
+                                                      uint32_t audio_delay)
+{
+    SharedVideoEncoderClient *client = (SharedVideoEncoderClient *)video_encoder;
+    VideoEncoder *encoder;
+
+    if (client->group && client->group->clients->next) {
+        if (num_drops == 0 && end_frame_delay >= 0) {
+            /* the encoder follows the tier rather than one of the clients */
+            return;
+        }
+        shared_video_encoder_client_leave_group(client);
+    }
+    encoder = shared_video_encoder_client_get_encoder(client);
+    if (encoder) {
+        encoder->client_stream_report(encoder, num_frames, num_drops, start_frame_mm_time,
+                                      end_frame_mm_time, end_frame_delay, audio_delay);
+    }
+}
+
+static void shared_video_encoder_client_notify_server_frame_drop(VideoEncoder *video_encoder)
+{
+    SharedVideoEncoderClient *client = (SharedVideoEncoderClient *)video_encoder;
+    VideoEncoder *encoder;
+
+    if (client->group && client->group->clients->next) {
+        shared_video_encoder_client_leave_group(client);
+    }
+    encoder = shared_video_encoder_client_get_encoder(client);
+    if (encoder) {
+        encoder->notify_server_frame_drop(encoder);
+    }
+}
+
+static uint64_t shared_video_encoder_client_get_bit_rate(VideoEncoder *video_encoder)
+{
+    SharedVideoEncoderClient *client = (SharedVideoEncoderClient *)video_encoder;
+    VideoEncoder *encoder = shared_video_encoder_client_get_encoder(client);
+
+    return encoder ? encoder->get_bit_rate(encoder) : 0;
+}
+
+static void shared_video_encoder_client_get_stats(VideoEncoder *video_encoder,
+                                                  VideoEncoderStats *stats)
+{
+    SharedVideoEncoderClient *client = (SharedVideoEncoderClient *)video_encoder;
+    VideoEncoder *encoder = shared_video_encoder_client_get_encoder(client);
+
+    if (encoder) {
+        encoder->get_stats(encoder, stats);
+    }
+}
+
+/* the group encoders are synchronous, only the encoder of a client which
+ * left its group may encode asynchronously */
+static int shared_video_encoder_client_pull_encoded_frames(VideoEncoder *video_encoder)
+{
+    SharedVideoEncoderClient *client = (SharedVideoEncoderClient *)video_encoder;
+
+    if (!client->encoder || !client->encoder->pull_encoded_frames) {
+        return 0;
+    }
+    return client->encoder->pull_encoded_frames(client->encoder);
+}
+
+static SharedVideoEncoder *shared_video_encoder_find(SharedVideoEncoder *groups,
+                                                     SpiceVideoCodecType codec_type,
+                                                     int tier)
+{
+    SharedVideoEncoder *group;
+
+    for (group = groups; group != NULL; group = group->next) {
+        /* a new client of an inter-frame codec would start without a key frame */
+        if (group->video_codec.type == codec_type && group->tier == tier &&
+            (group->serial == 0 || !codec_needs_all_frames(codec_type))) {
+            return group;
+        }
+    }
+    return NULL;
+}
+
+/* the rate control callbacks may be called while creating the encoder, the
+ * group must already have its first client */
+static SharedVideoEncoder *shared_video_encoder_group_new(SharedVideoEncoder **groups,
+                                                          const RedVideoCodec *video_codec,
+                                                          uint64_t starting_bit_rate,
+                                                          SharedVideoEncoderClient *client)
+{
+    SharedVideoEncoder *group = spice_new0(SharedVideoEncoder, 1);
+    int tier = bit_rate_tier(starting_bit_rate);
+
+    group->video_codec = *video_codec;
+    group->tier = tier;
+    group->bitmap_ref = client->bitmap_ref;
+    group->bitmap_unref = client->bitmap_unref;
+    group->cbs.opaque = group;
+    group->cbs.get_roundtrip_ms = shared_video_encoder_get_roundtrip_ms;
+    group->cbs.get_source_fps = shared_video_encoder_get_source_fps;
+    group->cbs.update_client_playback_delay = shared_video_encoder_update_client_playback_delay;
+    /* no frame_encoded(), the frame must be there for the next clients */
+    group->clients = g_list_append(NULL, client);
+
+    /* the lowest bit rate of the tier suits all its clients */
+    if (tier > 0) {
+        starting_bit_rate = 1ULL << (tier - 1);
+    }
+    group->encoder = video_codec->create(video_codec->type, starting_bit_rate, &group->cbs,
+                                         group->bitmap_ref, group->bitmap_unref);
+    if (!group->encoder) {
+        g_list_free(group->clients);
+        free(group);
+        return NULL;
+    }
+    group->groups = groups;
+    group->next = *groups;
+    *groups = group;
+    return group;
+}
+
+VideoEncoder *shared_video_encoder_new(SharedVideoEncoder **groups,
+                                       const RedVideoCodec *video_codec,
+                                       uint64_t starting_bit_rate,
+                                       VideoEncoderRateControlCbs *cbs,
+                                       bitmap_ref_t bitmap_ref,
+                                       bitmap_unref_t bitmap_unref)
+{
+    SharedVideoEncoderClient *client = spice_new0(SharedVideoEncoderClient, 1);
+    SharedVideoEncoder *group;
+
+    client->base.destroy = shared_video_encoder_client_destroy;
+    client->base.encode_frame = shared_video_encoder_client_encode_frame;
+    client->base.client_stream_report = shared_video_encoder_client_stream_report;
+    client->base.notify_server_frame_drop = shared_video_encoder_client_notify_server_frame_drop;
+    client->base.get_bit_rate = shared_video_encoder_client_get_bit_rate;
+    client->base.get_stats = shared_video_encoder_client_get_stats;
+    client->base.pull_encoded_frames = shared_video_encoder_client_pull_encoded_frames;
+    client->base.codec_type = video_codec->type;
+    client->cbs = *cbs;
+    client->bitmap_ref = bitmap_ref;
+    client->bitmap_unref = bitmap_unref;
+
+    group = shared_video_encoder_find(*groups, video_codec->type,
+                                      bit_rate_tier(starting_bit_rate));
+    if (group) {
+        group->clients = g_list_append(group->clients, client);
+    } else {
+        group = shared_video_encoder_group_new(groups, video_codec, starting_bit_rate, client);
+        if (!group) {
+            free(client);
+            return NULL;
+        }
+    }
+    client->group = group;
+    client->serial = group->serial;
+    return &client->base;
+}
+
+void shared_video_encoder_close_groups(SharedVideoEncoder **groups)
+{
+    while (*groups) {
+        shared_video_encoder_unlink(*groups);
+    }
+}
@@ -0,0 +1,61 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHARED_VIDEO_ENCODER_H_
+#define SHARED_VIDEO_ENCODER_H_
+
+#include "video-encoder.h"
+
+/*
+ * Video encoders shared by the clients of a stream, so that each frame is
+ * encoded once however many clients watch the video.
+ *
+ * Each client gets its own VideoEncoder, which belongs to the group of the
+ * clients of the stream using the same codec with a starting bit rate of
+ * the same tier (within a factor 2). The frame encoded by the first client
+ * of a group asking for it is given to the others, its buffer is refcounted.
+ * The last few frames are kept so that the clients lagging behind the first
+ * one get them too.
+ *
+ * The encoder of a group isn't adjusted to the reports of the clients while
+ * there are several of them. A client reporting drops, or missing frames of
+ * a codec which needs all of them, leaves its group for an encoder of its
+ * own at a lower bit rate.
+ */
+typedef struct SharedVideoEncoder SharedVideoEncoder;
+
+/*
+ * shared_video_encoder_new
+ * @groups: the groups of the stream, a new group is added if none matches
+ * @video_codec: the codec, and how to create the encoders
+ * The other parameters are those of new_video_encoder_t, for this client.
+ *
+ * Returns: the encoder of the client, NULL if a new encoder was needed and
+ *          couldn't be created
+ */
+VideoEncoder *shared_video_encoder_new(SharedVideoEncoder **groups,
+                                       const RedVideoCodec *video_codec,
+                                       uint64_t starting_bit_rate,
+                                       VideoEncoderRateControlCbs *cbs,
+                                       bitmap_ref_t bitmap_ref,
+                                       bitmap_unref_t bitmap_unref);
+
+/* no client joins @groups anymore, each group lives until its clients leave */
+void shared_video_encoder_close_groups(SharedVideoEncoder **groups);
+
+#endif /* SHARED_VIDEO_ENCODER_H_ */
@@ -22,6 +22,25 @@
 #include <sys/stat.h>
 
 #include "spice-bitmap-utils.h"
+#include "utils.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+
+#define SQUARE_SAMPLES_BATCH 64
+#define SQUARE_SAMPLES_ALIGN 8
+
+/* the sampled squares of pixels, as 0x00RRGGBB: top left, top right,
+ * bottom left and bottom right */
+typedef struct SquareSamples {
+    uint32_t pix[4][SQUARE_SAMPLES_BATCH];
+} SquareSamples;
+
+/* returns the sum of the scores of the @n squares, in quarters, @n being a
+ * multiple of SQUARE_SAMPLES_ALIGN */
+typedef int64_t (*square_scores_func_t)(const SquareSamples *samples, int n,
+                                        int contrast_th);
+#endif
 
 #define RED_BITMAP_UTILS_RGB16
 #include "spice-bitmap-utils.tmpl.c"
@@ -38,8 +57,102 @@
 // in window media player 12). see red_stream_add_frame
 #define GRADUAL_MEDIUM_SCORE_TH 0.002
 
+#ifdef SIMD_X86
+/*
+ * The pairs of pixels of a square are scored as in pixels_square_score(),
+ * in quarters: 2 if equal, 4 if contrasting and -1 otherwise, the squares
+ * with all their pixels equal getting 0.
+ */
+__attribute__((target("sse2")))
+static inline __m128i pair_score_sse2(__m128i p1, __m128i p2, __m128i th, __m128i *any_different)
+{
+    const __m128i rgb_mask = _mm_set1_epi32(0x00ffffff);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i diff, different, contrasting;
+
+    diff = _mm_and_si128(_mm_or_si128(_mm_subs_epu8(p1, p2), _mm_subs_epu8(p2, p1)), rgb_mask);
+    /* all ones where the pixels are different */
+    different = _mm_andnot_si128(_mm_cmpeq_epi32(diff, zero), _mm_cmpeq_epi32(zero, zero));
+    contrasting = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_subs_epu8(diff, th), zero),
+                                   _mm_cmpeq_epi32(zero, zero));
+    *any_different = _mm_or_si128(*any_different, different);
+    return _mm_add_epi32(_mm_set1_epi32(2),
+                         _mm_add_epi32(_mm_and_si128(different, _mm_set1_epi32(-3)),
+                                       _mm_and_si128(contrasting, _mm_set1_epi32(5))));
+}
+
+__attribute__((target("sse2")))
+static int64_t square_scores_sse2(const SquareSamples *samples, int n, int contrast_th)
+{
+    const __m128i th = _mm_set1_epi8(contrast_th - 1);
+    __m128i sum = _mm_setzero_si128();
+    int32_t lanes[4];
+    int i;
+
+    for (i = 0; i < n; i += 4) {
+        __m128i top_left = _mm_loadu_si128((const __m128i *)&samples->pix[0][i]);
+        __m128i top_right = _mm_loadu_si128((const __m128i *)&samples->pix[1][i]);
+        __m128i bottom_left = _mm_loadu_si128((const __m128i *)&samples->pix[2][i]);
+        __m128i bottom_right = _mm_loadu_si128((const __m128i *)&samples->pix[3][i]);
+        __m128i any_different = _mm_setzero_si128();
+        __m128i score;
+
+        score = pair_score_sse2(top_left, top_right, th, &any_different);
+        score = _mm_add_epi32(score, pair_score_sse2(top_left, bottom_left, th, &any_different));
+        score = _mm_add_epi32(score, pair_score_sse2(top_left, bottom_right, th, &any_different));
+        sum = _mm_add_epi32(sum, _mm_and_si128(score, any_different));
+    }
+    _mm_storeu_si128((__m128i *)lanes, sum);
+    return (int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pair_score_avx2(__m256i p1, __m256i p2, __m256i th, __m256i *any_different)
+{
+    const __m256i rgb_mask = _mm256_set1_epi32(0x00ffffff);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_cmpeq_epi32(zero, zero);
+    __m256i diff, different, contrasting;
+
+    diff = _mm256_and_si256(_mm256_or_si256(_mm256_subs_epu8(p1, p2), _mm256_subs_epu8(p2, p1)),
+                            rgb_mask);
+    different = _mm256_andnot_si256(_mm256_cmpeq_epi32(diff, zero), ones);
+    contrasting = _mm256_andnot_si256(_mm256_cmpeq_epi32(_mm256_subs_epu8(diff, th), zero), ones);
+    *any_different = _mm256_or_si256(*any_different, different);
+    return _mm256_add_epi32(_mm256_set1_epi32(2),
+                            _mm256_add_epi32(_mm256_and_si256(different, _mm256_set1_epi32(-3)),
+                                             _mm256_and_si256(contrasting, _mm256_set1_epi32(5))));
+}
+
+__attribute__((target("avx2")))
+static int64_t square_scores_avx2(const SquareSamples *samples, int n, int contrast_th)
+{
+    const __m256i th = _mm256_set1_epi8(contrast_th - 1);
+    __m256i sum = _mm256_setzero_si256();
+    int32_t lanes[8];
+    int i;
+
+    for (i = 0; i < n; i += 8) {
+        __m256i top_left = _mm256_loadu_si256((const __m256i *)&samples->pix[0][i]);
+        __m256i top_right = _mm256_loadu_si256((const __m256i *)&samples->pix[1][i]);
+        __m256i bottom_left = _mm256_loadu_si256((const __m256i *)&samples->pix[2][i]);
+        __m256i bottom_right = _mm256_loadu_si256((const __m256i *)&samples->pix[3][i]);
+        __m256i any_different = _mm256_setzero_si256();
+        __m256i score;
+
+        score = pair_score_avx2(top_left, top_right, th, &any_different);
+        score = _mm256_add_epi32(score, pair_score_avx2(top_left, bottom_left, th, &any_different));
+        score = _mm256_add_epi32(score, pair_score_avx2(top_left, bottom_right, th, &any_different));
+        sum = _mm256_add_epi32(sum, _mm256_and_si256(score, any_different));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, sum);
+    return (int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+           lanes[4] + lanes[5] + lanes[6] + lanes[7];
+}
+#endif
+
 // assumes that stride doesn't overflow
-BitmapGradualType bitmap_get_graduality_level(SpiceBitmap *bitmap)
+double bitmap_get_graduality_score(SpiceBitmap *bitmap)
 {
     double score = 0.0;
     int num_samples = 0;
@@ -48,11 +161,53 @@ BitmapGradualType bitmap_get_graduality_level(SpiceBitmap *bitmap)
     int chunk_num_samples = 0;
     uint32_t x, i;
     SpiceChunk *chunk;
+#ifdef SIMD_X86
+    square_scores_func_t square_scores = NULL;
+
+    switch (simd_get_level()) {
+    case SIMD_LEVEL_AVX2:
+        square_scores = square_scores_avx2;
+        break;
+    case SIMD_LEVEL_SSSE3:
+    case SIMD_LEVEL_SSE2:
+        square_scores = square_scores_sse2;
+        break;
+    default:
+        break;
+    }
+#endif
 
     chunk = bitmap->data->chunk;
     for (i = 0; i < bitmap->data->num_chunks; i++) {
         num_lines = chunk[i].len / bitmap->stride;
         x = bitmap->x;
+#ifdef SIMD_X86
+        if (square_scores) {
+            switch (bitmap->format) {
+            case SPICE_BITMAP_FMT_16BIT:
+                compute_lines_gradual_score_simd_rgb16((rgb16_pixel_t *)chunk[i].data, x,
+                                                       num_lines, &chunk_score,
+                                                       &chunk_num_samples, square_scores);
+                break;
+            case SPICE_BITMAP_FMT_24BIT:
+                compute_lines_gradual_score_simd_rgb24((rgb24_pixel_t *)chunk[i].data, x,
+                                                       num_lines, &chunk_score,
+                                                       &chunk_num_samples, square_scores);
+                break;
+            case SPICE_BITMAP_FMT_32BIT:
+            case SPICE_BITMAP_FMT_RGBA:
+                compute_lines_gradual_score_simd_rgb32((rgb32_pixel_t *)chunk[i].data, x,
+                                                       num_lines, &chunk_score,
+                                                       &chunk_num_samples, square_scores);
+                break;
+            default:
+                spice_error("invalid bitmap format (not RGB) %u", bitmap->format);
+            }
+            score += chunk_score;
+            num_samples += chunk_num_samples;
+            continue;
+        }
+#endif
         switch (bitmap->format) {
         case SPICE_BITMAP_FMT_16BIT:
             compute_lines_gradual_score_rgb16((rgb16_pixel_t *)chunk[i].data, x, num_lines,
@@ -75,7 +230,12 @@ BitmapGradualType bitmap_get_graduality_level(SpiceBitmap *bitmap)
     }
 
     spice_assert(num_samples);
-    score /= num_samples;
+    return score / num_samples;
+}
+
+BitmapGradualType bitmap_get_graduality_level(SpiceBitmap *bitmap)
+{
+    double score = bitmap_get_graduality_score(bitmap);
 
     if (bitmap->format == SPICE_BITMAP_FMT_16BIT) {
         if (score < GRADUAL_HIGH_RGB16_TH) {
@@ -121,6 +281,76 @@ int bitmap_has_extra_stride(SpiceBitmap *bitmap)
     return 0;
 }
 
+#define HASH_PRIME1 0x9e3779b185ebca87ULL
+#define HASH_PRIME2 0xc2b2ae3d27d4eb4fULL
+#define HASH_PRIME3 0x165667b19e3779f9ULL
+
+static inline uint64_t hash_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+    return hash_rotl(acc + input * HASH_PRIME2, 31) * HASH_PRIME1;
+}
+
+/* four independent lanes over 32 bytes blocks, in the way of xxHash64 */
+static uint64_t hash_data(uint64_t seed, const uint8_t *data, size_t len)
+{
+    uint64_t v1 = seed + HASH_PRIME1 + HASH_PRIME2;
+    uint64_t v2 = seed + HASH_PRIME2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - HASH_PRIME1;
+    uint64_t hash, word;
+
+    for (; len >= 32; data += 32, len -= 32) {
+        memcpy(&word, data, 8);
+        v1 = hash_round(v1, word);
+        memcpy(&word, data + 8, 8);
+        v2 = hash_round(v2, word);
+        memcpy(&word, data + 16, 8);
+        v3 = hash_round(v3, word);
+        memcpy(&word, data + 24, 8);
+        v4 = hash_round(v4, word);
+    }
+    hash = hash_rotl(v1, 1) + hash_rotl(v2, 7) + hash_rotl(v3, 12) + hash_rotl(v4, 18);
+    for (; len >= 8; data += 8, len -= 8) {
+        memcpy(&word, data, 8);
+        hash = hash_round(hash, word);
+    }
+    for (; len > 0; data++, len--) {
+        hash = hash_round(hash, *data);
+    }
+
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t bitmap_hash(SpiceBitmap *bitmap)
+{
+    uint32_t geometry[] = {
+        bitmap->format, bitmap->flags & SPICE_BITMAP_FLAGS_TOP_DOWN,
+        bitmap->x, bitmap->y, bitmap->stride
+    };
+    uint64_t hash;
+    uint32_t i;
+
+    hash = hash_data(0, (const uint8_t *)geometry, sizeof(geometry));
+    if (bitmap->palette) {
+        hash = hash_data(hash, (const uint8_t *)bitmap->palette->ents,
+                         bitmap->palette->num_ents * sizeof(bitmap->palette->ents[0]));
+    }
+    for (i = 0; i < bitmap->data->num_chunks; i++) {
+        hash = hash_data(hash, bitmap->data->chunk[i].data, bitmap->data->chunk[i].len);
+    }
+    return hash;
+}
+
 int spice_bitmap_from_surface_type(uint32_t surface_format)
 {
     switch (surface_format) {
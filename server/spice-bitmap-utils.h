@@ -83,8 +83,13 @@ static inline int bitmap_fmt_has_graduality(uint8_t fmt)
 }
 
 
+/* average score of the sampled squares of pixels, the lower the more gradual */
+double            bitmap_get_graduality_score     (SpiceBitmap *bitmap);
 BitmapGradualType bitmap_get_graduality_level     (SpiceBitmap *bitmap);
 int               bitmap_has_extra_stride         (SpiceBitmap *bitmap);
+/* hash of the content of the bitmap, including its palette and stride; the
+ * same content split in different chunks can get a different hash */
+uint64_t          bitmap_hash                     (SpiceBitmap *bitmap);
 
 void dump_bitmap(SpiceBitmap *bitmap);
 
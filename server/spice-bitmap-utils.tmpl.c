@@ -24,12 +24,14 @@
 #define GET_r(pix) (((pix) >> 10) & 0x1f)
 #define GET_g(pix) (((pix) >> 5) & 0x1f)
 #define GET_b(pix) ((pix) & 0x1f)
+#define GET_rgb(pix) ((GET_r(*(pix)) << 16) | (GET_g(*(pix)) << 8) | GET_b(*(pix)))
 #endif
 
 #if defined(RED_BITMAP_UTILS_RGB24) || defined(RED_BITMAP_UTILS_RGB32)
 #define GET_r(pix) ((pix).r)
 #define GET_g(pix) ((pix).g)
 #define GET_b(pix) ((pix).b)
+#define GET_rgb(pix) (((pix)->r << 16) | ((pix)->g << 8) | (pix)->b)
 #endif
 
 #ifdef RED_BITMAP_UTILS_RGB24
@@ -146,8 +148,67 @@ static void FNAME(compute_lines_gradual_score)(PIXEL *lines, int width, int num_
     (*o_num_samples) *= 3;
 }
 
+#ifdef SIMD_X86
+/* same as compute_lines_gradual_score(), the squares being scored by
+ * @square_scores */
+static void FNAME(compute_lines_gradual_score_simd)(PIXEL *lines, int width, int num_lines,
+                                                    double *o_samples_sum_score,
+                                                    int *o_num_samples,
+                                                    square_scores_func_t square_scores)
+{
+    int jump = (SAMPLE_JUMP % width) ? SAMPLE_JUMP : SAMPLE_JUMP - 1;
+    PIXEL *cur_pix = lines + width / 2;
+    PIXEL *last_line = lines + (num_lines - 1) * width;
+    int col = width / 2;
+    int64_t quarters = 0;
+    int num_samples = 0;
+    SquareSamples samples;
+    int n = 0;
+
+    if ((width <= 1) || (num_lines <= 1)) {
+        *o_num_samples = 1;
+        *o_samples_sum_score = 1.0;
+        return;
+    }
+
+    while (cur_pix < last_line) {
+        if (col == width - 1) { // last pixel in the row
+            cur_pix--;
+            col--;
+        }
+        samples.pix[0][n] = GET_rgb(cur_pix);
+        samples.pix[1][n] = GET_rgb(cur_pix + 1);
+        samples.pix[2][n] = GET_rgb(cur_pix + width);
+        samples.pix[3][n] = GET_rgb(cur_pix + width + 1);
+        if (++n == SQUARE_SAMPLES_BATCH) {
+            quarters += square_scores(&samples, n, CONTRAST_TH);
+            n = 0;
+        }
+        num_samples++;
+        cur_pix += jump;
+        col += jump;
+        while (col >= width) {
+            col -= width;
+        }
+    }
+    if (n) {
+        /* identical pixels score 0 */
+        for (; n % SQUARE_SAMPLES_ALIGN; n++) {
+            samples.pix[0][n] = samples.pix[1][n] = samples.pix[2][n] = samples.pix[3][n] = 0;
+        }
+        quarters += square_scores(&samples, n, CONTRAST_TH);
+    }
+
+    /* the scores are multiples of 1/4, so their sum in a double is exact
+     * and the same as the one of the scalar version */
+    *o_samples_sum_score = quarters * 0.25;
+    *o_num_samples = num_samples * 3;
+}
+#endif
+
 #undef PIXEL
 #undef FNAME
+#undef GET_rgb
 #undef GET_r
 #undef GET_g
 #undef GET_b
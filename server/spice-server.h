@@ -59,6 +59,10 @@ int spice_server_set_tls(SpiceServer *s, int port,
                          const char *ca_cert_file, const char *certs_file,
                          const char *private_key_file, const char *key_passwd,
                          const char *dh_key_file, const char *ciphersuite);
+/* request the kernel to do the TLS encryption, the connections fall back to
+ * OpenSSL if the kernel or the negotiated cipher does not support it. Must
+ * be called before spice_server_init(). Disabled by default */
+int spice_server_set_ktls(SpiceServer *s, int enable);
 
 int spice_server_add_client(SpiceServer *s, int socket, int skip_auth);
 int spice_server_add_ssl_client(SpiceServer *s, int socket, int skip_auth);
@@ -112,6 +116,45 @@ typedef enum {
 
 int spice_server_set_jpeg_compression(SpiceServer *s, spice_wan_compression_t comp);
 int spice_server_set_zlib_glz_compression(SpiceServer *s, spice_wan_compression_t comp);
+/* number of threads compressing the images of each display channel ahead
+ * of their sending, 0 (the default) to compress them when sending */
+int spice_server_set_compression_threads(SpiceServer *s, int n_threads);
+/* size in MiB of the compressed images each display channel keeps to send
+ * them to several clients, 32 by default, 0 to compress the images for each
+ * client. They are only kept while several clients are connected */
+int spice_server_set_shared_images_size(SpiceServer *s, int size_mb);
+/* maximum number of drawables pending in the tree of each display channel,
+ * the oldest ones are rendered when it is reached. 4096 by default, from
+ * 256 to 1048576 */
+int spice_server_set_max_drawables(SpiceServer *s, int max_drawables);
+/* hash the bitmaps sent so that the ones already in the cache of the client
+ * are sent as a reference to the cached copy, even when the guest gives
+ * them another id. Disabled by default */
+int spice_server_set_pixmap_dedup(SpiceServer *s, int enable);
+/* number of independently locked parts of the pixmap cache of each client,
+ * from 1 (the default) to 16. Each part gets an equal share of the size of
+ * the client cache, so the images bigger than this share are not cached */
+int spice_server_set_pixmap_cache_shards(SpiceServer *s, int n_shards);
+/* size in MiB of the images decoded while rendering that each display
+ * channel keeps to draw them again, 16 by default, 0 to not keep them */
+int spice_server_set_image_cache_size(SpiceServer *s, int size_mb);
+/* share the video encoders between the clients of a stream using the same
+ * codec at a similar bit rate. Disabled by default */
+int spice_server_set_shared_video_encoders(SpiceServer *s, int enable);
+/* let the video encoders which can (GStreamer) compress the frames in their
+ * own threads rather than waiting for each frame. Disabled by default */
+int spice_server_set_async_video_encoding(SpiceServer *s, int enable);
+/* encode the whole primary surface as a video while it changes quickly,
+ * for the content the stream detection doesn't recognize (games, 3D...).
+ * Disabled by default */
+int spice_server_set_surface_video(SpiceServer *s, int enable);
+/* the most KiB per second the areas sent lossily and then sent again
+ * losslessly may take on the connection of a client, 4096 by default, 0 to
+ * never send them again */
+int spice_server_set_lossy_refine_rate(SpiceServer *s, int kib_per_sec);
+/* send the large images and video frames of the display channels with
+ * MSG_ZEROCOPY over unencrypted TCP connections. Disabled by default */
+int spice_server_set_zerocopy(SpiceServer *s, int enable);
 
 #define SPICE_CHANNEL_SECURITY_NONE (1 << 0)
 #define SPICE_CHANNEL_SECURITY_SSL (1 << 1)
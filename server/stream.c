@@ -123,6 +123,12 @@ void stream_stop(DisplayChannel *display, Stream *stream)
         red_channel_client_pipe_add(RED_CHANNEL_CLIENT(dcc), stream_destroy_item_new(stream_agent));
         stream_agent_stats_print(stream_agent);
     }
+    shared_video_encoder_close_groups(&stream->shared_encoders);
+    if (stream->surface) {
+        display->priv->surface_video.stream = NULL;
+        display->priv->surface_video.windows = 0;
+        stat_inc_counter(display->priv->surface_video_switches_counter, 1);
+    }
     display->priv->streams_size_total -= stream->width * stream->height;
     ring_remove(&stream->link);
     stream_unref(display, stream);
@@ -278,6 +284,20 @@ static bool is_next_stream_frame(DisplayChannel *display,
     return TRUE;
 }
 
+static void stream_update_input_fps(Stream *stream, red_time_t frame_time)
+{
+    uint64_t duration = frame_time - stream->input_fps_start_time;
+    if (duration >= RED_STREAM_INPUT_FPS_TIMEOUT) {
+        /* Round to the nearest integer, for instance 24 for 23.976 */
+        stream->input_fps = ((uint64_t)stream->num_input_frames * 1000 * 1000 * 1000 + duration / 2) / duration;
+        spice_debug("input-fps=%u", stream->input_fps);
+        stream->num_input_frames = 0;
+        stream->input_fps_start_time = frame_time;
+    } else {
+        stream->num_input_frames++;
+    }
+}
+
 static void attach_stream(DisplayChannel *display, Drawable *drawable, Stream *stream)
 {
     DisplayChannelClient *dcc;
@@ -288,17 +308,7 @@ static void attach_stream(DisplayChannel *display, Drawable *drawable, Stream *s
     stream->current = drawable;
     drawable->stream = stream;
     stream->last_time = drawable->creation_time;
-
-    uint64_t duration = drawable->creation_time - stream->input_fps_start_time;
-    if (duration >= RED_STREAM_INPUT_FPS_TIMEOUT) {
-        /* Round to the nearest integer, for instance 24 for 23.976 */
-        stream->input_fps = ((uint64_t)stream->num_input_frames * 1000 * 1000 * 1000 + duration / 2) / duration;
-        spice_debug("input-fps=%u", stream->input_fps);
-        stream->num_input_frames = 0;
-        stream->input_fps_start_time = drawable->creation_time;
-    } else {
-        stream->num_input_frames++;
-    }
+    stream_update_input_fps(stream, drawable->creation_time);
 
     FOREACH_DCC(display, iter, dcc) {
         StreamAgent *agent;
@@ -403,6 +413,7 @@ static void display_channel_create_stream(DisplayChannel *display, Drawable *dra
     stream->refs = 1;
     SpiceBitmap *bitmap = &drawable->red_drawable->u.copy.src_bitmap->u.bitmap;
     stream->top_down = !!(bitmap->flags & SPICE_BITMAP_FLAGS_TOP_DOWN);
+    stream->surface = FALSE;
     drawable->stream = stream;
     /* Provide an fps estimate the video encoder can use when initializing
      * based on the frames that lead to the creation of the stream. Round to
@@ -596,13 +607,14 @@ static uint64_t get_initial_bit_rate(DisplayChannelClient *dcc, Stream *stream)
 
     if (!bit_rate) {
         MainChannelClient *mcc;
-        uint64_t net_test_bit_rate;
+        uint64_t net_bit_rate;
 
         mcc = red_client_get_main(red_channel_client_get_client(RED_CHANNEL_CLIENT(dcc)));
-        net_test_bit_rate = main_channel_client_is_network_info_initialized(mcc) ?
-                                main_channel_client_get_bitrate_per_sec(mcc) :
-                                0;
-        bit_rate = MAX(dcc_get_max_stream_bit_rate(dcc), net_test_bit_rate);
+        net_bit_rate = red_channel_client_get_bitrate_estimate(RED_CHANNEL_CLIENT(dcc));
+        if (net_bit_rate == 0 && main_channel_client_is_network_info_initialized(mcc)) {
+            net_bit_rate = main_channel_client_get_bitrate_per_sec(mcc);
+        }
+        bit_rate = MAX(dcc_get_max_stream_bit_rate(dcc), net_bit_rate);
         if (bit_rate == 0) {
             /*
              * In case we are after a spice session migration,
@@ -630,6 +642,9 @@ static uint32_t get_roundtrip_ms(void *opaque)
     RedChannelClient *rcc = RED_CHANNEL_CLIENT(agent->dcc);
 
     roundtrip = red_channel_client_get_roundtrip_ms(rcc);
+    if (roundtrip < 0) {
+        roundtrip = red_channel_client_get_rtt_estimate_ms(rcc);
+    }
     if (roundtrip < 0) {
         MainChannelClient *mcc = red_client_get_main(red_channel_client_get_client(rcc));
 
@@ -671,6 +686,81 @@ static void update_client_playback_delay(void *opaque, uint32_t delay_ms)
                                         dcc_get_max_stream_latency(agent->dcc));
 }
 
+static void stream_data_item_release(RedPipeItem *base)
+{
+    StreamDataItem *item = SPICE_UPCAST(StreamDataItem, base);
+
+    item->buffer->free(item->buffer);
+    stream_agent_unref(DCC_TO_DC(item->agent->dcc), item->agent);
+    free(item);
+}
+
+/* the caller must push the item */
+static void stream_data_item_add(StreamAgent *agent, uint32_t frame_mm_time,
+                                 const SpiceRect *src_area, const SpiceRect *dest,
+                                 VideoBuffer *buffer)
+{
+    StreamDataItem *item;
+
+    if (agent->stream->surface) {
+        stat_inc_counter(DCC_TO_DC(agent->dcc)->priv->surface_video_bytes_counter,
+                         buffer->size);
+    }
+    item = spice_new0(StreamDataItem, 1);
+    red_pipe_item_init_full(&item->base, RED_PIPE_ITEM_TYPE_STREAM_DATA,
+                            stream_data_item_release);
+    agent->stream->refs++;
+    item->agent = agent;
+    item->frame_mm_time = frame_mm_time;
+    item->src_area = *src_area;
+    item->dest = *dest;
+    item->buffer = buffer;
+    red_channel_client_pipe_add(RED_CHANNEL_CLIENT(agent->dcc), &item->base);
+}
+
+/* a copy of the rendered primary surface, see surface_video_send_frame() */
+typedef struct SurfaceFrame {
+    gint refs;
+    SpiceBitmap bitmap;
+} SurfaceFrame;
+
+static void frame_encoded(void *opaque, uint32_t frame_mm_time,
+                          gpointer bitmap_opaque, VideoBuffer *buffer)
+{
+    StreamAgent *agent = opaque;
+
+    if (!ring_item_is_linked(&agent->stream->link)) {
+        /* the stream destroy message is queued already */
+        buffer->free(buffer);
+        return;
+    }
+
+    /* sent along with the frames the encoders pulled, see
+     * stream_agents_pull_encoded_frames() */
+    if (agent->stream->surface) {
+        SurfaceFrame *frame = bitmap_opaque;
+        SpiceRect src_area = {
+            .right = frame->bitmap.x, .bottom = frame->bitmap.y
+        };
+
+        stream_data_item_add(agent, frame_mm_time, &src_area,
+                             &agent->stream->dest_area, buffer);
+    } else {
+        RedDrawable *red_drawable = bitmap_opaque;
+
+        stream_data_item_add(agent, frame_mm_time, &red_drawable->u.copy.src_area,
+                             &red_drawable->bbox, buffer);
+    }
+}
+
+/* called from the encoder threads */
+static void video_frames_wakeup(void *opaque)
+{
+    StreamAgent *agent = opaque;
+
+    display_channel_wakeup_video_frames(DCC_TO_DC(agent->dcc));
+}
+
 static void bitmap_ref(gpointer data)
 {
     RedDrawable *red_drawable = (RedDrawable*)data;
@@ -683,11 +773,48 @@ static void bitmap_unref(gpointer data)
     red_drawable_unref(red_drawable);
 }
 
+/* the frames may be released by the encoder threads */
+static void surface_frame_ref(gpointer data)
+{
+    SurfaceFrame *frame = data;
+    g_atomic_int_inc(&frame->refs);
+}
+
+static void surface_frame_unref(gpointer data)
+{
+    SurfaceFrame *frame = data;
+
+    if (g_atomic_int_dec_and_test(&frame->refs)) {
+        spice_chunks_destroy(frame->bitmap.data);
+        free(frame);
+    }
+}
+
+static VideoEncoder* dcc_create_codec_video_encoder(DisplayChannelClient *dcc,
+                                                    Stream *stream,
+                                                    const RedVideoCodec *video_codec,
+                                                    uint64_t starting_bit_rate,
+                                                    VideoEncoderRateControlCbs *cbs)
+{
+    bitmap_ref_t ref = stream->surface ? surface_frame_ref : bitmap_ref;
+    bitmap_unref_t unref = stream->surface ? surface_frame_unref : bitmap_unref;
+
+    if (DCC_TO_DC(dcc)->priv->shared_video_encoders) {
+        return shared_video_encoder_new(&stream->shared_encoders, video_codec,
+                                        starting_bit_rate, cbs, ref, unref);
+    }
+    return video_codec->create(video_codec->type, starting_bit_rate, cbs, ref, unref);
+}
+
 /* A helper for dcc_create_stream(). */
 static VideoEncoder* dcc_create_video_encoder(DisplayChannelClient *dcc,
+                                              Stream *stream,
                                               uint64_t starting_bit_rate,
                                               VideoEncoderRateControlCbs *cbs)
 {
+    static const RedVideoCodec mjpeg_codec = {
+        mjpeg_encoder_new, SPICE_VIDEO_CODEC_TYPE_MJPEG, SPICE_DISPLAY_CAP_CODEC_MJPEG
+    };
     RedChannelClient *rcc = RED_CHANNEL_CLIENT(dcc);
     bool client_has_multi_codec = red_channel_client_test_remote_cap(rcc, SPICE_DISPLAY_CAP_MULTI_CODEC);
     int i;
@@ -708,7 +835,8 @@ static VideoEncoder* dcc_create_video_encoder(DisplayChannelClient *dcc,
             continue;
         }
 
-        VideoEncoder* video_encoder = video_codec->create(video_codec->type, starting_bit_rate, cbs, bitmap_ref, bitmap_unref);
+        VideoEncoder* video_encoder = dcc_create_codec_video_encoder(dcc, stream, video_codec,
+                                                                     starting_bit_rate, cbs);
         if (video_encoder) {
             return video_encoder;
         }
@@ -716,7 +844,7 @@ static VideoEncoder* dcc_create_video_encoder(DisplayChannelClient *dcc,
 
     /* Try to use the builtin MJPEG video encoder as a fallback */
     if (!client_has_multi_codec || red_channel_client_test_remote_cap(rcc, SPICE_DISPLAY_CAP_CODEC_MJPEG)) {
-        return mjpeg_encoder_new(SPICE_VIDEO_CODEC_TYPE_MJPEG, starting_bit_rate, cbs, bitmap_ref, bitmap_unref);
+        return dcc_create_codec_video_encoder(dcc, stream, &mjpeg_codec, starting_bit_rate, cbs);
     }
 
     return NULL;
@@ -731,6 +859,9 @@ void dcc_create_stream(DisplayChannelClient *dcc, Stream *stream)
     if (stream->current) {
         region_clone(&agent->vis_region, &stream->current->tree_item.base.rgn);
         region_clone(&agent->clip, &agent->vis_region);
+    } else if (stream->surface) {
+        region_add(&agent->vis_region, &stream->dest_area);
+        region_clone(&agent->clip, &agent->vis_region);
     }
     agent->fps = MAX_FPS;
     agent->dcc = dcc;
@@ -740,9 +871,16 @@ void dcc_create_stream(DisplayChannelClient *dcc, Stream *stream)
     video_cbs.get_roundtrip_ms = get_roundtrip_ms;
     video_cbs.get_source_fps = get_source_fps;
     video_cbs.update_client_playback_delay = update_client_playback_delay;
+    if (DCC_TO_DC(dcc)->priv->video_frames_watch) {
+        video_cbs.frame_encoded = frame_encoded;
+        video_cbs.wakeup = video_frames_wakeup;
+    } else {
+        video_cbs.frame_encoded = NULL;
+        video_cbs.wakeup = NULL;
+    }
 
     uint64_t initial_bit_rate = get_initial_bit_rate(dcc, stream);
-    agent->video_encoder = dcc_create_video_encoder(dcc, initial_bit_rate, &video_cbs);
+    agent->video_encoder = dcc_create_video_encoder(dcc, stream, initial_bit_rate, &video_cbs);
     red_channel_client_pipe_add(RED_CHANNEL_CLIENT(dcc), stream_create_item_new(agent));
 
     if (red_channel_client_test_remote_cap(RED_CHANNEL_CLIENT(dcc), SPICE_DISPLAY_CAP_STREAM_REPORT)) {
@@ -773,6 +911,27 @@ void stream_agent_stop(StreamAgent *agent)
     }
 }
 
+/* The frames compressed asynchronously are queued to the clients, the
+ * caller must push them. Returns the number of frames. */
+int stream_agents_pull_encoded_frames(DisplayChannel *display)
+{
+    DisplayChannelClient *dcc;
+    GListIter iter;
+    int count = 0;
+    int i;
+
+    FOREACH_DCC(display, iter, dcc) {
+        for (i = 0; i < NUM_STREAMS; i++) {
+            VideoEncoder *video_encoder = dcc_get_stream_agent(dcc, i)->video_encoder;
+
+            if (video_encoder && video_encoder->pull_encoded_frames) {
+                count += video_encoder->pull_encoded_frames(video_encoder);
+            }
+        }
+    }
+    return count;
+}
+
 static void red_upgrade_item_free(RedPipeItem *base)
 {
     RedUpgradeItem *item = SPICE_UPCAST(RedUpgradeItem, base);
@@ -890,6 +1049,11 @@ void stream_detach_behind(DisplayChannel *display, QRegion *region, Drawable *dr
         int detach = 0;
         item = ring_next(ring, item);
 
+        if (stream->surface) {
+            /* the next frame covers the region */
+            continue;
+        }
+
         FOREACH_DCC(display, iter, dcc) {
             StreamAgent *agent = dcc_get_stream_agent(dcc, display_channel_get_stream_id(display, stream));
 
@@ -959,3 +1123,279 @@ void stream_trace_add_drawable(DisplayChannel *display, Drawable *item)
     trace->height = src_area->bottom - src_area->top;
     trace->dest_area = item->red_drawable->bbox;
 }
+
+bool stream_surface_video_is_active(DisplayChannel *display)
+{
+    return display->priv->surface_video.stream != NULL;
+}
+
+void stream_surface_video_add_damage(DisplayChannel *display, Drawable *drawable)
+{
+    SurfaceVideo *surface_video = &display->priv->surface_video;
+
+    if (!surface_video->enabled) {
+        return;
+    }
+    surface_video->damage += rect_get_area(&drawable->red_drawable->bbox);
+    if (surface_video->stream) {
+        surface_video->dirty = TRUE;
+    }
+}
+
+static void surface_video_start(DisplayChannel *display, red_time_t now)
+{
+    SurfaceVideo *surface_video = &display->priv->surface_video;
+    RedSurface *surface = &display->priv->surfaces[0];
+    DisplayChannelClient *dcc;
+    GListIter iter;
+    RingItem *item;
+    Stream *stream;
+
+    if (display->priv->stream_video == SPICE_STREAM_VIDEO_OFF ||
+        !red_channel_is_connected(RED_CHANNEL(display)) || !surface->context.canvas) {
+        return;
+    }
+
+    /* the streams of the drawables are covered by the frames, they don't
+     * need an upgrade */
+    while ((item = ring_get_head(&display->priv->streams))) {
+        stream = SPICE_CONTAINEROF(item, Stream, link);
+        if (stream->current) {
+            stream_detach_drawable(stream);
+        }
+        stream_stop(display, stream);
+    }
+    if (!(stream = display_channel_stream_try_new(display))) {
+        /* still referenced by the pipes, retried after the next window */
+        return;
+    }
+
+    ring_add(&display->priv->streams, &stream->link);
+    stream->current = NULL;
+    stream->surface = TRUE;
+    stream->last_time = now;
+    stream->width = surface->context.width;
+    stream->height = surface->context.height;
+    stream->dest_area.left = 0;
+    stream->dest_area.top = 0;
+    stream->dest_area.right = surface->context.width;
+    stream->dest_area.bottom = surface->context.height;
+    stream->refs = 1;
+    stream->top_down = surface->context.top_down;
+    stream->input_fps = MAX_FPS;
+    stream->num_input_frames = 0;
+    stream->input_fps_start_time = now;
+    display->priv->streams_size_total += stream->width * stream->height;
+    display->priv->stream_count++;
+
+    surface_video->stream = stream;
+    surface_video->windows = 0;
+    surface_video->dirty = TRUE;
+    surface_video->last_frame_time = 0;
+    stat_inc_counter(display->priv->surface_video_switches_counter, 1);
+
+    FOREACH_DCC(display, iter, dcc) {
+        dcc_create_stream(dcc, stream);
+    }
+    spice_debug("surface stream %d %dx%d",
+                display_channel_get_stream_id(display, stream), stream->width,
+                stream->height);
+}
+
+/* Going back to the drawables, the clients get the surface losslessly */
+static void surface_video_stop(DisplayChannel *display)
+{
+    Stream *stream = display->priv->surface_video.stream;
+
+    spice_debug("surface stream %d", display_channel_get_stream_id(display, stream));
+    detach_stream_gracefully(display, stream, NULL);
+    stream_stop(display, stream);
+}
+
+/* The primary surface is going away, the next one starts without a stream
+ * and with fresh statistics */
+void stream_surface_video_reset(DisplayChannel *display)
+{
+    SurfaceVideo *surface_video = &display->priv->surface_video;
+
+    if (surface_video->stream) {
+        surface_video_stop(display);
+    }
+    surface_video->windows = 0;
+    surface_video->damage = 0;
+    surface_video->dirty = FALSE;
+}
+
+static void surface_video_end_window(DisplayChannel *display, red_time_t now)
+{
+    SurfaceVideo *surface_video = &display->priv->surface_video;
+    RedSurface *surface = &display->priv->surfaces[0];
+    uint64_t area = (uint64_t)surface->context.width * surface->context.height;
+    uint64_t rate = 0;
+
+    /* in percents of the surface area per second */
+    if (area) {
+        rate = surface_video->damage * 100 / area * NSEC_PER_SEC /
+               (now - surface_video->window_start);
+    }
+    stat_set_counter(display->priv->surface_video_rate_counter, rate);
+
+    if (!surface_video->stream) {
+        surface_video->windows = rate >= SURFACE_VIDEO_START_RATE ?
+                                 surface_video->windows + 1 : 0;
+        if (surface_video->windows >= SURFACE_VIDEO_START_WINDOWS) {
+            surface_video_start(display, now);
+        }
+    } else {
+        surface_video->windows = rate < SURFACE_VIDEO_STOP_RATE ?
+                                 surface_video->windows + 1 : 0;
+        if (surface_video->windows >= SURFACE_VIDEO_STOP_WINDOWS) {
+            surface_video_stop(display);
+        }
+    }
+    surface_video->damage = 0;
+    surface_video->window_start = now;
+}
+
+static void surface_video_send_frame(DisplayChannel *display, red_time_t now)
+{
+    SurfaceVideo *surface_video = &display->priv->surface_video;
+    Stream *stream = surface_video->stream;
+    RedSurface *surface = &display->priv->surfaces[0];
+    SpiceCanvas *canvas = surface->context.canvas;
+    int stream_id = display_channel_get_stream_id(display, stream);
+    SpiceRect src_area = {
+        .right = stream->width, .bottom = stream->height
+    };
+    DisplayChannelClient *dcc;
+    GListIter iter;
+    SurfaceFrame *frame;
+    uint32_t frame_mm_time;
+    bool unsupported = FALSE;
+    uint8_t *data;
+    int stride;
+
+    if (!canvas || stream->width != surface->context.width ||
+        stream->height != surface->context.height) {
+        /* the primary surface was replaced behind the stream */
+        surface_video_stop(display);
+        return;
+    }
+
+    stride = SPICE_ALIGN(stream->width * SPICE_SURFACE_FMT_DEPTH(surface->context.format) / 8, 4);
+    data = spice_malloc_n(stream->height, stride);
+    frame = spice_new0(SurfaceFrame, 1);
+    frame->refs = 1;
+    frame->bitmap.format = spice_bitmap_from_surface_type(surface->context.format);
+    frame->bitmap.flags = stream->top_down ? SPICE_BITMAP_FLAGS_TOP_DOWN : 0;
+    frame->bitmap.x = stream->width;
+    frame->bitmap.y = stream->height;
+    frame->bitmap.stride = stride;
+    frame->bitmap.data = spice_chunks_new_linear(data, stream->height * stride);
+    frame->bitmap.data->flags |= SPICE_CHUNKS_FLAGS_FREE;
+
+    display_channel_draw(display, &stream->dest_area, 0);
+    canvas->ops->read_bits(canvas, data, stride, &stream->dest_area);
+
+    surface_video->dirty = FALSE;
+    surface_video->last_frame_time = now;
+    stream->last_time = now;
+    stream_update_input_fps(stream, now);
+    frame_mm_time = reds_get_mm_time();
+
+    FOREACH_DCC(display, iter, dcc) {
+        StreamAgent *agent = dcc_get_stream_agent(dcc, stream_id);
+        VideoBuffer *outbuf;
+        int ret;
+
+        if (!agent->video_encoder) {
+            unsupported = TRUE;
+            continue;
+        }
+        if (red_channel_client_is_blocked(RED_CHANNEL_CLIENT(dcc))) {
+#ifdef STREAM_STATS
+            agent->stats.num_drops_pipe++;
+#endif
+            agent->video_encoder->notify_server_frame_drop(agent->video_encoder);
+            continue;
+        }
+#ifdef STREAM_STATS
+        agent->stats.num_input_frames++;
+#endif
+        ret = agent->video_encoder->encode_frame(agent->video_encoder, frame_mm_time,
+                                                 &frame->bitmap, &src_area,
+                                                 stream->top_down, frame, &outbuf);
+        switch (ret) {
+        case VIDEO_ENCODER_FRAME_ENCODE_DONE:
+            stream_data_item_add(agent, frame_mm_time, &src_area,
+                                 &stream->dest_area, outbuf);
+            break;
+        case VIDEO_ENCODER_FRAME_DROP:
+#ifdef STREAM_STATS
+            agent->stats.num_drops_fps++;
+#endif
+            break;
+        case VIDEO_ENCODER_FRAME_UNSUPPORTED:
+            unsupported = TRUE;
+            break;
+        default:
+            break;
+        }
+    }
+    surface_frame_unref(frame);
+    if (unsupported) {
+        /* the client would see nothing until the video mode ends */
+        spice_warning("a client can't decode the surface stream, disabling it");
+        surface_video->enabled = FALSE;
+        surface_video_stop(display);
+    }
+    red_channel_push(RED_CHANNEL(display));
+}
+
+/*
+ * Games, 3D views and animations redraw the screen with many kinds of
+ * drawables, which the stream detection doesn't recognize. Once the
+ * drawables change enough of the primary surface (see SURFACE_VIDEO_WINDOW),
+ * they aren't sent anymore: they are rendered and the whole surface is
+ * encoded by a stream, up to MAX_FPS times per second.
+ */
+void stream_surface_video_timeout(DisplayChannel *display)
+{
+    SurfaceVideo *surface_video = &display->priv->surface_video;
+    red_time_t now;
+
+    if (!surface_video->enabled) {
+        return;
+    }
+
+    now = spice_get_monotonic_time_ns();
+    if (now >= surface_video->window_start + SURFACE_VIDEO_WINDOW) {
+        surface_video_end_window(display, now);
+    }
+    if (surface_video->stream && surface_video->dirty &&
+        now >= surface_video->last_frame_time + SURFACE_VIDEO_FRAME_DELAY) {
+        surface_video_send_frame(display, now);
+    }
+}
+
+/* Returns: the time until stream_surface_video_timeout() has work, in ms */
+int stream_surface_video_get_timeout(DisplayChannel *display)
+{
+    SurfaceVideo *surface_video = &display->priv->surface_video;
+    red_time_t next;
+    red_time_t now;
+
+    if (!surface_video->enabled || (!surface_video->stream && !surface_video->damage)) {
+        return INT_MAX;
+    }
+
+    next = surface_video->window_start + SURFACE_VIDEO_WINDOW;
+    if (surface_video->stream && surface_video->dirty) {
+        next = MIN(next, surface_video->last_frame_time + SURFACE_VIDEO_FRAME_DELAY);
+    }
+    now = spice_get_monotonic_time_ns();
+    if (next <= now) {
+        return 0;
+    }
+    return (next - now + 1000 * 1000 - 1) / (1000 * 1000);
+}
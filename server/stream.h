@@ -24,6 +24,7 @@
 
 #include "utils.h"
 #include "video-encoder.h"
+#include "shared-video-encoder.h"
 #include "red-channel.h"
 #include "dcc.h"
 
@@ -42,6 +43,17 @@
 #define RED_STREAM_DEFAULT_HIGH_START_BIT_RATE (10 * 1024 * 1024) // 10Mbps
 #define RED_STREAM_DEFAULT_LOW_START_BIT_RATE (2.5 * 1024 * 1024) // 2.5Mbps
 #define MAX_FPS 30
+/* The whole primary surface is encoded as a video while the drawables change
+ * more than SURFACE_VIDEO_START_RATE percents of its area per second, over
+ * SURFACE_VIDEO_START_WINDOWS consecutive windows. It is back to the drawables
+ * once under SURFACE_VIDEO_STOP_RATE for SURFACE_VIDEO_STOP_WINDOWS windows,
+ * or once the stream times out. */
+#define SURFACE_VIDEO_WINDOW (NSEC_PER_SEC / 2)
+#define SURFACE_VIDEO_START_RATE 300
+#define SURFACE_VIDEO_START_WINDOWS 2
+#define SURFACE_VIDEO_STOP_RATE 30
+#define SURFACE_VIDEO_STOP_WINDOWS 4
+#define SURFACE_VIDEO_FRAME_DELAY (NSEC_PER_SEC / MAX_FPS)
 
 typedef struct Stream Stream;
 
@@ -100,6 +112,18 @@ typedef struct StreamCreateDestroyItem {
     StreamAgent *agent;
 } StreamCreateDestroyItem;
 
+/* a frame compressed asynchronously, see VideoEncoderRateControlCbs, or a
+ * frame of the surface stream */
+typedef struct StreamDataItem {
+    RedPipeItem base;
+    StreamAgent *agent;
+    uint32_t frame_mm_time;
+    /* the source area and the destination of the frame */
+    SpiceRect src_area;
+    SpiceRect dest;
+    VideoBuffer *buffer;
+} StreamDataItem;
+
 typedef struct ItemTrace {
     red_time_t time;
     red_time_t first_frame_time;
@@ -111,6 +135,22 @@ typedef struct ItemTrace {
     SpiceRect dest_area;
 } ItemTrace;
 
+/* see stream_surface_video_timeout() */
+typedef struct SurfaceVideo {
+    bool enabled;
+    /* the stream of the whole primary surface, NULL in drawable mode */
+    Stream *stream;
+    /* the area of the drawables added to the primary surface since
+     * window_start */
+    uint64_t damage;
+    red_time_t window_start;
+    /* the consecutive windows past the start rate, or the stop rate */
+    int windows;
+    /* whether the surface changed since the last frame */
+    bool dirty;
+    red_time_t last_frame_time;
+} SurfaceVideo;
+
 struct Stream {
     uint8_t refs;
     Drawable *current;
@@ -125,6 +165,10 @@ struct Stream {
     uint32_t num_input_frames;
     uint64_t input_fps_start_time;
     uint32_t input_fps;
+    /* the encoders shared by the clients, see shared_video_encoder_new() */
+    SharedVideoEncoder *shared_encoders;
+    /* the frames are the rendered primary surface rather than drawables */
+    bool surface;
 };
 
 void                  display_channel_init_streams                  (DisplayChannel *display);
@@ -148,6 +192,13 @@ void                  stream_detach_behind                          (DisplayChan
 void                  stream_agent_unref                            (DisplayChannel *display,
                                                                      StreamAgent *agent);
 void                  stream_agent_stop                             (StreamAgent *agent);
+int                   stream_agents_pull_encoded_frames             (DisplayChannel *display);
+void                  stream_surface_video_add_damage               (DisplayChannel *display,
+                                                                     Drawable *drawable);
+bool                  stream_surface_video_is_active                (DisplayChannel *display);
+void                  stream_surface_video_reset                    (DisplayChannel *display);
+void                  stream_surface_video_timeout                  (DisplayChannel *display);
+int                   stream_surface_video_get_timeout              (DisplayChannel *display);
 
 void stream_detach_drawable(Stream *stream);
 
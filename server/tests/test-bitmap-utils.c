@@ -0,0 +1,228 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Checks that the vector versions of bitmap_get_graduality_score() and
+ * rgb32_data_has_alpha() give exactly the results of the scalar ones, on
+ * bitmaps of each RGB format split in chunks.
+ * Run with -m perf, the time spent by each version supported by the CPU on
+ * a full screen bitmap is printed too.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <glib.h>
+
+#include <common/log.h>
+#include "spice-bitmap-utils.h"
+#include "utils.h"
+
+typedef enum {
+    CONTENT_NOISE,
+    CONTENT_GRADIENT,
+    CONTENT_TEXT,
+} ContentType;
+
+/* the lines are split in 2 chunks when there are several */
+static SpiceBitmap *bitmap_new(GRand *rand, uint8_t format, uint32_t width, uint32_t height,
+                               ContentType content)
+{
+    SpiceBitmap *bitmap = g_new0(SpiceBitmap, 1);
+    uint32_t first_lines = height / 2;
+    uint8_t *data;
+    uint32_t i;
+
+    bitmap->format = format;
+    bitmap->x = width;
+    bitmap->y = height;
+    bitmap->stride = width * bitmap_fmt_get_bytes_per_pixel(format) +
+                     g_rand_int_range(rand, 0, 2) * 4;
+    data = g_malloc(bitmap->stride * height);
+    for (i = 0; i < bitmap->stride * height; i++) {
+        switch (content) {
+        case CONTENT_NOISE:
+            data[i] = g_rand_int(rand);
+            break;
+        case CONTENT_GRADIENT:
+            data[i] = (i % bitmap->stride) / 8 + g_rand_int_range(rand, 0, 3);
+            break;
+        case CONTENT_TEXT:
+            data[i] = g_rand_int_range(rand, 0, 10) == 0 ? g_rand_int(rand) : 0xff;
+            break;
+        }
+    }
+
+    bitmap->data = g_malloc0(sizeof(SpiceChunks) + 2 * sizeof(SpiceChunk));
+    bitmap->data->chunk[0].data = data;
+    if (first_lines) {
+        bitmap->data->num_chunks = 2;
+        bitmap->data->chunk[0].len = first_lines * bitmap->stride;
+        bitmap->data->chunk[1].data = data + first_lines * bitmap->stride;
+        bitmap->data->chunk[1].len = (height - first_lines) * bitmap->stride;
+    } else {
+        bitmap->data->num_chunks = 1;
+        bitmap->data->chunk[0].len = height * bitmap->stride;
+    }
+    return bitmap;
+}
+
+static void bitmap_free(SpiceBitmap *bitmap)
+{
+    g_free(bitmap->data->chunk[0].data);
+    g_free(bitmap->data);
+    g_free(bitmap);
+}
+
+/* sets the alpha of the 32 bits pixels, a few of them partially */
+static void bitmap_set_alpha(GRand *rand, SpiceBitmap *bitmap, uint8_t alpha, bool partial)
+{
+    uint8_t *data = bitmap->data->chunk[0].data;
+    uint32_t x, y;
+
+    for (y = 0; y < bitmap->y; y++) {
+        for (x = 0; x < bitmap->x; x++) {
+            bool change = partial && g_rand_int_range(rand, 0, 1000) == 0;
+
+            data[y * bitmap->stride + x * 4 + 3] = change ? 0x80 : alpha;
+        }
+    }
+}
+
+static void check_bitmap(SpiceBitmap *bitmap, SimdLevel max_level)
+{
+    bool rgb32 = bitmap_fmt_get_bytes_per_pixel(bitmap->format) == 4;
+    double scalar_score, score;
+    int scalar_has_alpha = 0, scalar_all_set = 0, has_alpha, all_set;
+    uint8_t *data = bitmap->data->chunk[0].data;
+    int level;
+
+    simd_set_max_level(SIMD_LEVEL_NONE);
+    scalar_score = bitmap_get_graduality_score(bitmap);
+    if (rgb32) {
+        scalar_has_alpha = rgb32_data_has_alpha(bitmap->x, bitmap->y, bitmap->stride, data,
+                                                &scalar_all_set);
+    }
+
+    for (level = SIMD_LEVEL_SSE2; level <= max_level; level++) {
+        simd_set_max_level(level);
+        score = bitmap_get_graduality_score(bitmap);
+        spice_assert(memcmp(&score, &scalar_score, sizeof(score)) == 0);
+        if (rgb32) {
+            has_alpha = rgb32_data_has_alpha(bitmap->x, bitmap->y, bitmap->stride, data,
+                                             &all_set);
+            spice_assert(has_alpha == scalar_has_alpha && all_set == scalar_all_set);
+        }
+    }
+}
+
+static void test_formats(GRand *rand, SimdLevel max_level)
+{
+    static const uint8_t formats[] = {
+        SPICE_BITMAP_FMT_16BIT, SPICE_BITMAP_FMT_24BIT,
+        SPICE_BITMAP_FMT_32BIT, SPICE_BITMAP_FMT_RGBA,
+    };
+    unsigned int i;
+    uint32_t width;
+    int content;
+
+    for (i = 0; i < G_N_ELEMENTS(formats); i++) {
+        for (content = CONTENT_NOISE; content <= CONTENT_TEXT; content++) {
+            /* narrow widths exercise the jumps over several lines */
+            for (width = 1; width < 80; width += width < 20 ? 1 : 7) {
+                SpiceBitmap *bitmap = bitmap_new(rand, formats[i], width,
+                                                 g_rand_int_range(rand, 1, 50), content);
+
+                check_bitmap(bitmap, max_level);
+                if (bitmap_fmt_get_bytes_per_pixel(formats[i]) == 4) {
+                    bitmap_set_alpha(rand, bitmap, 0xff, FALSE);
+                    check_bitmap(bitmap, max_level);
+                    bitmap_set_alpha(rand, bitmap, 0xff, TRUE);
+                    check_bitmap(bitmap, max_level);
+                    bitmap_set_alpha(rand, bitmap, 0, FALSE);
+                    check_bitmap(bitmap, max_level);
+                }
+                bitmap_free(bitmap);
+            }
+        }
+    }
+}
+
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+#define BENCH_LOOPS 50
+
+static const char *const simd_level_names[] = { "scalar", "sse2", "ssse3", "avx2" };
+
+static void bench_format(GRand *rand, uint8_t format, const char *name, SimdLevel max_level)
+{
+    SpiceBitmap *bitmap = bitmap_new(rand, format, BENCH_WIDTH, BENCH_HEIGHT, CONTENT_GRADIENT);
+    uint8_t *data = bitmap->data->chunk[0].data;
+    int level, i;
+
+    if (bitmap_fmt_get_bytes_per_pixel(format) == 4) {
+        bitmap_set_alpha(rand, bitmap, 0xff, FALSE);
+    }
+    for (level = SIMD_LEVEL_NONE; level <= max_level; level++) {
+        red_time_t start, graduality_time, alpha_time = 0;
+        int all_set;
+
+        simd_set_max_level(level);
+        start = spice_get_monotonic_time_ns();
+        for (i = 0; i < BENCH_LOOPS; i++) {
+            bitmap_get_graduality_score(bitmap);
+        }
+        graduality_time = spice_get_monotonic_time_ns() - start;
+
+        if (bitmap_fmt_get_bytes_per_pixel(format) == 4) {
+            start = spice_get_monotonic_time_ns();
+            for (i = 0; i < BENCH_LOOPS; i++) {
+                rgb32_data_has_alpha(bitmap->x, bitmap->y, bitmap->stride, data, &all_set);
+            }
+            alpha_time = spice_get_monotonic_time_ns() - start;
+        }
+        printf("%-6s %-6s graduality %6.3f ms", name, simd_level_names[level],
+               graduality_time / 1e6 / BENCH_LOOPS);
+        if (alpha_time) {
+            printf(", has_alpha %6.3f ms", alpha_time / 1e6 / BENCH_LOOPS);
+        }
+        printf("\n");
+    }
+    bitmap_free(bitmap);
+}
+
+int main(int argc, char *argv[])
+{
+    SimdLevel max_level = simd_get_level();
+    GRand *rand;
+
+    g_test_init(&argc, &argv, NULL);
+    rand = g_rand_new_with_seed(42);
+
+    test_formats(rand, max_level);
+
+    if (g_test_perf()) {
+        bench_format(rand, SPICE_BITMAP_FMT_16BIT, "16bit", max_level);
+        bench_format(rand, SPICE_BITMAP_FMT_24BIT, "24bit", max_level);
+        bench_format(rand, SPICE_BITMAP_FMT_32BIT, "32bit", max_level);
+        bench_format(rand, SPICE_BITMAP_FMT_RGBA, "rgba", max_level);
+    }
+
+    g_rand_free(rand);
+    return 0;
+}
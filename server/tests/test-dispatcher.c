@@ -0,0 +1,233 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Checks that the Dispatcher delivers the messages in order, from one and
+ * from several threads, and that the acked messages are handled.
+ *
+ * Run with -m perf, many more messages are sent and the messages per second
+ * without ack and the round trip time of the acked messages are printed.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <poll.h>
+#include <pthread.h>
+
+#include <common/log.h>
+#include "dispatcher.h"
+#include "utils.h"
+
+#define NUM_SENDERS 4
+
+/* enough to go around the ring several times, more with -m perf */
+static uint32_t num_messages = 4000;
+static uint32_t num_acked_messages = 100;
+
+enum {
+    MSG_DATA,
+    MSG_SYNC,
+    MSG_QUIT,
+
+    MSG_COUNT
+};
+
+typedef struct {
+    uint32_t sender;
+    uint32_t seq;
+} DataMessage;
+
+typedef struct {
+    uint32_t expected_seq[NUM_SENDERS];
+    uint64_t received;
+    uint64_t synced;
+    bool order_ok;
+    bool quit;
+} TestState;
+
+typedef struct {
+    Dispatcher *dispatcher;
+    uint32_t sender;
+    uint32_t count;
+} SenderInfo;
+
+static void handle_data(void *opaque, void *payload)
+{
+    TestState *state = opaque;
+    DataMessage *msg = payload;
+
+    if (msg->seq != state->expected_seq[msg->sender]) {
+        state->order_ok = false;
+    }
+    state->expected_seq[msg->sender] = msg->seq + 1;
+    state->received++;
+}
+
+static void handle_sync(void *opaque, void *payload)
+{
+    TestState *state = opaque;
+
+    state->synced++;
+}
+
+static void handle_quit(void *opaque, void *payload)
+{
+    TestState *state = opaque;
+
+    state->quit = true;
+}
+
+static gpointer dispatcher_thread(gpointer data)
+{
+    Dispatcher *dispatcher = data;
+    TestState *state;
+    struct pollfd pollfd = {
+        .fd = dispatcher_get_recv_fd(dispatcher),
+        .events = POLLIN,
+    };
+
+    g_object_get(dispatcher, "opaque", &state, NULL);
+    while (!state->quit) {
+        if (poll(&pollfd, 1, -1) > 0) {
+            dispatcher_handle_recv_read(dispatcher);
+        }
+    }
+    return NULL;
+}
+
+static gpointer sender_thread(gpointer data)
+{
+    SenderInfo *info = data;
+    DataMessage msg = { .sender = info->sender };
+
+    for (msg.seq = 0; msg.seq < info->count; msg.seq++) {
+        dispatcher_send_message(info->dispatcher, MSG_DATA, &msg);
+    }
+    return NULL;
+}
+
+static void send_sync(Dispatcher *dispatcher)
+{
+    uint32_t dummy = 0;
+
+    dispatcher_send_message(dispatcher, MSG_SYNC, &dummy);
+}
+
+static void test_throughput(Dispatcher *dispatcher, TestState *state)
+{
+    SenderInfo info = { dispatcher, 0, num_messages };
+    red_time_t start, elapsed;
+
+    start = spice_get_monotonic_time_ns();
+    sender_thread(&info);
+    send_sync(dispatcher);
+    elapsed = spice_get_monotonic_time_ns() - start;
+
+    spice_assert(state->received == num_messages);
+    spice_assert(state->order_ok);
+    if (g_test_perf()) {
+        printf("1 sender:  %.0f messages/s\n", num_messages * 1e9 / elapsed);
+    }
+}
+
+static void test_multiple_senders(Dispatcher *dispatcher, TestState *state)
+{
+    SenderInfo infos[NUM_SENDERS];
+    GThread *threads[NUM_SENDERS];
+    red_time_t start, elapsed;
+    int i;
+
+    memset(state->expected_seq, 0, sizeof(state->expected_seq));
+    state->received = 0;
+
+    start = spice_get_monotonic_time_ns();
+    for (i = 0; i < NUM_SENDERS; i++) {
+        infos[i].dispatcher = dispatcher;
+        infos[i].sender = i;
+        infos[i].count = num_messages / NUM_SENDERS;
+        threads[i] = g_thread_new("sender", sender_thread, &infos[i]);
+    }
+    for (i = 0; i < NUM_SENDERS; i++) {
+        g_thread_join(threads[i]);
+    }
+    send_sync(dispatcher);
+    elapsed = spice_get_monotonic_time_ns() - start;
+
+    spice_assert(state->received == NUM_SENDERS * (num_messages / NUM_SENDERS));
+    spice_assert(state->order_ok);
+    if (g_test_perf()) {
+        printf("%d senders: %.0f messages/s\n", NUM_SENDERS,
+               NUM_SENDERS * (num_messages / NUM_SENDERS) * 1e9 / elapsed);
+    }
+}
+
+static void test_ack_latency(Dispatcher *dispatcher, TestState *state)
+{
+    red_time_t total = 0, max = 0;
+    int i;
+
+    state->synced = 0;
+    for (i = 0; i < num_acked_messages; i++) {
+        red_time_t start = spice_get_monotonic_time_ns();
+        red_time_t roundtrip;
+
+        send_sync(dispatcher);
+        roundtrip = spice_get_monotonic_time_ns() - start;
+        total += roundtrip;
+        max = MAX(max, roundtrip);
+    }
+
+    spice_assert(state->synced == num_acked_messages);
+    if (g_test_perf()) {
+        printf("acked message round trip: average %.2f us, max %.2f us\n",
+               total / 1000.0 / num_acked_messages, max / 1000.0);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    TestState state = { .order_ok = true };
+    Dispatcher *dispatcher;
+    GThread *thread;
+    uint32_t dummy = 0;
+
+    g_test_init(&argc, &argv, NULL);
+    if (g_test_perf()) {
+        num_messages = 200000;
+        num_acked_messages = 20000;
+    }
+
+    dispatcher = dispatcher_new(MSG_COUNT, &state);
+    dispatcher_register_handler(dispatcher, MSG_DATA, handle_data,
+                                sizeof(DataMessage), DISPATCHER_NONE);
+    dispatcher_register_handler(dispatcher, MSG_SYNC, handle_sync,
+                                sizeof(uint32_t), DISPATCHER_ACK);
+    dispatcher_register_handler(dispatcher, MSG_QUIT, handle_quit,
+                                sizeof(uint32_t), DISPATCHER_ACK);
+    thread = g_thread_new("dispatcher", dispatcher_thread, dispatcher);
+
+    test_throughput(dispatcher, &state);
+    test_multiple_senders(dispatcher, &state);
+    test_ack_latency(dispatcher, &state);
+
+    dispatcher_send_message(dispatcher, MSG_QUIT, &dummy);
+    g_thread_join(thread);
+    g_object_unref(dispatcher);
+
+    return 0;
+}
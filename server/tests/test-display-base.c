@@ -639,6 +639,9 @@ static void do_wakeup(void *opaque)
 
     test->cursor_notify = NOTIFY_CURSOR_BATCH;
     for (notify = NOTIFY_DISPLAY_BATCH; notify > 0;--notify) {
+        if (test->throttle_commands && get_num_commands() >= (int) COMMANDS_SIZE / 2) {
+            break;
+        }
         produce_command(test);
     }
 
@@ -886,7 +889,13 @@ void test_set_command_list(Test *test, Command *commands, int num_commands)
 
 Test *test_new(SpiceCoreInterface *core)
 {
-    int port = 5912;
+    return test_new_with_port(core, 5912);
+}
+
+/* with a @port of -1 the server does not listen, the clients are added
+ * with spice_server_add_client() */
+Test *test_new_with_port(SpiceCoreInterface *core, int port)
+{
     Test *test = spice_new0(Test, 1);
     SpiceServer* server = spice_server_new();
 
@@ -898,8 +907,10 @@ Test *test_new(SpiceCoreInterface *core)
     test->wakeup_ms = 1;
     test->cursor_notify = NOTIFY_CURSOR_BATCH;
     // some common initialization for all display tests
-    printf("TESTER: listening on port %d (unsecure)\n", port);
-    spice_server_set_port(server, port);
+    if (port != -1) {
+        printf("TESTER: listening on port %d (unsecure)\n", port);
+        spice_server_set_port(server, port);
+    }
     spice_server_set_noauth(server);
     spice_server_init(server, core);
 
@@ -127,6 +127,11 @@ struct Test {
 
     int target_surface;
 
+    // stop producing commands while half of the ring is not taken, for the
+    // tests where the server may not take them for a while, with all its
+    // clients blocked
+    int throttle_commands;
+
     // callbacks
     void (*on_client_connected)(Test *test);
     void (*on_client_disconnected)(Test *test);
@@ -137,6 +142,7 @@ void test_set_command_list(Test *test, Command *command, int num_commands);
 void test_add_display_interface(Test *test);
 void test_add_agent_interface(SpiceServer *server); // TODO - Test *test
 Test* test_new(SpiceCoreInterface* core);
+Test* test_new_with_port(SpiceCoreInterface* core, int port);
 void test_destroy(Test *test);
 
 uint32_t test_get_width(void);
@@ -0,0 +1,177 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Checks that the vector versions of the pixel converters give exactly the
+ * bytes of the scalar ones.
+ * Run with -m perf, the frames per second of the conversion alone and of the
+ * whole JPEG encoding are printed too, for each source format at 1080p and 4K
+ * and for each version supported by the CPU.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <glib.h>
+
+#include <common/log.h>
+#include "jpeg-encoder.h"
+#include "pixel-convert.h"
+#include "utils.h"
+
+typedef struct {
+    const char *name;
+    PixelConvertFormat convert_format;
+    JpegEncoderImageType jpeg_type;
+    int bytes_per_pixel;
+} SourceFormat;
+
+static const SourceFormat formats[] = {
+    { "rgb16", PIXEL_CONVERT_RGB16, JPEG_IMAGE_TYPE_RGB16, 2 },
+    { "bgr24", PIXEL_CONVERT_BGR24, JPEG_IMAGE_TYPE_BGR24, 3 },
+    { "bgrx32", PIXEL_CONVERT_BGRX32, JPEG_IMAGE_TYPE_BGRX32, 4 },
+};
+
+static void check_format(GRand *rand, const SourceFormat *format, SimdLevel max_level)
+{
+    int width;
+
+    /* the vector versions work on groups of up to 16 pixels */
+    for (width = 1; width < 100; width++) {
+        int size = width * format->bytes_per_pixel;
+        uint8_t *src = g_malloc(size);
+        /* a guard byte after the line */
+        uint8_t *scalar_dest = g_malloc(width * 3 + 1);
+        uint8_t *dest = g_malloc(width * 3 + 1);
+        int i, level;
+
+        for (i = 0; i < size; i++) {
+            src[i] = g_rand_int(rand);
+        }
+        simd_set_max_level(SIMD_LEVEL_NONE);
+        pixel_convert_get_line_to_rgb24(format->convert_format)(src, scalar_dest, width);
+
+        for (level = SIMD_LEVEL_SSE2; level <= max_level; level++) {
+            simd_set_max_level(level);
+            dest[width * 3] = 0x5a;
+            pixel_convert_get_line_to_rgb24(format->convert_format)(src, dest, width);
+            spice_assert(memcmp(dest, scalar_dest, width * 3) == 0);
+            spice_assert(dest[width * 3] == 0x5a);
+        }
+        g_free(src);
+        g_free(scalar_dest);
+        g_free(dest);
+    }
+}
+
+#define BENCH_FRAMES 5
+#define JPEG_QUALITY 85
+
+static const char *const simd_level_names[] = { "scalar", "sse2", "ssse3", "avx2" };
+
+typedef struct {
+    JpegEncoderUsrContext base;
+    uint8_t *buf;
+    int buf_size;
+} TestUsrContext;
+
+/* the whole image is given at once and the buffer is big enough */
+static int more_space(JpegEncoderUsrContext *usr, uint8_t **io_ptr)
+{
+    return 0;
+}
+
+static int more_lines(JpegEncoderUsrContext *usr, uint8_t **lines)
+{
+    return 0;
+}
+
+static void bench_format(GRand *rand, const SourceFormat *format, int width, int height,
+                         SimdLevel max_level)
+{
+    int stride = width * format->bytes_per_pixel;
+    uint8_t *data = g_malloc(stride * height);
+    uint8_t *line = g_malloc(width * 3);
+    TestUsrContext usr;
+    JpegEncoderContext *jpeg;
+    int i, y, level;
+
+    /* smooth content with some noise, as a video frame */
+    for (i = 0; i < stride * height; i++) {
+        data[i] = (i % stride) / 16 + (i / stride) / 8 + g_rand_int_range(rand, 0, 8);
+    }
+    usr.base.more_space = more_space;
+    usr.base.more_lines = more_lines;
+    usr.buf_size = width * height * 4;
+    usr.buf = g_malloc(usr.buf_size);
+    jpeg = jpeg_encoder_create(&usr.base);
+
+    for (level = SIMD_LEVEL_NONE; level <= max_level; level++) {
+        pixel_convert_line_t convert;
+        red_time_t start, convert_time, encode_time;
+
+        simd_set_max_level(level);
+        convert = pixel_convert_get_line_to_rgb24(format->convert_format);
+        start = spice_get_monotonic_time_ns();
+        for (i = 0; i < BENCH_FRAMES; i++) {
+            for (y = 0; y < height; y++) {
+                convert(data + y * stride, line, width);
+            }
+        }
+        convert_time = spice_get_monotonic_time_ns() - start;
+
+        start = spice_get_monotonic_time_ns();
+        for (i = 0; i < BENCH_FRAMES; i++) {
+            jpeg_encode(jpeg, JPEG_QUALITY, format->jpeg_type, width, height,
+                        data, height, stride, usr.buf, usr.buf_size);
+        }
+        encode_time = spice_get_monotonic_time_ns() - start;
+
+        printf("%-6s %4dx%-4d %-6s convert %8.1f fps, jpeg %6.1f fps\n",
+               format->name, width, height, simd_level_names[level],
+               BENCH_FRAMES * 1e9 / convert_time, BENCH_FRAMES * 1e9 / encode_time);
+    }
+
+    jpeg_encoder_destroy(jpeg);
+    g_free(usr.buf);
+    g_free(line);
+    g_free(data);
+}
+
+int main(int argc, char *argv[])
+{
+    SimdLevel max_level = simd_get_level();
+    GRand *rand;
+    unsigned int i;
+
+    g_test_init(&argc, &argv, NULL);
+    rand = g_rand_new_with_seed(42);
+
+    for (i = 0; i < G_N_ELEMENTS(formats); i++) {
+        check_format(rand, &formats[i], max_level);
+    }
+    if (g_test_perf()) {
+        for (i = 0; i < G_N_ELEMENTS(formats); i++) {
+            bench_format(rand, &formats[i], 1920, 1080, max_level);
+            bench_format(rand, &formats[i], 3840, 2160, max_level);
+        }
+    }
+
+    g_rand_free(rand);
+    return 0;
+}
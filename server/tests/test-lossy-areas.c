@@ -0,0 +1,131 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Checks the order in which the areas sent lossy are refined.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <glib.h>
+
+#include "lossy-areas.h"
+
+static void note(LossyAreas *areas, uint32_t surface_id, int n)
+{
+    SpiceRect rect = { .left = n, .top = n, .right = n + 10, .bottom = n + 10 };
+
+    lossy_areas_note(areas, surface_id, &rect);
+}
+
+static void assert_take(LossyAreas *areas, uint32_t surface_id, int n)
+{
+    LossyArea lossy;
+
+    g_assert_true(lossy_areas_take(areas, 0, &lossy));
+    g_assert_cmpuint(lossy.surface_id, ==, surface_id);
+    g_assert_cmpint(lossy.area.left, ==, n);
+    g_assert_cmpint(lossy.area.bottom, ==, n + 10);
+}
+
+/* the most recent first */
+static void test_order(void)
+{
+    LossyAreas areas;
+    LossyArea lossy;
+
+    memset(&areas, 0, sizeof(areas));
+    g_assert_true(lossy_areas_is_empty(&areas));
+    g_assert_false(lossy_areas_take(&areas, 0, &lossy));
+
+    note(&areas, 0, 1);
+    note(&areas, 0, 2);
+    note(&areas, 0, 3);
+    assert_take(&areas, 0, 3);
+    assert_take(&areas, 0, 2);
+    assert_take(&areas, 0, 1);
+    g_assert_true(lossy_areas_is_empty(&areas));
+}
+
+/* noting an area again makes it the most recent, without duplicating it */
+static void test_renote(void)
+{
+    LossyAreas areas;
+
+    memset(&areas, 0, sizeof(areas));
+    note(&areas, 0, 1);
+    note(&areas, 0, 2);
+    note(&areas, 0, 3);
+    note(&areas, 0, 1);
+    g_assert_cmpint(areas.n_areas, ==, 3);
+    assert_take(&areas, 0, 1);
+    assert_take(&areas, 0, 3);
+    assert_take(&areas, 0, 2);
+    g_assert_true(lossy_areas_is_empty(&areas));
+}
+
+/* the areas of the primary surface come before the more recent ones of the
+ * other surfaces */
+static void test_primary_first(void)
+{
+    LossyAreas areas;
+
+    memset(&areas, 0, sizeof(areas));
+    note(&areas, 0, 1);
+    note(&areas, 2, 2);
+    note(&areas, 0, 3);
+    note(&areas, 1, 4);
+    /* the same rectangle on another surface is another area */
+    note(&areas, 1, 3);
+    assert_take(&areas, 0, 3);
+    assert_take(&areas, 0, 1);
+    assert_take(&areas, 1, 3);
+    assert_take(&areas, 1, 4);
+    assert_take(&areas, 2, 2);
+    g_assert_true(lossy_areas_is_empty(&areas));
+}
+
+/* beyond LOSSY_AREAS_MAX the oldest are forgotten */
+static void test_overflow(void)
+{
+    LossyAreas areas;
+    int i;
+
+    memset(&areas, 0, sizeof(areas));
+    for (i = 0; i < LOSSY_AREAS_MAX + 5; i++) {
+        note(&areas, 0, i);
+    }
+    g_assert_cmpint(areas.n_areas, ==, LOSSY_AREAS_MAX);
+    for (i = LOSSY_AREAS_MAX + 4; i >= 5; i--) {
+        assert_take(&areas, 0, i);
+    }
+    g_assert_true(lossy_areas_is_empty(&areas));
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/lossy-areas/order", test_order);
+    g_test_add_func("/server/lossy-areas/renote", test_renote);
+    g_test_add_func("/server/lossy-areas/primary-first", test_primary_first);
+    g_test_add_func("/server/lossy-areas/overflow", test_overflow);
+
+    return g_test_run();
+}
@@ -0,0 +1,366 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Connects two clients speaking the raw protocol to the display channel,
+ * one reading everything it gets and one never reading after its link,
+ * and checks the first keeps getting the drawings while the other one
+ * lags behind.
+ */
+#include <config.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+#include <spice/protocol.h>
+#include <spice/enums.h>
+
+#include "test-glib-compat.h"
+#include "test-display-base.h"
+
+#define TILE_SIZE 16
+/* well over what the server processes when the pipe of the slow client
+ * blocks everybody: MAX_PIPE_SIZE items and two ack windows */
+#define NUM_DRAWS 500
+#define CLIENT_TIMEOUT_SECS 10
+
+typedef struct TestClient {
+    int main_socket;
+    int display_socket;
+} TestClient;
+
+typedef struct SPICE_ATTR_PACKED DisplayInit {
+    uint8_t pixmap_cache_id;
+    int64_t pixmap_cache_size;
+    uint8_t glz_dictionary_id;
+    int32_t glz_dictionary_window_size;
+} DisplayInit;
+
+static GMainLoop *loop;
+
+/* fills the primary surface with tiles which do not cover each other until
+ * it is full, so the drawings stay in the pipes */
+static void next_tile(Test *test, Command *command)
+{
+    static int tile = 0;
+    int columns = test->primary_width / TILE_SIZE;
+    int rows = test->primary_height / TILE_SIZE;
+    QXLRect *bbox = &command->solid.bbox;
+
+    bbox->left = tile % columns * TILE_SIZE;
+    bbox->top = tile / columns % rows * TILE_SIZE;
+    bbox->right = bbox->left + TILE_SIZE;
+    bbox->bottom = bbox->top + TILE_SIZE;
+    command->solid.color = 0xff000000 | (tile * 0x10305);
+    tile++;
+}
+
+static Command draw_command = {
+    .command = SIMPLE_DRAW_SOLID,
+    .cb = next_tile,
+};
+
+static void socket_write(int socket, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+
+    while (size > 0) {
+        ssize_t n = write(socket, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        g_assert_cmpint(n, >, 0);
+        p += n;
+        size -= n;
+    }
+}
+
+static void socket_read(int socket, void *data, size_t size)
+{
+    uint8_t *p = data;
+
+    while (size > 0) {
+        ssize_t n = read(socket, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        g_assert_cmpint(n, >, 0);
+        p += n;
+        size -= n;
+    }
+}
+
+static void socket_set_timeout(int socket)
+{
+    struct timeval timeout = { CLIENT_TIMEOUT_SECS, 0 };
+
+    g_assert_cmpint(setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO,
+                               &timeout, sizeof(timeout)), ==, 0);
+    g_assert_cmpint(setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO,
+                               &timeout, sizeof(timeout)), ==, 0);
+}
+
+/* a loopback connection, the server expects TCP sockets */
+static void tcp_socketpair(int sv[2])
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int listen_socket;
+
+    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    g_assert_cmpint(listen_socket, !=, -1);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    g_assert_cmpint(bind(listen_socket, (struct sockaddr *)&addr, sizeof(addr)), ==, 0);
+    g_assert_cmpint(listen(listen_socket, 1), ==, 0);
+    g_assert_cmpint(getsockname(listen_socket, (struct sockaddr *)&addr, &addr_len), ==, 0);
+
+    sv[1] = socket(AF_INET, SOCK_STREAM, 0);
+    g_assert_cmpint(sv[1], !=, -1);
+    g_assert_cmpint(connect(sv[1], (struct sockaddr *)&addr, sizeof(addr)), ==, 0);
+    sv[0] = accept(listen_socket, NULL, NULL);
+    g_assert_cmpint(sv[0], !=, -1);
+    close(listen_socket);
+}
+
+/* returns the client end of a new connection to the server */
+static int client_socket_new(SpiceServer *server)
+{
+    int sv[2];
+
+    tcp_socketpair(sv);
+    g_assert_cmpint(spice_server_add_client(server, sv[0], 0), ==, 0);
+    socket_set_timeout(sv[1]);
+    return sv[1];
+}
+
+static void client_link(int socket, uint32_t connection_id, uint8_t channel_type)
+{
+    struct SPICE_ATTR_PACKED {
+        SpiceLinkHeader header;
+        SpiceLinkMess mess;
+        uint32_t common_caps;
+    } link;
+    SpiceLinkHeader reply_header;
+    SpiceLinkReply *reply;
+    SpiceLinkAuthMechanism auth;
+    uint8_t ticket[SPICE_TICKET_KEY_PAIR_LENGTH / 8];
+    const uint8_t *pub_key;
+    uint32_t size, result;
+    RSA *rsa;
+
+    memset(&link, 0, sizeof(link));
+    link.header.magic = GUINT32_TO_LE(SPICE_MAGIC);
+    link.header.major_version = GUINT32_TO_LE(SPICE_VERSION_MAJOR);
+    link.header.minor_version = GUINT32_TO_LE(SPICE_VERSION_MINOR);
+    link.header.size = GUINT32_TO_LE(sizeof(link) - sizeof(link.header));
+    link.mess.connection_id = GUINT32_TO_LE(connection_id);
+    link.mess.channel_type = channel_type;
+    link.mess.num_common_caps = GUINT32_TO_LE(1);
+    link.mess.caps_offset = GUINT32_TO_LE(sizeof(link.mess));
+    link.common_caps = GUINT32_TO_LE(1 << SPICE_COMMON_CAP_PROTOCOL_AUTH_SELECTION |
+                                     1 << SPICE_COMMON_CAP_AUTH_SPICE |
+                                     1 << SPICE_COMMON_CAP_MINI_HEADER);
+    socket_write(socket, &link, sizeof(link));
+
+    socket_read(socket, &reply_header, sizeof(reply_header));
+    g_assert_cmpuint(GUINT32_FROM_LE(reply_header.magic), ==, SPICE_MAGIC);
+    size = GUINT32_FROM_LE(reply_header.size);
+    g_assert_cmpuint(size, >=, sizeof(*reply));
+    reply = g_malloc(size);
+    socket_read(socket, reply, size);
+    g_assert_cmpuint(GUINT32_FROM_LE(reply->error), ==, SPICE_LINK_ERR_OK);
+
+    /* there is no ticket to check but it must still be encrypted with the
+     * key of the server */
+    pub_key = reply->pub_key;
+    rsa = d2i_RSA_PUBKEY(NULL, &pub_key, sizeof(reply->pub_key));
+    g_assert_nonnull(rsa);
+    g_assert_cmpint(RSA_size(rsa), ==, sizeof(ticket));
+    g_assert_cmpint(RSA_public_encrypt(1, (const uint8_t *)"", ticket, rsa,
+                                       RSA_PKCS1_OAEP_PADDING), ==, sizeof(ticket));
+    RSA_free(rsa);
+    g_free(reply);
+
+    auth.auth_mechanism = GUINT32_TO_LE(SPICE_COMMON_CAP_AUTH_SPICE);
+    socket_write(socket, &auth, sizeof(auth));
+    socket_write(socket, ticket, sizeof(ticket));
+
+    socket_read(socket, &result, sizeof(result));
+    g_assert_cmpuint(GUINT32_FROM_LE(result), ==, SPICE_LINK_ERR_OK);
+}
+
+static void client_send_msg(int socket, uint16_t type, const void *data, uint32_t size)
+{
+    SpiceMiniDataHeader header;
+
+    header.type = GUINT16_TO_LE(type);
+    header.size = GUINT32_TO_LE(size);
+    socket_write(socket, &header, sizeof(header));
+    socket_write(socket, data, size);
+}
+
+/* returns the type of the message, its data is put in @data */
+static uint16_t client_read_msg(int socket, GByteArray *data)
+{
+    SpiceMiniDataHeader header;
+
+    socket_read(socket, &header, sizeof(header));
+    g_byte_array_set_size(data, GUINT32_FROM_LE(header.size));
+    socket_read(socket, data->data, data->len);
+    return GUINT16_FROM_LE(header.type);
+}
+
+static uint32_t msg_get_uint32(GByteArray *data, size_t offset)
+{
+    uint32_t value;
+
+    g_assert_cmpuint(data->len, >=, offset + sizeof(value));
+    memcpy(&value, data->data + offset, sizeof(value));
+    return GUINT32_FROM_LE(value);
+}
+
+/* links the main and display channels of the client */
+static void client_connect(TestClient *client)
+{
+    GByteArray *data = g_byte_array_new();
+    DisplayInit init;
+    uint32_t connection_id;
+
+    client_link(client->main_socket, 0, SPICE_CHANNEL_MAIN);
+    while (client_read_msg(client->main_socket, data) != SPICE_MSG_MAIN_INIT) {
+    }
+    /* the session id of SpiceMsgMainInit */
+    connection_id = msg_get_uint32(data, 0);
+    g_byte_array_free(data, TRUE);
+
+    client_link(client->display_socket, connection_id, SPICE_CHANNEL_DISPLAY);
+    /* the display channel waits for it before sending anything */
+    init.pixmap_cache_id = 1;
+    init.pixmap_cache_size = GINT64_TO_LE(1024 * 1024);
+    init.glz_dictionary_id = 1;
+    init.glz_dictionary_window_size = GINT32_TO_LE(1024 * 1024);
+    client_send_msg(client->display_socket, SPICE_MSGC_DISPLAY_INIT, &init, sizeof(init));
+}
+
+/* reads the display channel of the fast client, acknowledging the messages
+ * like a real client, until it got NUM_DRAWS drawings */
+static void client_read_draws(TestClient *client)
+{
+    GByteArray *data = g_byte_array_new();
+    uint32_t ack_window = 0, ack_count = 0;
+    int draws = 0;
+
+    while (draws < NUM_DRAWS) {
+        uint16_t type = client_read_msg(client->display_socket, data);
+
+        if (ack_count && --ack_count == 0) {
+            client_send_msg(client->display_socket, SPICE_MSGC_ACK, NULL, 0);
+            ack_count = ack_window;
+        }
+
+        switch (type) {
+        case SPICE_MSG_SET_ACK: {
+            /* SpiceMsgSetAck, answered with SpiceMsgcAckSync */
+            uint32_t generation = GUINT32_TO_LE(msg_get_uint32(data, 0));
+
+            ack_window = ack_count = msg_get_uint32(data, sizeof(uint32_t));
+            client_send_msg(client->display_socket, SPICE_MSGC_ACK_SYNC,
+                            &generation, sizeof(generation));
+            break;
+        }
+        case SPICE_MSG_DISPLAY_DRAW_COPY:
+            draws++;
+            break;
+        }
+    }
+    g_byte_array_free(data, TRUE);
+}
+
+static gpointer clients_thread(gpointer data)
+{
+    TestClient *clients = data;
+
+    client_connect(&clients[0]);
+    client_connect(&clients[1]);
+    /* the second client never reads anything from now on, its pipe used to
+     * stop the commands processing for both */
+    client_read_draws(&clients[0]);
+
+    g_main_loop_quit(loop);
+    return NULL;
+}
+
+static void test_slow_client(void)
+{
+    SpiceCoreInterface *core;
+    TestClient clients[2];
+    GThread *thread;
+    Test *test;
+    int i;
+
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                          "*allowing multiple client connections*");
+    core = basic_event_loop_init();
+    test = test_new_with_port(core, -1);
+    g_test_assert_expected_messages();
+    test->throttle_commands = TRUE;
+
+    spice_server_set_image_compression(test->server, SPICE_IMAGE_COMPRESSION_OFF);
+    test_add_display_interface(test);
+    test_set_command_list(test, &draw_command, 1);
+
+    for (i = 0; i < G_N_ELEMENTS(clients); i++) {
+        clients[i].main_socket = client_socket_new(test->server);
+        clients[i].display_socket = client_socket_new(test->server);
+    }
+
+    loop = g_main_loop_new(basic_event_loop_get_context(), FALSE);
+    thread = g_thread_new("clients", clients_thread, clients);
+    g_main_loop_run(loop);
+    g_thread_join(thread);
+    g_main_loop_unref(loop);
+
+    test_destroy(test);
+    basic_event_loop_destroy();
+    for (i = 0; i < G_N_ELEMENTS(clients); i++) {
+        close(clients[i].main_socket);
+        close(clients[i].display_socket);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    /* read by spice_server_init() */
+    g_setenv("SPICE_DEBUG_ALLOW_MC", "1", TRUE);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/multi-client/slow-client", test_slow_client);
+
+    return g_test_run();
+}
@@ -46,11 +46,74 @@ static void agent_options(void)
     spice_server_destroy(server);
 }
 
+static void compression_threads_options(void)
+{
+    SpiceServer *server = spice_server_new();
+
+    g_assert_nonnull(server);
+
+    g_assert_cmpint(spice_server_set_compression_threads(server, 0), ==, 0);
+    g_assert_cmpint(spice_server_set_compression_threads(server, 2), ==, 0);
+
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                          "*invalid number of compression threads*");
+    g_assert_cmpint(spice_server_set_compression_threads(server, -1), ==, -1);
+    g_test_assert_expected_messages();
+
+    spice_server_destroy(server);
+}
+
+static void display_options(void)
+{
+    SpiceServer *server = spice_server_new();
+
+    g_assert_nonnull(server);
+
+    g_assert_cmpint(spice_server_set_shared_images_size(server, 0), ==, 0);
+    g_assert_cmpint(spice_server_set_shared_images_size(server, 64), ==, 0);
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "*invalid shared images size*");
+    g_assert_cmpint(spice_server_set_shared_images_size(server, -1), ==, -1);
+    g_test_assert_expected_messages();
+
+    g_assert_cmpint(spice_server_set_max_drawables(server, 10000), ==, 0);
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "*invalid maximum number of drawables*");
+    g_assert_cmpint(spice_server_set_max_drawables(server, 10), ==, -1);
+    g_test_assert_expected_messages();
+
+    g_assert_cmpint(spice_server_set_pixmap_dedup(server, 1), ==, 0);
+
+    g_assert_cmpint(spice_server_set_pixmap_cache_shards(server, 4), ==, 0);
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                          "*invalid number of pixmap cache shards*");
+    g_assert_cmpint(spice_server_set_pixmap_cache_shards(server, 0), ==, -1);
+    g_test_assert_expected_messages();
+
+    g_assert_cmpint(spice_server_set_image_cache_size(server, 0), ==, 0);
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "*invalid image cache size*");
+    g_assert_cmpint(spice_server_set_image_cache_size(server, 100000), ==, -1);
+    g_test_assert_expected_messages();
+
+    g_assert_cmpint(spice_server_set_shared_video_encoders(server, 1), ==, 0);
+    g_assert_cmpint(spice_server_set_async_video_encoding(server, 1), ==, 0);
+    g_assert_cmpint(spice_server_set_surface_video(server, 1), ==, 0);
+
+    g_assert_cmpint(spice_server_set_lossy_refine_rate(server, 0), ==, 0);
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "*invalid lossy refine rate*");
+    g_assert_cmpint(spice_server_set_lossy_refine_rate(server, -1), ==, -1);
+    g_test_assert_expected_messages();
+
+    g_assert_cmpint(spice_server_set_zerocopy(server, 1), ==, 0);
+
+    spice_server_destroy(server);
+}
+
 int main(int argc, char *argv[])
 {
     g_test_init(&argc, &argv, NULL);
 
     g_test_add_func("/server/agent options", agent_options);
+    g_test_add_func("/server/compression threads options", compression_threads_options);
+    g_test_add_func("/server/display options", display_options);
 
     return g_test_run();
 }
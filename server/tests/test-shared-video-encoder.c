@@ -0,0 +1,345 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Checks how the clients of a stream share their video encoders, using a
+ * fake codec which counts the encoders and the frames it encodes.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include "shared-video-encoder.h"
+
+typedef struct FakeEncoder {
+    VideoEncoder base;
+    uint64_t bit_rate;
+} FakeEncoder;
+
+static int encoders;
+static int encoded_frames;
+/* the starting bit rate of the last encoder created */
+static uint64_t last_bit_rate;
+static int bitmap_refs;
+
+static void fake_bitmap_ref(gpointer data)
+{
+    bitmap_refs++;
+}
+
+static void fake_bitmap_unref(gpointer data)
+{
+    g_assert_cmpint(bitmap_refs, >, 0);
+    bitmap_refs--;
+}
+
+static void fake_buffer_free(VideoBuffer *buffer)
+{
+    g_free(buffer->data);
+    g_free(buffer);
+}
+
+static void fake_encoder_destroy(VideoEncoder *encoder)
+{
+    encoders--;
+    g_free(encoder);
+}
+
+/* the data of the buffer is the number of the encoded frame */
+static int fake_encoder_encode_frame(VideoEncoder *encoder, uint32_t frame_mm_time,
+                                     const SpiceBitmap *bitmap,
+                                     const SpiceRect *src, int top_down,
+                                     gpointer bitmap_opaque, VideoBuffer **outbuf)
+{
+    VideoBuffer *buffer = g_new0(VideoBuffer, 1);
+
+    buffer->data = g_malloc(sizeof(int));
+    *(int *)buffer->data = ++encoded_frames;
+    buffer->size = sizeof(int);
+    buffer->free = fake_buffer_free;
+    *outbuf = buffer;
+    return VIDEO_ENCODER_FRAME_ENCODE_DONE;
+}
+
+static void fake_encoder_client_stream_report(VideoEncoder *encoder,
+                                              uint32_t num_frames, uint32_t num_drops,
+                                              uint32_t start_frame_mm_time,
+                                              uint32_t end_frame_mm_time,
+                                              int32_t end_frame_delay, uint32_t audio_delay)
+{
+}
+
+static void fake_encoder_notify_server_frame_drop(VideoEncoder *encoder)
+{
+}
+
+static uint64_t fake_encoder_get_bit_rate(VideoEncoder *encoder)
+{
+    return ((FakeEncoder *)encoder)->bit_rate;
+}
+
+static void fake_encoder_get_stats(VideoEncoder *encoder, VideoEncoderStats *stats)
+{
+}
+
+static VideoEncoder *fake_encoder_new(SpiceVideoCodecType codec_type,
+                                      uint64_t starting_bit_rate,
+                                      VideoEncoderRateControlCbs *cbs,
+                                      bitmap_ref_t bitmap_ref,
+                                      bitmap_unref_t bitmap_unref)
+{
+    FakeEncoder *encoder = g_new0(FakeEncoder, 1);
+
+    encoder->base.destroy = fake_encoder_destroy;
+    encoder->base.encode_frame = fake_encoder_encode_frame;
+    encoder->base.client_stream_report = fake_encoder_client_stream_report;
+    encoder->base.notify_server_frame_drop = fake_encoder_notify_server_frame_drop;
+    encoder->base.get_bit_rate = fake_encoder_get_bit_rate;
+    encoder->base.get_stats = fake_encoder_get_stats;
+    encoder->base.codec_type = codec_type;
+    encoder->bit_rate = starting_bit_rate;
+    last_bit_rate = starting_bit_rate;
+    encoders++;
+    return &encoder->base;
+}
+
+static uint32_t fake_get_roundtrip_ms(void *opaque)
+{
+    return 10;
+}
+
+static uint32_t fake_get_source_fps(void *opaque)
+{
+    return 25;
+}
+
+static void fake_update_client_playback_delay(void *opaque, uint32_t delay_ms)
+{
+}
+
+static VideoEncoderRateControlCbs fake_cbs = {
+    .get_roundtrip_ms = fake_get_roundtrip_ms,
+    .get_source_fps = fake_get_source_fps,
+    .update_client_playback_delay = fake_update_client_playback_delay,
+};
+
+static VideoEncoder *client_new(SharedVideoEncoder **groups, SpiceVideoCodecType codec_type,
+                                uint64_t bit_rate)
+{
+    RedVideoCodec codec = { fake_encoder_new, codec_type, 0 };
+    VideoEncoder *encoder;
+
+    encoder = shared_video_encoder_new(groups, &codec, bit_rate, &fake_cbs,
+                                       fake_bitmap_ref, fake_bitmap_unref);
+    g_assert_nonnull(encoder);
+    return encoder;
+}
+
+/* the frames are numbered from 1, returns the number of the encoded frame
+ * the client got */
+static int client_encode(VideoEncoder *encoder, int frame)
+{
+    VideoBuffer *buffer = NULL;
+    int ret, encoded;
+
+    ret = encoder->encode_frame(encoder, frame * 40, NULL, NULL, TRUE,
+                                GINT_TO_POINTER(frame), &buffer);
+    g_assert_cmpint(ret, ==, VIDEO_ENCODER_FRAME_ENCODE_DONE);
+    g_assert_nonnull(buffer);
+    g_assert_cmpint(buffer->size, ==, sizeof(int));
+    encoded = *(int *)buffer->data;
+    buffer->free(buffer);
+    return encoded;
+}
+
+static void test_setup(void)
+{
+    encoders = 0;
+    encoded_frames = 0;
+    bitmap_refs = 0;
+}
+
+static void test_teardown(SharedVideoEncoder **groups, VideoEncoder **clients, int n_clients)
+{
+    int i;
+
+    shared_video_encoder_close_groups(groups);
+    g_assert_null(*groups);
+    for (i = 0; i < n_clients; i++) {
+        clients[i]->destroy(clients[i]);
+    }
+    g_assert_cmpint(encoders, ==, 0);
+    g_assert_cmpint(bitmap_refs, ==, 0);
+}
+
+/* each frame is encoded once whatever the number of clients */
+static void test_fan_out(gconstpointer data)
+{
+    SpiceVideoCodecType codec_type = GPOINTER_TO_INT(data);
+    SharedVideoEncoder *groups = NULL;
+    VideoEncoder *clients[3];
+    int i, frame;
+
+    test_setup();
+    for (i = 0; i < G_N_ELEMENTS(clients); i++) {
+        clients[i] = client_new(&groups, codec_type, 0);
+    }
+    g_assert_cmpint(encoders, ==, 1);
+
+    for (frame = 1; frame <= 10; frame++) {
+        for (i = 0; i < G_N_ELEMENTS(clients); i++) {
+            g_assert_cmpint(client_encode(clients[i], frame), ==, frame);
+        }
+    }
+    g_assert_cmpint(encoded_frames, ==, 10);
+    g_assert_cmpint(encoders, ==, 1);
+
+    test_teardown(&groups, clients, G_N_ELEMENTS(clients));
+}
+
+/* a client a few frames behind the others still shares their frames */
+static void test_drift(gconstpointer data)
+{
+    SpiceVideoCodecType codec_type = GPOINTER_TO_INT(data);
+    SharedVideoEncoder *groups = NULL;
+    VideoEncoder *clients[2];
+    int frame;
+
+    test_setup();
+    clients[0] = client_new(&groups, codec_type, 0);
+    clients[1] = client_new(&groups, codec_type, 0);
+
+    g_assert_cmpint(client_encode(clients[0], 1), ==, 1);
+    for (frame = 2; frame <= 10; frame++) {
+        g_assert_cmpint(client_encode(clients[0], frame), ==, frame);
+        g_assert_cmpint(client_encode(clients[1], frame - 1), ==, frame - 1);
+    }
+    g_assert_cmpint(client_encode(clients[1], 10), ==, 10);
+    g_assert_cmpint(encoded_frames, ==, 10);
+    g_assert_cmpint(encoders, ==, 1);
+
+    test_teardown(&groups, clients, G_N_ELEMENTS(clients));
+}
+
+/* a client missing a frame of an inter-frame codec gets its own encoder,
+ * the others keep the group */
+static void test_leave(void)
+{
+    SharedVideoEncoder *groups = NULL;
+    VideoEncoder *clients[3];
+    int i;
+
+    test_setup();
+    for (i = 0; i < G_N_ELEMENTS(clients); i++) {
+        clients[i] = client_new(&groups, SPICE_VIDEO_CODEC_TYPE_VP8, 0);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(clients); i++) {
+        g_assert_cmpint(client_encode(clients[i], 1), ==, 1);
+    }
+    g_assert_cmpint(client_encode(clients[0], 2), ==, 2);
+    g_assert_cmpint(client_encode(clients[1], 2), ==, 2);
+    /* the third client's frame 2 was dropped */
+    g_assert_cmpint(client_encode(clients[2], 3), ==, 3);
+    g_assert_cmpint(encoders, ==, 2);
+    g_assert_cmpint(client_encode(clients[0], 3), ==, 4);
+    g_assert_cmpint(client_encode(clients[1], 3), ==, 4);
+    g_assert_cmpint(encoded_frames, ==, 4);
+
+    /* the group lives until its last client leaves */
+    clients[0]->destroy(clients[0]);
+    g_assert_cmpint(encoders, ==, 2);
+    clients[0] = clients[2];
+    test_teardown(&groups, clients, 2);
+}
+
+/* only the groups of intra-frame codecs can be joined after their first
+ * frame, and only by the clients of the same bit rate tier */
+static void test_join(void)
+{
+    SharedVideoEncoder *groups = NULL;
+    VideoEncoder *clients[5];
+
+    test_setup();
+    clients[0] = client_new(&groups, SPICE_VIDEO_CODEC_TYPE_MJPEG, 0);
+    clients[1] = client_new(&groups, SPICE_VIDEO_CODEC_TYPE_VP8, 0);
+    g_assert_cmpint(encoders, ==, 2);
+    g_assert_cmpint(client_encode(clients[0], 1), ==, 1);
+    g_assert_cmpint(client_encode(clients[1], 1), ==, 2);
+
+    clients[2] = client_new(&groups, SPICE_VIDEO_CODEC_TYPE_MJPEG, 0);
+    clients[3] = client_new(&groups, SPICE_VIDEO_CODEC_TYPE_VP8, 0);
+    g_assert_cmpint(encoders, ==, 3);
+    g_assert_cmpint(client_encode(clients[2], 1), ==, 1);
+    g_assert_cmpint(client_encode(clients[3], 2), ==, 3);
+
+    clients[4] = client_new(&groups, SPICE_VIDEO_CODEC_TYPE_MJPEG, 8 * 1024 * 1024);
+    g_assert_cmpint(encoders, ==, 4);
+    g_assert_cmpint(client_encode(clients[4], 1), ==, 4);
+    g_assert_cmpint(encoded_frames, ==, 4);
+
+    test_teardown(&groups, clients, G_N_ELEMENTS(clients));
+}
+
+/* the clients of a group are within a factor 2 and the encoder starts at
+ * a bit rate none of them is below */
+static void test_join_low_rates(void)
+{
+    SharedVideoEncoder *groups = NULL;
+    VideoEncoder *clients[3];
+
+    test_setup();
+    clients[0] = client_new(&groups, SPICE_VIDEO_CODEC_TYPE_MJPEG, 300 * 1024);
+    g_assert_cmpint(encoders, ==, 1);
+    g_assert_cmpuint(last_bit_rate, <=, 300 * 1024);
+    g_assert_cmpuint(last_bit_rate, >, 150 * 1024);
+
+    clients[1] = client_new(&groups, SPICE_VIDEO_CODEC_TYPE_MJPEG, 1900 * 1024);
+    g_assert_cmpint(encoders, ==, 2);
+    g_assert_cmpuint(last_bit_rate, <=, 1900 * 1024);
+    g_assert_cmpuint(last_bit_rate, >, 950 * 1024);
+
+    clients[2] = client_new(&groups, SPICE_VIDEO_CODEC_TYPE_MJPEG, 400 * 1024);
+    g_assert_cmpint(encoders, ==, 2);
+    g_assert_cmpint(client_encode(clients[0], 1), ==, 1);
+    g_assert_cmpint(client_encode(clients[1], 1), ==, 2);
+    g_assert_cmpint(client_encode(clients[2], 1), ==, 1);
+    g_assert_cmpint(encoded_frames, ==, 2);
+
+    test_teardown(&groups, clients, G_N_ELEMENTS(clients));
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_data_func("/server/shared-video-encoder/fan-out/mjpeg",
+                         GINT_TO_POINTER(SPICE_VIDEO_CODEC_TYPE_MJPEG), test_fan_out);
+    g_test_add_data_func("/server/shared-video-encoder/fan-out/vp8",
+                         GINT_TO_POINTER(SPICE_VIDEO_CODEC_TYPE_VP8), test_fan_out);
+    g_test_add_data_func("/server/shared-video-encoder/drift/mjpeg",
+                         GINT_TO_POINTER(SPICE_VIDEO_CODEC_TYPE_MJPEG), test_drift);
+    g_test_add_data_func("/server/shared-video-encoder/drift/vp8",
+                         GINT_TO_POINTER(SPICE_VIDEO_CODEC_TYPE_VP8), test_drift);
+    g_test_add_func("/server/shared-video-encoder/leave", test_leave);
+    g_test_add_func("/server/shared-video-encoder/join", test_join);
+    g_test_add_func("/server/shared-video-encoder/join-low-rates", test_join_low_rates);
+
+    return g_test_run();
+}
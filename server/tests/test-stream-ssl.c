@@ -0,0 +1,305 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Sends the same stream of small messages over a loopback TLS connection,
+ * once with one write per iovec and once through reds_stream_writev(), and
+ * compares the number of TLS records and the bytes seen on the wire.
+ * The stream is then sent again with kernel TLS requested, which must give
+ * the same data whether or not the kernel supports it.
+ *
+ * Run with -m perf, more messages are sent and the records and bytes of each
+ * way are printed.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include <common/log.h>
+#include "reds-stream.h"
+#include "basic-event-loop.h"
+
+#define PKI_DIR SPICE_TOP_SRCDIR "/server/tests/pki/"
+
+#define BIG_CHUNK_SIZE (40 * 1024)
+
+/* a few big chunks among the small messages, more with -m perf */
+static int num_messages = 300;
+
+typedef struct {
+    uint64_t records;
+    uint64_t wire_bytes;
+    bool ktls;
+} TestResult;
+
+typedef struct {
+    int socket;
+    SSL_CTX *ctx;
+    size_t expected;
+    uint64_t records;
+    uint64_t wire_bytes;
+    bool data_ok;
+} TestClient;
+
+static SpiceServer *server = NULL;
+
+static int server_init(void)
+{
+    SpiceCoreInterface *core = basic_event_loop_init();
+    server = spice_server_new();
+
+    return spice_server_init(server, core);
+}
+
+static void client_msg_cb(int write_p, int version, int content_type,
+                          const void *buf, size_t len, SSL *ssl, void *arg)
+{
+    TestClient *client = arg;
+
+    if (!write_p && content_type == SSL3_RT_HEADER) {
+        client->records++;
+    }
+}
+
+static gpointer client_thread(gpointer data)
+{
+    TestClient *client = data;
+    uint8_t buf[4096];
+    uint8_t expected_byte = 0;
+    size_t received = 0;
+    unsigned long handshake_bytes;
+    SSL *ssl;
+
+    ssl = SSL_new(client->ctx);
+    spice_assert(ssl != NULL);
+    SSL_set_fd(ssl, client->socket);
+    SSL_set_msg_callback(ssl, client_msg_cb);
+    SSL_set_msg_callback_arg(ssl, client);
+    if (SSL_connect(ssl) != 1) {
+        ERR_print_errors_fp(stderr);
+        spice_error("SSL_connect failed");
+    }
+
+    /* only count the application data */
+    client->records = 0;
+    handshake_bytes = BIO_number_read(SSL_get_rbio(ssl));
+
+    client->data_ok = true;
+    while (received < client->expected) {
+        int i, n;
+
+        n = SSL_read(ssl, buf, MIN(sizeof(buf), client->expected - received));
+        spice_assert(n > 0);
+        for (i = 0; i < n; i++) {
+            if (buf[i] != expected_byte++) {
+                client->data_ok = false;
+            }
+        }
+        received += n;
+    }
+
+    client->wire_bytes = BIO_number_read(SSL_get_rbio(ssl)) - handshake_bytes;
+    SSL_free(ssl);
+
+    return NULL;
+}
+
+/* kernel TLS is only available on TCP sockets, so use a loopback
+ * connection rather than a socketpair() */
+static void tcp_socketpair(int sv[2])
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int listen_socket;
+
+    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    spice_assert(listen_socket != -1);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    spice_assert(bind(listen_socket, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    spice_assert(listen(listen_socket, 1) == 0);
+    spice_assert(getsockname(listen_socket, (struct sockaddr *)&addr, &addr_len) == 0);
+
+    sv[1] = socket(AF_INET, SOCK_STREAM, 0);
+    spice_assert(sv[1] != -1);
+    spice_assert(connect(sv[1], (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    sv[0] = accept(listen_socket, NULL, NULL);
+    spice_assert(sv[0] != -1);
+    close(listen_socket);
+}
+
+/* message layout similar to what the display channel produces:
+ * a header, a few small fields and from time to time some image data */
+static int fill_message(struct iovec *iov, uint8_t *data, int msg)
+{
+    static const size_t chunk_sizes[] = { 6, 24, 8, 60, 12 };
+    int n = 0;
+    size_t i;
+
+    for (i = 0; i < G_N_ELEMENTS(chunk_sizes); i++) {
+        iov[n].iov_base = data;
+        iov[n].iov_len = chunk_sizes[i];
+        data += chunk_sizes[i];
+        n++;
+    }
+    if (msg % 100 == 0) {
+        iov[n].iov_base = data;
+        iov[n].iov_len = BIG_CHUNK_SIZE;
+        n++;
+    }
+    return n;
+}
+
+static void run_test(SSL_CTX *server_ctx, SSL_CTX *client_ctx, bool use_writev,
+                     TestResult *result)
+{
+    static uint8_t data[BIG_CHUNK_SIZE + 1024];
+    struct iovec iov[8];
+    TestClient client;
+    RedsStream *stream;
+    GThread *thread;
+    uint8_t pattern = 0;
+    int sv[2];
+    int msg;
+
+    tcp_socketpair(sv);
+
+    memset(&client, 0, sizeof(client));
+    client.socket = sv[1];
+    client.ctx = client_ctx;
+    for (msg = 0; msg < num_messages; msg++) {
+        int i, n = fill_message(iov, data, msg);
+        for (i = 0; i < n; i++) {
+            client.expected += iov[i].iov_len;
+        }
+    }
+    thread = g_thread_new("ssl-client", client_thread, &client);
+
+    stream = reds_stream_new(server, sv[0]);
+    spice_assert(reds_stream_enable_ssl(stream, server_ctx) == REDS_STREAM_SSL_STATUS_OK);
+
+    for (msg = 0; msg < num_messages; msg++) {
+        int i, n = fill_message(iov, data, msg);
+        size_t msg_size = 0;
+
+        /* regenerate the content so the client can check the stream */
+        for (i = 0; i < n; i++) {
+            size_t j;
+            for (j = 0; j < iov[i].iov_len; j++) {
+                ((uint8_t *)iov[i].iov_base)[j] = pattern++;
+            }
+            msg_size += iov[i].iov_len;
+        }
+
+        if (use_writev) {
+            spice_assert(reds_stream_writev(stream, iov, n) == (ssize_t)msg_size);
+        } else {
+            for (i = 0; i < n; i++) {
+                spice_assert(reds_stream_write_all(stream, iov[i].iov_base, iov[i].iov_len));
+            }
+        }
+    }
+
+    g_thread_join(thread);
+    spice_assert(client.data_ok);
+
+    result->records = client.records;
+    result->wire_bytes = client.wire_bytes;
+    result->ktls = reds_stream_is_ktls(stream);
+
+    reds_stream_free(stream);
+    close(sv[1]);
+}
+
+static SSL_CTX *server_ctx_new(void)
+{
+    SSL_CTX *ctx = SSL_CTX_new(SSLv23_server_method());
+
+    spice_assert(ctx != NULL);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    /* the test certificates use a small key */
+    SSL_CTX_set_security_level(ctx, 0);
+#endif
+    spice_assert(SSL_CTX_use_certificate_chain_file(ctx, PKI_DIR "server-cert.pem") == 1);
+    spice_assert(SSL_CTX_use_PrivateKey_file(ctx, PKI_DIR "server-key.pem",
+                                             SSL_FILETYPE_PEM) == 1);
+    return ctx;
+}
+
+int main(int argc, char *argv[])
+{
+    SSL_CTX *server_ctx, *client_ctx;
+    TestResult results[2];
+
+    g_test_init(&argc, &argv, NULL);
+    if (g_test_perf()) {
+        num_messages = 2000;
+    }
+    spice_return_val_if_fail(server_init() == 0, -1);
+
+    SSL_library_init();
+    SSL_load_error_strings();
+
+    server_ctx = server_ctx_new();
+    client_ctx = SSL_CTX_new(SSLv23_client_method());
+    spice_assert(client_ctx != NULL);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    SSL_CTX_set_security_level(client_ctx, 0);
+#endif
+
+    run_test(server_ctx, client_ctx, false, &results[0]);
+    run_test(server_ctx, client_ctx, true, &results[1]);
+
+    if (g_test_perf()) {
+        printf("one write per iovec: %" G_GUINT64_FORMAT " records, %" G_GUINT64_FORMAT " bytes\n",
+               results[0].records, results[0].wire_bytes);
+        printf("coalesced writev:    %" G_GUINT64_FORMAT " records, %" G_GUINT64_FORMAT " bytes\n",
+               results[1].records, results[1].wire_bytes);
+    }
+
+    spice_assert(!results[0].ktls && !results[1].ktls);
+    spice_assert(results[1].records < results[0].records);
+    spice_assert(results[1].wire_bytes < results[0].wire_bytes);
+    SSL_CTX_free(server_ctx);
+
+#ifdef SSL_OP_ENABLE_KTLS
+    server_ctx = server_ctx_new();
+    SSL_CTX_set_options(server_ctx, SSL_OP_ENABLE_KTLS);
+    run_test(server_ctx, client_ctx, true, &results[0]);
+    if (g_test_perf()) {
+        printf("kernel TLS %s:  %" G_GUINT64_FORMAT " records, %" G_GUINT64_FORMAT " bytes\n",
+               results[0].ktls ? "enabled" : "fallback",
+               results[0].records, results[0].wire_bytes);
+    }
+    SSL_CTX_free(server_ctx);
+#endif
+
+    SSL_CTX_free(client_ctx);
+
+    return 0;
+}
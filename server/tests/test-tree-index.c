@@ -0,0 +1,287 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 the SPICE authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Replays a trace of drawing rectangles on a ring of tree items, looking for
+ * the items overlapping each new one by walking the whole ring and through
+ * the TreeIndex. Checks that both give the same items in the same order.
+ * Run with -m perf, longer traces are used and the time spent by each is
+ * printed.
+ *
+ * Without arguments, traces similar to a terminal, an IDE and a browser are
+ * generated. A trace file can be given instead, with a "left top right
+ * bottom" rectangle per line, for instance the bounding boxes of the draw
+ * commands of a spice-server-replay record.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <glib.h>
+
+#include <common/log.h>
+#include "tree.h"
+#include "utils.h"
+
+#define SURFACE_WIDTH 1920
+#define SURFACE_HEIGHT 1080
+/* drawables pending in the tree before being rendered */
+#define MAX_ITEMS 1000
+/* long enough for the oldest items to be removed */
+#define TRACE_LENGTH 3000
+#define PERF_TRACE_LENGTH 50000
+
+typedef struct TestItem {
+    TreeItem base;
+    RingItem age_link;
+} TestItem;
+
+typedef struct TestTree {
+    Ring ring;
+    Ring age;
+    uint32_t n_items;
+    TreeIndex *index;
+} TestTree;
+
+static void test_tree_init(TestTree *tree)
+{
+    ring_init(&tree->ring);
+    ring_init(&tree->age);
+    tree->n_items = 0;
+    tree->index = tree_index_new(&tree->ring, SURFACE_WIDTH, SURFACE_HEIGHT);
+}
+
+static void test_tree_remove_oldest(TestTree *tree)
+{
+    TestItem *item = SPICE_CONTAINEROF(ring_get_tail(&tree->age), TestItem, age_link);
+
+    tree_index_remove(&item->base);
+    ring_remove(&item->base.siblings_link);
+    ring_remove(&item->age_link);
+    region_destroy(&item->base.rgn);
+    g_free(item);
+    tree->n_items--;
+}
+
+static void test_tree_add(TestTree *tree, const SpiceRect *rect)
+{
+    TestItem *item = g_new0(TestItem, 1);
+
+    item->base.type = TREE_ITEM_TYPE_DRAWABLE;
+    region_init(&item->base.rgn);
+    region_add(&item->base.rgn, rect);
+    ring_item_init(&item->base.siblings_link);
+    ring_add(&tree->ring, &item->base.siblings_link);
+    ring_add(&tree->age, &item->age_link);
+    tree_index_add(tree->index, &item->base);
+    if (++tree->n_items > MAX_ITEMS) {
+        test_tree_remove_oldest(tree);
+    }
+}
+
+static void test_tree_destroy(TestTree *tree)
+{
+    while (tree->n_items) {
+        test_tree_remove_oldest(tree);
+    }
+    tree_index_free(tree->index);
+}
+
+static uint32_t query_linear(TestTree *tree, QRegion *rgn, TreeItem **found)
+{
+    RingItem *now;
+    uint32_t n = 0;
+
+    RING_FOREACH(now, &tree->ring) {
+        TreeItem *item = SPICE_CONTAINEROF(now, TreeItem, siblings_link);
+        if (region_bounds_intersects(rgn, &item->rgn)) {
+            found[n++] = item;
+        }
+    }
+    return n;
+}
+
+static uint32_t query_indexed(TestTree *tree, QRegion *rgn, TreeItem **found)
+{
+    TreeItem *item = NULL;
+    uint32_t n = 0;
+
+    while ((item = tree_index_next(tree->index, item, &rgn->extents))) {
+        if (region_bounds_intersects(rgn, &item->rgn)) {
+            found[n++] = item;
+        }
+    }
+    return n;
+}
+
+static void run_trace(const char *name, const SpiceRect *rects, uint32_t n_rects)
+{
+    TreeItem *linear_found[MAX_ITEMS + 1], *indexed_found[MAX_ITEMS + 1];
+    red_time_t linear_time = 0, indexed_time = 0;
+    uint64_t n_found = 0;
+    TestTree tree;
+    uint32_t i;
+
+    test_tree_init(&tree);
+    for (i = 0; i < n_rects; i++) {
+        QRegion rgn;
+        red_time_t start;
+        uint32_t n_linear, n_indexed;
+
+        region_init(&rgn);
+        region_add(&rgn, &rects[i]);
+
+        start = spice_get_monotonic_time_ns();
+        n_linear = query_linear(&tree, &rgn, linear_found);
+        linear_time += spice_get_monotonic_time_ns() - start;
+
+        start = spice_get_monotonic_time_ns();
+        n_indexed = query_indexed(&tree, &rgn, indexed_found);
+        indexed_time += spice_get_monotonic_time_ns() - start;
+
+        spice_assert(n_linear == n_indexed);
+        spice_assert(memcmp(linear_found, indexed_found, n_linear * sizeof(TreeItem *)) == 0);
+        n_found += n_linear;
+
+        region_destroy(&rgn);
+        test_tree_add(&tree, &rects[i]);
+    }
+    test_tree_destroy(&tree);
+
+    if (g_test_perf()) {
+        printf("%-10s %6u rects, %5.1f overlaps/rect: linear %8.2f ms, indexed %8.2f ms (x%.1f)\n",
+               name, n_rects, (double)n_found / n_rects,
+               linear_time / 1e6, indexed_time / 1e6,
+               indexed_time ? (double)linear_time / indexed_time : 0.0);
+    }
+}
+
+static void set_rect(SpiceRect *rect, int32_t left, int32_t top, int32_t width, int32_t height)
+{
+    rect->left = CLAMP(left, 0, SURFACE_WIDTH - 1);
+    rect->top = CLAMP(top, 0, SURFACE_HEIGHT - 1);
+    rect->right = CLAMP(left + width, rect->left + 1, SURFACE_WIDTH);
+    rect->bottom = CLAMP(top + height, rect->top + 1, SURFACE_HEIGHT);
+}
+
+/* glyph runs on 8x16 character cells, a full line from time to time */
+static void generate_terminal(GRand *rand, SpiceRect *rects, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        int32_t row = g_rand_int_range(rand, 0, SURFACE_HEIGHT / 16);
+        int32_t col = g_rand_int_range(rand, 0, SURFACE_WIDTH / 8);
+
+        if (g_rand_int_range(rand, 0, 20) == 0) {
+            set_rect(&rects[i], 0, row * 16, SURFACE_WIDTH, 16);
+        } else {
+            set_rect(&rects[i], col * 8, row * 16, g_rand_int_range(rand, 1, 12) * 8, 16);
+        }
+    }
+}
+
+/* small text and icons in a few panels, some panel repaints */
+static void generate_ide(GRand *rand, SpiceRect *rects, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        int32_t panel = g_rand_int_range(rand, 0, 3);
+        int32_t left = panel == 0 ? 0 : panel == 1 ? 300 : 1500;
+        int32_t width = panel == 0 ? 300 : panel == 1 ? 1200 : 420;
+
+        if (g_rand_int_range(rand, 0, 100) == 0) {
+            set_rect(&rects[i], left, 40, width, SURFACE_HEIGHT - 40);
+        } else {
+            set_rect(&rects[i], left + g_rand_int_range(rand, 0, width),
+                     g_rand_int_range(rand, 40, SURFACE_HEIGHT),
+                     g_rand_int_range(rand, 8, 200), g_rand_int_range(rand, 14, 24));
+        }
+    }
+}
+
+/* page elements of various sizes, scrolled images */
+static void generate_browser(GRand *rand, SpiceRect *rects, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        if (g_rand_int_range(rand, 0, 10) == 0) {
+            set_rect(&rects[i], g_rand_int_range(rand, 0, SURFACE_WIDTH - 600),
+                     g_rand_int_range(rand, 100, SURFACE_HEIGHT - 400),
+                     g_rand_int_range(rand, 200, 600), g_rand_int_range(rand, 100, 400));
+        } else {
+            set_rect(&rects[i], g_rand_int_range(rand, 0, SURFACE_WIDTH),
+                     g_rand_int_range(rand, 100, SURFACE_HEIGHT),
+                     g_rand_int_range(rand, 10, 300), g_rand_int_range(rand, 10, 60));
+        }
+    }
+}
+
+static SpiceRect *load_trace(const char *filename, uint32_t *n_rects)
+{
+    GArray *rects = g_array_new(FALSE, FALSE, sizeof(SpiceRect));
+    SpiceRect rect;
+    FILE *f;
+
+    f = fopen(filename, "r");
+    if (!f) {
+        spice_error("cannot open %s", filename);
+    }
+    while (fscanf(f, "%d %d %d %d", &rect.left, &rect.top, &rect.right, &rect.bottom) == 4) {
+        if (rect.right > rect.left && rect.bottom > rect.top) {
+            g_array_append_val(rects, rect);
+        }
+    }
+    fclose(f);
+    *n_rects = rects->len;
+    return (SpiceRect *)g_array_free(rects, FALSE);
+}
+
+int main(int argc, char *argv[])
+{
+    SpiceRect *rects;
+    GRand *rand;
+    uint32_t trace_length;
+
+    g_test_init(&argc, &argv, NULL);
+    if (argc > 1) {
+        uint32_t n_rects;
+
+        rects = load_trace(argv[1], &n_rects);
+        run_trace("trace", rects, n_rects);
+        g_free(rects);
+        return 0;
+    }
+
+    trace_length = g_test_perf() ? PERF_TRACE_LENGTH : TRACE_LENGTH;
+    rects = g_new(SpiceRect, trace_length);
+    rand = g_rand_new_with_seed(42);
+
+    generate_terminal(rand, rects, trace_length);
+    run_trace("terminal", rects, trace_length);
+    generate_ide(rand, rects, trace_length);
+    run_trace("ide", rects, trace_length);
+    generate_browser(rand, rects, trace_length);
+    run_trace("browser", rects, trace_length);
+
+    g_rand_free(rand);
+    g_free(rects);
+    return 0;
+}
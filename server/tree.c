@@ -199,6 +199,7 @@ Shadow* shadow_new(DrawItem *item, const SpicePoint *delta)
 
     shadow->base.type = TREE_ITEM_TYPE_SHADOW;
     shadow->base.container = NULL;
+    shadow->base.index_entry = NULL;
     region_clone(&shadow->base.rgn, &item->base.rgn);
     region_offset(&shadow->base.rgn, delta->x, delta->y);
     ring_item_init(&shadow->base.siblings_link);
@@ -219,6 +220,8 @@ Container* container_new(DrawItem *item)
 
     container->base.type = TREE_ITEM_TYPE_CONTAINER;
     container->base.container = item->base.container;
+    container->base.index_entry = NULL;
+    tree_index_move(&item->base, &container->base);
     item->base.container = container;
     item->container_root = TRUE;
     region_clone(&container->base.rgn, &item->base.rgn);
@@ -235,6 +238,7 @@ void container_free(Container *container)
 {
     spice_return_if_fail(ring_is_empty(&container->items));
 
+    tree_index_remove(&container->base);
     ring_remove(&container->base.siblings_link);
     region_destroy(&container->base.rgn);
     free(container);
@@ -253,6 +257,7 @@ void container_cleanup(Container *container)
             ring_remove(&item->siblings_link);
             ring_add_after(&item->siblings_link, &container->base.siblings_link);
             item->container = container->base.container;
+            tree_index_move(&container->base, item);
         }
         container_free(container);
         container = next;
@@ -305,8 +310,191 @@ void draw_item_remove_shadow(DrawItem *item)
     }
     shadow = item->shadow;
     item->shadow = NULL;
+    tree_index_remove(&shadow->base);
     ring_remove(&shadow->base.siblings_link);
     region_destroy(&shadow->base.rgn);
     region_destroy(&shadow->on_hold);
     free(shadow);
 }
+
+/* larger queries walk the ring, most of the items would be visited anyway */
+#define TREE_INDEX_MAX_QUERY_CELLS 32
+
+typedef struct TreeIndexLink {
+    RingItem link;
+    TreeIndexEntry *entry;
+} TreeIndexLink;
+
+struct TreeIndexEntry {
+    TreeItem *item;
+    /* position in the ring, higher is closer to the head */
+    uint64_t seq;
+    uint8_t x1, y1, x2, y2;
+    /* one per cell, row by row */
+    TreeIndexLink links[0];
+};
+
+TreeIndex *tree_index_new(Ring *ring, uint32_t width, uint32_t height)
+{
+    TreeIndex *index = g_new(TreeIndex, 1);
+    int i;
+
+    index->ring = ring;
+    index->cell_width = MAX((width + TREE_INDEX_GRID_SIZE - 1) / TREE_INDEX_GRID_SIZE, 1);
+    index->cell_height = MAX((height + TREE_INDEX_GRID_SIZE - 1) / TREE_INDEX_GRID_SIZE, 1);
+    index->last_seq = 0;
+    for (i = 0; i < TREE_INDEX_GRID_SIZE * TREE_INDEX_GRID_SIZE; i++) {
+        ring_init(&index->cells[i]);
+    }
+    return index;
+}
+
+void tree_index_free(TreeIndex *index)
+{
+    int i;
+
+    if (!index) {
+        return;
+    }
+    for (i = 0; i < TREE_INDEX_GRID_SIZE * TREE_INDEX_GRID_SIZE; i++) {
+        RingItem *link;
+
+        while ((link = ring_get_head(&index->cells[i]))) {
+            tree_index_remove(SPICE_CONTAINEROF(link, TreeIndexLink, link)->entry->item);
+        }
+    }
+    g_free(index);
+}
+
+/* the cells covered by @box, FALSE if it is empty */
+static bool tree_index_get_cells(const TreeIndex *index, const pixman_box32_t *box,
+                                 int *x1, int *y1, int *x2, int *y2)
+{
+    if (box->x2 <= box->x1 || box->y2 <= box->y1) {
+        return FALSE;
+    }
+    *x1 = CLAMP(box->x1 / (int32_t)index->cell_width, 0, TREE_INDEX_GRID_SIZE - 1);
+    *y1 = CLAMP(box->y1 / (int32_t)index->cell_height, 0, TREE_INDEX_GRID_SIZE - 1);
+    *x2 = CLAMP((box->x2 - 1) / (int32_t)index->cell_width, 0, TREE_INDEX_GRID_SIZE - 1);
+    *y2 = CLAMP((box->y2 - 1) / (int32_t)index->cell_height, 0, TREE_INDEX_GRID_SIZE - 1);
+    return TRUE;
+}
+
+static inline TreeIndexLink *tree_index_entry_get_link(TreeIndexEntry *entry, int x, int y)
+{
+    if (x < entry->x1 || x > entry->x2 || y < entry->y1 || y > entry->y2) {
+        return NULL;
+    }
+    return &entry->links[(y - entry->y1) * (entry->x2 - entry->x1 + 1) + x - entry->x1];
+}
+
+void tree_index_add(TreeIndex *index, TreeItem *item)
+{
+    TreeIndexEntry *entry;
+    int x1, y1, x2, y2, x, y, n;
+
+    spice_return_if_fail(item->index_entry == NULL);
+
+    if (!tree_index_get_cells(index, &item->rgn.extents, &x1, &y1, &x2, &y2)) {
+        /* keep the item in the ring order, in a single cell */
+        x1 = x2 = y1 = y2 = 0;
+    }
+    n = (x2 - x1 + 1) * (y2 - y1 + 1);
+    entry = g_malloc(sizeof(TreeIndexEntry) + n * sizeof(TreeIndexLink));
+    entry->item = item;
+    entry->seq = ++index->last_seq;
+    entry->x1 = x1;
+    entry->y1 = y1;
+    entry->x2 = x2;
+    entry->y2 = y2;
+    for (y = y1; y <= y2; y++) {
+        for (x = x1; x <= x2; x++) {
+            TreeIndexLink *link = tree_index_entry_get_link(entry, x, y);
+
+            link->entry = entry;
+            ring_item_init(&link->link);
+            ring_add(&index->cells[y * TREE_INDEX_GRID_SIZE + x], &link->link);
+        }
+    }
+    item->index_entry = entry;
+}
+
+void tree_index_remove(TreeItem *item)
+{
+    TreeIndexEntry *entry = item->index_entry;
+    int i, n;
+
+    if (!entry) {
+        return;
+    }
+    n = (entry->x2 - entry->x1 + 1) * (entry->y2 - entry->y1 + 1);
+    for (i = 0; i < n; i++) {
+        ring_remove(&entry->links[i].link);
+    }
+    g_free(entry);
+    item->index_entry = NULL;
+}
+
+void tree_index_move(TreeItem *from, TreeItem *to)
+{
+    TreeIndexEntry *entry = from->index_entry;
+
+    if (!entry) {
+        return;
+    }
+    spice_return_if_fail(to->index_entry == NULL);
+    entry->item = to;
+    to->index_entry = entry;
+    from->index_entry = NULL;
+}
+
+TreeItem *tree_index_next(TreeIndex *index, TreeItem *pos, const pixman_box32_t *box)
+{
+    TreeIndexEntry *pos_entry = NULL;
+    TreeIndexEntry *best = NULL;
+    uint64_t pos_seq = UINT64_MAX;
+    int x1, y1, x2, y2, x, y;
+
+    if (pos) {
+        pos_entry = pos->index_entry;
+        if (!pos_entry) {
+            goto walk_ring;
+        }
+        pos_seq = pos_entry->seq;
+    }
+    if (!tree_index_get_cells(index, box, &x1, &y1, &x2, &y2)) {
+        return NULL;
+    }
+    if ((x2 - x1 + 1) * (y2 - y1 + 1) > TREE_INDEX_MAX_QUERY_CELLS) {
+        goto walk_ring;
+    }
+
+    for (y = y1; y <= y2; y++) {
+        for (x = x1; x <= x2; x++) {
+            Ring *cell = &index->cells[y * TREE_INDEX_GRID_SIZE + x];
+            TreeIndexLink *pos_link = pos_entry ? tree_index_entry_get_link(pos_entry, x, y) : NULL;
+            RingItem *link;
+
+            /* the cell is ordered as the ring, find its first item after @pos */
+            if (pos_link) {
+                link = ring_next(cell, &pos_link->link);
+            } else {
+                link = ring_get_head(cell);
+                while (link && SPICE_CONTAINEROF(link, TreeIndexLink, link)->entry->seq >= pos_seq) {
+                    link = ring_next(cell, link);
+                }
+            }
+            if (link) {
+                TreeIndexEntry *entry = SPICE_CONTAINEROF(link, TreeIndexLink, link)->entry;
+                if (!best || entry->seq > best->seq) {
+                    best = entry;
+                }
+            }
+        }
+    }
+    return best ? best->item : NULL;
+
+walk_ring:
+    SPICE_VERIFY(SPICE_OFFSETOF(TreeItem, siblings_link) == 0);
+    return (TreeItem *)ring_next(index->ring, pos ? &pos->siblings_link : index->ring);
+}
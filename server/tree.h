@@ -38,6 +38,8 @@ typedef struct TreeItem TreeItem;
 typedef struct Shadow Shadow;
 typedef struct Container Container;
 typedef struct DrawItem DrawItem;
+typedef struct TreeIndex TreeIndex;
+typedef struct TreeIndexEntry TreeIndexEntry;
 
 /* TODO consider GNode instead */
 struct TreeItem {
@@ -48,6 +50,8 @@ struct TreeItem {
      * tree, this region may be modified to exclude the portion of the item
      * that is obscured by other items */
     QRegion rgn;
+    /* set for the items of the ring indexed by a TreeIndex */
+    TreeIndexEntry *index_entry;
 };
 
 /* A region "below" a copy, or the src region of the copy */
@@ -91,6 +95,35 @@ Shadow*    tree_item_find_shadow                    (TreeItem *item);
 bool       tree_item_contained_by                   (TreeItem *item, Ring *ring);
 Ring*      tree_item_container_items                (TreeItem *item, Ring *ring);
 
+/* Uniform grid over a surface listing the items of its top level ring in
+ * each cell they cover, so that looking for the items overlapping a small
+ * area does not visit the whole ring. The ring order is kept: the items are
+ * only added at the head of the ring, or take the place of another item
+ * with tree_index_move(). The cells covered by an item are the ones of its
+ * region when it was added, regions only shrink in the tree. */
+#define TREE_INDEX_GRID_SIZE 16
+
+struct TreeIndex {
+    Ring *ring;
+    uint32_t cell_width;
+    uint32_t cell_height;
+    uint64_t last_seq;
+    Ring cells[TREE_INDEX_GRID_SIZE * TREE_INDEX_GRID_SIZE];
+};
+
+TreeIndex* tree_index_new                           (Ring *ring, uint32_t width, uint32_t height);
+void       tree_index_free                          (TreeIndex *index);
+/* @item was just added at the head of the indexed ring */
+void       tree_index_add                           (TreeIndex *index, TreeItem *item);
+void       tree_index_remove                        (TreeItem *item);
+/* @to takes the place of @from in the ring, @to region must be within the
+ * region of @from */
+void       tree_index_move                          (TreeItem *from, TreeItem *to);
+/* next item after @pos (NULL for the head) in the ring that may intersect
+ * @box, NULL if there are none */
+TreeItem*  tree_index_next                          (TreeIndex *index, TreeItem *pos,
+                                                     const pixman_box32_t *box);
+
 void       draw_item_remove_shadow                  (DrawItem *item);
 Shadow*    shadow_new                               (DrawItem *item, const SpicePoint *delta);
 Container* container_new                            (DrawItem *item);
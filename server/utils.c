@@ -21,8 +21,41 @@
 #include <glib.h>
 #include "utils.h"
 
-int rgb32_data_has_alpha(int width, int height, size_t stride,
-                         uint8_t *data, int *all_set_out)
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+static SimdLevel simd_max_level = SIMD_LEVEL_AVX2;
+static gint simd_supported_level = -1;
+
+SimdLevel simd_get_level(void)
+{
+    gint level = g_atomic_int_get(&simd_supported_level);
+
+    if (level < 0) {
+        level = SIMD_LEVEL_NONE;
+#ifdef SIMD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            level = SIMD_LEVEL_AVX2;
+        } else if (__builtin_cpu_supports("ssse3")) {
+            level = SIMD_LEVEL_SSSE3;
+        } else if (__builtin_cpu_supports("sse2")) {
+            level = SIMD_LEVEL_SSE2;
+        }
+#endif
+        g_atomic_int_set(&simd_supported_level, level);
+    }
+    return MIN((SimdLevel)level, simd_max_level);
+}
+
+void simd_set_max_level(SimdLevel level)
+{
+    simd_max_level = level;
+}
+
+static int rgb32_data_has_alpha_scalar(int width, int height, size_t stride,
+                                       uint8_t *data, int *all_set_out)
 {
     uint32_t *line, *end, alpha;
     int has_alpha;
@@ -48,3 +81,112 @@ int rgb32_data_has_alpha(int width, int height, size_t stride,
     *all_set_out = has_alpha;
     return has_alpha;
 }
+
+#ifdef SIMD_X86
+/*
+ * The vector versions check a whole line before returning, which gives the
+ * same result as the scalar version: a partial alpha anywhere means TRUE
+ * with *all_set_out FALSE.
+ */
+__attribute__((target("sse2")))
+static int rgb32_data_has_alpha_sse2(int width, int height, size_t stride,
+                                     uint8_t *data, int *all_set_out)
+{
+    const __m128i alpha_mask = _mm_set1_epi32(0xff000000U);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i any = zero;
+    int has_alpha;
+
+    while (height-- > 0) {
+        const uint8_t *line = data;
+        /* lanes with no or full alpha */
+        __m128i ok = _mm_cmpeq_epi32(zero, zero);
+        uint32_t tail_any = 0, tail_partial = 0;
+        int x;
+
+        for (x = 0; x + 4 <= width; x += 4) {
+            __m128i alpha = _mm_and_si128(_mm_loadu_si128((const __m128i *)(line + x * 4)),
+                                          alpha_mask);
+            any = _mm_or_si128(any, alpha);
+            ok = _mm_and_si128(ok, _mm_or_si128(_mm_cmpeq_epi32(alpha, zero),
+                                                _mm_cmpeq_epi32(alpha, alpha_mask)));
+        }
+        for (; x < width; x++) {
+            uint32_t alpha = ((const uint32_t *)line)[x] & 0xff000000U;
+            tail_any |= alpha;
+            tail_partial |= alpha != 0 && alpha != 0xff000000U;
+        }
+        if (_mm_movemask_epi8(ok) != 0xffff || tail_partial) {
+            *all_set_out = FALSE;
+            return TRUE;
+        }
+        if (tail_any) {
+            any = _mm_or_si128(any, alpha_mask);
+        }
+        data += stride;
+    }
+
+    has_alpha = _mm_movemask_epi8(_mm_cmpeq_epi32(any, zero)) != 0xffff;
+    *all_set_out = has_alpha;
+    return has_alpha;
+}
+
+__attribute__((target("avx2")))
+static int rgb32_data_has_alpha_avx2(int width, int height, size_t stride,
+                                     uint8_t *data, int *all_set_out)
+{
+    const __m256i alpha_mask = _mm256_set1_epi32(0xff000000U);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i any = zero;
+    int has_alpha;
+
+    while (height-- > 0) {
+        const uint8_t *line = data;
+        __m256i ok = _mm256_cmpeq_epi32(zero, zero);
+        uint32_t tail_any = 0, tail_partial = 0;
+        int x;
+
+        for (x = 0; x + 8 <= width; x += 8) {
+            __m256i alpha = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(line + x * 4)),
+                                             alpha_mask);
+            any = _mm256_or_si256(any, alpha);
+            ok = _mm256_and_si256(ok, _mm256_or_si256(_mm256_cmpeq_epi32(alpha, zero),
+                                                      _mm256_cmpeq_epi32(alpha, alpha_mask)));
+        }
+        for (; x < width; x++) {
+            uint32_t alpha = ((const uint32_t *)line)[x] & 0xff000000U;
+            tail_any |= alpha;
+            tail_partial |= alpha != 0 && alpha != 0xff000000U;
+        }
+        if (_mm256_movemask_epi8(ok) != -1 || tail_partial) {
+            *all_set_out = FALSE;
+            return TRUE;
+        }
+        if (tail_any) {
+            any = _mm256_or_si256(any, alpha_mask);
+        }
+        data += stride;
+    }
+
+    has_alpha = _mm256_movemask_epi8(_mm256_cmpeq_epi32(any, zero)) != -1;
+    *all_set_out = has_alpha;
+    return has_alpha;
+}
+#endif
+
+int rgb32_data_has_alpha(int width, int height, size_t stride,
+                         uint8_t *data, int *all_set_out)
+{
+#ifdef SIMD_X86
+    switch (simd_get_level()) {
+    case SIMD_LEVEL_AVX2:
+        return rgb32_data_has_alpha_avx2(width, height, stride, data, all_set_out);
+    case SIMD_LEVEL_SSSE3:
+    case SIMD_LEVEL_SSE2:
+        return rgb32_data_has_alpha_sse2(width, height, stride, data, all_set_out);
+    default:
+        break;
+    }
+#endif
+    return rgb32_data_has_alpha_scalar(width, height, stride, data, all_set_out);
+}
@@ -54,6 +54,7 @@ typedef int64_t red_time_t;
 
 #define NSEC_PER_SEC      1000000000LL
 #define NSEC_PER_MILLISEC 1000000LL
+#define NSEC_PER_MICROSEC 1000LL
 
 /* FIXME: consider g_get_monotonic_time (), but in microseconds */
 static inline red_time_t spice_get_monotonic_time_ns(void)
@@ -71,6 +72,24 @@ static inline red_time_t spice_get_monotonic_time_ms(void)
     return g_get_monotonic_time() / 1000;
 }
 
+/* the x86 vector instructions can be used, functions using them are
+ * compiled with a target attribute and selected at runtime */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SIMD_X86 1
+#endif
+
+typedef enum {
+    SIMD_LEVEL_NONE,
+    SIMD_LEVEL_SSE2,
+    SIMD_LEVEL_SSSE3,
+    SIMD_LEVEL_AVX2,
+} SimdLevel;
+
+/* the best vector instructions supported by the CPU, up to the maximum */
+SimdLevel simd_get_level(void);
+/* limits the vector instructions used, to compare them in the tests */
+void simd_set_max_level(SimdLevel level);
+
 int rgb32_data_has_alpha(int width, int height, size_t stride,
                          uint8_t *data, int *all_set_out);
 
@@ -46,6 +46,7 @@ enum {
     VIDEO_ENCODER_FRAME_UNSUPPORTED = -1,
     VIDEO_ENCODER_FRAME_DROP,
     VIDEO_ENCODER_FRAME_ENCODE_DONE,
+    VIDEO_ENCODER_FRAME_ENCODE_PENDING,
 };
 
 typedef struct VideoEncoderStats {
@@ -76,6 +77,11 @@ struct VideoEncoder {
      *     VIDEO_ENCODER_FRAME_UNSUPPORTED if the frame cannot be encoded.
      *     VIDEO_ENCODER_FRAME_DROP if the frame was dropped. This value can
      *                              only happen if rate control is active.
+     *     VIDEO_ENCODER_FRAME_ENCODE_PENDING if the frame is being encoded
+     *                              asynchronously, outbuf is not set and
+     *                              the compressed frame will be given to the
+     *                              frame_encoded() callback. This value can
+     *                              only happen if that callback is set.
      */
     int (*encode_frame)(VideoEncoder *encoder, uint32_t frame_mm_time,
                         const SpiceBitmap *bitmap,
@@ -138,6 +144,16 @@ struct VideoEncoder {
      */
     void (*get_stats)(VideoEncoder *encoder, VideoEncoderStats *stats);
 
+    /* Gives the frames compressed asynchronously since the last call to the
+     * frame_encoded() callback. This should be called from the main context
+     * after the wakeup() callback. NULL if the encoder only encodes
+     * synchronously.
+     *
+     * @encoder:    The video encoder.
+     * @return:     The number of frames given to frame_encoded().
+     */
+    int (*pull_encoded_frames)(VideoEncoder *encoder);
+
     /* The codec being used by the video encoder */
     SpiceVideoCodecType codec_type;
 };
@@ -145,7 +161,7 @@ struct VideoEncoder {
 
 /* When rate control is active the video encoder can use these callbacks to
  * figure out how to adjust the stream bit rate and adjust some stream
- * parameters.
+ * parameters. They also hand over the frames encoded asynchronously.
  */
 typedef struct VideoEncoderRateControlCbs {
     /* The opaque parameter for the callbacks */
@@ -167,6 +183,23 @@ typedef struct VideoEncoderRateControlCbs {
      *              frames to reach the client.
      */
     void (*update_client_playback_delay)(void *opaque, uint32_t delay_ms);
+
+    /* Optional, lets the encoder compress the frames asynchronously, see
+     * VIDEO_ENCODER_FRAME_ENCODE_PENDING. Called from pull_encoded_frames()
+     * with each compressed frame, in order.
+     *
+     * @frame_mm_time: The mm_time given to encode_frame().
+     * @bitmap_opaque: The bitmap_opaque given to encode_frame(), it is
+     *                 referenced until this callback returns.
+     * @buffer:        The compressed frame, the callback owns it.
+     */
+    void (*frame_encoded)(void *opaque, uint32_t frame_mm_time,
+                          gpointer bitmap_opaque, VideoBuffer *buffer);
+
+    /* Needed with frame_encoded(), tells that pull_encoded_frames() has
+     * frames to give. This is called from the encoder threads.
+     */
+    void (*wakeup)(void *opaque);
 } VideoEncoderRateControlCbs;
 
 typedef void (*bitmap_ref_t)(gpointer data);